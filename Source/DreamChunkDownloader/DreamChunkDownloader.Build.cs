@@ -42,6 +42,7 @@ public class DreamChunkDownloader : ModuleRules
 				"Slate",
 				"SlateCore",
 				"HTTP",
+				"Sockets",
 				"Json",
 				"JsonUtilities",
 				"DeveloperSettings",
@@ -57,6 +58,20 @@ public class DreamChunkDownloader : ModuleRules
 			}
 		);
 
+		// streaming decompression of gzip pak variants
+		AddEngineThirdPartyPrivateStaticDependencies(Target, "zlib");
+
+		// libcurl multi download transport
+		if (Target.Platform == UnrealTargetPlatform.Linux)
+		{
+			AddEngineThirdPartyPrivateStaticDependencies(Target, "libcurl");
+			PublicDefinitions.Add("DCD_WITH_CURL_MULTI=1");
+		}
+		else
+		{
+			PublicDefinitions.Add("DCD_WITH_CURL_MULTI=0");
+		}
+
 		if (Target.Type == TargetType.Editor)
 		{
 			PrivateDependencyModuleNames.Add(
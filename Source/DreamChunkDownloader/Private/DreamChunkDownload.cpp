@@ -3,14 +3,50 @@
 
 #include "DreamChunkDownload.h"
 
+#include "DreamChunkDownloaderConcurrencyController.h"
+#include "DreamChunkDownloaderDeltaPatch.h"
+#include "DreamChunkDownloaderDiskSpaceLedger.h"
+#include "DreamChunkDownloaderFileSink.h"
+#include "DreamChunkDownloaderHashRegistry.h"
 #include "DreamChunkDownloaderLog.h"
+#include "DreamChunkDownloaderPakVerifyWork.h"
+#include "DreamChunkDownloaderRetryPolicy.h"
+#include "DreamChunkDownloaderSettings.h"
+#include "DreamChunkDownloaderStreamDecoder.h"
+#include "DreamChunkDownloaderTokenBucket.h"
 #include "DreamChunkDownloaderUtils.h"
+#include "Async/Async.h"
+#include "Dom/JsonObject.h"
 #include "HAL/FileManager.h"
 #include "HAL/PlatformFile.h"
+#include "HAL/PlatformTime.h"
+#include "HttpModule.h"
+#include "Interfaces/IHttpRequest.h"
 #include "Interfaces/IHttpResponse.h"
+#include "Misc/Paths.h"
+#include "Serialization/JsonReader.h"
+#include "Serialization/JsonSerializer.h"
 
 #define LOCTEXT_NAMESPACE "ChunkDownloader"
 
+/** Number of times a corrupt file is repaired block by block before it is downloaded again */
+static const int32 MAX_REPAIR_ATTEMPTS = 2;
+
+/** Number of times assembling a pak from content chunks may fail before it is downloaded whole */
+static const int32 MAX_CONTENT_CHUNK_ASSEMBLY_FAILURES = 2;
+
+/** Smallest remainder of a segment that is worth a hedged request */
+static const int64 MIN_HEDGE_BYTES = 256 * 1024;
+
+/** Progress after which the segment table is saved again while requests are in flight */
+static const uint64 SEGMENT_PROGRESS_SAVE_BYTES = 16 * 1024 * 1024;
+
+/** Seconds of bandwidth a segment request fetches while a bandwidth limit is set */
+static const double BANDWIDTH_SLICE_SECONDS = 2.0;
+
+/** Smallest segment request while a bandwidth limit is set */
+static const int64 MIN_BANDWIDTH_SLICE_BYTES = 64 * 1024;
+
 FDreamChunkDownload::FDreamChunkDownload(const TWeakObjectPtr<UDreamChunkDownloaderSubsystem>& DownloaderIn, const TSharedRef<FDreamPakFile>& PakFileIn)
 	: Downloader(DownloaderIn)
 	  , PakFile(PakFileIn)
@@ -20,6 +56,19 @@ FDreamChunkDownload::FDreamChunkDownload(const TWeakObjectPtr<UDreamChunkDownloa
 	check(!PakFile->bIsCached);
 	check(!PakFile->bIsEmbedded);
 	check(!PakFile->bIsMounted);
+
+	// hash single stream downloads while the bytes arrive
+	if (FDreamIncrementalFileHash::IsSupported(PakFile->Entry.FileVersion))
+	{
+		IncrementalHash = MakeShared<FDreamIncrementalFileHash, ESPMode::ThreadSafe>(PakFile->Entry.FileVersion);
+	}
+
+	// block hashes from the manifest allow repairing a corrupt file in place
+	if (PakFile->Entry.HasBlockHashes())
+	{
+		BlockSize = PakFile->Entry.BlockSize;
+		BlockHashes = PakFile->Entry.BlockHashes;
+	}
 }
 
 FDreamChunkDownload::~FDreamChunkDownload()
@@ -30,9 +79,11 @@ void FDreamChunkDownload::Start()
 {
 	check(!bHasCompleted);
 
-	// check to make sure we have enough space for this download
-	if (!HasDeviceSpaceRequired())
+	// the subsystem normally reserved the space when it issued the download
+	if (!bDiskSpaceReserved && !ReserveDiskSpace())
 	{
+		DCD_LOG(Warning, TEXT("Unable to download '%s'. Needed %lld bytes, %lld bytes available"),
+		        *PakFile->Entry.FileName, ReservedDiskSpace, Downloader.Get()->GetDiskSpaceLedger()->GetAvailableBytes());
 		TWeakPtr<FDreamChunkDownload> WeakThisPtr = AsShared();
 		FTSTicker::GetCoreTicker().AddTicker(FTickerDelegate::CreateLambda([WeakThisPtr](float Unused)
 		{
@@ -46,6 +97,13 @@ void FDreamChunkDownload::Start()
 		return;
 	}
 
+	// a delta patch against the previous version is much smaller than the pak
+	if (ShouldUsePatch())
+	{
+		StartPatchDownload(0);
+		return;
+	}
+
 	// try to download from the CDN
 	StartDownload(0);
 }
@@ -59,13 +117,50 @@ void FDreamChunkDownload::Cancel(bool bResult)
 	if (!bIsCancelled)
 	{
 		bIsCancelled = true;
-		CancelCallback();
+		if (CancelCallback)
+		{
+			CancelCallback();
+		}
 	}
 
 	// fire the completion results
 	OnCompleted(bResult, FText::Format(LOCTEXT("DownloadCanceled", "Download of '%s' was canceled."), FText::FromString(PakFile->Entry.FileName)));
 }
 
+bool FDreamChunkDownload::Pause()
+{
+	check(!bHasCompleted);
+
+	// verifying, patching or assembling would race the next attempt over the file
+	if (!CanPause())
+	{
+		return false;
+	}
+	DCD_LOG(Log, TEXT("Pausing download of '%s' (%lld bytes received by this attempt)"), *PakFile->Entry.FileName, LastBytesReceived);
+
+	// stop the requests, what reached the disk is picked up by the next download of this pak
+	// (the owner holds the pak back until the cancelled requests have let go of the file)
+	bIsCancelled = true;
+	bHasCompleted = true;
+	bIsPaused = true;
+	ReleaseDiskSpace();
+	if (CancelCallback)
+	{
+		CancelCallback();
+	}
+
+	// the size of a preallocated file says nothing, record how far each range got
+	if (ResumeState.Segments.Num() > 0)
+	{
+		SaveSegmentProgress();
+	}
+
+	// the bytes of this attempt are counted again once the download resumes
+	Downloader.Get()->AddBytesDownloaded(-LastBytesReceived);
+	LastBytesReceived = 0;
+	return true;
+}
+
 void FDreamChunkDownload::UpdateFileSize()
 {
 	IFileManager& FileManager = IFileManager::Get();
@@ -73,133 +168,1523 @@ void FDreamChunkDownload::UpdateFileSize()
 	PakFile->SizeOnDisk = (FileSizeOnDisk > 0) ? (uint64)FileSizeOnDisk : 0;
 }
 
-bool FDreamChunkDownload::ValidateFile() const
+void FDreamChunkDownload::StartVerification(const FString& Url, int TryNumber, bool bBlocksOnly)
+{
+	// configure the task
+	FDreamChunkDownloaderTypes::FDreamVerifyTask* VerifyTask = new FDreamChunkDownloaderTypes::FDreamVerifyTask();
+	FDreamPakVerifyWork& VerifyWork = VerifyTask->GetTask();
+	VerifyWork.Download = AsShared();
+	VerifyWork.Url = Url;
+	VerifyWork.TryNumber = TryNumber;
+	VerifyWork.TargetFile = TargetFile;
+	VerifyWork.Entry = PakFile->Entry;
+	VerifyWork.SizeOnDisk = PakFile->SizeOnDisk;
+	VerifyWork.IncrementalHash = IncrementalHash;
+	VerifyWork.MemoryBudget = Downloader.Get()->GetMemoryBudget();
+	VerifyWork.BlockSize = BlockSize;
+	VerifyWork.BlockHashes = BlockHashes;
+	VerifyWork.bBlocksOnly = bBlocksOnly;
+
+	// the subsystem starts it once a verification slot is free
+	Downloader.Get()->QueueVerifyTask(VerifyTask);
+}
+
+void FDreamChunkDownload::OnVerifyComplete(const FDreamPakVerifyWork& VerifyWork)
 {
-	if (PakFile->SizeOnDisk != PakFile->Entry.FileSize)
+	// only handle completion once
+	check(!bHasCompleted);
+
+	if (VerifyWork.bIsValid)
 	{
-		DCD_LOG(Error, TEXT("Size mismatch. Expected %llu, got %llu"), PakFile->Entry.FileSize, PakFile->SizeOnDisk);
-		return false;
+		PakFile->bIsCached = true;
+		OnCompleted(true, FText());
+		return;
+	}
+
+	// only fetch the blocks that are actually corrupt
+	if (VerifyWork.bBlocksChecked && VerifyWork.CorruptBlocks.Num() > 0 && StartRepair(VerifyWork.CorruptBlocks, VerifyWork.TryNumber))
+	{
+		return;
+	}
+
+	// the CDN may publish block hashes for this pak
+	if (!VerifyWork.bBlocksOnly && BlockHashes.Num() == 0 && !bBlockHashesRequested &&
+		PakFile->SizeOnDisk == PakFile->Entry.FileSize && UDreamChunkDownloaderSettings::Get()->bFetchBlockHashFiles)
+	{
+		FetchBlockHashes(VerifyWork.Url, VerifyWork.TryNumber);
+		return;
 	}
 
-	if (PakFile->Entry.FileVersion.StartsWith(TEXT("SHA1:")))
+	// if we fail validation, delete the file and start over
+	DCD_LOG(Error, TEXT("%s from %s failed validation"), *TargetFile, *VerifyWork.Url);
+	DiscardAndRetry(VerifyWork.TryNumber);
+}
+
+void FDreamChunkDownload::FetchBlockHashes(const FString& Url, int TryNumber)
+{
+	bBlockHashesRequested = true;
+	FString BlockHashesUrl = Url + FDreamChunkDownloaderStatics::BLOCK_HASHES_EXTENSION;
+	DCD_LOG(Log, TEXT("Fetching block hashes for %s from %s"), *PakFile->Entry.FileName, *BlockHashesUrl);
+
+	TSharedRef<IHttpRequest, ESPMode::ThreadSafe> Request = FHttpModule::Get().CreateRequest();
+	Request->SetURL(BlockHashesUrl);
+	Request->SetVerb(TEXT("GET"));
+
+	TWeakPtr<FDreamChunkDownload> WeakThisPtr = AsShared();
+	Request->OnProcessRequestComplete().BindLambda([WeakThisPtr, Url, TryNumber](FHttpRequestPtr HttpRequest, FHttpResponsePtr HttpResponse, bool bSuccess)
 	{
-		// check the sha1 hash
-		if (!FDreamChunkDownloaderUtils::CheckFileSha1Hash(TargetFile, PakFile->Entry.FileVersion))
+		TSharedPtr<FDreamChunkDownload> SharedThis = WeakThisPtr.Pin();
+		if (SharedThis.IsValid() && !SharedThis->bHasCompleted)
 		{
-			DCD_LOG(Error, TEXT("Checksum mismatch. Expected %s"), *PakFile->Entry.FileVersion);
-			return false;
+			const bool bIsOk = bSuccess && HttpResponse.IsValid() && EHttpResponseCodes::IsOk(HttpResponse->GetResponseCode());
+			SharedThis->OnBlockHashesReceived(Url, TryNumber, bIsOk ? HttpResponse->GetContentAsString() : FString());
 		}
+	});
+	Request->ProcessRequest();
+	CancelCallback = [Request]()
+	{
+		Request->CancelRequest();
+	};
+}
+
+void FDreamChunkDownload::OnBlockHashesReceived(const FString& Url, int TryNumber, const FString& JsonData)
+{
+	TSharedPtr<FJsonObject> JsonObject;
+	TSharedRef<TJsonReader<>> Reader = TJsonReaderFactory<>::Create(JsonData);
+	int64 NewBlockSize = 0;
+	TArray<FString> NewBlockHashes;
+	if (!JsonData.IsEmpty() && FJsonSerializer::Deserialize(Reader, JsonObject) &&
+		FDreamChunkDownloaderUtils::ParseBlockHashes(JsonObject, NewBlockSize, NewBlockHashes) &&
+		NewBlockHashes.Num() == FMath::DivideAndRoundUp<int64>(PakFile->Entry.FileSize, NewBlockSize))
+	{
+		// locate the corrupt blocks
+		BlockSize = NewBlockSize;
+		BlockHashes = MoveTemp(NewBlockHashes);
+		StartVerification(Url, TryNumber, true);
+		return;
+	}
+
+	DCD_LOG(Log, TEXT("No usable block hashes for %s, downloading it again"), *PakFile->Entry.FileName);
+	DiscardAndRetry(TryNumber);
+}
+
+bool FDreamChunkDownload::StartRepair(const TArray<int32>& CorruptBlocks, int TryNumber)
+{
+	if (RepairAttempts >= MAX_REPAIR_ATTEMPTS || bSegmentsUnsupported || BlockSize <= 0)
+	{
+		return false;
+	}
+	++RepairAttempts;
+
+	// mark only the corrupt ranges as missing, the rest of the file stays
+	ResumeState.ResetForRepair(PakFile->Entry.FileVersion, PakFile->Entry.FileSize, BlockSize, CorruptBlocks);
+	if (!ResumeState.Save(TargetFile))
+	{
+		ResumeState = FDreamDownloadResumeState();
+		return false;
 	}
 
+	// the running hash no longer describes the file
+	if (IncrementalHash.IsValid())
+	{
+		IncrementalHash->Invalidate();
+	}
+
+	DCD_LOG(Log, TEXT("Repairing %s: refetching %d corrupt blocks (%lld of %lld bytes)"),
+	        *PakFile->Entry.FileName, CorruptBlocks.Num(), PakFile->Entry.FileSize - ResumeState.GetReceivedBytes(), PakFile->Entry.FileSize);
+	StartDownload(TryNumber + 1);
+	return true;
+}
+
+void FDreamChunkDownload::DiscardAndRetry(int TryNumber)
+{
+	IPlatformFile::GetPlatformPhysical().DeleteFile(*TargetFile);
+	ResetSegments();
+	if (IncrementalHash.IsValid())
+	{
+		IncrementalHash->Reset();
+	}
+	ScheduleRetry(TryNumber);
+}
+
+bool FDreamChunkDownload::ReserveDiskSpace()
+{
+	ReservedDiskSpace = GetRequiredDiskSpace();
+	if (!Downloader.Get()->GetDiskSpaceLedger()->Reserve(PakFile->Entry.FileName, ReservedDiskSpace))
+	{
+		ReleaseDiskSpace();
+		return false;
+	}
+	bDiskSpaceReserved = true;
 	return true;
 }
 
-bool FDreamChunkDownload::HasDeviceSpaceRequired() const
+int64 FDreamChunkDownload::GetRequiredDiskSpace() const
+{
+	// a preallocated file already has its final size
+	const int64 SizeOnDisk = FMath::Max<int64>(IFileManager::Get().FileSize(*TargetFile), 0);
+	int64 RequiredBytes = FMath::Max<int64>(PakFile->Entry.FileSize - SizeOnDisk, 0);
+
+	// the patch or the staged content chunks sit next to the pak until it is rebuilt
+	if (ShouldUsePatch())
+	{
+		RequiredBytes += PakFile->Entry.FindPatch(PakFile->PatchBaseVersion)->FileSize;
+	}
+	else if (ShouldUseContentChunks())
+	{
+		RequiredBytes += PakFile->Entry.FileSize;
+	}
+	return RequiredBytes;
+}
+
+int64 FDreamChunkDownload::GetRequiredMemory() const
 {
-	uint64 TotalDiskSpace = 0;
-	uint64 TotalDiskFreeSpace = 0;
-	if (FPlatformMisc::GetDiskTotalAndFreeSpace(Downloader.Get()->GetCacheFolder(), TotalDiskSpace, TotalDiskFreeSpace))
+	// a streamed request makes do with the smallest write buffer, any other body is held in memory whole
+	const UDreamChunkDownloaderSettings* Settings = UDreamChunkDownloaderSettings::Get();
+	const int64 MinBufferSize = FDreamChunkDownloadFileSink::MIN_BUFFER_SIZE;
+	if (ShouldUseContentChunks())
 	{
-		uint64 BytesNeeded = PakFile->Entry.FileSize - PakFile->SizeOnDisk;
-		if (TotalDiskFreeSpace < BytesNeeded)
+		int64 RequestMemory = MinBufferSize;
+		if (!Settings->bStreamDownloadsToDisk)
 		{
-			// not enough space
-			DCD_LOG(Warning, TEXT("Unable to download '%s'. Needed %llu bytes had %llu bytes free (of %llu bytes)"),
-			        *PakFile->Entry.FileName, PakFile->Entry.FileSize, TotalDiskFreeSpace, TotalDiskSpace);
-			return false;
+			for (const FDreamContentChunk& Chunk : PakFile->Entry.ContentChunks)
+			{
+				RequestMemory = FMath::Max(RequestMemory, Chunk.Size);
+			}
 		}
+		return FMath::Max(1, Settings->MaxConcurrentContentChunkDownloads) * RequestMemory;
+	}
+	if (ShouldUsePatch())
+	{
+		return Settings->bStreamDownloadsToDisk ? MinBufferSize : PakFile->Entry.FindPatch(PakFile->PatchBaseVersion)->FileSize;
+	}
+
+	// segments and compressed variants are always streamed
+	if (ShouldUseSegments())
+	{
+		return (ShouldSplitIntoSegments() ? FMath::Clamp(Settings->SegmentsPerDownload, 2, 16) : 1) * MinBufferSize;
+	}
+	if (Settings->bStreamDownloadsToDisk || ShouldUseCompressedVariant())
+	{
+		return MinBufferSize;
+	}
+	return FMath::Max<int64>(PakFile->Entry.FileSize - FMath::Max<int64>(IFileManager::Get().FileSize(*TargetFile), 0), 0);
+}
+
+void FDreamChunkDownload::ReleaseDiskSpace()
+{
+	if (bDiskSpaceReserved)
+	{
+		Downloader.Get()->GetDiskSpaceLedger()->Release(PakFile->Entry.FileName);
+		bDiskSpaceReserved = false;
 	}
-	return true;
 }
 
 void FDreamChunkDownload::StartDownload(int TryNumber)
 {
 	// only handle completion once
 	check(!bHasCompleted);
+	if (PauseIfRequested())
+	{
+		return;
+	}
+
+	// the data of earlier requests is paid for before a new one goes out
+	if (DeferForBandwidth([this, TryNumber]() { StartDownload(TryNumber); }))
+	{
+		return;
+	}
 	BeginTime = FDateTime::UtcNow();
+	bAwaitingFirstByte = true;
 	OnDownloadProgress(0);
 
-	// download the next url
+	// only fetch the content chunks we don't hold yet
+	if (ShouldUseContentChunks())
+	{
+		StartContentChunkDownload(TryNumber);
+		return;
+	}
+
+	// large paks may be fetched as several ranges in parallel
+	if (ShouldUseSegments())
+	{
+		StartSegmentedDownload(TryNumber);
+		return;
+	}
+
+	// the running hash has to cover what's already on disk before we append to it
+	if (!PrepareIncrementalHash(TryNumber, FMath::Max<int64>(IFileManager::Get().FileSize(*TargetFile), 0)))
+	{
+		return;
+	}
+
+	// download the next url (the compressed variant is decompressed as it arrives)
 	check(Downloader.Get()->GetBuildBaseUrls().Num() > 0);
-	FString Url = Downloader.Get()->GetBuildBaseUrls()[TryNumber % Downloader.Get()->GetBuildBaseUrls().Num()] / PakFile->Entry.RelativeUrl;
+	const bool bCompressed = ShouldUseCompressedVariant();
+	const FString& RelativeUrl = bCompressed ? PakFile->Entry.CompressedRelativeUrl : PakFile->Entry.RelativeUrl;
+	AttemptHostIndex = Downloader.Get()->SelectBuildHost(TryNumber);
+	FString Url = Downloader.Get()->GetBuildBaseUrls()[AttemptHostIndex] / RelativeUrl;
 	DCD_LOG(Log, TEXT("Downloading %s from %s"), *PakFile->Entry.FileName, *Url);
+
+	// stream to disk in bounded blocks unless disabled
+	FDreamStreamDownloadOptions Options;
+	Options.bStreamToDisk = UDreamChunkDownloaderSettings::Get()->bStreamDownloadsToDisk;
+	Options.WriteBufferSize = FMath::Max(16, UDreamChunkDownloaderSettings::Get()->StreamWriteBufferSizeKB) * 1024;
+	Options.Bandwidth = Downloader.Get()->GetDownloadBandwidth();
+	Options.CompletionThread = Downloader.Get()->GetDownloaderThread();
+	Options.RetryPolicy = Downloader.Get()->GetRetryPolicy();
+	Options.MemoryBudget = Downloader.Get()->GetMemoryBudget();
+	Options.ExpectedBodySize = FMath::Max<int64>(PakFile->Entry.FileSize - FMath::Max<int64>(IFileManager::Get().FileSize(*TargetFile), 0), 0);
+	Options.IncrementalHash = IncrementalHash;
+	if (bCompressed)
+	{
+		Options.Compression = PakFile->Entry.Compression;
+	}
+
 	TWeakPtr<FDreamChunkDownload> WeakThisPtr = AsShared();
-	CancelCallback = PlatformStreamDownload(Url, TargetFile, [WeakThisPtr](int32 BytesReceived)
+	bIsTransferring = true;
+	Downloader.Get()->OnBuildHostRequestIssued(AttemptHostIndex);
+	CancelCallback = PlatformStreamDownload(Url, TargetFile, Options, [WeakThisPtr](uint64 BytesReceived)
 	                                        {
 		                                        TSharedPtr<FDreamChunkDownload> SharedThis = WeakThisPtr.Pin();
 		                                        if (SharedThis.IsValid() && !SharedThis->bHasCompleted)
 		                                        {
-			                                        SharedThis->OnDownloadProgress(BytesReceived);
+			                                        SharedThis->OnDownloadProgress((int64)BytesReceived);
 		                                        }
-	                                        }, [WeakThisPtr, TryNumber, Url](int32 HttpStatus)
+	                                        }, TrackTransfer([WeakThisPtr, TryNumber, Url, bCompressed](int32 HttpStatus)
 	                                        {
 		                                        TSharedPtr<FDreamChunkDownload> SharedThis = WeakThisPtr.Pin();
 		                                        if (SharedThis.IsValid() && !SharedThis->bHasCompleted)
 		                                        {
+			                                        SharedThis->ReportRequestResult(SharedThis->AttemptHostIndex, HttpStatus);
+			                                        if (EHttpResponseCodes::IsOk(HttpStatus))
+			                                        {
+				                                        SharedThis->Downloader.Get()->ReportHostTransfer(SharedThis->AttemptHostIndex, SharedThis->LastBytesReceived, (FDateTime::UtcNow() - SharedThis->BeginTime).GetTotalSeconds());
+			                                        }
+
+			                                        // a missing or undecodable variant isn't worth another try, fetch the plain pak instead
+			                                        if (bCompressed && HttpStatus >= 400 && HttpStatus < 500)
+			                                        {
+				                                        DCD_LOG(Warning, TEXT("Compressed variant of %s is unusable (%d), downloading the plain file"), *SharedThis->PakFile->Entry.FileName, HttpStatus);
+				                                        SharedThis->bCompressedVariantFailed = true;
+			                                        }
 			                                        SharedThis->OnDownloadComplete(Url, TryNumber, HttpStatus);
 		                                        }
-	                                        });
+	                                        }));
 }
 
-void FDreamChunkDownload::OnDownloadProgress(int32 BytesReceived)
+bool FDreamChunkDownload::ShouldUseCompressedVariant() const
 {
-	Downloader.Get()->GetStats().BytesDownloaded -= LastBytesReceived;
-	LastBytesReceived = BytesReceived;
-	Downloader.Get()->GetStats().BytesDownloaded += LastBytesReceived;
+	if (bCompressedVariantFailed || !UDreamChunkDownloaderSettings::Get()->bEnableCompressedDownloads)
+	{
+		return false;
+	}
+	return PakFile->Entry.HasCompressedVariant() && FDreamStreamDecoderRegistry::Get().IsSupported(PakFile->Entry.Compression);
 }
 
-void FDreamChunkDownload::OnDownloadComplete(const FString& Url, int TryNumber, int32 HttpStatus)
+bool FDreamChunkDownload::PrepareIncrementalHash(int TryNumber, int64 ValidLength)
 {
-	// only handle completion once
-	check(!bHasCompleted);
+	if (!IncrementalHash.IsValid())
+	{
+		return true;
+	}
 
-	// update file size on disk
-	UpdateFileSize();
+	// nothing to do if the hash is in step with the file
+	if (IncrementalHash->IsValid() && IncrementalHash->GetHashedBytes() == ValidLength)
+	{
+		return true;
+	}
 
-	// report analytics
-	if (Downloader.Get()->OnDownloadAnalytics)
+	// start over if the hash can't be continued (data was rolled back or the file changed)
+	if (!IncrementalHash->IsValid() || IncrementalHash->GetHashedBytes() > ValidLength)
 	{
-		Downloader.Get()->OnDownloadAnalytics(PakFile->Entry.FileName, Url, PakFile->SizeOnDisk, FDateTime::UtcNow() - BeginTime, HttpStatus);
+		IncrementalHash->Reset();
+	}
+	if (ValidLength == 0)
+	{
+		return true;
 	}
 
-	// handle success
-	if (EHttpResponseCodes::IsOk(HttpStatus))
+	// hash the existing prefix once, off the game thread, then issue the download
+	DCD_LOG(Verbose, TEXT("Hashing %lld bytes of %s before resuming"), ValidLength - IncrementalHash->GetHashedBytes(), *PakFile->Entry.FileName);
+	TWeakPtr<FDreamChunkDownload> WeakThisPtr = AsShared();
+	TSharedPtr<FDreamIncrementalFileHash, ESPMode::ThreadSafe> Hash = IncrementalHash;
+	FString HashFile = TargetFile;
+	Async(EAsyncExecution::ThreadPool, [WeakThisPtr, Hash, HashFile, ValidLength, TryNumber]()
 	{
-		// make sure the file is complete
-		if (ValidateFile())
+		const bool bHashed = Hash->CatchUp(HashFile, ValidLength);
+		AsyncTask(ENamedThreads::GameThread, [WeakThisPtr, bHashed, TryNumber]()
 		{
-			PakFile->bIsCached = true;
-			OnCompleted(true, FText());
-			return;
+			TSharedPtr<FDreamChunkDownload> SharedThis = WeakThisPtr.Pin();
+			if (SharedThis.IsValid() && !SharedThis->bHasCompleted && !SharedThis->bIsCancelled)
+			{
+				// don't try again if the prefix can't be read, the file is validated in full instead
+				if (!bHashed)
+				{
+					SharedThis->IncrementalHash.Reset();
+				}
+				SharedThis->StartDownload(TryNumber);
+			}
+		});
+	});
+	return false;
+}
+
+bool FDreamChunkDownload::ShouldUseSegments() const
+{
+	if (bSegmentsUnsupported)
+	{
+		return false;
+	}
+
+	// always continue a segmented download that was started earlier (possibly in a previous session)
+	if (ResumeState.Segments.Num() > 0 || FDreamDownloadResumeState::Exists(TargetFile))
+	{
+		return true;
+	}
+
+	// a single compressed stream moves fewer bytes than parallel ranges of the plain file
+	if (ShouldUseCompressedVariant())
+	{
+		return false;
+	}
+
+	// a preallocated pak is written in place, so it needs the segment table even as a single range
+	return ShouldSplitIntoSegments() || ShouldPreallocate();
+}
+
+bool FDreamChunkDownload::ShouldSplitIntoSegments() const
+{
+	const UDreamChunkDownloaderSettings* Settings = UDreamChunkDownloaderSettings::Get();
+	const int64 MinSize = (int64)FMath::Max(1, Settings->SegmentedDownloadMinSizeMB) * 1024 * 1024;
+	return Settings->bEnableSegmentedDownloads && Settings->SegmentsPerDownload > 1 && PakFile->Entry.FileSize >= MinSize;
+}
+
+bool FDreamChunkDownload::ShouldPreallocate() const
+{
+	// patches, content chunks and compressed variants write the whole pak in one pass
+	if (!UDreamChunkDownloaderSettings::Get()->bPreallocatePakFiles || bSegmentsUnsupported)
+	{
+		return false;
+	}
+	return !ShouldUseCompressedVariant() && !ShouldUsePatch() && !ShouldUseContentChunks();
+}
+
+void FDreamChunkDownload::StartSegmentedDownload(int TryNumber)
+{
+	const UDreamChunkDownloaderSettings* Settings = UDreamChunkDownloaderSettings::Get();
+
+	// pick up the segment table of an earlier attempt if it still belongs to this pak
+	if (ResumeState.Segments.Num() == 0)
+	{
+		if (!ResumeState.Load(TargetFile) ||
+			ResumeState.FileVersion != PakFile->Entry.FileVersion ||
+			ResumeState.FileSize != PakFile->Entry.FileSize)
+		{
+			// start a new table, keeping anything a single stream download already wrote
+			const int64 ValidPrefix = FMath::Clamp<int64>(IFileManager::Get().FileSize(*TargetFile), 0, PakFile->Entry.FileSize);
+			const int32 NumSegments = ShouldSplitIntoSegments() ? FMath::Clamp(Settings->SegmentsPerDownload, 2, 16) : 1;
+			ResumeState.Reset(PakFile->Entry.FileVersion, PakFile->Entry.FileSize, NumSegments, ValidPrefix);
 		}
 
-		// if we fail validation, delete the file and start over
-		DCD_LOG(Error, TEXT("%s from %s failed validation"), *TargetFile, *Url);
-		IPlatformFile::GetPlatformPhysical().DeleteFile(*TargetFile);
+		// reserve the whole file so every segment can be written in place (and a full device fails now)
+		const bool bPreallocated = FDreamChunkDownloaderUtils::PreallocateFile(TargetFile, PakFile->Entry.FileSize);
+		if (bPreallocated && bDiskSpaceReserved)
+		{
+			// the file holds the space now
+			Downloader.Get()->GetDiskSpaceLedger()->Reduce(PakFile->Entry.FileName, 0);
+		}
+		if (!bPreallocated || !ResumeState.Save(TargetFile))
+		{
+			ResetSegments();
+			FText ErrorText = LOCTEXT("NotEnoughSpace", "Not enough space on device.");
+			if (!bPreallocated)
+			{
+				ErrorText = FText::Format(LOCTEXT("PreallocationFailed", "Not enough space on device to download '{0}' ({1} required)."),
+				                          FText::FromString(PakFile->Entry.FileName), FText::AsMemory(PakFile->Entry.FileSize));
+			}
+			TWeakPtr<FDreamChunkDownload> WeakThisPtr = AsShared();
+			FTSTicker::GetCoreTicker().AddTicker(FTickerDelegate::CreateLambda([WeakThisPtr, ErrorText](float Unused)
+			{
+				TSharedPtr<FDreamChunkDownload> SharedThis = WeakThisPtr.Pin();
+				if (SharedThis.IsValid() && !SharedThis->bHasCompleted)
+				{
+					SharedThis->OnCompleted(false, ErrorText);
+				}
+				return false;
+			}), 0.0f);
+			return;
+		}
 	}
 
-	// check again to make sure we have enough space for this download
-	if (!HasDeviceSpaceRequired())
+	// a single range is written in order, so the running hash can follow it like a single stream
+	const bool bHashSegment = IncrementalHash.IsValid() && ResumeState.Segments.Num() == 1;
+	if (bHashSegment && !PrepareIncrementalHash(TryNumber, ResumeState.Segments[0].Received))
 	{
-		OnCompleted(false, LOCTEXT("NotEnoughSpace", "Not enough space on device."));
 		return;
 	}
 
-	// compute delay before re-starting download
-	float SecondsToDelay = (TryNumber + 1) * 5.0f;
-	if (SecondsToDelay > 60)
+	// issue a range request for every segment that is still missing
+	check(Downloader.Get()->GetBuildBaseUrls().Num() > 0);
+	AttemptHostIndex = Downloader.Get()->SelectBuildHost(TryNumber);
+	SegmentTryNumber = TryNumber;
+	SegmentsInFlight = 0;
+	SegmentFailureStatus = 0;
+	SegmentBytesAtLastSave = 0;
+	SegmentTransfers.Empty(ResumeState.Segments.Num());
+	SegmentTransfers.SetNum(ResumeState.Segments.Num());
+	bIsTransferring = true;
+
+	for (int32 SegmentIndex = 0; SegmentIndex < ResumeState.Segments.Num(); ++SegmentIndex)
+	{
+		if (ResumeState.Segments[SegmentIndex].IsComplete())
+		{
+			continue;
+		}
+
+		// spread the segments over the hosts so one slow mirror doesn't hold up the whole pak
+		// (each request marks its host as it goes out, so only one segment can take a host's probe)
+		const int32 HostIndex = (Settings->bSpreadSegmentsAcrossHosts && SegmentIndex > 0) ? Downloader.Get()->SelectBuildHost(TryNumber + SegmentIndex) : AttemptHostIndex;
+		++SegmentsInFlight;
+		StartSegmentRequest(SegmentIndex, HostIndex);
+	}
+
+	if (ResumeState.Segments.Num() == 1)
+	{
+		DCD_LOG(Log, TEXT("Downloading %s into a preallocated file (%lld of %lld bytes already on disk)"),
+		        *PakFile->Entry.FileName, ResumeState.GetReceivedBytes(), PakFile->Entry.FileSize);
+	}
+	else
+	{
+		DCD_LOG(Log, TEXT("Downloading %s as %d segments (%lld of %lld bytes already on disk)"),
+		        *PakFile->Entry.FileName, SegmentsInFlight, ResumeState.GetReceivedBytes(), PakFile->Entry.FileSize);
+	}
+
+	// cancelling the download cancels every segment (including hedges started later)
+	TWeakPtr<FDreamChunkDownload> WeakThisPtr = AsShared();
+	CancelCallback = [WeakThisPtr]()
+	{
+		TSharedPtr<FDreamChunkDownload> SharedThis = WeakThisPtr.Pin();
+		if (SharedThis.IsValid())
+		{
+			SharedThis->CancelSegmentRequests();
+		}
+	};
+}
+
+void FDreamChunkDownload::StartSegmentRequest(int32 SegmentIndex, int32 HostIndex)
+{
+	const UDreamChunkDownloaderSettings* Settings = UDreamChunkDownloaderSettings::Get();
+	const FDreamDownloadSegment& Segment = ResumeState.Segments[SegmentIndex];
+	FString Url = Downloader.Get()->GetBuildBaseUrls()[HostIndex] / PakFile->Entry.RelativeUrl;
+
+	FDreamStreamDownloadOptions Options;
+	Options.bStreamToDisk = true;
+	Options.WriteBufferSize = FMath::Max(16, Settings->StreamWriteBufferSizeKB) * 1024;
+	Options.Bandwidth = Downloader.Get()->GetDownloadBandwidth();
+	Options.CompletionThread = Downloader.Get()->GetDownloaderThread();
+	Options.RetryPolicy = Downloader.Get()->GetRetryPolicy();
+	Options.MemoryBudget = Downloader.Get()->GetMemoryBudget();
+	Options.RangeBegin = Segment.Begin + Segment.Received;
+	Options.RangeEnd = Segment.End - 1;
+	Options.FileSize = PakFile->Entry.FileSize;
+	Options.FlushedEnd = MakeShared<std::atomic<int64>, ESPMode::ThreadSafe>(Options.RangeBegin);
+
+	// under a bandwidth limit only the next slice is requested, the rest follows once it is paid for
+	const int64 SliceSize = GetBandwidthSliceSize();
+	if (SliceSize > 0)
+	{
+		Options.RangeEnd = FMath::Min(Options.RangeEnd, Options.RangeBegin + SliceSize - 1);
+	}
+
+	// a single range is written in order, so the running hash can follow it like a single stream
+	if (IncrementalHash.IsValid() && ResumeState.Segments.Num() == 1)
+	{
+		Options.IncrementalHash = IncrementalHash;
+	}
+
+	DCD_LOG(Verbose, TEXT("Downloading %s bytes %lld-%lld from %s"), *PakFile->Entry.FileName, Options.RangeBegin, Options.RangeEnd, *Url);
+	const int TryNumber = SegmentTryNumber;
+	TWeakPtr<FDreamChunkDownload> WeakThisPtr = AsShared();
+	FSegmentTransfer& Transfer = SegmentTransfers[SegmentIndex];
+	Transfer.HostIndex = HostIndex;
+	Transfer.RequestEnd = Options.RangeEnd + 1;
+	Transfer.StartTime = FPlatformTime::Seconds();
+	Transfer.BytesReceived = 0;
+	Transfer.FlushedEnd = Options.FlushedEnd;
+	Transfer.bInFlight = true;
+	Downloader.Get()->OnBuildHostRequestIssued(HostIndex);
+	Transfer.Cancel = PlatformStreamDownload(Url, TargetFile, Options, [WeakThisPtr, SegmentIndex](uint64 BytesReceived)
+	{
+		TSharedPtr<FDreamChunkDownload> SharedThis = WeakThisPtr.Pin();
+		if (SharedThis.IsValid() && !SharedThis->bHasCompleted)
+		{
+			SharedThis->OnSegmentProgress(SegmentIndex, BytesReceived, false);
+		}
+	}, TrackTransfer([WeakThisPtr, SegmentIndex, HostIndex, TryNumber, Url](int32 HttpStatus)
+	{
+		TSharedPtr<FDreamChunkDownload> SharedThis = WeakThisPtr.Pin();
+		if (SharedThis.IsValid() && !SharedThis->bHasCompleted)
+		{
+			SharedThis->OnSegmentComplete(SegmentIndex, HostIndex, Url, TryNumber, HttpStatus, false);
+		}
+	}));
+}
+
+int64 FDreamChunkDownload::GetBandwidthSliceSize() const
+{
+	TSharedPtr<FDreamTokenBucket, ESPMode::ThreadSafe> Bandwidth = Downloader.Get()->GetDownloadBandwidth();
+	const double Rate = Bandwidth.IsValid() ? Bandwidth->GetRate() : 0.0;
+	if (Rate <= 0.0)
+	{
+		return 0;
+	}
+	return FMath::Max<int64>((int64)(Rate * BANDWIDTH_SLICE_SECONDS), MIN_BANDWIDTH_SLICE_BYTES);
+}
+
+bool FDreamChunkDownload::DeferForBandwidth(TFunction<void()>&& Function)
+{
+	TSharedPtr<FDreamTokenBucket, ESPMode::ThreadSafe> Bandwidth = Downloader.Get()->GetDownloadBandwidth();
+	const double SecondsToWait = Bandwidth.IsValid() ? Bandwidth->GetWaitSeconds() : 0.0;
+	if (SecondsToWait <= 0.0)
 	{
-		SecondsToDelay = 60;
+		return false;
 	}
 
+	TWeakPtr<FDreamChunkDownload> WeakThisPtr = AsShared();
+	bIsWaiting = true;
+	FTSTicker::GetCoreTicker().AddTicker(FTickerDelegate::CreateLambda([WeakThisPtr, Function = MoveTemp(Function)](float Unused)
+	{
+		TSharedPtr<FDreamChunkDownload> SharedThis = WeakThisPtr.Pin();
+		if (SharedThis.IsValid() && !SharedThis->bHasCompleted && !SharedThis->bIsCancelled)
+		{
+			SharedThis->bIsWaiting = false;
+			Function();
+		}
+		return false;
+	}), (float)SecondsToWait);
+	return true;
+}
+
+bool FDreamChunkDownload::PauseIfRequested()
+{
+	UDreamChunkDownloaderSubsystem* Subsystem = Downloader.Get();
+	if (!Subsystem->AreDownloadsPaused() && !Subsystem->IsChunkDownloadPaused(PakFile->Entry.ChunkId))
+	{
+		return false;
+	}
+
+	DCD_LOG(Log, TEXT("Download of '%s' was paused while it was busy, stopping before the next request"), *PakFile->Entry.FileName);
+	return ReturnToQueue();
+}
+
+bool FDreamChunkDownload::ReturnToQueue()
+{
+	// the subsystem drops its reference to us while requeueing the pak
+	TSharedRef<FDreamChunkDownload> KeepAlive = AsShared();
+	UDreamChunkDownloaderSubsystem* Subsystem = Downloader.Get();
+	bIsWaiting = true;
+	if (!Subsystem->PauseDownload(PakFile))
+	{
+		bIsWaiting = false;
+		return false;
+	}
+
+	// another pak may take the slot
+	Subsystem->IssueDownloads();
+	return true;
+}
+
+FDreamDownloadComplete FDreamChunkDownload::TrackTransfer(FDreamDownloadComplete&& Callback)
+{
+	++TransfersInFlight;
+	TWeakPtr<FDreamChunkDownload> WeakThisPtr = AsShared();
+	return [WeakThisPtr, Callback = MoveTemp(Callback)](int32 HttpStatus)
+	{
+		// completions run on the game thread once the sink is closed
+		TSharedPtr<FDreamChunkDownload> SharedThis = WeakThisPtr.Pin();
+		if (SharedThis.IsValid())
+		{
+			--SharedThis->TransfersInFlight;
+		}
+		Callback(HttpStatus);
+		if (!SharedThis.IsValid() || !SharedThis->bIsPaused || SharedThis->TransfersInFlight > 0)
+		{
+			return;
+		}
+
+		// the last request of a paused download let go of the file, record where each range really ended
+		if (SharedThis->ResumeState.Segments.Num() > 0)
+		{
+			SharedThis->SaveSegmentProgress();
+		}
+		SharedThis->Downloader.Get()->OnPausedDownloadSettled(SharedThis->PakFile);
+	};
+}
+
+void FDreamChunkDownload::CancelSegmentRequests()
+{
+	for (FSegmentTransfer& Transfer : SegmentTransfers)
+	{
+		if (Transfer.bInFlight && Transfer.Cancel)
+		{
+			Transfer.Cancel();
+		}
+		if (Transfer.bHedgeInFlight && Transfer.HedgeCancel)
+		{
+			Transfer.HedgeCancel();
+		}
+	}
+}
+
+void FDreamChunkDownload::OnSegmentProgress(int32 SegmentIndex, uint64 BytesReceived, bool bHedge)
+{
+	if (!SegmentTransfers.IsValidIndex(SegmentIndex))
+	{
+		return;
+	}
+	FSegmentTransfer& Transfer = SegmentTransfers[SegmentIndex];
+	(bHedge ? Transfer.HedgeBytesReceived : Transfer.BytesReceived) = BytesReceived;
+
+	// report the sum of all segments of this attempt
+	uint64 TotalBytesReceived = 0;
+	for (const FSegmentTransfer& SegmentTransfer : SegmentTransfers)
+	{
+		TotalBytesReceived += SegmentTransfer.GetBytesReceived();
+	}
+	OnDownloadProgress((int64)TotalBytesReceived);
+
+	// keep the table on disk close to the file, the process may not get to record a failure
+	if (TotalBytesReceived >= SegmentBytesAtLastSave + SEGMENT_PROGRESS_SAVE_BYTES)
+	{
+		SegmentBytesAtLastSave = TotalBytesReceived;
+		SaveSegmentProgress();
+	}
+}
+
+void FDreamChunkDownload::CreditFlushedBytes(FDreamDownloadSegment& Segment, int32 SegmentIndex) const
+{
+	if (!SegmentTransfers.IsValidIndex(SegmentIndex))
+	{
+		return;
+	}
+	const FSegmentTransfer& Transfer = SegmentTransfers[SegmentIndex];
+
+	// the hedged range only extends the valid data if it starts inside what the original request flushed
+	int64 ValidEnd = Segment.Begin + Segment.Received;
+	if (Transfer.FlushedEnd.IsValid())
+	{
+		ValidEnd = FMath::Max(ValidEnd, Transfer.FlushedEnd->load());
+	}
+	if (Transfer.HedgeFlushedEnd.IsValid() && Transfer.HedgeBegin <= ValidEnd)
+	{
+		ValidEnd = FMath::Max(ValidEnd, Transfer.HedgeFlushedEnd->load());
+	}
+	Segment.Received = FMath::Clamp<int64>(ValidEnd - Segment.Begin, Segment.Received, Segment.GetLength());
+}
+
+void FDreamChunkDownload::SaveSegmentProgress() const
+{
+	FDreamDownloadResumeState Progress = ResumeState;
+	for (int32 SegmentIndex = 0; SegmentIndex < Progress.Segments.Num(); ++SegmentIndex)
+	{
+		CreditFlushedBytes(Progress.Segments[SegmentIndex], SegmentIndex);
+	}
+	Progress.Save(TargetFile);
+}
+
+void FDreamChunkDownload::SampleSegmentRates(float DeltaSeconds, TArray<float>& OutRates)
+{
+	if (bHasCompleted || bIsCancelled || DeltaSeconds <= 0.0f)
+	{
+		return;
+	}
+	for (FSegmentTransfer& Transfer : SegmentTransfers)
+	{
+		if (!Transfer.IsInFlight())
+		{
+			continue;
+		}
+		const uint64 Bytes = Transfer.GetBytesReceived();
+		Transfer.Rate = (float)(Bytes - FMath::Min(Transfer.SampledBytes, Bytes)) / DeltaSeconds;
+		Transfer.SampledBytes = Bytes;
+		OutRates.Add(Transfer.Rate);
+	}
+}
+
+void FDreamChunkDownload::UpdateHedging(double Now, float MedianRate)
+{
+	if (bHasCompleted || bIsCancelled || MedianRate <= 0.0f)
+	{
+		return;
+	}
+
+	// under a bandwidth limit every segment is slow on purpose, a hedge would only split the same bandwidth
+	if (GetBandwidthSliceSize() > 0)
+	{
+		return;
+	}
+	const UDreamChunkDownloaderSettings* Settings = UDreamChunkDownloaderSettings::Get();
+	const float SlowRate = MedianRate * Settings->HedgeSlowRateFraction;
+	for (int32 SegmentIndex = 0; SegmentIndex < SegmentTransfers.Num(); ++SegmentIndex)
+	{
+		FSegmentTransfer& Transfer = SegmentTransfers[SegmentIndex];
+		if (!Transfer.bInFlight || Transfer.bHedged || Transfer.RequestEnd < ResumeState.Segments[SegmentIndex].End)
+		{
+			continue;
+		}
+
+		// a short dip is normal, only a segment that stays slow for the whole window is hedged
+		if (Transfer.Rate >= SlowRate)
+		{
+			Transfer.SlowSince = 0.0;
+			continue;
+		}
+		if (Transfer.SlowSince <= 0.0)
+		{
+			Transfer.SlowSince = Now;
+			continue;
+		}
+		if (Now - Transfer.SlowSince >= Settings->HedgeSlowWindowSeconds)
+		{
+			StartHedge(SegmentIndex);
+		}
+	}
+}
+
+void FDreamChunkDownload::StartHedge(int32 SegmentIndex)
+{
+	const UDreamChunkDownloaderSettings* Settings = UDreamChunkDownloaderSettings::Get();
+	const FDreamDownloadSegment& Segment = ResumeState.Segments[SegmentIndex];
+	FSegmentTransfer& Transfer = SegmentTransfers[SegmentIndex];
+	Transfer.bHedged = true;
+
+	// start where the original request's data ends on disk, whatever it still holds in memory is fetched again
+	const int32 WriteBufferSize = FMath::Max(16, Settings->StreamWriteBufferSizeKB) * 1024;
+	const int64 RequestBegin = Segment.Begin + Segment.Received;
+	const int64 HedgeBegin = Transfer.FlushedEnd.IsValid() ? FMath::Clamp<int64>(Transfer.FlushedEnd->load(), RequestBegin, Segment.End) : RequestBegin;
+	Transfer.HedgeSkippedBytes = (uint64)(HedgeBegin - RequestBegin);
+	if (Segment.End - HedgeBegin < MIN_HEDGE_BYTES)
+	{
+		return;
+	}
+
+	// race the slow host with another one in rotation (a fresh connection to the same host if there is none)
+	const int32 HostIndex = Downloader.Get()->SelectBuildHost(SegmentTryNumber + SegmentIndex + 1, Transfer.HostIndex);
+	FString Url = Downloader.Get()->GetBuildBaseUrls()[HostIndex] / PakFile->Entry.RelativeUrl;
+
+	FDreamStreamDownloadOptions Options;
+	Options.bStreamToDisk = true;
+	Options.WriteBufferSize = WriteBufferSize;
+	Options.Bandwidth = Downloader.Get()->GetDownloadBandwidth();
+	Options.CompletionThread = Downloader.Get()->GetDownloaderThread();
+	Options.RetryPolicy = Downloader.Get()->GetRetryPolicy();
+	Options.MemoryBudget = Downloader.Get()->GetMemoryBudget();
+	Options.RangeBegin = HedgeBegin;
+	Options.RangeEnd = Segment.End - 1;
+	Options.FlushedEnd = MakeShared<std::atomic<int64>, ESPMode::ThreadSafe>(HedgeBegin);
+
+	DCD_LOG(Log, TEXT("Segment %d of %s is stalling (%.0f bytes/s), hedging bytes %lld-%lld from %s"),
+	        SegmentIndex, *PakFile->Entry.FileName, Transfer.Rate, Options.RangeBegin, Options.RangeEnd, *Url);
+	const int TryNumber = SegmentTryNumber;
+	TWeakPtr<FDreamChunkDownload> WeakThisPtr = AsShared();
+	Transfer.HedgeBegin = HedgeBegin;
+	Transfer.HedgeHostIndex = HostIndex;
+	Transfer.HedgeStartTime = FPlatformTime::Seconds();
+	Transfer.HedgeFlushedEnd = Options.FlushedEnd;
+	Transfer.bHedgeInFlight = true;
+	Downloader.Get()->OnBuildHostRequestIssued(HostIndex);
+	Transfer.HedgeCancel = PlatformStreamDownload(Url, TargetFile, Options, [WeakThisPtr, SegmentIndex](uint64 BytesReceived)
+	{
+		TSharedPtr<FDreamChunkDownload> SharedThis = WeakThisPtr.Pin();
+		if (SharedThis.IsValid() && !SharedThis->bHasCompleted)
+		{
+			SharedThis->OnSegmentProgress(SegmentIndex, BytesReceived, true);
+		}
+	}, TrackTransfer([WeakThisPtr, SegmentIndex, HostIndex, TryNumber, Url](int32 HttpStatus)
+	{
+		TSharedPtr<FDreamChunkDownload> SharedThis = WeakThisPtr.Pin();
+		if (SharedThis.IsValid() && !SharedThis->bHasCompleted)
+		{
+			SharedThis->OnSegmentComplete(SegmentIndex, HostIndex, Url, TryNumber, HttpStatus, true);
+		}
+	}));
+}
+
+void FDreamChunkDownload::OnSegmentComplete(int32 SegmentIndex, int32 HostIndex, const FString& Url, int TryNumber, int32 HttpStatus, bool bHedge)
+{
+	// ignore segments of an attempt we already gave up on
+	if (bIsCancelled || TryNumber != SegmentTryNumber || !ResumeState.Segments.IsValidIndex(SegmentIndex) || !SegmentTransfers.IsValidIndex(SegmentIndex))
+	{
+		return;
+	}
+
+	// the loser of a hedge race was cancelled, its result means nothing
+	FSegmentTransfer& Transfer = SegmentTransfers[SegmentIndex];
+	bool& bRequestInFlight = bHedge ? Transfer.bHedgeInFlight : Transfer.bInFlight;
+	bool& bOtherInFlight = bHedge ? Transfer.bInFlight : Transfer.bHedgeInFlight;
+	if (!bRequestInFlight)
+	{
+		return;
+	}
+	bRequestInFlight = false;
+	ReportRequestResult(HostIndex, HttpStatus);
+
+	// only what reached the disk counts, a body that ended early is an interrupted request
+	if (EHttpResponseCodes::IsOk(HttpStatus) && !bHedge && Transfer.FlushedEnd.IsValid() && Transfer.FlushedEnd->load() < Transfer.RequestEnd)
+	{
+		DCD_LOG(Warning, TEXT("Segment %d of %s ended at %lld instead of %lld"), SegmentIndex, *PakFile->Entry.FileName, Transfer.FlushedEnd->load(), Transfer.RequestEnd);
+		HttpStatus = 0;
+	}
+
+	if (EHttpResponseCodes::IsOk(HttpStatus))
+	{
+		// credit the throughput to the host that served this request
+		const double Now = FPlatformTime::Seconds();
+		Downloader.Get()->ReportHostTransfer(HostIndex, (int64)(bHedge ? Transfer.HedgeBytesReceived : Transfer.BytesReceived), Now - (bHedge ? Transfer.HedgeStartTime : Transfer.StartTime));
+
+		// credit what reached the disk (a hedge only finishes the segment if the original request got its data up to the hedge's start)
+		FDreamDownloadSegment& Segment = ResumeState.Segments[SegmentIndex];
+		CreditFlushedBytes(Segment, SegmentIndex);
+		ResumeState.Save(TargetFile);
+
+		// the original request is still on its way to the hedge's start, it finishes the segment instead
+		if (bHedge && !Segment.IsComplete() && bOtherInFlight)
+		{
+			DCD_LOG(Log, TEXT("Hedged request of segment %d of %s finished before the original reached it, waiting for the original"), SegmentIndex, *PakFile->Entry.FileName);
+			return;
+		}
+
+		// first one home wins, the other request is cancelled
+		if (bOtherInFlight)
+		{
+			DCD_LOG(Log, TEXT("Segment %d of %s finished by the %s request"), SegmentIndex, *PakFile->Entry.FileName, bHedge ? TEXT("hedged") : TEXT("original"));
+			bOtherInFlight = false;
+			const FDreamDownloadCancel& OtherCancel = bHedge ? Transfer.Cancel : Transfer.HedgeCancel;
+			if (OtherCancel)
+			{
+				OtherCancel();
+			}
+
+			// the loser was the slower host, what it managed so far counts for it
+			Downloader.Get()->ReportHostTransfer(bHedge ? Transfer.HostIndex : Transfer.HedgeHostIndex, (int64)(bHedge ? Transfer.BytesReceived : Transfer.HedgeBytesReceived),
+			                                     Now - (bHedge ? Transfer.StartTime : Transfer.HedgeStartTime));
+		}
+
+		// a segment fetched in slices goes on with the next one once this one is paid for
+		if (!bHedge && !Segment.IsComplete())
+		{
+			Transfer.CompletedBytes += Transfer.BytesReceived;
+			Transfer.BytesReceived = 0;
+			Transfer.Cancel = FDreamDownloadCancel();
+			bRequestInFlight = true;
+			if (!DeferForBandwidth([this, SegmentIndex, HostIndex, TryNumber]()
+			{
+				if (TryNumber == SegmentTryNumber)
+				{
+					StartSegmentRequest(SegmentIndex, HostIndex);
+				}
+			}))
+			{
+				StartSegmentRequest(SegmentIndex, HostIndex);
+			}
+			return;
+		}
+	}
+	else
+	{
+		// the other request may still finish the segment (a hedge that leaves a gap fails with this status)
+		if (bOtherInFlight)
+		{
+			SegmentFailureStatus = HttpStatus;
+			return;
+		}
+
+		// the retry continues after whatever reached the disk
+		CreditFlushedBytes(ResumeState.Segments[SegmentIndex], SegmentIndex);
+		ResumeState.Save(TargetFile);
+		SegmentFailureStatus = HttpStatus;
+		if (HttpStatus == EHttpResponseCodes::RequestedRangeNotSatisfiable)
+		{
+			bSegmentsUnsupported = true;
+		}
+	}
+	--SegmentsInFlight;
+
+	// wait for the rest of this attempt
+	if (SegmentsInFlight > 0)
+	{
+		return;
+	}
+
+	if (ResumeState.IsComplete())
+	{
+		// the file is whole, validate it like a single stream download
+		FDreamDownloadResumeState::Delete(TargetFile);
+		ResumeState = FDreamDownloadResumeState();
+		OnDownloadComplete(Url, TryNumber, EHttpResponseCodes::Ok);
+		return;
+	}
+
+	if (bSegmentsUnsupported)
+	{
+		// the preallocated file is useless for a single stream, start over
+		DCD_LOG(Warning, TEXT("%s does not support range requests, falling back to a single stream for %s"), *Url, *PakFile->Entry.FileName);
+		ResetSegments();
+	}
+
+	// only the failed segments are fetched by the retry
+	OnDownloadComplete(Url, TryNumber, SegmentFailureStatus);
+}
+
+void FDreamChunkDownload::ResetSegments()
+{
+	if (ResumeState.Segments.Num() > 0 || FDreamDownloadResumeState::Exists(TargetFile))
+	{
+		IPlatformFile::GetPlatformPhysical().DeleteFile(*TargetFile);
+		FDreamDownloadResumeState::Delete(TargetFile);
+	}
+	ResumeState = FDreamDownloadResumeState();
+	SegmentTransfers.Empty();
+}
+
+bool FDreamChunkDownload::ShouldUsePatch() const
+{
+	if (PakFile->PatchBaseVersion.IsEmpty() || !UDreamChunkDownloaderSettings::Get()->bEnableDeltaPatches)
+	{
+		return false;
+	}
+	return PakFile->Entry.FindPatch(PakFile->PatchBaseVersion) != nullptr &&
+		IFileManager::Get().FileExists(*(TargetFile + FDreamChunkDownloaderStatics::PATCH_BASE_EXTENSION));
+}
+
+void FDreamChunkDownload::StartPatchDownload(int TryNumber)
+{
+	// only handle completion once
+	check(!bHasCompleted);
+	if (PauseIfRequested())
+	{
+		return;
+	}
+
+	// the data of earlier requests is paid for before a new one goes out
+	if (DeferForBandwidth([this, TryNumber]() { StartPatchDownload(TryNumber); }))
+	{
+		return;
+	}
+	BeginTime = FDateTime::UtcNow();
+	bAwaitingFirstByte = true;
+	OnDownloadProgress(0);
+
+	const FDreamPakPatchEntry* Patch = PakFile->Entry.FindPatch(PakFile->PatchBaseVersion);
+	check(Patch != nullptr);
+	check(Downloader.Get()->GetBuildBaseUrls().Num() > 0);
+	AttemptHostIndex = Downloader.Get()->SelectBuildHost(TryNumber);
+	FString Url = Downloader.Get()->GetBuildBaseUrls()[AttemptHostIndex] / Patch->RelativeUrl;
+	DCD_LOG(Log, TEXT("Downloading patch for %s from %s (%lld bytes instead of %lld)"), *PakFile->Entry.FileName, *Url, Patch->FileSize, PakFile->Entry.FileSize);
+
+	// a leftover patch may belong to another version
+	FString PatchFile = TargetFile + FDreamChunkDownloaderStatics::PATCH_EXTENSION;
+	IPlatformFile::GetPlatformPhysical().DeleteFile(*PatchFile);
+
+	FDreamStreamDownloadOptions Options;
+	Options.bStreamToDisk = UDreamChunkDownloaderSettings::Get()->bStreamDownloadsToDisk;
+	Options.WriteBufferSize = FMath::Max(16, UDreamChunkDownloaderSettings::Get()->StreamWriteBufferSizeKB) * 1024;
+	Options.Bandwidth = Downloader.Get()->GetDownloadBandwidth();
+	Options.CompletionThread = Downloader.Get()->GetDownloaderThread();
+	Options.RetryPolicy = Downloader.Get()->GetRetryPolicy();
+	Options.MemoryBudget = Downloader.Get()->GetMemoryBudget();
+	Options.ExpectedBodySize = Patch->FileSize;
+
+	TWeakPtr<FDreamChunkDownload> WeakThisPtr = AsShared();
+	bIsTransferring = true;
+	Downloader.Get()->OnBuildHostRequestIssued(AttemptHostIndex);
+	CancelCallback = PlatformStreamDownload(Url, PatchFile, Options, [WeakThisPtr](uint64 BytesReceived)
+	                                        {
+		                                        TSharedPtr<FDreamChunkDownload> SharedThis = WeakThisPtr.Pin();
+		                                        if (SharedThis.IsValid() && !SharedThis->bHasCompleted)
+		                                        {
+			                                        SharedThis->OnDownloadProgress((int64)BytesReceived);
+		                                        }
+	                                        }, TrackTransfer([WeakThisPtr, TryNumber, Url](int32 HttpStatus)
+	                                        {
+		                                        TSharedPtr<FDreamChunkDownload> SharedThis = WeakThisPtr.Pin();
+		                                        if (SharedThis.IsValid() && !SharedThis->bHasCompleted)
+		                                        {
+			                                        SharedThis->OnPatchDownloadComplete(Url, TryNumber, HttpStatus);
+		                                        }
+	                                        }));
+}
+
+void FDreamChunkDownload::OnPatchDownloadComplete(const FString& Url, int TryNumber, int32 HttpStatus)
+{
+	// only handle completion once
+	check(!bHasCompleted);
+	bIsTransferring = false;
+	ReportRequestResult(AttemptHostIndex, HttpStatus);
+	if (EHttpResponseCodes::IsOk(HttpStatus))
+	{
+		Downloader.Get()->ReportHostTransfer(AttemptHostIndex, LastBytesReceived, (FDateTime::UtcNow() - BeginTime).GetTotalSeconds());
+	}
+
+	if (!EHttpResponseCodes::IsOk(HttpStatus))
+	{
+		DCD_LOG(Warning, TEXT("Failed to download patch for %s from %s (%d), downloading the whole file"), *PakFile->Entry.FileName, *Url, HttpStatus);
+		DiscardPatch();
+		ScheduleRetry(TryNumber);
+		return;
+	}
+
+	ApplyPatch(Url, TryNumber);
+}
+
+void FDreamChunkDownload::ApplyPatch(const FString& Url, int TryNumber)
+{
+	const FDreamPakPatchEntry* Patch = PakFile->Entry.FindPatch(PakFile->PatchBaseVersion);
+	check(Patch != nullptr);
+	DCD_LOG(Log, TEXT("Applying patch to %s (from version '%s')"), *PakFile->Entry.FileName, *PakFile->PatchBaseVersion);
+
+	// patching reads the whole base, keep it off the game thread
+	FString BasePath = TargetFile + FDreamChunkDownloaderStatics::PATCH_BASE_EXTENSION;
+	FString PatchPath = TargetFile + FDreamChunkDownloaderStatics::PATCH_EXTENSION;
+	FString OutputPath = TargetFile;
+	FString PatchVersion = Patch->FileVersion;
+	const int64 PatchSize = Patch->FileSize;
+	const int64 FileSize = PakFile->Entry.FileSize;
+	TSharedPtr<FDreamIncrementalFileHash, ESPMode::ThreadSafe> Hash = IncrementalHash;
+	TWeakPtr<FDreamChunkDownload> WeakThisPtr = AsShared();
+	Async(EAsyncExecution::ThreadPool, [WeakThisPtr, Url, TryNumber, BasePath, PatchPath, OutputPath, PatchVersion, PatchSize, FileSize, Hash]()
+	{
+		// make sure the patch arrived intact before trusting its offsets
+		const bool bPatchIsValid = IFileManager::Get().FileSize(*PatchPath) == PatchSize &&
+			(!FDreamHashRegistry::Get().IsSupported(PatchVersion) || FDreamChunkDownloaderUtils::CheckFileHash(PatchPath, PatchVersion));
+		const bool bApplied = bPatchIsValid && FDreamDeltaPatch::Apply(BasePath, PatchPath, OutputPath, FileSize, Hash.Get());
+
+		AsyncTask(ENamedThreads::GameThread, [WeakThisPtr, Url, TryNumber, bApplied]()
+		{
+			TSharedPtr<FDreamChunkDownload> SharedThis = WeakThisPtr.Pin();
+			if (SharedThis.IsValid() && !SharedThis->bHasCompleted)
+			{
+				SharedThis->OnPatchApplied(Url, TryNumber, bApplied);
+			}
+		});
+	});
+}
+
+void FDreamChunkDownload::OnPatchApplied(const FString& Url, int TryNumber, bool bApplied)
+{
+	// the previous version isn't needed anymore either way
+	DiscardPatch();
+
+	if (!bApplied)
+	{
+		DCD_LOG(Warning, TEXT("Failed to patch %s, downloading the whole file"), *PakFile->Entry.FileName);
+		IPlatformFile::GetPlatformPhysical().DeleteFile(*TargetFile);
+		if (IncrementalHash.IsValid())
+		{
+			IncrementalHash->Reset();
+		}
+		ScheduleRetry(TryNumber);
+		return;
+	}
+
+	// the patched file is verified like a downloaded one
+	OnDownloadComplete(Url, TryNumber, EHttpResponseCodes::Ok);
+}
+
+void FDreamChunkDownload::DiscardPatch()
+{
+	IPlatformFile& PlatformFile = IPlatformFile::GetPlatformPhysical();
+	PlatformFile.DeleteFile(*(TargetFile + FDreamChunkDownloaderStatics::PATCH_EXTENSION));
+	PlatformFile.DeleteFile(*(TargetFile + FDreamChunkDownloaderStatics::PATCH_BASE_EXTENSION));
+	PakFile->PatchBaseVersion.Empty();
+	PakFile->BaseContentChunks.Empty();
+}
+
+bool FDreamChunkDownload::ShouldUseContentChunks() const
+{
+	if (!UDreamChunkDownloaderSettings::Get()->bEnableContentChunkStore || !PakFile->Entry.HasContentChunks() ||
+		ContentChunkAssemblyFailures >= MAX_CONTENT_CHUNK_ASSEMBLY_FAILURES)
+	{
+		return false;
+	}
+
+	// a block repair in progress is finished with range requests
+	return ResumeState.Segments.Num() == 0 && !FDreamDownloadResumeState::Exists(TargetFile);
+}
+
+void FDreamChunkDownload::StartContentChunkDownload(int TryNumber)
+{
+	// find every chunk that is already on disk
+	TMap<FString, FDreamContentChunkStore::FSource> LocalChunks;
+	Downloader.Get()->BuildContentChunkIndex(LocalChunks);
+
+	IFileManager& FileManager = IFileManager::Get();
+	FString StagingFolder = TargetFile + FDreamChunkDownloaderStatics::CONTENT_CHUNKS_EXTENSION;
+	ContentChunkSources.Reset();
+	ContentChunkQueue.Reset();
+	TSet<FString> QueuedChunks;
+	int64 LocalBytes = 0, StagedBytes = 0, MissingBytes = 0;
+	for (const FDreamContentChunk& Chunk : PakFile->Entry.ContentChunks)
+	{
+		const FDreamContentChunkStore::FSource* LocalChunk = ExcludedContentChunks.Contains(Chunk.Hash) ? nullptr : LocalChunks.Find(Chunk.Hash);
+		if (LocalChunk != nullptr)
+		{
+			ContentChunkSources.Add(*LocalChunk);
+			LocalBytes += Chunk.Size;
+			continue;
+		}
+
+		// everything else is read from the staging folder (a chunk may repeat within the pak)
+		FDreamContentChunkStore::FSource& StagedChunk = ContentChunkSources.AddDefaulted_GetRef();
+		StagedChunk.Path = StagingFolder / FDreamContentChunkStore::GetChunkFileName(Chunk.Hash);
+		if (QueuedChunks.Contains(Chunk.Hash))
+		{
+			continue;
+		}
+		QueuedChunks.Add(Chunk.Hash);
+
+		// chunks staged by an earlier attempt are kept
+		if (FileManager.FileSize(*StagedChunk.Path) == Chunk.Size)
+		{
+			StagedBytes += Chunk.Size;
+			continue;
+		}
+		ContentChunkQueue.Add(Chunk);
+		MissingBytes += Chunk.Size;
+	}
+
+	check(Downloader.Get()->GetBuildBaseUrls().Num() > 0);
+	AttemptHostIndex = Downloader.Get()->SelectBuildHost(TryNumber);
+	ContentChunkBaseUrl = Downloader.Get()->GetBuildBaseUrls()[AttemptHostIndex] / UDreamChunkDownloaderSettings::Get()->ContentChunkRelativeUrl;
+	DCD_LOG(Log, TEXT("Assembling %s from %d content chunks: %lld bytes on disk, %lld bytes staged, %lld bytes (%d chunks) to download from %s"),
+	        *PakFile->Entry.FileName, PakFile->Entry.ContentChunks.Num(), LocalBytes, StagedBytes, MissingBytes, ContentChunkQueue.Num(), *ContentChunkBaseUrl);
+
+	ContentChunkTryNumber = TryNumber;
+	NextContentChunk = 0;
+	ContentChunkCancels.Empty();
+	ContentChunkBytesReceived = 0;
+	ContentChunkFailureStatus = 0;
+	bContentChunkFailed = false;
+	bContentChunkIssuePending = false;
+
+	// cancelling the download cancels every chunk request in flight
+	TWeakPtr<FDreamChunkDownload> WeakThisPtr = AsShared();
+	CancelCallback = [WeakThisPtr]()
+	{
+		TSharedPtr<FDreamChunkDownload> SharedThis = WeakThisPtr.Pin();
+		if (SharedThis.IsValid())
+		{
+			TMap<int32, FDreamDownloadCancel> ChunkCancels = MoveTemp(SharedThis->ContentChunkCancels);
+			for (const auto& It : ChunkCancels)
+			{
+				It.Value();
+			}
+		}
+	};
+
+	if (ContentChunkQueue.Num() == 0)
+	{
+		AssembleContentChunks(TryNumber);
+		return;
+	}
+	bIsTransferring = true;
+	IssueContentChunkDownloads();
+}
+
+void FDreamChunkDownload::IssueContentChunkDownloads()
+{
+	const UDreamChunkDownloaderSettings* Settings = UDreamChunkDownloaderSettings::Get();
+	const int32 MaxInFlight = FMath::Max(1, Settings->MaxConcurrentContentChunkDownloads);
+	FString StagingFolder = TargetFile + FDreamChunkDownloaderStatics::CONTENT_CHUNKS_EXTENSION;
+	TWeakPtr<FDreamChunkDownload> WeakThisPtr = AsShared();
+	while (!bIsCancelled && !bContentChunkFailed && !bContentChunkIssuePending && ContentChunkCancels.Num() < MaxInFlight && NextContentChunk < ContentChunkQueue.Num())
+	{
+		// under a bandwidth limit a new chunk waits until the data of the earlier ones is paid for
+		if (ContentChunkCancels.Num() > 0)
+		{
+			// the next chunk to complete looks again
+			TSharedPtr<FDreamTokenBucket, ESPMode::ThreadSafe> Bandwidth = Downloader.Get()->GetDownloadBandwidth();
+			if (Bandwidth.IsValid() && Bandwidth->GetWaitSeconds() > 0.0)
+			{
+				break;
+			}
+		}
+		else if (DeferForBandwidth([this]() { bContentChunkIssuePending = false; IssueContentChunkDownloads(); }))
+		{
+			bContentChunkIssuePending = true;
+			break;
+		}
+
+		const int32 QueueIndex = NextContentChunk++;
+		const FDreamContentChunk& Chunk = ContentChunkQueue[QueueIndex];
+		FString ChunkFileName = FDreamContentChunkStore::GetChunkFileName(Chunk.Hash);
+		FString Url = ContentChunkBaseUrl / ChunkFileName;
+		FString StagedPath = StagingFolder / ChunkFileName;
+
+		// a partial chunk from an earlier attempt is simply fetched again
+		IPlatformFile::GetPlatformPhysical().DeleteFile(*StagedPath);
+
+		FDreamStreamDownloadOptions Options;
+		Options.bStreamToDisk = Settings->bStreamDownloadsToDisk;
+		Options.WriteBufferSize = FMath::Max(16, Settings->StreamWriteBufferSizeKB) * 1024;
+		Options.Bandwidth = Downloader.Get()->GetDownloadBandwidth();
+		Options.CompletionThread = Downloader.Get()->GetDownloaderThread();
+		Options.RetryPolicy = Downloader.Get()->GetRetryPolicy();
+		Options.MemoryBudget = Downloader.Get()->GetMemoryBudget();
+		Options.ExpectedBodySize = Chunk.Size;
+
+		DCD_LOG(Verbose, TEXT("Downloading content chunk %s of %s from %s"), *Chunk.Hash, *PakFile->Entry.FileName, *Url);
+		const int TryNumber = ContentChunkTryNumber;
+		Downloader.Get()->OnBuildHostRequestIssued(AttemptHostIndex);
+		ContentChunkCancels.Add(QueueIndex, PlatformStreamDownload(Url, StagedPath, Options, [](uint64 BytesReceived)
+		{
+		}, TrackTransfer([WeakThisPtr, QueueIndex, TryNumber](int32 HttpStatus)
+		{
+			TSharedPtr<FDreamChunkDownload> SharedThis = WeakThisPtr.Pin();
+			if (SharedThis.IsValid() && !SharedThis->bHasCompleted)
+			{
+				SharedThis->OnContentChunkComplete(QueueIndex, TryNumber, HttpStatus);
+			}
+		})));
+	}
+}
+
+void FDreamChunkDownload::OnContentChunkComplete(int32 QueueIndex, int TryNumber, int32 HttpStatus)
+{
+	// ignore stragglers of a cancelled or earlier attempt
+	if (bIsCancelled || TryNumber != ContentChunkTryNumber || ContentChunkCancels.Remove(QueueIndex) == 0)
+	{
+		return;
+	}
+
+	ReportRequestResult(AttemptHostIndex, HttpStatus);
+
+	const FDreamContentChunk& Chunk = ContentChunkQueue[QueueIndex];
+	if (EHttpResponseCodes::IsOk(HttpStatus))
+	{
+		ContentChunkBytesReceived += Chunk.Size;
+		OnDownloadProgress(ContentChunkBytesReceived);
+	}
+	else
+	{
+		DCD_LOG(Warning, TEXT("Failed to download content chunk %s of %s (%d)"), *Chunk.Hash, *PakFile->Entry.FileName, HttpStatus);
+		ContentChunkFailureStatus = HttpStatus;
+		bContentChunkFailed = true;
+	}
+
+	// keep the pipe full until every chunk is in
+	IssueContentChunkDownloads();
+	if (ContentChunkCancels.Num() > 0 || bContentChunkIssuePending)
+	{
+		return;
+	}
+
+	if (bContentChunkFailed)
+	{
+		// the chunks already staged are kept for the retry
+		OnDownloadComplete(ContentChunkBaseUrl, TryNumber, ContentChunkFailureStatus);
+		return;
+	}
+	bIsTransferring = false;
+
+	// every chunk of the attempt came from the same host
+	Downloader.Get()->ReportHostTransfer(AttemptHostIndex, ContentChunkBytesReceived, (FDateTime::UtcNow() - BeginTime).GetTotalSeconds());
+	AssembleContentChunks(TryNumber);
+}
+
+void FDreamChunkDownload::AssembleContentChunks(int TryNumber)
+{
+	// assembly reads and hashes the whole pak, keep it off the game thread
+	TArray<FDreamContentChunk> Chunks = PakFile->Entry.ContentChunks;
+	TArray<FDreamContentChunkStore::FSource> Sources = ContentChunkSources;
+	FString OutputPath = TargetFile;
+	TSharedPtr<FDreamIncrementalFileHash, ESPMode::ThreadSafe> Hash = IncrementalHash;
+	TWeakPtr<FDreamChunkDownload> WeakThisPtr = AsShared();
+	Async(EAsyncExecution::ThreadPool, [WeakThisPtr, TryNumber, Chunks = MoveTemp(Chunks), Sources = MoveTemp(Sources), OutputPath, Hash]()
+	{
+		TArray<int32> BadChunks;
+		const bool bAssembled = FDreamContentChunkStore::Assemble(Chunks, Sources, OutputPath, Hash.Get(), BadChunks);
+
+		AsyncTask(ENamedThreads::GameThread, [WeakThisPtr, TryNumber, BadChunks = MoveTemp(BadChunks), bAssembled]()
+		{
+			TSharedPtr<FDreamChunkDownload> SharedThis = WeakThisPtr.Pin();
+			if (SharedThis.IsValid() && !SharedThis->bHasCompleted)
+			{
+				SharedThis->OnContentChunksAssembled(TryNumber, BadChunks, bAssembled);
+			}
+		});
+	});
+}
+
+void FDreamChunkDownload::OnContentChunksAssembled(int TryNumber, const TArray<int32>& BadChunks, bool bAssembled)
+{
+	if (bAssembled)
+	{
+		// the staged chunks and the previous version have served their purpose
+		DiscardContentChunks();
+		DiscardPatch();
+
+		// the assembled file is verified like a downloaded one
+		OnDownloadComplete(ContentChunkBaseUrl, TryNumber, EHttpResponseCodes::Ok);
+		return;
+	}
+
+	// bad local copies are downloaded next time, bad downloads are fetched again
+	++ContentChunkAssemblyFailures;
+	FString StagingFolder = TargetFile + FDreamChunkDownloaderStatics::CONTENT_CHUNKS_EXTENSION;
+	for (int32 ChunkIndex : BadChunks)
+	{
+		const FDreamContentChunkStore::FSource& Source = ContentChunkSources[ChunkIndex];
+		if (FPaths::GetPath(Source.Path) == StagingFolder)
+		{
+			IPlatformFile::GetPlatformPhysical().DeleteFile(*Source.Path);
+		}
+		else
+		{
+			ExcludedContentChunks.Add(PakFile->Entry.ContentChunks[ChunkIndex].Hash);
+		}
+	}
+	DCD_LOG(Warning, TEXT("Failed to assemble %s (%d bad chunks)%s"), *PakFile->Entry.FileName, BadChunks.Num(),
+	        ContentChunkAssemblyFailures >= MAX_CONTENT_CHUNK_ASSEMBLY_FAILURES ? TEXT(", downloading the whole file") : TEXT(""));
+
+	IPlatformFile::GetPlatformPhysical().DeleteFile(*TargetFile);
+	if (ContentChunkAssemblyFailures >= MAX_CONTENT_CHUNK_ASSEMBLY_FAILURES)
+	{
+		DiscardContentChunks();
+	}
+	if (IncrementalHash.IsValid())
+	{
+		IncrementalHash->Reset();
+	}
+	ScheduleRetry(TryNumber);
+}
+
+void FDreamChunkDownload::DiscardContentChunks()
+{
+	FString StagingFolder = TargetFile + FDreamChunkDownloaderStatics::CONTENT_CHUNKS_EXTENSION;
+	if (IFileManager::Get().DirectoryExists(*StagingFolder))
+	{
+		IFileManager::Get().DeleteDirectory(*StagingFolder, false, true);
+	}
+}
+
+void FDreamChunkDownload::OnDownloadProgress(int64 BytesReceived)
+{
+	// feed the network side of the progress to the concurrency controller
+	TSharedPtr<FDreamConcurrencyController> Concurrency = Downloader.Get()->GetConcurrencyController();
+	if (Concurrency.IsValid() && !bHasCompleted)
+	{
+		Concurrency->AddBytes(BytesReceived - LastBytesReceived);
+	}
+	if (bAwaitingFirstByte && BytesReceived > 0 && !bHasCompleted)
+	{
+		const double FirstByteSeconds = (FDateTime::UtcNow() - BeginTime).GetTotalSeconds();
+		if (Concurrency.IsValid())
+		{
+			Concurrency->AddFirstByteTime(FirstByteSeconds);
+		}
+		Downloader.Get()->ReportHostLatency(AttemptHostIndex, FirstByteSeconds);
+		bAwaitingFirstByte = false;
+	}
+
+	Downloader.Get()->AddBytesDownloaded(BytesReceived - LastBytesReceived);
+	LastBytesReceived = BytesReceived;
+
+	// what reached the disk no longer has to be reserved
+	if (bDiskSpaceReserved && !bHasCompleted)
+	{
+		Downloader.Get()->GetDiskSpaceLedger()->Reduce(PakFile->Entry.FileName, ReservedDiskSpace - BytesReceived);
+	}
+}
+
+void FDreamChunkDownload::ReportRequestResult(int32 HostIndex, int32 HttpStatus)
+{
+	TSharedPtr<FDreamConcurrencyController> Concurrency = Downloader.Get()->GetConcurrencyController();
+	if (Concurrency.IsValid())
+	{
+		Concurrency->AddRequestResult(HttpStatus);
+	}
+	Downloader.Get()->ReportHostResult(HostIndex, HttpStatus);
+}
+
+void FDreamChunkDownload::OnDownloadComplete(const FString& Url, int TryNumber, int32 HttpStatus)
+{
+	// only handle completion once
+	check(!bHasCompleted);
+	bIsTransferring = false;
+
+	// update file size on disk
+	UpdateFileSize();
+
+	// report analytics
+	if (Downloader.Get()->OnDownloadAnalytics)
+	{
+		Downloader.Get()->OnDownloadAnalytics(PakFile->Entry.FileName, Url, PakFile->SizeOnDisk, FDateTime::UtcNow() - BeginTime, HttpStatus);
+	}
+
+	// handle success
+	if (EHttpResponseCodes::IsOk(HttpStatus))
+	{
+		// make sure the file is complete (the pak is only cached once this reports back)
+		StartVerification(Url, TryNumber);
+		return;
+	}
+
+	ScheduleRetry(TryNumber, HttpStatus);
+}
+
+void FDreamChunkDownload::ScheduleRetry(int TryNumber, int32 HttpStatus)
+{
+	// reserve the space again, a discarded file has to be downloaded whole
+	if (!ReserveDiskSpace())
+	{
+		// a download in flight may still fail or be cancelled and give its space back, wait in the queue like IssueDownloads does
+		if (Downloader.Get()->GetDiskSpaceLedger()->GetReservedBytes() > 0)
+		{
+			DCD_LOG(Log, TEXT("Waiting for disk space to retry %s (%lld bytes available)"), *PakFile->Entry.FileName, Downloader.Get()->GetDiskSpaceLedger()->GetAvailableBytes());
+			if (ReturnToQueue())
+			{
+				return;
+			}
+		}
+		DCD_LOG(Warning, TEXT("Unable to download '%s'. Needed %lld bytes, %lld bytes available"),
+		        *PakFile->Entry.FileName, ReservedDiskSpace, Downloader.Get()->GetDiskSpaceLedger()->GetAvailableBytes());
+		OnCompleted(false, LOCTEXT("NotEnoughSpace", "Not enough space on device."));
+		return;
+	}
+
+	// errors a retry can't fix are only retried on the other hosts
+	if (FDreamRetryPolicy::IsPermanentFailure(HttpStatus) && ++PermanentFailures >= Downloader.Get()->GetBuildBaseUrls().Num())
+	{
+		DCD_LOG(Error, TEXT("Giving up on %s, every host failed permanently (HTTP %d)"), *PakFile->Entry.FileName, HttpStatus);
+		OnCompleted(false, FText::Format(LOCTEXT("DownloadFailedPermanently", "Download of '{0}' failed (HTTP {1})."), FText::FromString(PakFile->Entry.FileName), FText::AsNumber(HttpStatus)));
+		return;
+	}
+
+	// retries draw from the budget of the session
+	TSharedPtr<FDreamRetryPolicy, ESPMode::ThreadSafe> RetryPolicy = Downloader.Get()->GetRetryPolicy();
+	if (!RetryPolicy->ConsumeRetry())
+	{
+		DCD_LOG(Error, TEXT("Giving up on %s, the retry budget of the session is spent"), *PakFile->Entry.FileName);
+		OnCompleted(false, LOCTEXT("RetryBudgetSpent", "Too many failed downloads, check your network connection."));
+		return;
+	}
+
+	// compute delay before re-starting download (backoff with jitter, or what the server asked for)
+	const float SecondsToDelay = RetryPolicy->GetRetryDelay(TryNumber);
+
 	// set a ticker to delay
 	DCD_LOG(Log, TEXT("Will re-attempt to download %s in %f seconds"), *PakFile->Entry.FileName, SecondsToDelay);
+	// the backoff can be paused, the pak is requeued and the ticker finds the download completed
 	TWeakPtr<FDreamChunkDownload> WeakThisPtr = AsShared();
+	bIsWaiting = true;
 	FTSTicker::GetCoreTicker().AddTicker(FTickerDelegate::CreateLambda([WeakThisPtr, TryNumber](float Unused)
 	{
 		TSharedPtr<FDreamChunkDownload> SharedThis = WeakThisPtr.Pin();
 		if (SharedThis.IsValid() && !SharedThis->bHasCompleted)
 		{
+			SharedThis->bIsWaiting = false;
 			SharedThis->StartDownload(TryNumber + 1);
 		}
 		return false;
@@ -211,9 +1696,10 @@ void FDreamChunkDownload::OnCompleted(bool bSuccess, const FText& ErrorText)
 	// make sure we don't complete more than once
 	check(!bHasCompleted);
 	bHasCompleted = true;
+	ReleaseDiskSpace();
 
 	// increment files downloaded
-	OnDownloadProgress(bSuccess ? PakFile->SizeOnDisk : 0);
+	OnDownloadProgress(bSuccess ? (int64)PakFile->SizeOnDisk : 0);
 	++Downloader.Get()->GetStats().FilesDownloaded;
 	if (!bSuccess && !ErrorText.IsEmpty())
 	{
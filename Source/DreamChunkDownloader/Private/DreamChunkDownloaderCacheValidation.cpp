@@ -0,0 +1,131 @@
+﻿// Copyright (C) 2025 Dream Moon, All Rights Reserved.
+
+
+#include "DreamChunkDownloaderCacheValidation.h"
+
+#include "Async/Async.h"
+
+#include "DreamChunkDownloaderLog.h"
+#include "DreamChunkDownloaderUtils.h"
+
+FDreamCacheValidation::FDreamCacheValidation(TArray<FFile>&& InFiles, int32 InParallelism, int64 InIoBytesPerSecond)
+	: Files(MoveTemp(InFiles))
+	  , Parallelism(FMath::Max(InParallelism, 1))
+	  , IoBudget((double)FMath::Max<int64>(InIoBytesPerSecond, 0))
+{
+	Results.Init(EResult::Pending, Files.Num());
+	CorruptBlocks.SetNum(Files.Num());
+}
+
+void FDreamCacheValidation::Start(FOnFileValidated InOnFileValidated, FOnFinished InOnFinished)
+{
+	check(Workers.Num() == 0);
+	OnFileValidated = MoveTemp(InOnFileValidated);
+	OnFinished = MoveTemp(InOnFinished);
+
+	// nothing to do, still finish asynchronously so callers see the same order of events
+	const int32 NumWorkers = FMath::Min(Parallelism, Files.Num());
+	if (NumWorkers <= 0)
+	{
+		TSharedRef<FDreamCacheValidation, ESPMode::ThreadSafe> SharedThis = AsShared();
+		AsyncTask(ENamedThreads::GameThread, [SharedThis]()
+		{
+			if (SharedThis->OnFinished)
+			{
+				SharedThis->OnFinished();
+			}
+		});
+		return;
+	}
+
+	DCD_LOG(Log, TEXT("Validating %d cached files on %d workers."), Files.Num(), NumWorkers);
+	WorkersRunning = NumWorkers;
+	for (int32 i = 0; i < NumWorkers; ++i)
+	{
+		TSharedRef<FDreamCacheValidation, ESPMode::ThreadSafe> SharedThis = AsShared();
+		Workers.Add(Async(EAsyncExecution::ThreadPool, [SharedThis]()
+		{
+			SharedThis->WorkerLoop();
+		}));
+	}
+}
+
+void FDreamCacheValidation::Cancel()
+{
+	bCancelled = true;
+}
+
+void FDreamCacheValidation::Wait()
+{
+	for (TFuture<void>& Worker : Workers)
+	{
+		if (Worker.IsValid())
+		{
+			Worker.Wait();
+		}
+	}
+}
+
+bool FDreamCacheValidation::IsCancelled() const
+{
+	return bCancelled;
+}
+
+void FDreamCacheValidation::WorkerLoop()
+{
+	TSharedRef<FDreamCacheValidation, ESPMode::ThreadSafe> SharedThis = AsShared();
+	while (!bCancelled)
+	{
+		// grab the next file
+		const int32 FileIndex = NextFileIndex++;
+		if (FileIndex >= Files.Num())
+		{
+			break;
+		}
+
+		// hash the file, paced by the shared read budget
+		const FFile& File = Files[FileIndex];
+		auto OnBlockRead = [this](int64 BytesRead)
+		{
+			IoBudget.Consume(BytesRead, &bCancelled);
+			return !bCancelled;
+		};
+		const bool bIsValid = FDreamChunkDownloaderUtils::CheckFileHash(File.FullPathOnDisk, File.FileVersion, OnBlockRead);
+
+		// find out which blocks have to be fetched again
+		if (!bIsValid && !bCancelled && File.BlockSize > 0)
+		{
+			if (!FDreamChunkDownloaderUtils::FindCorruptBlocks(File.FullPathOnDisk, File.BlockSize, File.BlockHashes, CorruptBlocks[FileIndex], OnBlockRead))
+			{
+				CorruptBlocks[FileIndex].Empty();
+			}
+		}
+
+		// an aborted hash says nothing about the file
+		if (bCancelled)
+		{
+			break;
+		}
+		Results[FileIndex] = bIsValid ? EResult::Valid : EResult::Invalid;
+
+		AsyncTask(ENamedThreads::GameThread, [SharedThis, FileIndex, bIsValid]()
+		{
+			if (SharedThis->OnFileValidated)
+			{
+				SharedThis->OnFileValidated(FileIndex, bIsValid);
+			}
+		});
+	}
+
+	// the last worker out reports the end (queued after every per-file callback)
+	if (--WorkersRunning == 0)
+	{
+		AsyncTask(ENamedThreads::GameThread, [SharedThis]()
+		{
+			if (SharedThis->OnFinished)
+			{
+				SharedThis->OnFinished();
+			}
+		});
+	}
+}
@@ -0,0 +1,108 @@
+﻿// Copyright (C) 2025 Dream Moon, All Rights Reserved.
+
+
+#include "DreamChunkDownloaderCircuitBreaker.h"
+
+#include "DreamChunkDownloaderLog.h"
+#include "DreamChunkDownloaderUtils.h"
+
+FDreamCircuitBreaker::FDreamCircuitBreaker(int32 InFailureThreshold, double InCooldownSeconds)
+	: FailureThreshold(FMath::Max(InFailureThreshold, 1))
+	  , CooldownSeconds(FMath::Max(InCooldownSeconds, 1.0))
+{
+}
+
+bool FDreamCircuitBreaker::IsAvailable(const FString& Host, double Now) const
+{
+	const FState* State = States.Find(Host);
+	return State == nullptr || State->State == EDreamCircuitState::Closed || NeedsProbe(Host, Now);
+}
+
+bool FDreamCircuitBreaker::NeedsProbe(const FString& Host, double Now) const
+{
+	const FState* State = States.Find(Host);
+	if (State == nullptr)
+	{
+		return false;
+	}
+	switch (State->State)
+	{
+	case EDreamCircuitState::Open:
+		return Now - State->OpenedTime >= CooldownSeconds;
+	case EDreamCircuitState::HalfOpen:
+		// the probe got lost (cancelled download), try another one
+		return Now - State->ProbeTime >= CooldownSeconds;
+	default:
+		return false;
+	}
+}
+
+void FDreamCircuitBreaker::OnRequestIssued(const FString& Host, double Now)
+{
+	FState* State = States.Find(Host);
+	if (State != nullptr && NeedsProbe(Host, Now))
+	{
+		DCD_LOG(Log, TEXT("Probing CDN host %s"), *Host);
+		State->State = EDreamCircuitState::HalfOpen;
+		State->ProbeTime = Now;
+	}
+}
+
+bool FDreamCircuitBreaker::OnResult(const FString& Host, int32 HttpStatus, double Now)
+{
+	// a missing file is not the host's fault, but it did answer
+	const bool bFailed = FDreamChunkDownloaderUtils::IsHostFailure(HttpStatus);
+	FState& State = States.FindOrAdd(Host);
+	const EDreamCircuitState OldState = State.State;
+
+	switch (State.State)
+	{
+	case EDreamCircuitState::Closed:
+		State.ConsecutiveFailures = bFailed ? State.ConsecutiveFailures + 1 : 0;
+		if (State.ConsecutiveFailures >= FailureThreshold)
+		{
+			DCD_LOG(Warning, TEXT("CDN host %s failed %d requests in a row (HTTP %d), taking it out of rotation for %.0f seconds"),
+			        *Host, State.ConsecutiveFailures, HttpStatus, CooldownSeconds);
+			State.State = EDreamCircuitState::Open;
+			State.OpenedTime = Now;
+		}
+		break;
+
+	case EDreamCircuitState::HalfOpen:
+		if (bFailed)
+		{
+			DCD_LOG(Warning, TEXT("Probe of CDN host %s failed (HTTP %d), keeping it out of rotation"), *Host, HttpStatus);
+			++State.ConsecutiveFailures;
+			State.State = EDreamCircuitState::Open;
+			State.OpenedTime = Now;
+		}
+		else
+		{
+			DCD_LOG(Log, TEXT("CDN host %s is back in rotation"), *Host);
+			State.ConsecutiveFailures = 0;
+			State.State = EDreamCircuitState::Closed;
+		}
+		break;
+
+	case EDreamCircuitState::Open:
+		// stragglers issued before the circuit opened don't change anything
+		break;
+	}
+	return State.State != OldState;
+}
+
+FDreamHostCircuit FDreamCircuitBreaker::GetCircuit(const FString& Host, double Now) const
+{
+	FDreamHostCircuit Circuit;
+	Circuit.Url = Host;
+	if (const FState* State = States.Find(Host))
+	{
+		Circuit.State = State->State;
+		Circuit.ConsecutiveFailures = State->ConsecutiveFailures;
+		if (State->State == EDreamCircuitState::Open)
+		{
+			Circuit.CooldownRemainingSeconds = (float)FMath::Max(CooldownSeconds - (Now - State->OpenedTime), 0.0);
+		}
+	}
+	return Circuit;
+}
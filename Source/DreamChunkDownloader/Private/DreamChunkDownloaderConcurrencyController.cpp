@@ -0,0 +1,139 @@
+﻿// Copyright (C) 2025 Dream Moon, All Rights Reserved.
+
+
+#include "DreamChunkDownloaderConcurrencyController.h"
+
+#include "DreamChunkDownloaderLog.h"
+#include "DreamChunkDownloaderUtils.h"
+#include "Interfaces/IHttpResponse.h"
+
+namespace DreamConcurrencyController
+{
+	/** Share of failed requests in a window that counts as congestion */
+	static constexpr double MAX_FAILURE_RATE = 0.2;
+
+	/** How far the average time to first byte may rise above the baseline before backing off */
+	static constexpr double MAX_FIRST_BYTE_INFLATION = 3.0;
+
+	/** Growth in throughput that justifies another download in flight */
+	static constexpr double MIN_THROUGHPUT_GAIN = 1.05;
+
+	/** Weight of a slower measurement when the baseline drifts up */
+	static constexpr double BASELINE_DRIFT = 0.05;
+}
+
+FDreamConcurrencyController::FDreamConcurrencyController(int32 InMinLimit, int32 InMaxLimit, int32 InInitialLimit, double InWindowSeconds)
+	: MinLimit(FMath::Max(InMinLimit, 1))
+	  , MaxLimit(FMath::Max(InMaxLimit, MinLimit))
+	  , WindowSeconds(FMath::Max(InWindowSeconds, 0.5))
+	  , Limit(FMath::Clamp(InInitialLimit, MinLimit, MaxLimit))
+{
+}
+
+void FDreamConcurrencyController::AddBytes(int64 Bytes)
+{
+	if (Bytes > 0)
+	{
+		WindowBytes += Bytes;
+	}
+}
+
+void FDreamConcurrencyController::AddFirstByteTime(double Seconds)
+{
+	if (Seconds >= 0.0)
+	{
+		WindowFirstByteSeconds += Seconds;
+		++WindowFirstByteCount;
+	}
+}
+
+void FDreamConcurrencyController::AddRequestResult(int32 HttpStatus)
+{
+	if (EHttpResponseCodes::IsOk(HttpStatus))
+	{
+		++WindowSuccesses;
+	}
+	else if (FDreamChunkDownloaderUtils::IsHostFailure(HttpStatus))
+	{
+		++WindowFailures;
+	}
+}
+
+bool FDreamConcurrencyController::Update(double Now, int32 NumWaitingDownloads)
+{
+	using namespace DreamConcurrencyController;
+
+	if (WindowStart <= 0.0)
+	{
+		ResetWindow(Now);
+	}
+	bWindowSaturated |= (NumWaitingDownloads > Limit);
+
+	const double Elapsed = Now - WindowStart;
+	if (Elapsed < WindowSeconds)
+	{
+		return false;
+	}
+
+	// nothing to learn from an idle window
+	const int32 Requests = WindowSuccesses + WindowFailures;
+	if (WindowBytes <= 0 && Requests == 0)
+	{
+		ResetWindow(Now);
+		return false;
+	}
+
+	const int32 OldLimit = Limit;
+	const double Throughput = (double)WindowBytes / Elapsed;
+	const double FirstByteSeconds = (WindowFirstByteCount > 0) ? (WindowFirstByteSeconds / WindowFirstByteCount) : 0.0;
+	const bool bFirstByteInflated = (WindowFirstByteCount > 0 && BaselineFirstByteSeconds > 0.0 && FirstByteSeconds > BaselineFirstByteSeconds * MAX_FIRST_BYTE_INFLATION);
+
+	if (WindowFailures > 0 && (double)WindowFailures / Requests >= MAX_FAILURE_RATE)
+	{
+		// requests are failing, back off hard
+		Limit = FMath::Max(MinLimit, Limit / 2);
+	}
+	else if (bFirstByteInflated)
+	{
+		// responses are queueing up somewhere, back off gently
+		Limit = FMath::Max(MinLimit, (Limit * 3) / 4);
+	}
+	else if (bWindowSaturated && Throughput >= LastThroughput * MIN_THROUGHPUT_GAIN)
+	{
+		// more work is waiting and the last step paid off, probe for more
+		Limit = FMath::Min(MaxLimit, Limit + 1);
+	}
+
+	// track the best time to first byte, drifting up slowly
+	if (WindowFirstByteCount > 0)
+	{
+		if (BaselineFirstByteSeconds <= 0.0 || FirstByteSeconds < BaselineFirstByteSeconds)
+		{
+			BaselineFirstByteSeconds = FirstByteSeconds;
+		}
+		else
+		{
+			BaselineFirstByteSeconds += (FirstByteSeconds - BaselineFirstByteSeconds) * BASELINE_DRIFT;
+		}
+	}
+	LastThroughput = Throughput;
+
+	if (Limit != OldLimit)
+	{
+		DCD_LOG(Log, TEXT("Downloads in flight %d -> %d (%.0f bytes/s, %d/%d requests failed, %.3fs to first byte)"),
+		        OldLimit, Limit, Throughput, WindowFailures, Requests, FirstByteSeconds);
+	}
+	ResetWindow(Now);
+	return Limit != OldLimit;
+}
+
+void FDreamConcurrencyController::ResetWindow(double Now)
+{
+	WindowStart = Now;
+	WindowBytes = 0;
+	WindowSuccesses = 0;
+	WindowFailures = 0;
+	WindowFirstByteSeconds = 0.0;
+	WindowFirstByteCount = 0;
+	bWindowSaturated = false;
+}
@@ -0,0 +1,110 @@
+﻿// Copyright (C) 2025 Dream Moon, All Rights Reserved.
+
+
+#include "DreamChunkDownloaderContentChunkStore.h"
+
+#include "HAL/PlatformFile.h"
+
+#include "DreamChunkDownloaderHashRegistry.h"
+#include "DreamChunkDownloaderIncrementalHash.h"
+#include "DreamChunkDownloaderLog.h"
+#include "DreamChunkDownloaderTypes.h"
+
+FString FDreamContentChunkStore::GetChunkFileName(const FString& ChunkHash)
+{
+	// hashes come from the manifest, never let them escape the folder
+	FString FileName = ChunkHash;
+	for (TCHAR& Character : FileName.GetCharArray())
+	{
+		if (Character != TEXT('\0') && !FChar::IsAlnum(Character))
+		{
+			Character = TEXT('-');
+		}
+	}
+	return FileName;
+}
+
+void FDreamContentChunkStore::AddSources(const TArray<FDreamContentChunk>& Chunks, const FString& Path, TMap<FString, FSource>& OutIndex)
+{
+	int64 Offset = 0;
+	for (const FDreamContentChunk& Chunk : Chunks)
+	{
+		if (!OutIndex.Contains(Chunk.Hash))
+		{
+			FSource& Source = OutIndex.Add(Chunk.Hash);
+			Source.Path = Path;
+			Source.Offset = Offset;
+		}
+		Offset += Chunk.Size;
+	}
+}
+
+bool FDreamContentChunkStore::Assemble(const TArray<FDreamContentChunk>& Chunks, const TArray<FSource>& Sources, const FString& OutputPath, FDreamIncrementalFileHash* OutputHash, TArray<int32>& OutBadChunks)
+{
+	check(Chunks.Num() == Sources.Num());
+	OutBadChunks.Empty();
+
+	IPlatformFile& PlatformFile = IPlatformFile::GetPlatformPhysical();
+	TUniquePtr<IFileHandle> OutputFile(PlatformFile.OpenWrite(*OutputPath));
+	if (!OutputFile.IsValid())
+	{
+		DCD_LOG(Error, TEXT("Unable to open %s to assemble content chunks."), *OutputPath);
+		return false;
+	}
+	if (OutputHash != nullptr)
+	{
+		OutputHash->Reset();
+	}
+
+	// chunks are checked before they are written, so each one is read whole
+	TMap<FString, TUniquePtr<IFileHandle>> SourceFiles;
+	TArray<uint8> Buffer;
+	int64 OutputOffset = 0;
+	for (int32 ChunkIndex = 0; ChunkIndex < Chunks.Num(); ++ChunkIndex)
+	{
+		const FDreamContentChunk& Chunk = Chunks[ChunkIndex];
+		const FSource& Source = Sources[ChunkIndex];
+
+		TUniquePtr<IFileHandle>* SourceFile = SourceFiles.Find(Source.Path);
+		if (SourceFile == nullptr)
+		{
+			SourceFile = &SourceFiles.Add(Source.Path, TUniquePtr<IFileHandle>(PlatformFile.OpenRead(*Source.Path)));
+		}
+
+		Buffer.SetNumUninitialized((int32)Chunk.Size);
+		TUniquePtr<IDreamHasher> Hasher = FDreamHashRegistry::Get().CreateHasher(Chunk.Hash);
+		if (!SourceFile->IsValid() || !Hasher.IsValid() || !(*SourceFile)->Seek(Source.Offset) || !(*SourceFile)->Read(Buffer.GetData(), Chunk.Size))
+		{
+			DCD_LOG(Warning, TEXT("Unable to read content chunk %s from %s."), *Chunk.Hash, *Source.Path);
+			OutBadChunks.Add(ChunkIndex);
+			continue;
+		}
+
+		Hasher->Update(Buffer.GetData(), Chunk.Size);
+		if (!FDreamHashRegistry::FileVersionsMatch(FDreamHashRegistry::MakeFileVersion(Chunk.Hash, *Hasher), Chunk.Hash))
+		{
+			DCD_LOG(Warning, TEXT("Content chunk %s read from %s does not match its hash."), *Chunk.Hash, *Source.Path);
+			OutBadChunks.Add(ChunkIndex);
+			continue;
+		}
+
+		// keep checking the remaining chunks once the output is broken so they can all be refetched
+		if (OutBadChunks.Num() > 0)
+		{
+			continue;
+		}
+
+		if (!OutputFile->Write(Buffer.GetData(), Chunk.Size))
+		{
+			DCD_LOG(Error, TEXT("Failed to write %s at offset %lld."), *OutputPath, OutputOffset);
+			return false;
+		}
+		if (OutputHash != nullptr)
+		{
+			OutputHash->Update(OutputOffset, Buffer.GetData(), Chunk.Size);
+		}
+		OutputOffset += Chunk.Size;
+	}
+
+	return OutBadChunks.Num() == 0 && OutputFile->Flush();
+}
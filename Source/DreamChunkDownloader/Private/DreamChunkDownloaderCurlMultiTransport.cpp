@@ -0,0 +1,476 @@
+﻿// Copyright (C) 2025 Dream Moon, All Rights Reserved.
+
+
+#include "DreamChunkDownloaderCurlMultiTransport.h"
+
+#if DCD_WITH_CURL_MULTI
+
+#include "DreamChunkDownloaderFileSink.h"
+#include "DreamChunkDownloaderLog.h"
+#include "DreamChunkDownloaderRetryPolicy.h"
+#include "DreamChunkDownloaderSettings.h"
+#include "DreamChunkDownloaderTokenBucket.h"
+#include "HAL/PlatformTime.h"
+#include "HAL/RunnableThread.h"
+#include "Misc/Paths.h"
+#include "Misc/ScopeLock.h"
+#include "PlatformHttp.h"
+
+THIRD_PARTY_INCLUDES_START
+#include "curl/curl.h"
+THIRD_PARTY_INCLUDES_END
+
+// curl_multi_poll and curl_multi_wakeup arrived in 7.68, older versions poll with a short timeout
+#define DCD_CURL_HAS_WAKEUP (LIBCURL_VERSION_NUM >= 0x074400)
+
+namespace
+{
+	/** Where Linux distributions keep their CA bundle (the static libcurl of the engine has no default) */
+	const TCHAR* CA_BUNDLE_PATHS[] = {
+		TEXT("/etc/pki/tls/certs/ca-bundle.crt"),
+		TEXT("/etc/ssl/certs/ca-certificates.crt"),
+		TEXT("/etc/ssl/ca-bundle.pem"),
+	};
+
+	/** Largest receive buffer libcurl accepts */
+	const int32 MAX_CURL_BUFFER_SIZE = 512 * 1024;
+
+	/** Longest time the thread sleeps before looking at cancelled transfers again (milliseconds) */
+	const int32 POLL_TIMEOUT_MS = DCD_CURL_HAS_WAKEUP ? 250 : 10;
+}
+
+struct FDreamCurlMultiDownloadTransport::FTransfer
+{
+	/** URL of the source */
+	FString Url;
+
+	/** Path of the file being written */
+	FString TargetFile;
+
+	/** Range of the transfer */
+	FDreamTransferRange Range;
+
+	/** Receive buffer size requested from libcurl */
+	int32 BufferSize = 0;
+
+	/** Sink the body is written to */
+	TSharedPtr<FDreamChunkDownloadFileSink, ESPMode::ThreadSafe> Sink;
+
+	/** Hands progress to the game thread */
+	TSharedPtr<FDreamGameThreadProgress, ESPMode::ThreadSafe> Progress;
+
+	/** Receives the final status on the game thread */
+	FDreamDownloadComplete Callback;
+
+	/** Told about Retry-After headers (optional) */
+	TSharedPtr<FDreamRetryPolicy, ESPMode::ThreadSafe> RetryPolicy;
+
+	/** Bandwidth limit the body is paced with (optional) */
+	TSharedPtr<FDreamTokenBucket, ESPMode::ThreadSafe> Bandwidth;
+
+	/** libcurl easy handle */
+	CURL* EasyHandle = nullptr;
+
+	/** Request headers */
+	curl_slist* Headers = nullptr;
+
+	/** Content-Range header of the final response */
+	FString ContentRange;
+
+	/** Retry-After header of the final response */
+	FString RetryAfter;
+
+	/** Number of body bytes received */
+	uint64 BytesReceived = 0;
+
+	/** Set by the cancel callback */
+	std::atomic<bool> bCancelled{false};
+
+	/** Time before which no more body data is taken (bandwidth limit, transport thread only) */
+	double ResumeTime = 0.0;
+
+	/** Rate generation of the bandwidth when the wait was computed (a rate change ends the wait) */
+	uint32 BandwidthGeneration = 0;
+
+	/** Whether libcurl was told to pause the body until ResumeTime */
+	bool bPaused = false;
+
+	/**
+	 * Body data callback of libcurl, writes straight from the receive buffer into the sink
+	 */
+	static size_t OnWrite(char* Data, size_t Size, size_t Count, void* UserData)
+	{
+		FTransfer* Transfer = static_cast<FTransfer*>(UserData);
+		const size_t Length = Size * Count;
+		if (Transfer->bCancelled)
+		{
+			return 0;
+		}
+
+		// over the bandwidth limit, libcurl keeps the block and stops reading this connection (the thread serves the others meanwhile)
+		if (Transfer->ResumeTime > FPlatformTime::Seconds() && Transfer->Bandwidth->GetRateGeneration() == Transfer->BandwidthGeneration)
+		{
+			Transfer->bPaused = true;
+			return CURL_WRITEFUNC_PAUSE;
+		}
+
+		// look at the headers once, before the first block is written
+		if (!Transfer->Sink->HasBegunResponse())
+		{
+			long HttpStatus = 0;
+			curl_easy_getinfo(Transfer->EasyHandle, CURLINFO_RESPONSE_CODE, &HttpStatus);
+			Transfer->Sink->BeginResponse((int32)HttpStatus, Transfer->ContentRange);
+		}
+
+		// returning less than Length aborts the transfer (write error)
+		if (!Transfer->Sink->Write(reinterpret_cast<const uint8*>(Data), (int64)Length))
+		{
+			return 0;
+		}
+		Transfer->BytesReceived += Length;
+		Transfer->Progress->Report(Transfer->BytesReceived);
+
+		// take our share of the bandwidth, the wait is served by pausing before the next block
+		if (Transfer->Bandwidth.IsValid())
+		{
+			Transfer->BandwidthGeneration = Transfer->Bandwidth->GetRateGeneration();
+			const double SecondsToWait = Transfer->Bandwidth->Reserve((int64)Length);
+			Transfer->ResumeTime = (SecondsToWait > 0.0) ? FPlatformTime::Seconds() + SecondsToWait : 0.0;
+		}
+		return Length;
+	}
+
+	/**
+	 * Header callback of libcurl, keeps the headers we care about
+	 */
+	static size_t OnHeader(char* Data, size_t Size, size_t Count, void* UserData)
+	{
+		FTransfer* Transfer = static_cast<FTransfer*>(UserData);
+		const size_t Length = Size * Count;
+		const FUTF8ToTCHAR Converted(Data, (int32)Length);
+		const FString Line = FString(Converted.Length(), Converted.Get()).TrimStartAndEnd();
+
+		// every response (redirects included) starts with a status line
+		if (Line.StartsWith(TEXT("HTTP/")))
+		{
+			Transfer->ContentRange.Reset();
+			Transfer->RetryAfter.Reset();
+			return Length;
+		}
+
+		FString Name, Value;
+		if (Line.Split(TEXT(":"), &Name, &Value))
+		{
+			Name.TrimEndInline();
+			if (Name.Equals(TEXT("Content-Range"), ESearchCase::IgnoreCase))
+			{
+				Transfer->ContentRange = Value.TrimStartAndEnd();
+			}
+			else if (Name.Equals(TEXT("Retry-After"), ESearchCase::IgnoreCase))
+			{
+				Transfer->RetryAfter = Value.TrimStartAndEnd();
+			}
+		}
+		return Length;
+	}
+};
+
+FDreamCurlMultiDownloadTransport::~FDreamCurlMultiDownloadTransport()
+{
+	Shutdown();
+}
+
+bool FDreamCurlMultiDownloadTransport::CanHandle(const FString& Url) const
+{
+	return UDreamChunkDownloaderSettings::Get()->bUseCurlMultiTransport &&
+		(Url.StartsWith(TEXT("http://"), ESearchCase::IgnoreCase) || Url.StartsWith(TEXT("https://"), ESearchCase::IgnoreCase));
+}
+
+FDreamDownloadCancel FDreamCurlMultiDownloadTransport::Download(const FString& Url, const FString& TargetFile, const FDreamStreamDownloadOptions& Options,
+                                                                const FDreamDownloadProgress& Progress, const FDreamDownloadComplete& Callback)
+{
+	// libcurl always streams, there is no in-memory fallback to pick
+	const FDreamTransferRange Range = FDreamTransferRange::Make(TargetFile, Options);
+	TSharedPtr<FDreamChunkDownloadFileSink, ESPMode::ThreadSafe> Sink = CreateFileSink(TargetFile, Options, Range);
+	if (!Sink.IsValid() || !EnsureStarted())
+	{
+		CompleteOnGameThread(Callback, 0);
+		return []() {};
+	}
+
+	TSharedPtr<FTransfer, ESPMode::ThreadSafe> Transfer = MakeShared<FTransfer, ESPMode::ThreadSafe>();
+	Transfer->Url = Url;
+	Transfer->TargetFile = TargetFile;
+	Transfer->Range = Range;
+	Transfer->BufferSize = FMath::Clamp(Options.WriteBufferSize, CURL_MAX_WRITE_SIZE, MAX_CURL_BUFFER_SIZE);
+	Transfer->Sink = Sink;
+	Transfer->Progress = MakeShared<FDreamGameThreadProgress, ESPMode::ThreadSafe>(Progress);
+	Transfer->Callback = Callback;
+	Transfer->RetryPolicy = Options.RetryPolicy;
+	Transfer->Bandwidth = Options.Bandwidth;
+	NewTransfers.Enqueue(Transfer);
+#if DCD_CURL_HAS_WAKEUP
+	curl_multi_wakeup(MultiHandle);
+#endif
+
+	// a transfer receiving data aborts right away, a stalled one when the thread next wakes up
+	return [Transfer]()
+	{
+		Transfer->bCancelled = true;
+	};
+}
+
+void FDreamCurlMultiDownloadTransport::Shutdown()
+{
+	FScopeLock ScopeLock(&StartLock);
+	if (Thread != nullptr)
+	{
+		// Kill calls Stop and waits for Run to return (which fails every transfer left)
+		Thread->Kill(true);
+		delete Thread;
+		Thread = nullptr;
+	}
+	if (MultiHandle != nullptr)
+	{
+		curl_multi_cleanup(MultiHandle);
+		MultiHandle = nullptr;
+		curl_global_cleanup();
+	}
+}
+
+bool FDreamCurlMultiDownloadTransport::EnsureStarted()
+{
+	FScopeLock ScopeLock(&StartLock);
+	if (Thread != nullptr)
+	{
+		return true;
+	}
+	if (bStopping)
+	{
+		return false;
+	}
+
+	curl_global_init(CURL_GLOBAL_ALL);
+	MultiHandle = curl_multi_init();
+	if (MultiHandle == nullptr)
+	{
+		DCD_LOG(Error, TEXT("Unable to create the libcurl multi handle"));
+		curl_global_cleanup();
+		return false;
+	}
+
+	Thread = FRunnableThread::Create(this, TEXT("DreamCurlMultiTransport"), 0, TPri_AboveNormal);
+	if (Thread == nullptr)
+	{
+		DCD_LOG(Error, TEXT("Unable to create the libcurl transport thread"));
+		curl_multi_cleanup(MultiHandle);
+		MultiHandle = nullptr;
+		curl_global_cleanup();
+		return false;
+	}
+	return true;
+}
+
+bool FDreamCurlMultiDownloadTransport::StartTransfer(const TSharedPtr<FTransfer, ESPMode::ThreadSafe>& Transfer)
+{
+	CURL* EasyHandle = curl_easy_init();
+	if (EasyHandle == nullptr)
+	{
+		return false;
+	}
+	Transfer->EasyHandle = EasyHandle;
+
+	curl_easy_setopt(EasyHandle, CURLOPT_URL, TCHAR_TO_UTF8(*Transfer->Url));
+	curl_easy_setopt(EasyHandle, CURLOPT_PRIVATE, Transfer.Get());
+	curl_easy_setopt(EasyHandle, CURLOPT_WRITEFUNCTION, &FTransfer::OnWrite);
+	curl_easy_setopt(EasyHandle, CURLOPT_WRITEDATA, Transfer.Get());
+	curl_easy_setopt(EasyHandle, CURLOPT_HEADERFUNCTION, &FTransfer::OnHeader);
+	curl_easy_setopt(EasyHandle, CURLOPT_HEADERDATA, Transfer.Get());
+	curl_easy_setopt(EasyHandle, CURLOPT_BUFFERSIZE, (long)Transfer->BufferSize);
+	curl_easy_setopt(EasyHandle, CURLOPT_FOLLOWLOCATION, 1L);
+	curl_easy_setopt(EasyHandle, CURLOPT_MAXREDIRS, 5L);
+	curl_easy_setopt(EasyHandle, CURLOPT_NOSIGNAL, 1L);
+	curl_easy_setopt(EasyHandle, CURLOPT_CONNECTTIMEOUT, 30L);
+	curl_easy_setopt(EasyHandle, CURLOPT_USERAGENT, TCHAR_TO_UTF8(*FPlatformHttp::GetDefaultUserAgent()));
+
+	// a transfer that stops moving counts as a dropped connection
+	curl_easy_setopt(EasyHandle, CURLOPT_LOW_SPEED_LIMIT, 1L);
+	curl_easy_setopt(EasyHandle, CURLOPT_LOW_SPEED_TIME, 60L);
+
+	for (const TCHAR* CaBundlePath : CA_BUNDLE_PATHS)
+	{
+		if (FPaths::FileExists(CaBundlePath))
+		{
+			curl_easy_setopt(EasyHandle, CURLOPT_CAINFO, TCHAR_TO_UTF8(CaBundlePath));
+			break;
+		}
+	}
+
+	// do a range request for the part we're missing (compressed bodies are decoded by the sink, not by libcurl)
+	if (Transfer->Range.bIsCompressed)
+	{
+		Transfer->Headers = curl_slist_append(Transfer->Headers, "Accept-Encoding: identity");
+	}
+	const FString RangeHeader = Transfer->Range.GetRangeHeader();
+	if (!RangeHeader.IsEmpty())
+	{
+		Transfer->Headers = curl_slist_append(Transfer->Headers, TCHAR_TO_UTF8(*(TEXT("Range: ") + RangeHeader)));
+	}
+	if (Transfer->Headers != nullptr)
+	{
+		curl_easy_setopt(EasyHandle, CURLOPT_HTTPHEADER, Transfer->Headers);
+	}
+
+	if (curl_multi_add_handle(MultiHandle, EasyHandle) != CURLM_OK)
+	{
+		return false;
+	}
+	ActiveTransfers.Add(Transfer);
+	return true;
+}
+
+void FDreamCurlMultiDownloadTransport::FinishTransfer(const TSharedPtr<FTransfer, ESPMode::ThreadSafe>& Transfer, int32 CurlResult)
+{
+	long HttpStatus = 0;
+	if (Transfer->EasyHandle != nullptr)
+	{
+		curl_easy_getinfo(Transfer->EasyHandle, CURLINFO_RESPONSE_CODE, &HttpStatus);
+		curl_multi_remove_handle(MultiHandle, Transfer->EasyHandle);
+		curl_easy_cleanup(Transfer->EasyHandle);
+		Transfer->EasyHandle = nullptr;
+	}
+	if (Transfer->Headers != nullptr)
+	{
+		curl_slist_free_all(Transfer->Headers);
+		Transfer->Headers = nullptr;
+	}
+
+	// a write error or a refused response still got a response, anything else that failed is a dropped connection
+	const bool bGotResponse = (CurlResult == CURLE_OK) || ((Transfer->Sink->HasError() || Transfer->Sink->HasRejectedResponse()) && !Transfer->bCancelled);
+	if (!bGotResponse)
+	{
+		DCD_LOG(Verbose, TEXT("libcurl transfer of '%s' ended with %hs"), *Transfer->Url, curl_easy_strerror((CURLcode)CurlResult));
+		HttpStatus = 0;
+	}
+	else if (Transfer->RetryPolicy.IsValid())
+	{
+		Transfer->RetryPolicy->NoteResponse((int32)HttpStatus, Transfer->RetryAfter);
+	}
+
+	const int32 FinalStatus = FinishResponse(*Transfer->Sink, Transfer->Url, Transfer->TargetFile, Transfer->Range, bGotResponse, (int32)HttpStatus, Transfer->ContentRange);
+	Transfer->Progress->Complete();
+	CompleteOnGameThread(Transfer->Callback, FinalStatus);
+}
+
+int32 FDreamCurlMultiDownloadTransport::ResumePausedTransfers()
+{
+	int32 PollTimeoutMs = POLL_TIMEOUT_MS;
+	const double Now = FPlatformTime::Seconds();
+	for (int32 Idx = 0; Idx < ActiveTransfers.Num(); ++Idx)
+	{
+		FTransfer& Transfer = *ActiveTransfers[Idx];
+		if (!Transfer.bPaused)
+		{
+			continue;
+		}
+
+		if (Transfer.ResumeTime <= Now || Transfer.Bandwidth->GetRateGeneration() != Transfer.BandwidthGeneration)
+		{
+			// the held block is delivered to OnWrite right away
+			Transfer.bPaused = false;
+			Transfer.ResumeTime = 0.0;
+			curl_easy_pause(Transfer.EasyHandle, CURLPAUSE_CONT);
+		}
+		else
+		{
+			// wake up in time to resume it
+			PollTimeoutMs = FMath::Min(PollTimeoutMs, FMath::Max(FMath::CeilToInt((Transfer.ResumeTime - Now) * 1000.0), 1));
+		}
+	}
+	return PollTimeoutMs;
+}
+
+uint32 FDreamCurlMultiDownloadTransport::Run()
+{
+	while (!bStopping)
+	{
+		// pick up new transfers
+		TSharedPtr<FTransfer, ESPMode::ThreadSafe> NewTransfer;
+		while (NewTransfers.Dequeue(NewTransfer))
+		{
+			if (NewTransfer->bCancelled || !StartTransfer(NewTransfer))
+			{
+				FinishTransfer(NewTransfer, CURLE_ABORTED_BY_CALLBACK);
+			}
+		}
+
+		// drop cancelled transfers that aren't writing (a writing one aborts in OnWrite)
+		for (int32 Idx = ActiveTransfers.Num() - 1; Idx >= 0; --Idx)
+		{
+			if (ActiveTransfers[Idx]->bCancelled)
+			{
+				TSharedPtr<FTransfer, ESPMode::ThreadSafe> Transfer = ActiveTransfers[Idx];
+				ActiveTransfers.RemoveAtSwap(Idx);
+				FinishTransfer(Transfer, CURLE_ABORTED_BY_CALLBACK);
+			}
+		}
+
+		// let paused transfers read again once their share of the bandwidth is back (or the rate changed)
+		const int32 PollTimeoutMs = ResumePausedTransfers();
+
+		int RunningHandles = 0;
+		curl_multi_perform(MultiHandle, &RunningHandles);
+
+		// report the transfers that are done
+		int MessagesLeft = 0;
+		while (CURLMsg* Message = curl_multi_info_read(MultiHandle, &MessagesLeft))
+		{
+			if (Message->msg != CURLMSG_DONE)
+			{
+				continue;
+			}
+			for (int32 Idx = 0; Idx < ActiveTransfers.Num(); ++Idx)
+			{
+				if (ActiveTransfers[Idx]->EasyHandle == Message->easy_handle)
+				{
+					TSharedPtr<FTransfer, ESPMode::ThreadSafe> Transfer = ActiveTransfers[Idx];
+					ActiveTransfers.RemoveAtSwap(Idx);
+					FinishTransfer(Transfer, Message->data.result);
+					break;
+				}
+			}
+		}
+
+#if DCD_CURL_HAS_WAKEUP
+		curl_multi_poll(MultiHandle, nullptr, 0, PollTimeoutMs, nullptr);
+#else
+		curl_multi_wait(MultiHandle, nullptr, 0, PollTimeoutMs, nullptr);
+#endif
+	}
+
+	// fail whatever is left, the partial files are kept for the next session
+	for (const TSharedPtr<FTransfer, ESPMode::ThreadSafe>& Transfer : ActiveTransfers)
+	{
+		FinishTransfer(Transfer, CURLE_ABORTED_BY_CALLBACK);
+	}
+	ActiveTransfers.Empty();
+	TSharedPtr<FTransfer, ESPMode::ThreadSafe> NewTransfer;
+	while (NewTransfers.Dequeue(NewTransfer))
+	{
+		FinishTransfer(NewTransfer, CURLE_ABORTED_BY_CALLBACK);
+	}
+	return 0;
+}
+
+void FDreamCurlMultiDownloadTransport::Stop()
+{
+	bStopping = true;
+#if DCD_CURL_HAS_WAKEUP
+	if (MultiHandle != nullptr)
+	{
+		curl_multi_wakeup(MultiHandle);
+	}
+#endif
+}
+
+#endif // DCD_WITH_CURL_MULTI
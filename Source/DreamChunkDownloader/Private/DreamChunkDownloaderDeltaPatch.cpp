@@ -0,0 +1,156 @@
+﻿// Copyright (C) 2025 Dream Moon, All Rights Reserved.
+
+
+#include "DreamChunkDownloaderDeltaPatch.h"
+
+#include "HAL/PlatformFile.h"
+
+#include "DreamChunkDownloaderIncrementalHash.h"
+#include "DreamChunkDownloaderLog.h"
+
+namespace DreamDeltaPatch
+{
+	static const uint8 MAGIC[8] = {'D', 'C', 'D', 'P', 'A', 'T', 'C', 'H'};
+	static const uint32 FORMAT_VERSION = 1;
+
+	enum EOpCode : uint8
+	{
+		End = 0,
+		Copy = 1,
+		Insert = 2,
+	};
+
+	// copy in 64K chunks to prevent raising the memory high water mark too much
+	static const int64 COPY_BUFFER_SIZE = 64 * 1024;
+
+	static bool ReadUInt32(IFileHandle& File, uint32& OutValue)
+	{
+		uint8 Bytes[4];
+		if (!File.Read(Bytes, sizeof(Bytes)))
+		{
+			return false;
+		}
+		OutValue = (uint32)Bytes[0] | ((uint32)Bytes[1] << 8) | ((uint32)Bytes[2] << 16) | ((uint32)Bytes[3] << 24);
+		return true;
+	}
+
+	static bool ReadInt64(IFileHandle& File, int64& OutValue)
+	{
+		uint8 Bytes[8];
+		if (!File.Read(Bytes, sizeof(Bytes)))
+		{
+			return false;
+		}
+		uint64 Value = 0;
+		for (int32 i = 7; i >= 0; --i)
+		{
+			Value = (Value << 8) | Bytes[i];
+		}
+		OutValue = (int64)Value;
+		return true;
+	}
+
+	static bool CopyRange(IFileHandle& Source, int64 Length, IFileHandle& Output, int64& OutputOffset, FDreamIncrementalFileHash* OutputHash, TArray<uint8>& Buffer)
+	{
+		while (Length > 0)
+		{
+			const int64 SizeToCopy = FMath::Min(Length, COPY_BUFFER_SIZE);
+			if (!Source.Read(Buffer.GetData(), SizeToCopy) || !Output.Write(Buffer.GetData(), SizeToCopy))
+			{
+				return false;
+			}
+			if (OutputHash != nullptr)
+			{
+				OutputHash->Update(OutputOffset, Buffer.GetData(), SizeToCopy);
+			}
+			OutputOffset += SizeToCopy;
+			Length -= SizeToCopy;
+		}
+		return true;
+	}
+}
+
+bool FDreamDeltaPatch::Apply(const FString& BasePath, const FString& PatchPath, const FString& OutputPath, int64 OutputSize, FDreamIncrementalFileHash* OutputHash)
+{
+	using namespace DreamDeltaPatch;
+
+	IPlatformFile& PlatformFile = IPlatformFile::GetPlatformPhysical();
+	TUniquePtr<IFileHandle> BaseFile(PlatformFile.OpenRead(*BasePath));
+	TUniquePtr<IFileHandle> PatchFile(PlatformFile.OpenRead(*PatchPath));
+	if (!BaseFile.IsValid() || !PatchFile.IsValid())
+	{
+		DCD_LOG(Error, TEXT("Unable to open %s or %s to apply the patch."), *BasePath, *PatchPath);
+		return false;
+	}
+
+	// check the header
+	uint8 Magic[sizeof(MAGIC)];
+	uint32 FormatVersion = 0;
+	int64 PatchOutputSize = 0;
+	if (!PatchFile->Read(Magic, sizeof(Magic)) || FMemory::Memcmp(Magic, MAGIC, sizeof(MAGIC)) != 0 ||
+		!ReadUInt32(*PatchFile, FormatVersion) || FormatVersion != FORMAT_VERSION ||
+		!ReadInt64(*PatchFile, PatchOutputSize) || PatchOutputSize != OutputSize)
+	{
+		DCD_LOG(Error, TEXT("%s is not a valid patch for a %lld byte file."), *PatchPath, OutputSize);
+		return false;
+	}
+
+	TUniquePtr<IFileHandle> OutputFile(PlatformFile.OpenWrite(*OutputPath));
+	if (!OutputFile.IsValid())
+	{
+		DCD_LOG(Error, TEXT("Unable to open %s to write the patched file."), *OutputPath);
+		return false;
+	}
+	if (OutputHash != nullptr)
+	{
+		OutputHash->Reset();
+	}
+
+	const int64 BaseSize = BaseFile->Size();
+	TArray<uint8> Buffer;
+	Buffer.SetNumUninitialized(COPY_BUFFER_SIZE);
+	int64 OutputOffset = 0;
+	for (;;)
+	{
+		uint8 OpCode = 0;
+		if (!PatchFile->Read(&OpCode, 1))
+		{
+			DCD_LOG(Error, TEXT("%s is truncated at offset %lld."), *PatchPath, PatchFile->Tell());
+			return false;
+		}
+
+		if (OpCode == EOpCode::End)
+		{
+			break;
+		}
+
+		int64 Offset = 0, Length = 0;
+		bool bOpIsValid = false;
+		if (OpCode == EOpCode::Copy)
+		{
+			// unchanged bytes of the base file
+			bOpIsValid = ReadInt64(*PatchFile, Offset) && ReadInt64(*PatchFile, Length) &&
+				Offset >= 0 && Length >= 0 && Offset <= BaseSize - Length && Length <= OutputSize - OutputOffset &&
+				BaseFile->Seek(Offset) && CopyRange(*BaseFile, Length, *OutputFile, OutputOffset, OutputHash, Buffer);
+		}
+		else if (OpCode == EOpCode::Insert)
+		{
+			// new bytes carried by the patch
+			bOpIsValid = ReadInt64(*PatchFile, Length) && Length >= 0 && Length <= OutputSize - OutputOffset &&
+				CopyRange(*PatchFile, Length, *OutputFile, OutputOffset, OutputHash, Buffer);
+		}
+
+		if (!bOpIsValid)
+		{
+			DCD_LOG(Error, TEXT("Failed to apply operation %d of %s at output offset %lld."), (int32)OpCode, *PatchPath, OutputOffset);
+			return false;
+		}
+	}
+
+	if (OutputOffset != OutputSize || PatchFile->Tell() != PatchFile->Size() || !OutputFile->Flush())
+	{
+		DCD_LOG(Error, TEXT("Patching with %s produced %lld of %lld bytes."), *PatchPath, OutputOffset, OutputSize);
+		return false;
+	}
+	return true;
+}
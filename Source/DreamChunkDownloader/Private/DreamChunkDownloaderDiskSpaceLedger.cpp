@@ -0,0 +1,81 @@
+﻿// Copyright (C) 2025 Dream Moon, All Rights Reserved.
+
+
+#include "DreamChunkDownloaderDiskSpaceLedger.h"
+
+#include "DreamChunkDownloaderLog.h"
+#include "HAL/PlatformMisc.h"
+
+FDreamDiskSpaceLedger::FDreamDiskSpaceLedger(const FString& InFolder)
+	: Folder(InFolder)
+{
+}
+
+bool FDreamDiskSpaceLedger::Reserve(const FString& FileName, int64 Bytes)
+{
+	Bytes = FMath::Max<int64>(Bytes, 0);
+	const int64 PreviousBytes = Reservations.FindRef(FileName);
+
+	// the other downloads are going to use their reservations whatever happens to this one
+	int64 FreeBytes = 0;
+	if (Bytes > 0 && GetFreeBytes(FreeBytes))
+	{
+		const int64 OtherBytes = ReservedBytes - PreviousBytes;
+		if (FreeBytes - OtherBytes < Bytes)
+		{
+			DCD_LOG(Verbose, TEXT("Unable to reserve %lld bytes for %s (%lld bytes free, %lld reserved by other downloads)"), Bytes, *FileName, FreeBytes, OtherBytes);
+			return false;
+		}
+	}
+
+	ReservedBytes += Bytes - PreviousBytes;
+	Reservations.Add(FileName, Bytes);
+	return true;
+}
+
+void FDreamDiskSpaceLedger::Reduce(const FString& FileName, int64 RemainingBytes)
+{
+	RemainingBytes = FMath::Max<int64>(RemainingBytes, 0);
+	int64* Bytes = Reservations.Find(FileName);
+	if (Bytes != nullptr && RemainingBytes < *Bytes)
+	{
+		ReservedBytes -= *Bytes - RemainingBytes;
+		*Bytes = RemainingBytes;
+	}
+}
+
+void FDreamDiskSpaceLedger::Release(const FString& FileName)
+{
+	int64 Bytes = 0;
+	if (Reservations.RemoveAndCopyValue(FileName, Bytes))
+	{
+		ReservedBytes -= Bytes;
+	}
+}
+
+int64 FDreamDiskSpaceLedger::GetReservedBytes(const FString& FileName) const
+{
+	return Reservations.FindRef(FileName);
+}
+
+int64 FDreamDiskSpaceLedger::GetAvailableBytes() const
+{
+	int64 FreeBytes = 0;
+	if (!GetFreeBytes(FreeBytes))
+	{
+		return -1;
+	}
+	return FMath::Max<int64>(FreeBytes - ReservedBytes, 0);
+}
+
+bool FDreamDiskSpaceLedger::GetFreeBytes(int64& OutFreeBytes) const
+{
+	uint64 TotalDiskSpace = 0;
+	uint64 TotalDiskFreeSpace = 0;
+	if (!FPlatformMisc::GetDiskTotalAndFreeSpace(Folder, TotalDiskSpace, TotalDiskFreeSpace))
+	{
+		return false;
+	}
+	OutFreeBytes = (int64)FMath::Min<uint64>(TotalDiskFreeSpace, (uint64)MAX_int64);
+	return true;
+}
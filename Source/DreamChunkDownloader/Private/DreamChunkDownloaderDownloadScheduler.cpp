@@ -0,0 +1,144 @@
+﻿// Copyright (C) 2025 Dream Moon, All Rights Reserved.
+
+
+#include "DreamChunkDownloaderDownloadScheduler.h"
+
+FDreamDownloadScheduler::FDreamDownloadScheduler(double InAgingPerSecond)
+	: AgingPerSecond(FMath::Max(InAgingPerSecond, 0.0))
+{
+}
+
+bool FDreamDownloadScheduler::Push(const TSharedRef<FDreamPakFile>& PakFile, double Now)
+{
+	if (const int32* Index = HeapIndices.Find(&PakFile.Get()))
+	{
+		// keep the aging credit earned so far
+		FEntry& Entry = Heap[*Index];
+		const double OldKey = Entry.Key;
+		Entry.Key = PakFile->Priority - AgingPerSecond * Entry.QueueTime;
+		if (Entry.Key > OldKey)
+		{
+			SiftUp(*Index);
+		}
+		else if (Entry.Key < OldKey)
+		{
+			SiftDown(*Index);
+		}
+		return false;
+	}
+
+	const int32 Index = Heap.Add(FEntry{PakFile, Now, PakFile->Priority - AgingPerSecond * Now, NextSequence++});
+	HeapIndices.Add(&PakFile.Get(), Index);
+	SiftUp(Index);
+	return true;
+}
+
+bool FDreamDownloadScheduler::Remove(const TSharedRef<FDreamPakFile>& PakFile)
+{
+	const int32* Index = HeapIndices.Find(&PakFile.Get());
+	if (Index == nullptr)
+	{
+		return false;
+	}
+	RemoveAt(*Index);
+	return true;
+}
+
+TSharedPtr<FDreamPakFile> FDreamDownloadScheduler::Pop(double* OutQueueTime)
+{
+	if (Heap.Num() == 0)
+	{
+		return nullptr;
+	}
+	TSharedPtr<FDreamPakFile> PakFile = Heap[0].PakFile;
+	if (OutQueueTime != nullptr)
+	{
+		*OutQueueTime = Heap[0].QueueTime;
+	}
+	RemoveAt(0);
+	return PakFile;
+}
+
+bool FDreamDownloadScheduler::Contains(const FDreamPakFile& PakFile) const
+{
+	return HeapIndices.Contains(&PakFile);
+}
+
+void FDreamDownloadScheduler::Empty()
+{
+	Heap.Empty();
+	HeapIndices.Empty();
+}
+
+bool FDreamDownloadScheduler::GoesBefore(const FEntry& A, const FEntry& B)
+{
+	if (A.Key != B.Key)
+	{
+		return A.Key > B.Key;
+	}
+	return A.Sequence < B.Sequence;
+}
+
+void FDreamDownloadScheduler::SiftUp(int32 Index)
+{
+	while (Index > 0)
+	{
+		const int32 Parent = (Index - 1) / 2;
+		if (!GoesBefore(Heap[Index], Heap[Parent]))
+		{
+			break;
+		}
+		SwapEntries(Index, Parent);
+		Index = Parent;
+	}
+}
+
+void FDreamDownloadScheduler::SiftDown(int32 Index)
+{
+	for (;;)
+	{
+		const int32 Left = 2 * Index + 1;
+		const int32 Right = Left + 1;
+		int32 First = Index;
+		if (Left < Heap.Num() && GoesBefore(Heap[Left], Heap[First]))
+		{
+			First = Left;
+		}
+		if (Right < Heap.Num() && GoesBefore(Heap[Right], Heap[First]))
+		{
+			First = Right;
+		}
+		if (First == Index)
+		{
+			break;
+		}
+		SwapEntries(Index, First);
+		Index = First;
+	}
+}
+
+void FDreamDownloadScheduler::SwapEntries(int32 A, int32 B)
+{
+	Heap.Swap(A, B);
+	HeapIndices[&Heap[A].PakFile.Get()] = A;
+	HeapIndices[&Heap[B].PakFile.Get()] = B;
+}
+
+void FDreamDownloadScheduler::RemoveAt(int32 Index)
+{
+	HeapIndices.Remove(&Heap[Index].PakFile.Get());
+
+	// move the last entry into the gap and restore the order from there
+	const int32 LastIndex = Heap.Num() - 1;
+	if (Index != LastIndex)
+	{
+		Heap.Swap(Index, LastIndex);
+		HeapIndices[&Heap[Index].PakFile.Get()] = Index;
+	}
+	Heap.RemoveAt(LastIndex);
+	if (Index < Heap.Num())
+	{
+		SiftUp(Index);
+		SiftDown(Index);
+	}
+}
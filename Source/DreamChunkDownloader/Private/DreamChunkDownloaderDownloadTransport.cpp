@@ -0,0 +1,382 @@
+﻿// Copyright (C) 2025 Dream Moon, All Rights Reserved.
+
+
+#include "DreamChunkDownloaderDownloadTransport.h"
+
+#include "DreamChunkDownloaderCurlMultiTransport.h"
+#include "DreamChunkDownloaderFileSink.h"
+#include "DreamChunkDownloaderLog.h"
+#include "DreamChunkDownloaderStreamDecoder.h"
+#include "DreamChunkDownloaderTokenBucket.h"
+#include "Async/Async.h"
+#include "GenericPlatform/GenericPlatformHttp.h"
+#include "HAL/FileManager.h"
+#include "HAL/PlatformFile.h"
+#include "Interfaces/IHttpResponse.h"
+#include "Misc/Paths.h"
+
+//////////////////////////////////////////////////////////////////////////////////
+// FDreamTransferRange
+
+FDreamTransferRange FDreamTransferRange::Make(const FString& TargetFile, const FDreamStreamDownloadOptions& Options)
+{
+	FDreamTransferRange Range;
+
+	// how much of the file do we currently have on disk (if any)
+	const int64 FileSizeOnDisk = IFileManager::Get().FileSize(*TargetFile);
+	Range.ResumeOffset = FMath::Max<int64>(FileSizeOnDisk, 0);
+
+	// an explicit range is written in place (segmented downloads)
+	Range.bIsExplicitRange = (Options.RangeBegin >= 0 && Options.RangeEnd >= Options.RangeBegin);
+	if (Range.bIsExplicitRange)
+	{
+		Range.ResumeOffset = Options.RangeBegin;
+		Range.RangeEnd = Options.RangeEnd;
+	}
+	Range.FileSize = Options.FileSize;
+
+	// compressed bodies can't be resumed mid-stream, the decoder skips what we already have instead
+	Range.bIsCompressed = !Options.Compression.IsEmpty() && !Range.bIsExplicitRange;
+	return Range;
+}
+
+int64 FDreamTransferRange::GetRequestBegin() const
+{
+	return bIsCompressed ? 0 : ResumeOffset;
+}
+
+FString FDreamTransferRange::GetRangeHeader() const
+{
+	if (bIsCompressed)
+	{
+		return FString();
+	}
+	if (bIsExplicitRange)
+	{
+		return FString::Printf(TEXT("bytes=%lld-%lld"), ResumeOffset, RangeEnd);
+	}
+	if (ResumeOffset > 0)
+	{
+		return FString::Printf(TEXT("bytes=%lld-"), ResumeOffset);
+	}
+	return FString();
+}
+
+int64 FDreamTransferRange::GetSinkRangeEnd() const
+{
+	return bIsExplicitRange ? RangeEnd + 1 : -1;
+}
+
+//////////////////////////////////////////////////////////////////////////////////
+// FDreamGameThreadProgress
+
+FDreamGameThreadProgress::FDreamGameThreadProgress(const FDreamDownloadProgress& InProgress)
+	: Progress(InProgress)
+{
+}
+
+void FDreamGameThreadProgress::Report(uint64 InBytesReceived)
+{
+	BytesReceived = InBytesReceived;
+	if (!Progress || bPending.exchange(true))
+	{
+		return;
+	}
+
+	TSharedRef<FDreamGameThreadProgress, ESPMode::ThreadSafe> SharedThis = AsShared();
+	AsyncTask(ENamedThreads::GameThread, [SharedThis]()
+	{
+		SharedThis->bPending = false;
+		if (!SharedThis->bCompleted)
+		{
+			SharedThis->Progress(SharedThis->BytesReceived);
+		}
+	});
+}
+
+void FDreamGameThreadProgress::Complete()
+{
+	bCompleted = true;
+}
+
+//////////////////////////////////////////////////////////////////////////////////
+// IDreamDownloadTransport
+
+TSharedPtr<FDreamChunkDownloadFileSink, ESPMode::ThreadSafe> IDreamDownloadTransport::CreateFileSink(const FString& TargetFile, const FDreamStreamDownloadOptions& Options, const FDreamTransferRange& Range)
+{
+	TUniquePtr<IDreamStreamDecoder> Decoder;
+	if (Range.bIsCompressed)
+	{
+		Decoder = FDreamStreamDecoderRegistry::Get().CreateDecoder(Options.Compression);
+		if (!Decoder.IsValid())
+		{
+			DCD_LOG(Error, TEXT("No stream decoder registered for '%s' (%s)"), *Options.Compression, *TargetFile);
+			return nullptr;
+		}
+	}
+
+	// the decoder needs all of its memory, the write buffer makes do with less when the budget runs short
+	int32 WriteBufferSize = Options.WriteBufferSize;
+	FDreamMemoryReservation Memory;
+	if (Options.MemoryBudget.IsValid())
+	{
+		const int64 DecoderMemory = Decoder.IsValid() ? Decoder->GetMemorySize() : 0;
+		const int64 MinBufferSize = FMath::Min(WriteBufferSize, FDreamChunkDownloadFileSink::MIN_BUFFER_SIZE);
+		Memory = FDreamMemoryReservation(Options.MemoryBudget, DecoderMemory + WriteBufferSize, DecoderMemory + MinBufferSize);
+		WriteBufferSize = (int32)(Memory.GetBytes() - DecoderMemory);
+		if (WriteBufferSize < Options.WriteBufferSize)
+		{
+			DCD_LOG(Verbose, TEXT("Memory budget is short, writing %s with a %d byte buffer"), *TargetFile, WriteBufferSize);
+		}
+	}
+
+	TSharedPtr<FDreamChunkDownloadFileSink, ESPMode::ThreadSafe> Sink = MakeShared<FDreamChunkDownloadFileSink, ESPMode::ThreadSafe>(TargetFile, Range.ResumeOffset, WriteBufferSize, Range.GetSinkRangeEnd());
+	Sink->SetIncrementalHash(Options.IncrementalHash);
+	Sink->SetFlushedEnd(Options.FlushedEnd);
+	Sink->SetFileSize(Range.FileSize);
+	Sink->SetMemoryReservation(MoveTemp(Memory));
+	if (Decoder.IsValid())
+	{
+		Sink->SetDecoder(MoveTemp(Decoder));
+	}
+	return Sink;
+}
+
+int32 IDreamDownloadTransport::FinishResponse(FDreamChunkDownloadFileSink& Sink, const FString& Url, const FString& TargetFile, const FDreamTransferRange& Range,
+                                              bool bGotResponse, int32 HttpStatus, const FString& ContentRange)
+{
+	// flush the last block and make sure the body belongs where we wrote it
+	const bool bBodyOk = Sink.EndResponse(HttpStatus, ContentRange);
+	if (!bGotResponse)
+	{
+		// whatever was flushed before the connection dropped is kept for the next attempt
+		DCD_LOG(Error, TEXT("HTTP connection issue downloading '%s' (%lld bytes kept)"), *Url, Sink.GetValidLength());
+		return 0;
+	}
+
+	if (Sink.HasError())
+	{
+		DCD_LOG(Error, TEXT("Write error writing to %s"), *TargetFile);
+
+		// delete the file (space issue?)
+		if (!Range.bIsExplicitRange)
+		{
+			IPlatformFile::GetPlatformPhysical().DeleteFile(*TargetFile);
+		}
+
+		// a compressed body that can't be decoded is as unusable as a bad range
+		if (Range.bIsCompressed)
+		{
+			return EHttpResponseCodes::RequestedRangeNotSatisfiable;
+		}
+	}
+	else if (!bBodyOk && EHttpResponseCodes::IsOk(HttpStatus))
+	{
+		// ok status but the body didn't line up with the requested range, report the range as unusable
+		DCD_LOG(Error, TEXT("Unexpected response body for '%s' (HTTP %d, Content-Range '%s')"), *Url, HttpStatus, *ContentRange);
+		return EHttpResponseCodes::RequestedRangeNotSatisfiable;
+	}
+	else if (!EHttpResponseCodes::IsOk(HttpStatus))
+	{
+		DCD_LOG(Error, TEXT("HTTP %d returned from '%s'"), HttpStatus, *Url);
+
+		// if the server responded with anything not ok (and not a server error), then delete the file for next time
+		if (HttpStatus < 500 && Range.ResumeOffset > 0 && !Range.bIsExplicitRange)
+		{
+			IPlatformFile::GetPlatformPhysical().DeleteFile(*TargetFile);
+		}
+	}
+	return HttpStatus;
+}
+
+void IDreamDownloadTransport::CompleteOnGameThread(const FDreamDownloadComplete& Callback, int32 HttpStatus)
+{
+	AsyncTask(ENamedThreads::GameThread, [Callback, HttpStatus]()
+	{
+		if (Callback)
+		{
+			Callback(HttpStatus);
+		}
+	});
+}
+
+//////////////////////////////////////////////////////////////////////////////////
+// FDreamFileDownloadTransport
+
+namespace
+{
+	const FString FILE_URL_SCHEME = TEXT("file://");
+
+	/** Shared between a local copy and its cancel callback */
+	struct FDreamLocalTransfer
+	{
+		std::atomic<bool> bCancelled{false};
+	};
+}
+
+FString FDreamFileDownloadTransport::GetLocalPath(const FString& Url)
+{
+	if (!Url.StartsWith(FILE_URL_SCHEME, ESearchCase::IgnoreCase))
+	{
+		return Url;
+	}
+
+	// file:///C:/Paks -> C:/Paks, file:///mnt/paks -> /mnt/paks
+	FString Path = FGenericPlatformHttp::UrlDecode(Url.RightChop(FILE_URL_SCHEME.Len()));
+	if (Path.Len() > 2 && Path[0] == TEXT('/') && Path[2] == TEXT(':'))
+	{
+		Path.RightChopInline(1);
+	}
+	return Path;
+}
+
+bool FDreamFileDownloadTransport::CanHandle(const FString& Url) const
+{
+	if (Url.StartsWith(FILE_URL_SCHEME, ESearchCase::IgnoreCase))
+	{
+		return true;
+	}
+
+	// a CDN root can also be a plain local directory
+	return !Url.Contains(TEXT("://")) && !FPaths::IsRelative(Url);
+}
+
+FDreamDownloadCancel FDreamFileDownloadTransport::Download(const FString& Url, const FString& TargetFile, const FDreamStreamDownloadOptions& Options,
+                                                           const FDreamDownloadProgress& Progress, const FDreamDownloadComplete& Callback)
+{
+	// local copies always go through the sink, there is no memory to save by buffering them
+	const FDreamTransferRange Range = FDreamTransferRange::Make(TargetFile, Options);
+	TSharedPtr<FDreamChunkDownloadFileSink, ESPMode::ThreadSafe> Sink = CreateFileSink(TargetFile, Options, Range);
+	if (!Sink.IsValid())
+	{
+		CompleteOnGameThread(Callback, 0);
+		return []() {};
+	}
+
+	const FString SourceFile = GetLocalPath(Url);
+	const int32 BlockSize = FMath::Max(Options.WriteBufferSize, 16 * 1024);
+	TSharedRef<FDreamLocalTransfer, ESPMode::ThreadSafe> Transfer = MakeShared<FDreamLocalTransfer, ESPMode::ThreadSafe>();
+	TSharedRef<FDreamGameThreadProgress, ESPMode::ThreadSafe> GameProgress = MakeShared<FDreamGameThreadProgress, ESPMode::ThreadSafe>(Progress);
+	TSharedPtr<FDreamTokenBucket, ESPMode::ThreadSafe> Bandwidth = Options.Bandwidth;
+	Async(EAsyncExecution::ThreadPool, [Url, TargetFile, SourceFile, Range, BlockSize, Sink, Bandwidth, Transfer, GameProgress, Callback]()
+	{
+		// answer the way a web server would
+		int32 HttpStatus = EHttpResponseCodes::NotFound;
+		FString ContentRange;
+		bool bGotResponse = true;
+		TUniquePtr<IFileHandle> Source(IPlatformFile::GetPlatformPhysical().OpenRead(*SourceFile));
+		if (Source.IsValid())
+		{
+			const int64 SourceSize = Source->Size();
+			const int64 Begin = Range.GetRequestBegin();
+			const int64 End = (Range.RangeEnd >= 0) ? FMath::Min(Range.RangeEnd, SourceSize - 1) : SourceSize - 1;
+			if (Begin == 0 && !Range.bIsExplicitRange)
+			{
+				HttpStatus = EHttpResponseCodes::Ok;
+			}
+			else if (Begin < SourceSize)
+			{
+				HttpStatus = EHttpResponseCodes::PartialContent;
+				ContentRange = FString::Printf(TEXT("bytes %lld-%lld/%lld"), Begin, End, SourceSize);
+			}
+			else
+			{
+				HttpStatus = EHttpResponseCodes::RequestedRangeNotSatisfiable;
+			}
+
+			if (EHttpResponseCodes::IsOk(HttpStatus) && Sink->BeginResponse(HttpStatus, ContentRange) && Source->Seek(Begin))
+			{
+				TArray<uint8> Buffer;
+				Buffer.SetNumUninitialized(BlockSize);
+				int64 Remaining = End - Begin + 1;
+				uint64 BytesReceived = 0;
+				while (Remaining > 0)
+				{
+					// a cancelled copy ends like a dropped connection, the partial file is kept
+					const int64 SizeToRead = FMath::Min<int64>(Remaining, Buffer.Num());
+					if (Transfer->bCancelled || !Source->Read(Buffer.GetData(), SizeToRead))
+					{
+						bGotResponse = false;
+						break;
+					}
+					if (!Sink->Write(Buffer.GetData(), SizeToRead))
+					{
+						break;
+					}
+					Remaining -= SizeToRead;
+					BytesReceived += SizeToRead;
+					GameProgress->Report(BytesReceived);
+
+					// this is a pool thread of our own, so it can wait for its share of the bandwidth (a cancel ends the wait)
+					if (Bandwidth.IsValid())
+					{
+						Bandwidth->Consume(SizeToRead, &Transfer->bCancelled);
+					}
+				}
+			}
+		}
+
+		HttpStatus = FinishResponse(*Sink, Url, TargetFile, Range, bGotResponse, bGotResponse ? HttpStatus : 0, ContentRange);
+		GameProgress->Complete();
+		CompleteOnGameThread(Callback, HttpStatus);
+	});
+
+	return [Transfer]()
+	{
+		Transfer->bCancelled = true;
+	};
+}
+
+//////////////////////////////////////////////////////////////////////////////////
+// FDreamDownloadTransportRegistry
+
+FDreamDownloadTransportRegistry& FDreamDownloadTransportRegistry::Get()
+{
+	static FDreamDownloadTransportRegistry Registry;
+	return Registry;
+}
+
+FDreamDownloadTransportRegistry::FDreamDownloadTransportRegistry()
+{
+	Register(TEXT("http"), MakeShared<FDreamHttpDownloadTransport, ESPMode::ThreadSafe>());
+	Register(TEXT("file"), MakeShared<FDreamFileDownloadTransport, ESPMode::ThreadSafe>());
+#if DCD_WITH_CURL_MULTI
+	Register(TEXT("curl"), MakeShared<FDreamCurlMultiDownloadTransport, ESPMode::ThreadSafe>());
+#endif
+}
+
+void FDreamDownloadTransportRegistry::Register(const FString& Name, const TSharedRef<IDreamDownloadTransport, ESPMode::ThreadSafe>& Transport)
+{
+	FWriteScopeLock ScopeLock(Lock);
+	for (FEntry& Entry : Transports)
+	{
+		if (Entry.Name.Equals(Name, ESearchCase::IgnoreCase))
+		{
+			Entry.Transport = Transport;
+			return;
+		}
+	}
+	Transports.Add(FEntry{Name, Transport});
+}
+
+TSharedPtr<IDreamDownloadTransport, ESPMode::ThreadSafe> FDreamDownloadTransportRegistry::FindTransport(const FString& Url) const
+{
+	FReadScopeLock ScopeLock(Lock);
+	for (int32 Idx = Transports.Num() - 1; Idx >= 0; --Idx)
+	{
+		if (Transports[Idx].Transport->CanHandle(Url))
+		{
+			return Transports[Idx].Transport;
+		}
+	}
+	return nullptr;
+}
+
+void FDreamDownloadTransportRegistry::Shutdown()
+{
+	FReadScopeLock ScopeLock(Lock);
+	for (const FEntry& Entry : Transports)
+	{
+		Entry.Transport->Shutdown();
+	}
+}
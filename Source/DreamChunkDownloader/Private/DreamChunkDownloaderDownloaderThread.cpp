@@ -0,0 +1,89 @@
+﻿// Copyright (C) 2025 Dream Moon, All Rights Reserved.
+
+
+#include "DreamChunkDownloaderDownloaderThread.h"
+
+#include "DreamChunkDownloaderLog.h"
+#include "HAL/Event.h"
+#include "HAL/PlatformProcess.h"
+#include "HAL/RunnableThread.h"
+
+FDreamDownloaderThread::FDreamDownloaderThread()
+{
+	WakeEvent = FPlatformProcess::GetSynchEventFromPool(false);
+	Thread = FRunnableThread::Create(this, TEXT("DreamChunkDownloader"), 0, TPri_AboveNormal);
+	if (Thread == nullptr)
+	{
+		DCD_LOG(Error, TEXT("Unable to create the downloader thread, transfers complete on the game thread."));
+		bStopping = true;
+		return;
+	}
+}
+
+FDreamDownloaderThread::~FDreamDownloaderThread()
+{
+	Shutdown();
+
+	// requests hold on to the thread, anything they posted after the shutdown runs with the last of them
+	ProcessMessages();
+	FPlatformProcess::ReturnSynchEventToPool(WakeEvent);
+	WakeEvent = nullptr;
+}
+
+bool FDreamDownloaderThread::Post(TFunction<void()>&& Message)
+{
+	if (bStopping)
+	{
+		return false;
+	}
+	Messages.Enqueue(MoveTemp(Message));
+	WakeEvent->Trigger();
+	return true;
+}
+
+void FDreamDownloaderThread::Shutdown()
+{
+	if (Thread == nullptr)
+	{
+		return;
+	}
+
+	// Kill calls Stop and waits for Run to return
+	Thread->Kill(true);
+	delete Thread;
+	Thread = nullptr;
+
+	// a message posted while the thread was exiting still has to run
+	ProcessMessages();
+}
+
+uint32 FDreamDownloaderThread::Run()
+{
+	while (!bStopping)
+	{
+		WakeEvent->Wait();
+		ProcessMessages();
+	}
+
+	// drain what was queued before the stop
+	ProcessMessages();
+	return 0;
+}
+
+void FDreamDownloaderThread::Stop()
+{
+	bStopping = true;
+	WakeEvent->Trigger();
+}
+
+void FDreamDownloaderThread::ProcessMessages()
+{
+	TFunction<void()> Message;
+	while (Messages.Dequeue(Message))
+	{
+		if (Message)
+		{
+			Message();
+		}
+	}
+}
@@ -0,0 +1,437 @@
+﻿// Copyright (C) 2025 Dream Moon, All Rights Reserved.
+
+
+#include "DreamChunkDownloaderFileSink.h"
+
+#include "DreamChunkDownloaderIncrementalHash.h"
+#include "DreamChunkDownloaderLog.h"
+#include "DreamChunkDownloaderStreamDecoder.h"
+#include "HAL/PlatformFile.h"
+#include "Misc/ScopeLock.h"
+
+FDreamChunkDownloadFileSink::FDreamChunkDownloadFileSink(const FString& InTargetFile, int64 InResumeOffset, int32 InBufferSize, int64 InRangeEnd)
+	: TargetFile(InTargetFile)
+	  , ResumeOffset(FMath::Max<int64>(InResumeOffset, 0))
+	  , RangeEnd(InRangeEnd)
+	  , WriteOffset(FMath::Max<int64>(InResumeOffset, 0))
+	  , BufferSize(FMath::Max(InBufferSize, MIN_BUFFER_SIZE))
+{
+}
+
+FDreamChunkDownloadFileSink::~FDreamChunkDownloadFileSink()
+{
+	Close();
+}
+
+void FDreamChunkDownloadFileSink::SetIncrementalHash(const TSharedPtr<FDreamIncrementalFileHash, ESPMode::ThreadSafe>& InHash)
+{
+	FScopeLock ScopeLock(&Lock);
+	IncrementalHash = InHash;
+}
+
+void FDreamChunkDownloadFileSink::SetFlushedEnd(const TSharedPtr<std::atomic<int64>, ESPMode::ThreadSafe>& InFlushedEnd)
+{
+	FScopeLock ScopeLock(&Lock);
+	FlushedEnd = InFlushedEnd;
+	if (FlushedEnd.IsValid())
+	{
+		FlushedEnd->store(ResumeOffset);
+	}
+}
+
+void FDreamChunkDownloadFileSink::SetFileSize(int64 InFileSize)
+{
+	FScopeLock ScopeLock(&Lock);
+	FileSize = InFileSize;
+}
+
+void FDreamChunkDownloadFileSink::SetDecoder(TUniquePtr<IDreamStreamDecoder>&& InDecoder)
+{
+	FScopeLock ScopeLock(&Lock);
+	check(RangeEnd < 0);
+	Decoder = MoveTemp(InDecoder);
+}
+
+void FDreamChunkDownloadFileSink::SetMemoryReservation(FDreamMemoryReservation&& InMemory)
+{
+	FScopeLock ScopeLock(&Lock);
+	Memory = MoveTemp(InMemory);
+}
+
+bool FDreamChunkDownloadFileSink::BeginResponse(int32 HttpStatus, const FString& ContentRange)
+{
+	FScopeLock ScopeLock(&Lock);
+	bHasBegunResponse = true;
+	bStatusKnownAtBegin = (HttpStatus != 0);
+
+	// without a status code we assume the range was honoured and check again in EndResponse
+	if (bStatusKnownAtBegin && !GetResponseWriteOffset(HttpStatus, ContentRange, WriteOffset))
+	{
+		// don't let an error body end up in the pak file
+		bDiscardBody = true;
+		bRejectedResponse = true;
+		return false;
+	}
+
+	if (WriteOffset < ResumeOffset)
+	{
+		DCD_LOG(Log, TEXT("Server ignored range request for %s, restarting from the beginning"), *TargetFile);
+	}
+	DecodedBytesToSkip = Decoder.IsValid() ? WriteOffset : 0;
+	return OpenAt(WriteOffset);
+}
+
+bool FDreamChunkDownloadFileSink::HasBegunResponse() const
+{
+	FScopeLock ScopeLock(&Lock);
+	return bHasBegunResponse;
+}
+
+bool FDreamChunkDownloadFileSink::Write(const uint8* Data, int64 Length)
+{
+	FScopeLock ScopeLock(&Lock);
+
+	// a refused response is aborted instead of drained, the body has no use
+	if (bDiscardBody)
+	{
+		return false;
+	}
+	if (Length <= 0)
+	{
+		return true;
+	}
+	if (bHasError)
+	{
+		return false;
+	}
+	if (!FileHandle.IsValid() && !OpenAt(WriteOffset))
+	{
+		return false;
+	}
+
+	if (Decoder.IsValid())
+	{
+		const bool bDecoded = Decoder->Decode(Data, Length, [this](const uint8* Output, int64 OutputLength)
+		{
+			// the start of the stream is already on disk
+			const int64 SizeToSkip = FMath::Min(OutputLength, DecodedBytesToSkip);
+			DecodedBytesToSkip -= SizeToSkip;
+			return WriteLocked(Output + SizeToSkip, OutputLength - SizeToSkip);
+		});
+		if (!bDecoded && !bHasError)
+		{
+			DCD_LOG(Error, TEXT("Corrupt compressed data for %s"), *TargetFile);
+			bHasError = true;
+		}
+		return bDecoded;
+	}
+	return WriteLocked(Data, Length);
+}
+
+bool FDreamChunkDownloadFileSink::WriteLocked(const uint8* Data, int64 Length)
+{
+	if (Length <= 0)
+	{
+		return true;
+	}
+
+	// never write past the end of an in-place segment
+	if (RangeEnd >= 0 && WriteOffset + FlushedBytes + Buffer.Num() + Length > RangeEnd)
+	{
+		DCD_LOG(Error, TEXT("Received more data than requested for %s (segment ends at %lld)"), *TargetFile, RangeEnd);
+		bHasError = true;
+		return false;
+	}
+
+	while (Length > 0)
+	{
+		// copy as much as fits in the buffer
+		int64 SizeToCopy = FMath::Min<int64>(Length, BufferSize - Buffer.Num());
+		Buffer.Append(Data, SizeToCopy);
+		Data += SizeToCopy;
+		Length -= SizeToCopy;
+
+		// write full blocks out to disk
+		if (Buffer.Num() >= BufferSize && !FlushBuffer())
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+bool FDreamChunkDownloadFileSink::EndResponse(int32 HttpStatus, const FString& ContentRange)
+{
+	FScopeLock ScopeLock(&Lock);
+
+	// make sure everything we accepted is on disk
+	if (FileHandle.IsValid())
+	{
+		FlushBuffer();
+		FileHandle->Flush();
+		FileHandle.Reset();
+	}
+	Buffer.Empty();
+	Memory.Reset();
+
+	if (bDiscardBody || bHasError)
+	{
+		return false;
+	}
+
+	// the status code may not have been known when the body started arriving
+	int64 ExpectedWriteOffset = WriteOffset;
+	if (!GetResponseWriteOffset(HttpStatus, ContentRange, ExpectedWriteOffset))
+	{
+		// keep what was valid before this response
+		if (!bStatusKnownAtBegin && FlushedBytes > 0)
+		{
+			DiscardLocked();
+		}
+		return false;
+	}
+	if (ExpectedWriteOffset != WriteOffset)
+	{
+		DCD_LOG(Error, TEXT("Response for %s was written at offset %lld but belongs at %lld"), *TargetFile, WriteOffset, ExpectedWriteOffset);
+		DiscardLocked();
+		return false;
+	}
+	if (FlushedEnd.IsValid())
+	{
+		FlushedEnd->store(WriteOffset + FlushedBytes);
+	}
+
+	// the decompressed prefix is kept, the next attempt continues after it
+	if (Decoder.IsValid() && !Decoder->IsFinished())
+	{
+		DCD_LOG(Error, TEXT("Compressed data for %s ended early (%lld bytes decompressed)"), *TargetFile, WriteOffset + FlushedBytes);
+		return false;
+	}
+	return true;
+}
+
+bool FDreamChunkDownloadFileSink::Close()
+{
+	FScopeLock ScopeLock(&Lock);
+	if (FileHandle.IsValid())
+	{
+		FlushBuffer();
+		FileHandle->Flush();
+		FileHandle.Reset();
+	}
+	Buffer.Empty();
+	Memory.Reset();
+	return !bHasError;
+}
+
+void FDreamChunkDownloadFileSink::Discard()
+{
+	FScopeLock ScopeLock(&Lock);
+	DiscardLocked();
+}
+
+int64 FDreamChunkDownloadFileSink::GetBytesWritten() const
+{
+	FScopeLock ScopeLock(&Lock);
+	return FlushedBytes + Buffer.Num();
+}
+
+int64 FDreamChunkDownloadFileSink::GetValidLength() const
+{
+	FScopeLock ScopeLock(&Lock);
+	return WriteOffset + FlushedBytes + Buffer.Num();
+}
+
+bool FDreamChunkDownloadFileSink::HasError() const
+{
+	FScopeLock ScopeLock(&Lock);
+	return bHasError;
+}
+
+bool FDreamChunkDownloadFileSink::HasRejectedResponse() const
+{
+	FScopeLock ScopeLock(&Lock);
+	return bRejectedResponse;
+}
+
+bool FDreamChunkDownloadFileSink::GetResponseWriteOffset(int32 HttpStatus, const FString& ContentRange, int64& OutWriteOffset) const
+{
+	if (Decoder.IsValid())
+	{
+		// compressed variants are always sent whole, the decompressed prefix on disk is skipped
+		if (HttpStatus == 200)
+		{
+			OutWriteOffset = ResumeOffset;
+			return true;
+		}
+		return false;
+	}
+	if (HttpStatus == 206)
+	{
+		// partial content has to continue exactly where our file ends
+		FString ExpectedHeaderPrefix = FString::Printf(TEXT("bytes %lld-"), ResumeOffset);
+		if (!ContentRange.StartsWith(ExpectedHeaderPrefix))
+		{
+			DCD_LOG(Error, TEXT("Content-Range for %s was '%s' but expected '%s' prefix"), *TargetFile, *ContentRange, *ExpectedHeaderPrefix);
+			return false;
+		}
+
+		// an in-place segment also has to end where we asked, a shorter range would leave a hole in the file
+		if (RangeEnd >= 0)
+		{
+			int64 RangeBegin = -1;
+			int64 RangeLast = -1;
+			int64 RangeTotal = -1;
+			if (!ParseContentRange(ContentRange, RangeBegin, RangeLast, RangeTotal) || RangeLast != RangeEnd - 1 ||
+				(FileSize > 0 && RangeTotal >= 0 && RangeTotal != FileSize))
+			{
+				DCD_LOG(Error, TEXT("Content-Range for %s was '%s' but expected 'bytes %lld-%lld/%lld'"), *TargetFile, *ContentRange, ResumeOffset, RangeEnd - 1, FileSize);
+				return false;
+			}
+		}
+		OutWriteOffset = ResumeOffset;
+		return true;
+	}
+	if (HttpStatus == 200 && (RangeEnd < 0 || (ResumeOffset == 0 && FileSize > 0 && RangeEnd == FileSize)))
+	{
+		// the server sent the whole file (for an in-place range only if that is what we asked for)
+		OutWriteOffset = 0;
+		return true;
+	}
+	return false;
+}
+
+bool FDreamChunkDownloadFileSink::ParseContentRange(const FString& ContentRange, int64& OutBegin, int64& OutEnd, int64& OutTotal)
+{
+	// bytes <first>-<last>/<total or *>
+	FString Range;
+	FString Total;
+	FString First;
+	FString Last;
+	if (!ContentRange.StartsWith(TEXT("bytes ")) ||
+		!ContentRange.RightChop(6).Split(TEXT("/"), &Range, &Total) ||
+		!Range.Split(TEXT("-"), &First, &Last) ||
+		!First.IsNumeric() || !Last.IsNumeric())
+	{
+		return false;
+	}
+
+	OutBegin = FCString::Atoi64(*First);
+	OutEnd = FCString::Atoi64(*Last);
+	OutTotal = Total == TEXT("*") ? -1 : (Total.IsNumeric() ? FCString::Atoi64(*Total) : -2);
+	return OutTotal != -2 && OutEnd >= OutBegin;
+}
+
+void FDreamChunkDownloadFileSink::DiscardLocked()
+{
+	// the hash already contains the data we're throwing away
+	if (IncrementalHash.IsValid() && FlushedBytes > 0)
+	{
+		IncrementalHash->Invalidate();
+	}
+
+	Buffer.Empty();
+	FileHandle.Reset();
+	FlushedBytes = 0;
+	bDiscardBody = true;
+	if (FlushedEnd.IsValid())
+	{
+		FlushedEnd->store(ResumeOffset);
+	}
+
+	// an in-place segment simply gets fetched again, the rest of the file is untouched
+	if (RangeEnd >= 0)
+	{
+		return;
+	}
+
+	IPlatformFile& PlatformFile = IPlatformFile::GetPlatformPhysical();
+	if (ResumeOffset <= 0 || WriteOffset < ResumeOffset)
+	{
+		// nothing worth keeping
+		PlatformFile.DeleteFile(*TargetFile);
+		return;
+	}
+
+	// cut the file back to the part we had before this response
+	TUniquePtr<IFileHandle> Handle(PlatformFile.OpenWrite(*TargetFile, true));
+	if (!Handle.IsValid() || !Handle->Truncate(ResumeOffset))
+	{
+		DCD_LOG(Warning, TEXT("Unable to roll %s back to %lld bytes, deleting it"), *TargetFile, ResumeOffset);
+		Handle.Reset();
+		PlatformFile.DeleteFile(*TargetFile);
+	}
+}
+
+bool FDreamChunkDownloadFileSink::OpenAt(int64 Offset)
+{
+	FileHandle.Reset();
+	Buffer.Reset(BufferSize);
+	FlushedBytes = 0;
+
+	// append keeps the existing data, otherwise the file is truncated
+	IPlatformFile& PlatformFile = IPlatformFile::GetPlatformPhysical();
+	FileHandle.Reset(PlatformFile.OpenWrite(*TargetFile, Offset > 0 || RangeEnd >= 0));
+	if (!FileHandle.IsValid())
+	{
+		DCD_LOG(Error, TEXT("Unable to save file to %s"), *TargetFile);
+		bHasError = true;
+		return false;
+	}
+
+	if (RangeEnd >= 0)
+	{
+		// segments write into the preallocated file in place
+		if (FileHandle->Size() < RangeEnd || !FileHandle->Seek(Offset))
+		{
+			DCD_LOG(Error, TEXT("Unable to write segment of %s at offset %lld (size on disk %lld)"), *TargetFile, Offset, FileHandle->Size());
+			FileHandle.Reset();
+			bHasError = true;
+			return false;
+		}
+	}
+	else if (Offset > 0)
+	{
+		// drop anything past the valid prefix and continue from there
+		if (FileHandle->Size() > Offset)
+		{
+			FileHandle->Truncate(Offset);
+		}
+		if (FileHandle->Size() != Offset || !FileHandle->Seek(Offset))
+		{
+			DCD_LOG(Error, TEXT("Unable to resume %s at offset %lld (size on disk %lld)"), *TargetFile, Offset, FileHandle->Size());
+			FileHandle.Reset();
+			bHasError = true;
+			return false;
+		}
+	}
+	return true;
+}
+
+bool FDreamChunkDownloadFileSink::FlushBuffer()
+{
+	if (Buffer.Num() <= 0)
+	{
+		return !bHasError;
+	}
+	if (!FileHandle.IsValid() || !FileHandle->Write(Buffer.GetData(), Buffer.Num()))
+	{
+		DCD_LOG(Error, TEXT("Write error writing to %s"), *TargetFile);
+		bHasError = true;
+		Buffer.Reset();
+		return false;
+	}
+	if (IncrementalHash.IsValid())
+	{
+		IncrementalHash->Update(WriteOffset + FlushedBytes, Buffer.GetData(), Buffer.Num());
+	}
+	FlushedBytes += Buffer.Num();
+	Buffer.Reset();
+
+	// data written before the status was known may still be rolled back
+	if (FlushedEnd.IsValid() && bStatusKnownAtBegin)
+	{
+		FlushedEnd->store(WriteOffset + FlushedBytes);
+	}
+	return true;
+}
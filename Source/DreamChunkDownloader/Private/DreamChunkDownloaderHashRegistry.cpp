@@ -0,0 +1,300 @@
+﻿// Copyright (C) 2025 Dream Moon, All Rights Reserved.
+
+
+#include "DreamChunkDownloaderHashRegistry.h"
+
+#include "Hash/Blake3.h"
+#include "Hash/xxhash.h"
+#include "Misc/SecureHash.h"
+
+namespace DreamHashRegistry
+{
+	/**
+	 * Convert a digest to an upper case hex string
+	 */
+	static FString BytesToHexString(const uint8* Bytes, int32 Count)
+	{
+		FString Result;
+		Result.Reserve(Count * 2);
+		for (int32 Idx = 0; Idx < Count; Idx++)
+		{
+			Result += FString::Printf(TEXT("%02X"), Bytes[Idx]);
+		}
+		return Result;
+	}
+
+	/**
+	 * SHA1 (legacy default)
+	 */
+	class FSha1Hasher : public IDreamHasher
+	{
+	public:
+		virtual void Update(const uint8* Data, int64 Length) override
+		{
+			HashContext.Update(Data, Length);
+		}
+
+		virtual FString Finalize() const override
+		{
+			// finalize a copy so the running state can keep going
+			FSHA1 FinalContext = HashContext;
+			FinalContext.Final();
+			uint8 FinalHash[FSHA1::DigestSize];
+			FinalContext.GetHash(FinalHash);
+			return BytesToHexString(FinalHash, FSHA1::DigestSize);
+		}
+
+	private:
+		FSHA1 HashContext;
+	};
+
+	/**
+	 * 64 bit XXH3
+	 */
+	class FXxh3Hasher : public IDreamHasher
+	{
+	public:
+		virtual void Update(const uint8* Data, int64 Length) override
+		{
+			Builder.Update(Data, (uint64)Length);
+		}
+
+		virtual FString Finalize() const override
+		{
+			// canonical (big endian) representation
+			const uint64 Hash = Builder.Finalize().Hash;
+			uint8 FinalHash[8];
+			for (int32 Idx = 0; Idx < 8; Idx++)
+			{
+				FinalHash[Idx] = (uint8)(Hash >> (56 - Idx * 8));
+			}
+			return BytesToHexString(FinalHash, 8);
+		}
+
+	private:
+		FXxHash64Builder Builder;
+	};
+
+	/**
+	 * 128 bit XXH3
+	 */
+	class FXxh128Hasher : public IDreamHasher
+	{
+	public:
+		virtual void Update(const uint8* Data, int64 Length) override
+		{
+			Builder.Update(Data, (uint64)Length);
+		}
+
+		virtual FString Finalize() const override
+		{
+			// canonical (big endian, high half first) representation
+			const FXxHash128 Hash = Builder.Finalize();
+			uint8 FinalHash[16];
+			for (int32 Idx = 0; Idx < 8; Idx++)
+			{
+				FinalHash[Idx] = (uint8)(Hash.HashHigh >> (56 - Idx * 8));
+				FinalHash[Idx + 8] = (uint8)(Hash.HashLow >> (56 - Idx * 8));
+			}
+			return BytesToHexString(FinalHash, 16);
+		}
+
+	private:
+		FXxHash128Builder Builder;
+	};
+
+	/**
+	 * 256 bit BLAKE3
+	 */
+	class FBlake3Hasher : public IDreamHasher
+	{
+	public:
+		virtual void Update(const uint8* Data, int64 Length) override
+		{
+			Builder.Update(Data, (uint64)Length);
+		}
+
+		virtual FString Finalize() const override
+		{
+			const FBlake3Hash Hash = Builder.Finalize();
+			return BytesToHexString(Hash.GetBytes(), sizeof(FBlake3Hash::ByteArray));
+		}
+
+	private:
+		FBlake3 Builder;
+	};
+
+	/**
+	 * SHA256 (FIPS 180-4)
+	 */
+	class FSha256Hasher : public IDreamHasher
+	{
+	public:
+		virtual void Update(const uint8* Data, int64 Length) override
+		{
+			TotalLength += (uint64)Length;
+			while (Length > 0)
+			{
+				const int64 SizeToCopy = FMath::Min<int64>(Length, 64 - BlockLength);
+				FMemory::Memcpy(Block + BlockLength, Data, SizeToCopy);
+				BlockLength += (int32)SizeToCopy;
+				Data += SizeToCopy;
+				Length -= SizeToCopy;
+				if (BlockLength == 64)
+				{
+					Transform(State, Block);
+					BlockLength = 0;
+				}
+			}
+		}
+
+		virtual FString Finalize() const override
+		{
+			// pad a copy so the running state can keep going
+			uint32 FinalState[8];
+			FMemory::Memcpy(FinalState, State, sizeof(State));
+			uint8 FinalBlock[128];
+			FMemory::Memcpy(FinalBlock, Block, BlockLength);
+
+			int32 PaddedLength = (BlockLength < 56) ? 64 : 128;
+			FMemory::Memzero(FinalBlock + BlockLength, PaddedLength - BlockLength);
+			FinalBlock[BlockLength] = 0x80;
+			const uint64 BitLength = TotalLength * 8;
+			for (int32 Idx = 0; Idx < 8; Idx++)
+			{
+				FinalBlock[PaddedLength - 1 - Idx] = (uint8)(BitLength >> (Idx * 8));
+			}
+			for (int32 Offset = 0; Offset < PaddedLength; Offset += 64)
+			{
+				Transform(FinalState, FinalBlock + Offset);
+			}
+
+			uint8 FinalHash[32];
+			for (int32 Idx = 0; Idx < 8; Idx++)
+			{
+				FinalHash[Idx * 4 + 0] = (uint8)(FinalState[Idx] >> 24);
+				FinalHash[Idx * 4 + 1] = (uint8)(FinalState[Idx] >> 16);
+				FinalHash[Idx * 4 + 2] = (uint8)(FinalState[Idx] >> 8);
+				FinalHash[Idx * 4 + 3] = (uint8)(FinalState[Idx]);
+			}
+			return BytesToHexString(FinalHash, 32);
+		}
+
+	private:
+		static FORCEINLINE uint32 RotateRight(uint32 Value, uint32 Bits)
+		{
+			return (Value >> Bits) | (Value << (32 - Bits));
+		}
+
+		static void Transform(uint32* InOutState, const uint8* InBlock)
+		{
+			static const uint32 K[64] =
+			{
+				0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+				0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+				0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+				0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+				0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+				0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+				0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+				0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+			};
+
+			uint32 W[64];
+			for (int32 Idx = 0; Idx < 16; Idx++)
+			{
+				W[Idx] = ((uint32)InBlock[Idx * 4] << 24) | ((uint32)InBlock[Idx * 4 + 1] << 16) | ((uint32)InBlock[Idx * 4 + 2] << 8) | (uint32)InBlock[Idx * 4 + 3];
+			}
+			for (int32 Idx = 16; Idx < 64; Idx++)
+			{
+				const uint32 S0 = RotateRight(W[Idx - 15], 7) ^ RotateRight(W[Idx - 15], 18) ^ (W[Idx - 15] >> 3);
+				const uint32 S1 = RotateRight(W[Idx - 2], 17) ^ RotateRight(W[Idx - 2], 19) ^ (W[Idx - 2] >> 10);
+				W[Idx] = W[Idx - 16] + S0 + W[Idx - 7] + S1;
+			}
+
+			uint32 A = InOutState[0], B = InOutState[1], C = InOutState[2], D = InOutState[3];
+			uint32 E = InOutState[4], F = InOutState[5], G = InOutState[6], H = InOutState[7];
+			for (int32 Idx = 0; Idx < 64; Idx++)
+			{
+				const uint32 S1 = RotateRight(E, 6) ^ RotateRight(E, 11) ^ RotateRight(E, 25);
+				const uint32 Ch = (E & F) ^ (~E & G);
+				const uint32 Temp1 = H + S1 + Ch + K[Idx] + W[Idx];
+				const uint32 S0 = RotateRight(A, 2) ^ RotateRight(A, 13) ^ RotateRight(A, 22);
+				const uint32 Maj = (A & B) ^ (A & C) ^ (B & C);
+				const uint32 Temp2 = S0 + Maj;
+				H = G;
+				G = F;
+				F = E;
+				E = D + Temp1;
+				D = C;
+				C = B;
+				B = A;
+				A = Temp1 + Temp2;
+			}
+			InOutState[0] += A;
+			InOutState[1] += B;
+			InOutState[2] += C;
+			InOutState[3] += D;
+			InOutState[4] += E;
+			InOutState[5] += F;
+			InOutState[6] += G;
+			InOutState[7] += H;
+		}
+
+		uint32 State[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+		uint8 Block[64];
+		int32 BlockLength = 0;
+		uint64 TotalLength = 0;
+	};
+}
+
+FDreamHashRegistry& FDreamHashRegistry::Get()
+{
+	static FDreamHashRegistry Registry;
+	return Registry;
+}
+
+FDreamHashRegistry::FDreamHashRegistry()
+{
+	using namespace DreamHashRegistry;
+	Register(TEXT("SHA1"), []() { return TUniquePtr<IDreamHasher>(new FSha1Hasher()); });
+	Register(TEXT("XXH3"), []() { return TUniquePtr<IDreamHasher>(new FXxh3Hasher()); });
+	Register(TEXT("XXH128"), []() { return TUniquePtr<IDreamHasher>(new FXxh128Hasher()); });
+	Register(TEXT("BLAKE3"), []() { return TUniquePtr<IDreamHasher>(new FBlake3Hasher()); });
+	Register(TEXT("SHA256"), []() { return TUniquePtr<IDreamHasher>(new FSha256Hasher()); });
+}
+
+void FDreamHashRegistry::Register(const FString& Prefix, FHasherFactory Factory)
+{
+	FWriteScopeLock ScopeLock(Lock);
+	Factories.Add(Prefix.ToUpper(), MoveTemp(Factory));
+}
+
+bool FDreamHashRegistry::IsSupported(const FString& FileVersion) const
+{
+	FReadScopeLock ScopeLock(Lock);
+	return Factories.Contains(GetPrefix(FileVersion).ToUpper());
+}
+
+TUniquePtr<IDreamHasher> FDreamHashRegistry::CreateHasher(const FString& FileVersion) const
+{
+	FReadScopeLock ScopeLock(Lock);
+	const FHasherFactory* Factory = Factories.Find(GetPrefix(FileVersion).ToUpper());
+	return (Factory != nullptr && *Factory) ? (*Factory)() : nullptr;
+}
+
+FString FDreamHashRegistry::GetPrefix(const FString& FileVersion)
+{
+	int32 ColonIndex = INDEX_NONE;
+	return FileVersion.FindChar(TEXT(':'), ColonIndex) ? FileVersion.Left(ColonIndex) : FString();
+}
+
+FString FDreamHashRegistry::MakeFileVersion(const FString& FileVersion, const IDreamHasher& Hasher)
+{
+	return GetPrefix(FileVersion) + TEXT(":") + Hasher.Finalize();
+}
+
+bool FDreamHashRegistry::FileVersionsMatch(const FString& A, const FString& B)
+{
+	return A.Equals(B, ESearchCase::IgnoreCase);
+}
@@ -0,0 +1,216 @@
+﻿// Copyright (C) 2025 Dream Moon, All Rights Reserved.
+
+
+#include "DreamChunkDownloaderHostScorer.h"
+
+#include "Misc/FileHelper.h"
+#include "Dom/JsonObject.h"
+#include "Dom/JsonValue.h"
+#include "Serialization/JsonWriter.h"
+#include "Serialization/JsonReader.h"
+#include "Serialization/JsonSerializer.h"
+
+#include "DreamChunkDownloaderLog.h"
+#include "DreamChunkDownloaderUtils.h"
+
+using namespace FDreamChunkDownloaderStatics;
+
+namespace DreamHostScorer
+{
+	/** Weight of a new measurement in the moving averages */
+	static constexpr float SMOOTHING = 0.2f;
+
+	/** Transfer size the score is computed for */
+	static constexpr float REFERENCE_BYTES = 1024.0f * 1024.0f;
+
+	/** Hosts failing more often than this are ranked as if they still succeeded this often */
+	static constexpr float MIN_SUCCESS_RATE = 0.05f;
+
+	/**
+	 * Fold a measurement into a moving average
+	 * @param Average The average (seeded with the first measurement)
+	 * @param Value The measurement
+	 * @param bFirst Whether this is the first measurement
+	 */
+	static void Blend(float& Average, float Value, bool bFirst)
+	{
+		Average = bFirst ? Value : Average + (Value - Average) * SMOOTHING;
+	}
+}
+
+int32 FDreamHostScorer::SelectHost(const TArray<FString>& InHosts, int32 TryNumber, float ExplorationRate) const
+{
+	check(InHosts.Num() > 0);
+	if (InHosts.Num() == 1)
+	{
+		return 0;
+	}
+
+	// explore on first attempts only, never measured hosts come first
+	if (TryNumber == 0 && FMath::FRand() < ExplorationRate)
+	{
+		TArray<int32> Unmeasured;
+		for (int32 Idx = 0; Idx < InHosts.Num(); ++Idx)
+		{
+			const FDreamHostScore* Host = Hosts.Find(InHosts[Idx]);
+			if (Host == nullptr || Host->Samples == 0)
+			{
+				Unmeasured.Add(Idx);
+			}
+		}
+		return Unmeasured.Num() > 0 ? Unmeasured[FMath::RandHelper(Unmeasured.Num())] : FMath::RandHelper(InHosts.Num());
+	}
+
+	// rank by score, unmeasured hosts keep their configured order behind the measured ones
+	TArray<int32> Ranking;
+	for (int32 Idx = 0; Idx < InHosts.Num(); ++Idx)
+	{
+		Ranking.Add(Idx);
+	}
+	Ranking.StableSort([this, &InHosts](int32 A, int32 B)
+	{
+		const FDreamHostScore* HostA = Hosts.Find(InHosts[A]);
+		const FDreamHostScore* HostB = Hosts.Find(InHosts[B]);
+		const bool bMeasuredA = HostA != nullptr && HostA->Samples > 0;
+		const bool bMeasuredB = HostB != nullptr && HostB->Samples > 0;
+		if (bMeasuredA != bMeasuredB)
+		{
+			return bMeasuredA;
+		}
+		return bMeasuredA && HostA->Score < HostB->Score;
+	});
+	return Ranking[TryNumber % Ranking.Num()];
+}
+
+void FDreamHostScorer::AddLatency(const FString& Host, double Seconds)
+{
+	FDreamHostScore& Score = FindOrAdd(Host);
+	DreamHostScorer::Blend(Score.LatencySeconds, (float)FMath::Max(Seconds, 0.0), Score.LatencySeconds <= 0.0f);
+	Score.Score = ComputeScore(Score);
+}
+
+void FDreamHostScorer::AddTransfer(const FString& Host, int64 Bytes, double Seconds)
+{
+	// tiny transfers say more about latency than throughput
+	if (Bytes < 64 * 1024 || Seconds <= 0.0)
+	{
+		return;
+	}
+
+	FDreamHostScore& Score = FindOrAdd(Host);
+	DreamHostScorer::Blend(Score.BytesPerSecond, (float)(Bytes / Seconds), Score.BytesPerSecond <= 0.0f);
+	Score.Score = ComputeScore(Score);
+}
+
+void FDreamHostScorer::AddResult(const FString& Host, int32 HttpStatus)
+{
+	// a missing file is not the host's fault
+	const bool bFailed = FDreamChunkDownloaderUtils::IsHostFailure(HttpStatus);
+
+	FDreamHostScore& Score = FindOrAdd(Host);
+	DreamHostScorer::Blend(Score.FailureRate, bFailed ? 1.0f : 0.0f, Score.Samples == 0);
+	++Score.Samples;
+	Score.Score = ComputeScore(Score);
+}
+
+void FDreamHostScorer::GetScores(TArray<FDreamHostScore>& OutScores) const
+{
+	Hosts.GenerateValueArray(OutScores);
+	OutScores.Sort([](const FDreamHostScore& A, const FDreamHostScore& B)
+	{
+		return A.Score < B.Score;
+	});
+}
+
+bool FDreamHostScorer::Load(const FString& Path)
+{
+	FString JsonData;
+	if (!FFileHelper::LoadFileToString(JsonData, *Path))
+	{
+		return false;
+	}
+
+	TSharedPtr<FJsonObject> JsonObject;
+	TSharedRef<TJsonReader<>> Reader = TJsonReaderFactory<>::Create(JsonData);
+	const TArray<TSharedPtr<FJsonValue>>* HostArray = nullptr;
+	if (!FJsonSerializer::Deserialize(Reader, JsonObject) || !JsonObject.IsValid() ||
+		!JsonObject->TryGetArrayField(HOSTS_FIELD, HostArray) || HostArray == nullptr)
+	{
+		DCD_LOG(Warning, TEXT("Host score file '%s' is corrupt, ignoring it"), *Path);
+		return false;
+	}
+
+	Hosts.Empty();
+	for (const TSharedPtr<FJsonValue>& HostValue : *HostArray)
+	{
+		const TSharedPtr<FJsonObject> HostObject = HostValue.IsValid() ? HostValue->AsObject() : nullptr;
+		FDreamHostScore Score;
+		double Latency = 0, Throughput = 0, FailureRate = 0;
+		if (!HostObject.IsValid() ||
+			!HostObject->TryGetStringField(HOST_URL_FIELD, Score.Url) ||
+			!HostObject->TryGetNumberField(HOST_LATENCY_FIELD, Latency) ||
+			!HostObject->TryGetNumberField(HOST_THROUGHPUT_FIELD, Throughput) ||
+			!HostObject->TryGetNumberField(HOST_FAILURE_RATE_FIELD, FailureRate) ||
+			!HostObject->TryGetNumberField(HOST_SAMPLES_FIELD, Score.Samples) ||
+			Score.Url.IsEmpty())
+		{
+			continue;
+		}
+		Score.LatencySeconds = (float)FMath::Max(Latency, 0.0);
+		Score.BytesPerSecond = (float)FMath::Max(Throughput, 0.0);
+		Score.FailureRate = (float)FMath::Clamp(FailureRate, 0.0, 1.0);
+		Score.Samples = FMath::Max(Score.Samples, 0);
+		Score.Score = ComputeScore(Score);
+		Hosts.Add(Score.Url, Score);
+	}
+	return true;
+}
+
+bool FDreamHostScorer::Save(const FString& Path) const
+{
+	FString JsonData;
+	TSharedRef<TJsonWriter<>> Writer = TJsonWriterFactory<>::Create(&JsonData);
+	Writer->WriteObjectStart();
+	Writer->WriteArrayStart(HOSTS_FIELD);
+	for (const auto& It : Hosts)
+	{
+		const FDreamHostScore& Score = It.Value;
+		Writer->WriteObjectStart();
+		Writer->WriteValue(HOST_URL_FIELD, Score.Url);
+		Writer->WriteValue(HOST_LATENCY_FIELD, Score.LatencySeconds);
+		Writer->WriteValue(HOST_THROUGHPUT_FIELD, Score.BytesPerSecond);
+		Writer->WriteValue(HOST_FAILURE_RATE_FIELD, Score.FailureRate);
+		Writer->WriteValue(HOST_SAMPLES_FIELD, Score.Samples);
+		Writer->WriteObjectEnd();
+	}
+	Writer->WriteArrayEnd();
+	Writer->WriteObjectEnd();
+	Writer->Close();
+
+	if (!FFileHelper::SaveStringToFile(JsonData, *Path))
+	{
+		DCD_LOG(Error, TEXT("Failed to write host scores '%s'"), *Path);
+		return false;
+	}
+	return true;
+}
+
+float FDreamHostScorer::ComputeScore(const FDreamHostScore& Host)
+{
+	// hosts without a throughput measurement yet are ranked by latency alone (a second if that's unknown too)
+	float Seconds = (Host.LatencySeconds > 0.0f) ? Host.LatencySeconds : 1.0f;
+	if (Host.BytesPerSecond > 0.0f)
+	{
+		Seconds += DreamHostScorer::REFERENCE_BYTES / Host.BytesPerSecond;
+	}
+
+	// every failure costs another attempt
+	return Seconds / FMath::Max(1.0f - Host.FailureRate, DreamHostScorer::MIN_SUCCESS_RATE);
+}
+
+FDreamHostScore& FDreamHostScorer::FindOrAdd(const FString& Host)
+{
+	FDreamHostScore& Score = Hosts.FindOrAdd(Host);
+	Score.Url = Host;
+	return Score;
+}
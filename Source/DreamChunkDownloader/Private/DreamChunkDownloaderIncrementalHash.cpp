@@ -0,0 +1,139 @@
+﻿// Copyright (C) 2025 Dream Moon, All Rights Reserved.
+
+
+#include "DreamChunkDownloaderIncrementalHash.h"
+
+#include "DreamChunkDownloaderHashRegistry.h"
+#include "DreamChunkDownloaderLog.h"
+#include "HAL/PlatformFile.h"
+#include "Misc/ScopeLock.h"
+
+FDreamIncrementalFileHash::FDreamIncrementalFileHash(const FString& InExpectedHash)
+	: ExpectedHash(InExpectedHash)
+	  , Hasher(FDreamHashRegistry::Get().CreateHasher(InExpectedHash))
+{
+	bIsValid = Hasher.IsValid();
+}
+
+FDreamIncrementalFileHash::~FDreamIncrementalFileHash()
+{
+}
+
+bool FDreamIncrementalFileHash::IsSupported(const FString& FileVersion)
+{
+	return FDreamHashRegistry::Get().IsSupported(FileVersion);
+}
+
+void FDreamIncrementalFileHash::Reset()
+{
+	FScopeLock ScopeLock(&Lock);
+	Hasher = FDreamHashRegistry::Get().CreateHasher(ExpectedHash);
+	HashedBytes = 0;
+	bIsValid = Hasher.IsValid();
+}
+
+void FDreamIncrementalFileHash::Invalidate()
+{
+	FScopeLock ScopeLock(&Lock);
+	bIsValid = false;
+}
+
+void FDreamIncrementalFileHash::Update(int64 Offset, const uint8* Data, int64 Length)
+{
+	FScopeLock ScopeLock(&Lock);
+
+	// a write at the start of the file means the download started over
+	if (Offset == 0 && HashedBytes != 0)
+	{
+		Hasher = FDreamHashRegistry::Get().CreateHasher(ExpectedHash);
+		HashedBytes = 0;
+		bIsValid = Hasher.IsValid();
+	}
+
+	if (!bIsValid || Length <= 0)
+	{
+		return;
+	}
+
+	// only a contiguous prefix can be hashed
+	if (Offset != HashedBytes)
+	{
+		bIsValid = false;
+		return;
+	}
+
+	Hasher->Update(Data, Length);
+	HashedBytes += Length;
+}
+
+bool FDreamIncrementalFileHash::CatchUp(const FString& FullPathOnDisk, int64 Length)
+{
+	FScopeLock ScopeLock(&Lock);
+	if (!bIsValid || HashedBytes > Length)
+	{
+		return false;
+	}
+	if (HashedBytes == Length)
+	{
+		return true;
+	}
+
+	TUniquePtr<IFileHandle> FilePtr(IPlatformFile::GetPlatformPhysical().OpenRead(*FullPathOnDisk));
+	if (!FilePtr.IsValid() || FilePtr->Size() < Length || !FilePtr->Seek(HashedBytes))
+	{
+		DCD_LOG(Warning, TEXT("Unable to open %s to hash the first %lld bytes."), *FullPathOnDisk, Length);
+		bIsValid = false;
+		return false;
+	}
+
+	// read in 64K chunks to prevent raising the memory high water mark too much
+	static const int64 FILE_BUFFER_SIZE = 64 * 1024;
+	TArray<uint8> Buffer;
+	Buffer.SetNumUninitialized(FILE_BUFFER_SIZE);
+	while (HashedBytes < Length)
+	{
+		int64 SizeToRead = FMath::Min(Length - HashedBytes, FILE_BUFFER_SIZE);
+		if (!FilePtr->Read(Buffer.GetData(), SizeToRead))
+		{
+			DCD_LOG(Warning, TEXT("Read error while hashing '%s' at offset %lld."), *FullPathOnDisk, HashedBytes);
+			bIsValid = false;
+			return false;
+		}
+		Hasher->Update(Buffer.GetData(), SizeToRead);
+		HashedBytes += SizeToRead;
+	}
+	return true;
+}
+
+int64 FDreamIncrementalFileHash::GetHashedBytes() const
+{
+	FScopeLock ScopeLock(&Lock);
+	return HashedBytes;
+}
+
+bool FDreamIncrementalFileHash::IsValid() const
+{
+	FScopeLock ScopeLock(&Lock);
+	return bIsValid;
+}
+
+bool FDreamIncrementalFileHash::Matches(int64 FileSize) const
+{
+	FScopeLock ScopeLock(&Lock);
+	if (!bIsValid || HashedBytes != FileSize)
+	{
+		return false;
+	}
+	return FDreamHashRegistry::FileVersionsMatch(GetHashString(), ExpectedHash);
+}
+
+FString FDreamIncrementalFileHash::GetHashString() const
+{
+	FScopeLock ScopeLock(&Lock);
+
+	if (!Hasher.IsValid())
+	{
+		return FString();
+	}
+	return FDreamHashRegistry::MakeFileVersion(ExpectedHash, *Hasher);
+}
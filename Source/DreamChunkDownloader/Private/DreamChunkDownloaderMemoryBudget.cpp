@@ -0,0 +1,116 @@
+﻿// Copyright (C) 2025 Dream Moon, All Rights Reserved.
+
+
+#include "DreamChunkDownloaderMemoryBudget.h"
+
+#include "Misc/ScopeLock.h"
+
+FDreamMemoryBudget::FDreamMemoryBudget(int64 InLimit)
+	: Limit(FMath::Max<int64>(InLimit, 0))
+{
+}
+
+void FDreamMemoryBudget::SetLimit(int64 InLimit)
+{
+	FScopeLock ScopeLock(&Lock);
+	Limit = FMath::Max<int64>(InLimit, 0);
+}
+
+int64 FDreamMemoryBudget::GetLimit() const
+{
+	FScopeLock ScopeLock(&Lock);
+	return Limit;
+}
+
+bool FDreamMemoryBudget::CanFit(int64 Bytes) const
+{
+	FScopeLock ScopeLock(&Lock);
+	return Limit <= 0 || UsedBytes + Bytes <= Limit;
+}
+
+int64 FDreamMemoryBudget::Acquire(int64 Bytes, int64 MinBytes)
+{
+	FScopeLock ScopeLock(&Lock);
+	Bytes = FMath::Max<int64>(Bytes, 0);
+	MinBytes = FMath::Clamp<int64>(MinBytes, 0, Bytes);
+
+	// take what is left, but never less than the caller needs to make progress
+	int64 Granted = Bytes;
+	if (Limit > 0)
+	{
+		Granted = FMath::Clamp<int64>(Limit - UsedBytes, MinBytes, Bytes);
+	}
+	UsedBytes += Granted;
+	PeakBytes = FMath::Max(PeakBytes, UsedBytes);
+	return Granted;
+}
+
+void FDreamMemoryBudget::Release(int64 Bytes)
+{
+	FScopeLock ScopeLock(&Lock);
+	UsedBytes = FMath::Max<int64>(UsedBytes - Bytes, 0);
+}
+
+int64 FDreamMemoryBudget::GetUsedBytes() const
+{
+	FScopeLock ScopeLock(&Lock);
+	return UsedBytes;
+}
+
+int64 FDreamMemoryBudget::GetPeakBytes() const
+{
+	FScopeLock ScopeLock(&Lock);
+	return PeakBytes;
+}
+
+void FDreamMemoryBudget::ResetPeak()
+{
+	FScopeLock ScopeLock(&Lock);
+	PeakBytes = UsedBytes;
+}
+
+//////////////////////////////////////////////////////////////////////////////////
+// FDreamMemoryReservation
+
+FDreamMemoryReservation::FDreamMemoryReservation(const TSharedPtr<FDreamMemoryBudget, ESPMode::ThreadSafe>& InBudget, int64 InBytes, int64 MinBytes)
+	: Budget(InBudget)
+{
+	if (Budget.IsValid())
+	{
+		Bytes = Budget->Acquire(InBytes, (MinBytes < 0) ? InBytes : MinBytes);
+	}
+}
+
+FDreamMemoryReservation::~FDreamMemoryReservation()
+{
+	Reset();
+}
+
+FDreamMemoryReservation::FDreamMemoryReservation(FDreamMemoryReservation&& Other)
+	: Budget(MoveTemp(Other.Budget))
+	  , Bytes(Other.Bytes)
+{
+	Other.Bytes = 0;
+}
+
+FDreamMemoryReservation& FDreamMemoryReservation::operator=(FDreamMemoryReservation&& Other)
+{
+	if (this != &Other)
+	{
+		Reset();
+		Budget = MoveTemp(Other.Budget);
+		Bytes = Other.Bytes;
+		Other.Bytes = 0;
+	}
+	return *this;
+}
+
+void FDreamMemoryReservation::Reset()
+{
+	if (Budget.IsValid() && Bytes > 0)
+	{
+		Budget->Release(Bytes);
+	}
+	Budget.Reset();
+	Bytes = 0;
+}
@@ -3,6 +3,7 @@
 
 #include "DreamChunkDownloaderModule.h"
 
+#include "DreamChunkDownloaderDownloadTransport.h"
 #include "DreamChunkDownloaderSettings.h"
 #if WITH_EDITOR
 #include "ISettingsModule.h"
@@ -28,6 +29,9 @@ void FDreamChunkDownloaderModule::StartupModule()
 
 void FDreamChunkDownloaderModule::ShutdownModule()
 {
+	// stop transport threads before the engine modules they use go away
+	FDreamDownloadTransportRegistry::Get().Shutdown();
+
 #if WITH_EDITOR
 	if (ISettingsModule* SettingsModule = FModuleManager::GetModulePtr<ISettingsModule>(TEXT("Settings")))
 	{
@@ -0,0 +1,65 @@
+﻿// Copyright (C) 2025 Dream Moon, All Rights Reserved.
+
+
+#include "DreamChunkDownloaderPakVerifyWork.h"
+
+#include "HAL/PlatformTime.h"
+
+#include "DreamChunkDownloaderHashRegistry.h"
+#include "DreamChunkDownloaderIncrementalHash.h"
+#include "DreamChunkDownloaderLog.h"
+#include "DreamChunkDownloaderMemoryBudget.h"
+#include "DreamChunkDownloaderUtils.h"
+
+void FDreamPakVerifyWork::DoWork()
+{
+	const double StartTime = FPlatformTime::Seconds();
+	bIsValid = !bBlocksOnly;
+
+	// the read buffer counts against the memory budget, but verification never waits for it
+	FDreamMemoryReservation ReadMemory;
+
+	if (bBlocksOnly)
+	{
+		// the file already failed, only find out where
+	}
+	else if (SizeOnDisk != Entry.FileSize)
+	{
+		DCD_LOG(Error, TEXT("Size mismatch. Expected %llu, got %llu"), Entry.FileSize, SizeOnDisk);
+		bIsValid = false;
+	}
+	else if (IncrementalHash.IsValid() && IncrementalHash->IsValid() && IncrementalHash->GetHashedBytes() == SizeOnDisk)
+	{
+		// the running hash already covers the whole file, no need to read it again
+		if (!IncrementalHash->Matches(SizeOnDisk))
+		{
+			DCD_LOG(Error, TEXT("Checksum mismatch. Expected %s, got %s"), *Entry.FileVersion, *IncrementalHash->GetHashString());
+			bIsValid = false;
+		}
+	}
+	else if (FDreamHashRegistry::Get().IsSupported(Entry.FileVersion))
+	{
+		// check the hash
+		ReadMemory = FDreamMemoryReservation(MemoryBudget, FDreamChunkDownloaderUtils::FILE_READ_BUFFER_SIZE);
+		if (!FDreamChunkDownloaderUtils::CheckFileHash(TargetFile, Entry.FileVersion))
+		{
+			DCD_LOG(Error, TEXT("Checksum mismatch. Expected %s"), *Entry.FileVersion);
+			bIsValid = false;
+		}
+	}
+
+	// find the corrupt blocks so only those have to be downloaded again
+	const bool bHasBlockHashes = BlockSize > 0 && BlockHashes.Num() == FMath::DivideAndRoundUp<int64>(Entry.FileSize, BlockSize);
+	if (!bIsValid && bHasBlockHashes && SizeOnDisk == Entry.FileSize)
+	{
+		ReadMemory = FDreamMemoryReservation(MemoryBudget, FDreamChunkDownloaderUtils::FILE_READ_BUFFER_SIZE);
+		bBlocksChecked = FDreamChunkDownloaderUtils::FindCorruptBlocks(TargetFile, BlockSize, BlockHashes, CorruptBlocks, [](int64 BytesRead) { return true; });
+		if (bBlocksChecked)
+		{
+			DCD_LOG(Log, TEXT("%s has %d corrupt blocks of %d"), *Entry.FileName, CorruptBlocks.Num(), BlockHashes.Num());
+		}
+	}
+
+	VerifySeconds = FPlatformTime::Seconds() - StartTime;
+	DCD_LOG(Verbose, TEXT("Verified %s in %.3f seconds (%s)"), *Entry.FileName, VerifySeconds, bIsValid ? TEXT("valid") : TEXT("invalid"));
+}
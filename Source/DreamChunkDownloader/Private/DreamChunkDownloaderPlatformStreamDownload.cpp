@@ -1,9 +1,15 @@
-﻿// Copyright (C) 2025 Dream Moon, All Rights Reserved.
+﻿﻿// Copyright (C) 2025 Dream Moon, All Rights Reserved.
 
 
 #include "DreamChunkDownloaderPlatformStreamDownload.h"
+#include "DreamChunkDownloaderDownloaderThread.h"
+#include "DreamChunkDownloaderDownloadTransport.h"
+#include "DreamChunkDownloaderFileSink.h"
+#include "DreamChunkDownloaderIncrementalHash.h"
 #include "DreamChunkDownloaderLog.h"
-#include "HAL/FileManager.h"
+#include "DreamChunkDownloaderRetryPolicy.h"
+#include "DreamChunkDownloaderTokenBucket.h"
+#include "Async/Async.h"
 #include "HAL/PlatformFile.h"
 #include "HttpModule.h"
 #include "Interfaces/IHttpRequest.h"
@@ -11,37 +17,205 @@
 #include "Modules/ModuleManager.h"
 //////////////////////////////////////////////////////////////////////////////////
 
-// NOTE: this implementation does not stream the file, it loads the whole thing into memory
-// then saves it (not optimal). It does attempt to resume interrupted downloads (for use in testing), but since it doesn't do partial writes, those probably won't occur in the wild.
-FDreamDownloadCancel PlatformStreamDownload(const FString& Url, const FString& TargetFile, const FDreamDownloadProgress& Progress, const FDreamDownloadComplete& Callback)
+namespace
 {
-	// how much of the file do we currently have on disk (if any)
-	IFileManager& FileManager = IFileManager::Get();
-	int64 FileSizeOnDisk = FileManager.FileSize(*TargetFile);
-	uint64 SizeOnDisk = (FileSizeOnDisk > 0) ? (uint64)FileSizeOnDisk : 0;
+	/** Result of the completion work of a request */
+	typedef TFunction<int32(FHttpRequestPtr HttpRequest, FHttpResponsePtr HttpResponse, bool bSuccess)> FDreamCompleteWork;
+
+	/**
+	 * Bind the progress and completion delegates of a request
+	 * Without a completion thread both run on the game thread. With one, the request completes on the HTTP thread,
+	 * the completion work runs on the downloader thread and only the callbacks go back to the game thread.
+	 */
+	void BindRequestDelegates(const TSharedRef<IHttpRequest, ESPMode::ThreadSafe>& Request, const FDreamStreamDownloadOptions& Options,
+	                          const FDreamDownloadProgress& Progress, const FDreamDownloadComplete& Callback, FDreamCompleteWork&& CompleteWork)
+	{
+		// let the retry policy see throttling responses before anything else
+		if (Options.RetryPolicy.IsValid())
+		{
+			CompleteWork = [RetryPolicy = Options.RetryPolicy, Work = MoveTemp(CompleteWork)](FHttpRequestPtr HttpRequest, FHttpResponsePtr HttpResponse, bool bSuccess)
+			{
+				if (HttpResponse.IsValid())
+				{
+					RetryPolicy->NoteResponse(HttpResponse->GetResponseCode(), HttpResponse->GetHeader(TEXT("Retry-After")));
+				}
+				return Work(HttpRequest, HttpResponse, bSuccess);
+			};
+		}
+
+		TSharedPtr<FDreamDownloaderThread, ESPMode::ThreadSafe> CompletionThread = Options.CompletionThread;
+		if (!CompletionThread.IsValid())
+		{
+			if (Progress)
+			{
+				Request->OnRequestProgress64().BindLambda([Progress](FHttpRequestPtr HttpRequest, uint64 BytesSent, uint64 BytesReceived)
+				{
+					Progress(BytesReceived);
+				});
+			}
+			Request->OnProcessRequestComplete().BindLambda([Callback, CompleteWork = MoveTemp(CompleteWork)](FHttpRequestPtr HttpRequest, FHttpResponsePtr HttpResponse, bool bSuccess)
+			{
+				const int32 HttpStatus = CompleteWork(HttpRequest, HttpResponse, bSuccess);
+				if (Callback)
+				{
+					Callback(HttpStatus);
+				}
+			});
+			return;
+		}
+
+		Request->SetDelegateThreadPolicy(EHttpRequestDelegateThreadPolicy::CompleteOnHttpThread);
+
+		// progress arrives on the HTTP thread, only the latest value is handed to the game thread
+		TSharedRef<FDreamGameThreadProgress, ESPMode::ThreadSafe> GameProgress = MakeShared<FDreamGameThreadProgress, ESPMode::ThreadSafe>(Progress);
+		if (Progress)
+		{
+			Request->OnRequestProgress64().BindLambda([GameProgress](FHttpRequestPtr HttpRequest, uint64 BytesSent, uint64 BytesReceived)
+			{
+				GameProgress->Report(BytesReceived);
+			});
+		}
+
+		TSharedRef<FDreamCompleteWork, ESPMode::ThreadSafe> SharedWork = MakeShared<FDreamCompleteWork, ESPMode::ThreadSafe>(MoveTemp(CompleteWork));
+		Request->OnProcessRequestComplete().BindLambda([Callback, SharedWork, CompletionThread, GameProgress](FHttpRequestPtr HttpRequest, FHttpResponsePtr HttpResponse, bool bSuccess)
+		{
+			GameProgress->Complete();
+			TFunction<void()> Message = [Callback, SharedWork, HttpRequest, HttpResponse, bSuccess]()
+			{
+				const int32 HttpStatus = (*SharedWork)(HttpRequest, HttpResponse, bSuccess);
+				AsyncTask(ENamedThreads::GameThread, [Callback, HttpStatus]()
+				{
+					if (Callback)
+					{
+						Callback(HttpStatus);
+					}
+				});
+			};
+
+			// the thread is gone during shutdown, finish the transfer right here instead
+			if (!CompletionThread->Post(MoveTemp(Message)))
+			{
+				Message();
+			}
+		});
+	}
+}
+
+FDreamDownloadCancel PlatformStreamDownload(const FString& Url, const FString& TargetFile, const FDreamStreamDownloadOptions& Options, const FDreamDownloadProgress& Progress, const FDreamDownloadComplete& Callback)
+{
+	TSharedPtr<IDreamDownloadTransport, ESPMode::ThreadSafe> Transport = FDreamDownloadTransportRegistry::Get().FindTransport(Url);
+	if (!Transport.IsValid())
+	{
+		DCD_LOG(Error, TEXT("No download transport can handle '%s'"), *Url);
+		AsyncTask(ENamedThreads::GameThread, [Callback]()
+		{
+			if (Callback)
+			{
+				Callback(0);
+			}
+		});
+		return []() {};
+	}
+	return Transport->Download(Url, TargetFile, Options, Progress, Callback);
+}
+
+bool FDreamHttpDownloadTransport::CanHandle(const FString& Url) const
+{
+	return Url.StartsWith(TEXT("http://"), ESearchCase::IgnoreCase) || Url.StartsWith(TEXT("https://"), ESearchCase::IgnoreCase);
+}
+
+// NOTE: with Options.bStreamToDisk the response body is written to the target file in bounded blocks as it arrives,
+// so interrupted downloads leave a real partial file that the next attempt resumes with a Range request.
+// Without it the whole file is loaded into memory then saved (not optimal, kept as a fallback for HTTP backends without body streaming).
+FDreamDownloadCancel FDreamHttpDownloadTransport::Download(const FString& Url, const FString& TargetFile, const FDreamStreamDownloadOptions& Options,
+                                                           const FDreamDownloadProgress& Progress, const FDreamDownloadComplete& Callback)
+{
+	const FDreamTransferRange Range = FDreamTransferRange::Make(TargetFile, Options);
+	const bool bUseSink = Options.bStreamToDisk || Range.bIsExplicitRange || Range.bIsCompressed;
+	TSharedPtr<FDreamChunkDownloadFileSink, ESPMode::ThreadSafe> Sink;
+	if (bUseSink)
+	{
+		Sink = CreateFileSink(TargetFile, Options, Range);
+		if (!Sink.IsValid())
+		{
+			CompleteOnGameThread(Callback, 0);
+			return []() {};
+		}
+	}
 
 	// do a range request for the part we're missing
 	FHttpModule& HttpModule = FModuleManager::LoadModuleChecked<FHttpModule>("HTTP");
 	TSharedRef<IHttpRequest, ESPMode::ThreadSafe> Request = HttpModule.Get().CreateRequest();
 	Request->SetURL(Url);
 	Request->SetVerb(TEXT("GET"));
-	if (SizeOnDisk > 0)
+	if (Range.bIsCompressed)
 	{
-		// try to request a specific range
-		Request->SetHeader(TEXT("Range"), FString::Printf(TEXT("bytes=%llu-"), SizeOnDisk));
+		// we decode the body ourselves, don't let the HTTP layer do it
+		Request->SetHeader(TEXT("Accept-Encoding"), TEXT("identity"));
+	}
+	const FString RangeHeader = Range.GetRangeHeader();
+	if (!RangeHeader.IsEmpty())
+	{
+		Request->SetHeader(TEXT("Range"), RangeHeader);
 	}
 
-	// bind the progress delegate
-	if (Progress)
+	// stream the body straight to disk
+	if (bUseSink)
 	{
-		Request->OnRequestProgress64().BindLambda([Progress](FHttpRequestPtr HttpRequest, uint64 BytesSent, uint64 BytesReceived)
+		TWeakPtr<IHttpRequest, ESPMode::ThreadSafe> WeakRequest = Request;
+		TSharedPtr<FDreamTokenBucket, ESPMode::ThreadSafe> Bandwidth = Options.Bandwidth;
+		Request->SetResponseBodyReceiveStreamDelegate(FHttpRequestStreamDelegate::CreateLambda([Sink, Bandwidth, WeakRequest](void* Ptr, int64 Length)
 		{
-			Progress(BytesReceived);
+			// look at the headers once, before the first block is written
+			if (!Sink->HasBegunResponse())
+			{
+				int32 HttpStatus = 0;
+				FString ContentRange;
+				TSharedPtr<IHttpRequest, ESPMode::ThreadSafe> HttpRequest = WeakRequest.Pin();
+				FHttpResponsePtr HttpResponse = HttpRequest.IsValid() ? HttpRequest->GetResponse() : nullptr;
+				if (HttpResponse.IsValid())
+				{
+					HttpStatus = HttpResponse->GetResponseCode();
+					ContentRange = HttpResponse->GetHeader(TEXT("Content-Range"));
+				}
+				Sink->BeginResponse(HttpStatus, ContentRange);
+			}
+
+			// never wait on the shared HTTP thread, the debt holds back the next requests of the download instead
+			if (Bandwidth.IsValid())
+			{
+				Bandwidth->Reserve(Length);
+			}
+
+			// returning false aborts the request (write error)
+			return Sink->Write(static_cast<const uint8*>(Ptr), Length);
+		}));
+
+		BindRequestDelegates(Request, Options, Progress, Callback, [TargetFile, Range, Sink](FHttpRequestPtr HttpRequest, FHttpResponsePtr HttpResponse, bool bSuccess)
+		{
+			int32 HttpStatus = 0;
+			FString ContentRange;
+			if (HttpResponse.IsValid())
+			{
+				HttpStatus = HttpResponse->GetResponseCode();
+				ContentRange = HttpResponse->GetHeader(TEXT("Content-Range"));
+			}
+			return FinishResponse(*Sink, HttpRequest->GetURL(), TargetFile, Range, HttpResponse.IsValid(), HttpStatus, ContentRange);
 		});
+		Request->ProcessRequest();
+		return [Request]()
+		{
+			Request->CancelRequest();
+		};
 	}
 
-	// bind a completion delegate
-	Request->OnProcessRequestComplete().BindLambda([Callback, TargetFile, SizeOnDisk](FHttpRequestPtr HttpRequest, FHttpResponsePtr HttpResponse, bool bSuccess)
+	// bind the completion work (writes the whole body)
+	TSharedPtr<FDreamIncrementalFileHash, ESPMode::ThreadSafe> IncrementalHash = Options.IncrementalHash;
+	const uint64 SizeOnDisk = (uint64)Range.ResumeOffset;
+
+	// the body is held in memory whole until it is saved
+	TSharedPtr<FDreamMemoryReservation, ESPMode::ThreadSafe> BodyMemory = MakeShared<FDreamMemoryReservation, ESPMode::ThreadSafe>(Options.MemoryBudget, FMath::Max<int64>(Options.ExpectedBodySize, 0));
+	BindRequestDelegates(Request, Options, Progress, Callback, [TargetFile, SizeOnDisk, IncrementalHash, BodyMemory](FHttpRequestPtr HttpRequest, FHttpResponsePtr HttpResponse, bool bSuccess)
 	{
 		// check response
 		int32 HttpStatus = 0;
@@ -70,12 +244,18 @@ FDreamDownloadCancel PlatformStreamDownload(const FString& Url, const FString& T
 				IFileHandle* ManifestFile = IPlatformFile::GetPlatformPhysical().OpenWrite(*TargetFile, SizeOnDisk > 0 && bIsPartialContent);
 				if (ManifestFile != nullptr)
 				{
-					// write to the file
+					// write to the file (an empty body leaves it as opened, truncated for a 200)
 					const TArray<uint8>& Content = HttpResponse->GetContent();
-					bSuccess = ManifestFile->Write(&Content[0], Content.Num());
+					bSuccess = Content.Num() == 0 || ManifestFile->Write(Content.GetData(), Content.Num());
 					// close the file
 					delete ManifestFile;
 
+					// keep the running hash in step with the file
+					if (bSuccess && IncrementalHash.IsValid() && Content.Num() > 0)
+					{
+						IncrementalHash->Update(bIsPartialContent ? (int64)SizeOnDisk : 0, Content.GetData(), Content.Num());
+					}
+
 					// handle failure
 					if (!bSuccess)
 					{
@@ -111,12 +291,8 @@ FDreamDownloadCancel PlatformStreamDownload(const FString& Url, const FString& T
 		{
 			DCD_LOG(Error, TEXT("HTTP connection issue downloading '%s'"), *HttpRequest->GetURL());
 		}
-
-		// invoke the callback
-		if (Callback)
-		{
-			Callback(HttpStatus);
-		}
+		BodyMemory->Reset();
+		return HttpStatus;
 	});
 	Request->ProcessRequest();
 	return [Request]()
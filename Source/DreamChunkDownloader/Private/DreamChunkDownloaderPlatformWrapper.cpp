@@ -64,12 +64,20 @@ void FDreamChunkDownloaderPlatformWrapper::RemoveChunkInstallDelegate(FDelegateH
 
 EChunkInstallSpeed::Type FDreamChunkDownloaderPlatformWrapper::GetInstallSpeed()
 {
-	return EChunkInstallSpeed::Fast;
+	if (!ChunkDownloader.IsValid())
+	{
+		return EChunkInstallSpeed::Fast;
+	}
+	return ChunkDownloader->GetInstallSpeed();
 }
 
 bool FDreamChunkDownloaderPlatformWrapper::SetInstallSpeed(EChunkInstallSpeed::Type InstallSpeed)
 {
-	return false;
+	if (!ChunkDownloader.IsValid())
+	{
+		return false;
+	}
+	return ChunkDownloader->SetInstallSpeed(InstallSpeed);
 }
 
 bool FDreamChunkDownloaderPlatformWrapper::DebugStartNextChunk()
@@ -0,0 +1,217 @@
+﻿// Copyright (C) 2025 Dream Moon, All Rights Reserved.
+
+
+#include "DreamChunkDownloaderResumeState.h"
+
+#include "HAL/FileManager.h"
+#include "Misc/FileHelper.h"
+#include "Misc/Paths.h"
+#include "Dom/JsonObject.h"
+#include "Dom/JsonValue.h"
+#include "Serialization/JsonWriter.h"
+#include "Serialization/JsonReader.h"
+#include "Serialization/JsonSerializer.h"
+
+#include "DreamChunkDownloaderLog.h"
+#include "DreamChunkDownloaderTypes.h"
+
+using namespace FDreamChunkDownloaderStatics;
+
+FString FDreamDownloadResumeState::GetPath(const FString& TargetFile)
+{
+	return TargetFile + RESUME_STATE_EXTENSION;
+}
+
+bool FDreamDownloadResumeState::Exists(const FString& TargetFile)
+{
+	return FPaths::FileExists(GetPath(TargetFile));
+}
+
+void FDreamDownloadResumeState::Delete(const FString& TargetFile)
+{
+	FString StatePath = GetPath(TargetFile);
+	if (FPaths::FileExists(StatePath) && !IFileManager::Get().Delete(*StatePath))
+	{
+		DCD_LOG(Error, TEXT("Unable to delete resume state '%s'"), *StatePath);
+	}
+}
+
+void FDreamDownloadResumeState::Reset(const FString& InFileVersion, int64 InFileSize, int32 NumSegments, int64 ValidPrefix)
+{
+	FileVersion = InFileVersion;
+	FileSize = InFileSize;
+	Segments.Empty();
+
+	NumSegments = FMath::Clamp<int64>(NumSegments, 1, FMath::Max<int64>(InFileSize, 1));
+	const int64 SegmentSize = FMath::DivideAndRoundUp<int64>(InFileSize, NumSegments);
+	for (int64 Begin = 0; Begin < InFileSize; Begin += SegmentSize)
+	{
+		FDreamDownloadSegment& Segment = Segments.AddDefaulted_GetRef();
+		Segment.Begin = Begin;
+		Segment.End = FMath::Min(Begin + SegmentSize, InFileSize);
+
+		// keep whatever a previous single stream download already wrote
+		Segment.Received = FMath::Clamp<int64>(ValidPrefix - Segment.Begin, 0, Segment.GetLength());
+	}
+}
+
+void FDreamDownloadResumeState::ResetForRepair(const FString& InFileVersion, int64 InFileSize, int64 BlockSize, const TArray<int32>& CorruptBlocks)
+{
+	FileVersion = InFileVersion;
+	FileSize = InFileSize;
+	Segments.Empty();
+
+	// alternate between complete runs of good blocks and missing runs of corrupt ones
+	int64 Offset = 0;
+	for (int32 Idx = 0; Idx < CorruptBlocks.Num();)
+	{
+		const int64 RunBegin = FMath::Min((int64)CorruptBlocks[Idx] * BlockSize, InFileSize);
+		int32 LastBlock = CorruptBlocks[Idx];
+		while (++Idx < CorruptBlocks.Num() && CorruptBlocks[Idx] == LastBlock + 1)
+		{
+			LastBlock = CorruptBlocks[Idx];
+		}
+		const int64 RunEnd = FMath::Min((int64)(LastBlock + 1) * BlockSize, InFileSize);
+		if (RunBegin < Offset || RunEnd <= RunBegin)
+		{
+			continue;
+		}
+
+		if (RunBegin > Offset)
+		{
+			FDreamDownloadSegment& GoodSegment = Segments.AddDefaulted_GetRef();
+			GoodSegment.Begin = Offset;
+			GoodSegment.End = RunBegin;
+			GoodSegment.Received = GoodSegment.GetLength();
+		}
+
+		FDreamDownloadSegment& BadSegment = Segments.AddDefaulted_GetRef();
+		BadSegment.Begin = RunBegin;
+		BadSegment.End = RunEnd;
+		BadSegment.Received = 0;
+		Offset = RunEnd;
+	}
+
+	if (Offset < InFileSize)
+	{
+		FDreamDownloadSegment& GoodSegment = Segments.AddDefaulted_GetRef();
+		GoodSegment.Begin = Offset;
+		GoodSegment.End = InFileSize;
+		GoodSegment.Received = GoodSegment.GetLength();
+	}
+}
+
+bool FDreamDownloadResumeState::Load(const FString& TargetFile)
+{
+	Segments.Empty();
+
+	FString JsonData;
+	if (!FFileHelper::LoadFileToString(JsonData, *GetPath(TargetFile)))
+	{
+		return false;
+	}
+
+	TSharedPtr<FJsonObject> JsonObject;
+	TSharedRef<TJsonReader<>> Reader = TJsonReaderFactory<>::Create(JsonData);
+	if (!FJsonSerializer::Deserialize(Reader, JsonObject) || !JsonObject.IsValid())
+	{
+		DCD_LOG(Warning, TEXT("Resume state for '%s' is corrupt, ignoring it"), *TargetFile);
+		return false;
+	}
+
+	double FileSizeDouble = 0;
+	const TArray<TSharedPtr<FJsonValue>>* SegmentArray = nullptr;
+	if (!JsonObject->TryGetStringField(FILE_VERSION_FIELD, FileVersion) ||
+		!JsonObject->TryGetNumberField(FILE_SIZE_FIELD, FileSizeDouble) ||
+		!JsonObject->TryGetArrayField(SEGMENTS_FIELD, SegmentArray) || SegmentArray == nullptr)
+	{
+		DCD_LOG(Warning, TEXT("Resume state for '%s' is missing fields, ignoring it"), *TargetFile);
+		return false;
+	}
+	FileSize = static_cast<int64>(FileSizeDouble);
+
+	// segments have to cover the file without gaps
+	int64 ExpectedBegin = 0;
+	for (const TSharedPtr<FJsonValue>& SegmentValue : *SegmentArray)
+	{
+		const TSharedPtr<FJsonObject> SegmentObject = SegmentValue.IsValid() ? SegmentValue->AsObject() : nullptr;
+		double Begin = 0, End = 0, Received = 0;
+		if (!SegmentObject.IsValid() ||
+			!SegmentObject->TryGetNumberField(SEGMENT_BEGIN_FIELD, Begin) ||
+			!SegmentObject->TryGetNumberField(SEGMENT_END_FIELD, End) ||
+			!SegmentObject->TryGetNumberField(SEGMENT_RECEIVED_FIELD, Received))
+		{
+			Segments.Empty();
+			return false;
+		}
+
+		FDreamDownloadSegment& Segment = Segments.AddDefaulted_GetRef();
+		Segment.Begin = static_cast<int64>(Begin);
+		Segment.End = static_cast<int64>(End);
+		Segment.Received = FMath::Clamp<int64>(static_cast<int64>(Received), 0, Segment.GetLength());
+		if (Segment.Begin != ExpectedBegin || Segment.End <= Segment.Begin)
+		{
+			Segments.Empty();
+			return false;
+		}
+		ExpectedBegin = Segment.End;
+	}
+
+	if (ExpectedBegin != FileSize)
+	{
+		Segments.Empty();
+		return false;
+	}
+	return true;
+}
+
+bool FDreamDownloadResumeState::Save(const FString& TargetFile) const
+{
+	FString JsonData;
+	TSharedRef<TJsonWriter<>> Writer = TJsonWriterFactory<>::Create(&JsonData);
+	Writer->WriteObjectStart();
+	Writer->WriteValue(FILE_VERSION_FIELD, FileVersion);
+	Writer->WriteValue(FILE_SIZE_FIELD, FileSize);
+	Writer->WriteArrayStart(SEGMENTS_FIELD);
+	for (const FDreamDownloadSegment& Segment : Segments)
+	{
+		Writer->WriteObjectStart();
+		Writer->WriteValue(SEGMENT_BEGIN_FIELD, Segment.Begin);
+		Writer->WriteValue(SEGMENT_END_FIELD, Segment.End);
+		Writer->WriteValue(SEGMENT_RECEIVED_FIELD, Segment.Received);
+		Writer->WriteObjectEnd();
+	}
+	Writer->WriteArrayEnd();
+	Writer->WriteObjectEnd();
+	Writer->Close();
+
+	FString StatePath = GetPath(TargetFile);
+	if (!FFileHelper::SaveStringToFile(JsonData, *StatePath))
+	{
+		DCD_LOG(Error, TEXT("Failed to write resume state '%s'"), *StatePath);
+		return false;
+	}
+	return true;
+}
+
+int64 FDreamDownloadResumeState::GetReceivedBytes() const
+{
+	int64 ReceivedBytes = 0;
+	for (const FDreamDownloadSegment& Segment : Segments)
+	{
+		ReceivedBytes += Segment.Received;
+	}
+	return ReceivedBytes;
+}
+
+bool FDreamDownloadResumeState::IsComplete() const
+{
+	for (const FDreamDownloadSegment& Segment : Segments)
+	{
+		if (!Segment.IsComplete())
+		{
+			return false;
+		}
+	}
+	return Segments.Num() > 0;
+}
@@ -0,0 +1,105 @@
+﻿// Copyright (C) 2025 Dream Moon, All Rights Reserved.
+
+
+#include "DreamChunkDownloaderRetryPolicy.h"
+
+#include "DreamChunkDownloaderLog.h"
+#include "HAL/PlatformTime.h"
+#include "Misc/DateTime.h"
+#include "Misc/ScopeLock.h"
+
+namespace
+{
+	/** Longest Retry-After we honour, a misconfigured server shouldn't stall downloads for hours */
+	const float MAX_RETRY_AFTER_SECONDS = 600.0f;
+}
+
+FDreamRetryPolicy::FDreamRetryPolicy(float InBaseDelaySeconds, float InMaxDelaySeconds, int32 InSessionBudget)
+	: BaseDelaySeconds(FMath::Max(InBaseDelaySeconds, 0.0f))
+	  , MaxDelaySeconds(FMath::Max(InMaxDelaySeconds, InBaseDelaySeconds))
+	  , SessionBudget(FMath::Max(InSessionBudget, 0))
+{
+}
+
+bool FDreamRetryPolicy::IsPermanentFailure(int32 HttpStatus)
+{
+	if (HttpStatus >= 400 && HttpStatus < 500)
+	{
+		// timeouts, early data and throttling clear up, an unusable range is fetched whole next time
+		return HttpStatus != 408 && HttpStatus != 416 && HttpStatus != 425 && HttpStatus != 429;
+	}
+
+	// not implemented / version not supported won't change either
+	return HttpStatus == 501 || HttpStatus == 505;
+}
+
+float FDreamRetryPolicy::ParseRetryAfter(const FString& HeaderValue)
+{
+	const FString Value = HeaderValue.TrimStartAndEnd();
+	if (Value.IsEmpty())
+	{
+		return 0.0f;
+	}
+
+	// delay-seconds
+	if (Value.IsNumeric())
+	{
+		return FMath::Clamp(FCString::Atof(*Value), 0.0f, MAX_RETRY_AFTER_SECONDS);
+	}
+
+	// HTTP-date
+	FDateTime RetryDate;
+	if (FDateTime::ParseHttpDate(Value, RetryDate))
+	{
+		return FMath::Clamp((float)(RetryDate - FDateTime::UtcNow()).GetTotalSeconds(), 0.0f, MAX_RETRY_AFTER_SECONDS);
+	}
+	return 0.0f;
+}
+
+void FDreamRetryPolicy::NoteResponse(int32 HttpStatus, const FString& RetryAfterHeader)
+{
+	if (HttpStatus != 429 && HttpStatus != 503)
+	{
+		return;
+	}
+
+	const float RetryAfterSeconds = ParseRetryAfter(RetryAfterHeader);
+	if (RetryAfterSeconds <= 0.0f)
+	{
+		return;
+	}
+
+	FScopeLock ScopeLock(&Lock);
+	RetryNotBefore = FMath::Max(RetryNotBefore, FPlatformTime::Seconds() + RetryAfterSeconds);
+	DCD_LOG(Log, TEXT("Server asked to retry after %.1f seconds (HTTP %d)"), RetryAfterSeconds, HttpStatus);
+}
+
+bool FDreamRetryPolicy::ConsumeRetry()
+{
+	FScopeLock ScopeLock(&Lock);
+	if (SessionBudget > 0 && RetriesUsed >= SessionBudget)
+	{
+		return false;
+	}
+	++RetriesUsed;
+	return true;
+}
+
+float FDreamRetryPolicy::GetRetryDelay(int32 RetryIndex)
+{
+	FScopeLock ScopeLock(&Lock);
+
+	// full jitter: anywhere between zero and the exponential cap
+	const float Cap = FMath::Min(BaseDelaySeconds * FMath::Pow(2.0f, (float)FMath::Clamp(RetryIndex, 0, 30)), MaxDelaySeconds);
+	const float Delay = FMath::FRandRange(0.0f, Cap);
+
+	// a Retry-After still pending is a floor
+	const float RetryAfter = (float)(RetryNotBefore - FPlatformTime::Seconds());
+	return FMath::Max(Delay, RetryAfter);
+}
+
+int32 FDreamRetryPolicy::GetRetriesUsed() const
+{
+	FScopeLock ScopeLock(&Lock);
+	return RetriesUsed;
+}
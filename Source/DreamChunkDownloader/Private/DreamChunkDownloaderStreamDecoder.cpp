@@ -0,0 +1,129 @@
+﻿// Copyright (C) 2025 Dream Moon, All Rights Reserved.
+
+
+#include "DreamChunkDownloaderStreamDecoder.h"
+
+THIRD_PARTY_INCLUDES_START
+#include "zlib.h"
+THIRD_PARTY_INCLUDES_END
+
+namespace DreamStreamDecoder
+{
+	/**
+	 * gzip (or zlib) decoder on top of the engine zlib
+	 */
+	class FGzipDecoder final : public IDreamStreamDecoder
+	{
+	public:
+		// decode in bounded pieces to keep the memory high water mark low
+		static constexpr uInt OUTPUT_BUFFER_SIZE = 64 * 1024;
+
+		// inflate allocates a window of 2^MAX_WBITS bytes next to its own state (about 7 KB)
+		static constexpr int64 INFLATE_STATE_SIZE = (1 << MAX_WBITS) + 8 * 1024;
+
+		FGzipDecoder()
+		{
+			FMemory::Memzero(Stream);
+			Output.SetNumUninitialized(OUTPUT_BUFFER_SIZE);
+			// 32 + MAX_WBITS detects the gzip or zlib header automatically
+			bIsValid = (inflateInit2(&Stream, 32 + MAX_WBITS) == Z_OK);
+		}
+
+		virtual ~FGzipDecoder() override
+		{
+			if (bIsValid)
+			{
+				inflateEnd(&Stream);
+			}
+		}
+
+		virtual bool Decode(const uint8* Data, int64 Length, TFunctionRef<bool(const uint8* Output, int64 OutputLength)> OnOutput) override
+		{
+			if (!bIsValid)
+			{
+				return false;
+			}
+
+			while (Length > 0 && !bIsFinished)
+			{
+				const uInt InputLength = (uInt)FMath::Min<int64>(Length, MAX_uint32);
+				Stream.next_in = const_cast<Bytef*>(Data);
+				Stream.avail_in = InputLength;
+				do
+				{
+					Stream.next_out = Output.GetData();
+					Stream.avail_out = OUTPUT_BUFFER_SIZE;
+					const int Result = inflate(&Stream, Z_NO_FLUSH);
+					if (Result != Z_OK && Result != Z_STREAM_END && Result != Z_BUF_ERROR)
+					{
+						bIsValid = false;
+						return false;
+					}
+
+					const int64 OutputLength = OUTPUT_BUFFER_SIZE - Stream.avail_out;
+					if (OutputLength > 0 && !OnOutput(Output.GetData(), OutputLength))
+					{
+						return false;
+					}
+					if (Result == Z_STREAM_END)
+					{
+						bIsFinished = true;
+						break;
+					}
+				}
+				while (Stream.avail_out == 0 || Stream.avail_in > 0);
+
+				Data += InputLength;
+				Length -= InputLength;
+			}
+			return true;
+		}
+
+		virtual bool IsFinished() const override
+		{
+			return bIsFinished;
+		}
+
+		virtual int64 GetMemorySize() const override
+		{
+			return OUTPUT_BUFFER_SIZE + INFLATE_STATE_SIZE;
+		}
+
+	private:
+		z_stream Stream;
+		TArray<uint8> Output;
+		bool bIsValid = false;
+		bool bIsFinished = false;
+	};
+}
+
+FDreamStreamDecoderRegistry& FDreamStreamDecoderRegistry::Get()
+{
+	static FDreamStreamDecoderRegistry Registry;
+	return Registry;
+}
+
+FDreamStreamDecoderRegistry::FDreamStreamDecoderRegistry()
+{
+	using namespace DreamStreamDecoder;
+	Register(TEXT("gzip"), []() { return TUniquePtr<IDreamStreamDecoder>(new FGzipDecoder()); });
+}
+
+void FDreamStreamDecoderRegistry::Register(const FString& Compression, FDecoderFactory Factory)
+{
+	FWriteScopeLock ScopeLock(Lock);
+	Factories.Add(Compression.ToLower(), MoveTemp(Factory));
+}
+
+bool FDreamStreamDecoderRegistry::IsSupported(const FString& Compression) const
+{
+	FReadScopeLock ScopeLock(Lock);
+	return Factories.Contains(Compression.ToLower());
+}
+
+TUniquePtr<IDreamStreamDecoder> FDreamStreamDecoderRegistry::CreateDecoder(const FString& Compression) const
+{
+	FReadScopeLock ScopeLock(Lock);
+	const FDecoderFactory* Factory = Factories.Find(Compression.ToLower());
+	return (Factory != nullptr && *Factory) ? (*Factory)() : nullptr;
+}
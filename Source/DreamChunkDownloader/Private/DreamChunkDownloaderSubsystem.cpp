@@ -16,11 +16,24 @@
 #include "Serialization/JsonReader.h"
 #include "Serialization/JsonSerializer.h"
 
+#include "DreamChunkDownloaderCacheValidation.h"
+#include "DreamChunkDownloaderConcurrencyController.h"
+#include "DreamChunkDownloaderHashRegistry.h"
+#include "DreamChunkDownloaderHostScorer.h"
+#include "DreamChunkDownloaderCircuitBreaker.h"
+#include "DreamChunkDownloaderDiskSpaceLedger.h"
+#include "DreamChunkDownloaderMemoryBudget.h"
+#include "DreamChunkDownloaderDownloadScheduler.h"
+#include "DreamChunkDownloaderDownloaderThread.h"
+#include "DreamChunkDownloaderRetryPolicy.h"
 #include "DreamChunkDownloaderLog.h"
 #include "DreamChunkDownloaderSettings.h"
 #include "DreamChunkDownloaderUtils.h"
 #include "DreamChunkDownload.h"
 #include "DreamChunkDownloaderPakMountWork.h"
+#include "DreamChunkDownloaderPakVerifyWork.h"
+#include "DreamChunkDownloaderResumeState.h"
+#include "DreamChunkDownloaderTokenBucket.h"
 
 #define LOCTEXT_NAMESPACE "DreamChunkDownloaderSubsystem"
 
@@ -74,9 +87,30 @@ void UDreamChunkDownloaderSubsystem::Initialize(FSubsystemCollectionBase& Collec
 
 	FPlatformMisc::AddAdditionalRootDirectory(PackageCacheDir);
 
+	PendingDownloads = MakeShared<FDreamDownloadScheduler>(UDreamChunkDownloaderSettings::Get()->DownloadPriorityAgingPerMinute / 60.0);
 	TargetDownloadsInFlight = FMath::Max(1, UDreamChunkDownloaderSettings::Get()->MaxConcurrentDownloads);
+	if (UDreamChunkDownloaderSettings::Get()->bEnableAdaptiveConcurrency)
+	{
+		const UDreamChunkDownloaderSettings* Settings = UDreamChunkDownloaderSettings::Get();
+		ConcurrencyController = MakeShared<FDreamConcurrencyController>(Settings->MinConcurrentDownloads, Settings->MaxAdaptiveConcurrentDownloads,
+		                                                                 TargetDownloadsInFlight, Settings->AdaptiveConcurrencyWindowSeconds);
+		TargetDownloadsInFlight = ConcurrencyController->GetLimit();
+		ConcurrencyTicker = FTSTicker::GetCoreTicker().AddTicker(FTickerDelegate::CreateUObject(this, &UDreamChunkDownloaderSubsystem::UpdateConcurrency), 0.5f);
+	}
+	if (UDreamChunkDownloaderSettings::Get()->bEnableSegmentedDownloads && UDreamChunkDownloaderSettings::Get()->bEnableHedgedRequests)
+	{
+		HedgeTicker = FTSTicker::GetCoreTicker().AddTicker(FTickerDelegate::CreateUObject(this, &UDreamChunkDownloaderSubsystem::UpdateHedging), 0.5f);
+	}
+	DownloadBandwidth = MakeShared<FDreamTokenBucket, ESPMode::ThreadSafe>();
+	MemoryBudget = MakeShared<FDreamMemoryBudget, ESPMode::ThreadSafe>((int64)UDreamChunkDownloaderSettings::Get()->DownloadMemoryBudgetMB * 1024 * 1024);
+	if (UDreamChunkDownloaderSettings::Get()->bUseDownloaderThread)
+	{
+		DownloaderThread = MakeShared<FDreamDownloaderThread, ESPMode::ThreadSafe>();
+	}
+	SetInstallSpeed(EChunkInstallSpeed::Fast);
 	CacheFolder = PackageCacheDir;
 	EmbeddedFolder = PackageEmbeddedDir;
+	DiskSpaceLedger = MakeShared<FDreamDiskSpaceLedger>(CacheFolder);
 
 	IFileManager& FileManager = IFileManager::Get();
 	if (!FileManager.MakeDirectory(*PackageCacheDir, true))
@@ -84,6 +118,19 @@ void UDreamChunkDownloaderSubsystem::Initialize(FSubsystemCollectionBase& Collec
 		DCD_LOG(Error, TEXT("Failed to create cache folder '%s'"), *PackageCacheDir);
 	}
 
+	// pick up the host measurements of earlier sessions
+	HostScorer = MakeShared<FDreamHostScorer>();
+	HostScorer->Load(CacheFolder / UDreamChunkDownloaderSettings::Get()->HostScoresFileName);
+
+	const int32 CircuitBreakerFailureThreshold = UDreamChunkDownloaderSettings::Get()->CircuitBreakerFailureThreshold;
+	if (CircuitBreakerFailureThreshold > 0)
+	{
+		CircuitBreaker = MakeShared<FDreamCircuitBreaker>(CircuitBreakerFailureThreshold, UDreamChunkDownloaderSettings::Get()->CircuitBreakerCooldownSeconds);
+	}
+	RetryPolicy = MakeShared<FDreamRetryPolicy, ESPMode::ThreadSafe>(UDreamChunkDownloaderSettings::Get()->RetryBaseDelaySeconds,
+	                                                                 UDreamChunkDownloaderSettings::Get()->RetryMaxDelaySeconds,
+	                                                                 UDreamChunkDownloaderSettings::Get()->SessionRetryBudget);
+
 	// 加载embedded paks
 	EmbeddedPaks.Empty();
 	for (const FDreamPakFileEntry& Entry : FDreamChunkDownloaderUtils::ParseManifest(EmbeddedFolder / UDreamChunkDownloaderSettings::Get()->EmbeddedManifestFileName))
@@ -129,7 +176,9 @@ void UDreamChunkDownloaderSubsystem::Initialize(FSubsystemCollectionBase& Collec
 	}
 
 	// 处理本地已有的pak文件
-	ProcessLocalPakFiles(LocalManifest, FileManager);
+	TArray<FDreamPakFileEntry> PatchBases;
+	FDreamChunkDownloaderUtils::ParsePatchBases(JsonObject, PatchBases);
+	ProcessLocalPakFiles(LocalManifest, PatchBases, FileManager);
 
 	SaveLocalManifest(false);
 
@@ -219,7 +268,7 @@ void UDreamChunkDownloaderSubsystem::SetupBuildId(const TSharedPtr<FJsonObject>&
 	DCD_LOG(Log, TEXT("Using local build id '%s'"), *ContentBuildId);
 }
 
-void UDreamChunkDownloaderSubsystem::ProcessLocalPakFiles(const TArray<FDreamPakFileEntry>& LocalManifest, IFileManager& FileManager)
+void UDreamChunkDownloaderSubsystem::ProcessLocalPakFiles(const TArray<FDreamPakFileEntry>& LocalManifest, const TArray<FDreamPakFileEntry>& PatchBases, IFileManager& FileManager)
 {
 	TArray<FString> StrayFiles;
 	FileManager.FindFiles(StrayFiles, *CacheFolder, TEXT("*.pak"));
@@ -244,7 +293,8 @@ void UDreamChunkDownloaderSubsystem::ProcessLocalPakFiles(const TArray<FDreamPak
 					continue;
 				}
 
-				if (FileInfo->SizeOnDisk == Entry.FileSize)
+				// a preallocated segmented download has the full size but isn't complete
+				if (FileInfo->SizeOnDisk == Entry.FileSize && !FDreamDownloadResumeState::Exists(LocalPath))
 				{
 					FileInfo->bIsCached = true;
 				}
@@ -261,6 +311,35 @@ void UDreamChunkDownloaderSubsystem::ProcessLocalPakFiles(const TArray<FDreamPak
 		}
 	}
 
+	// 恢复上次会话保留的补丁基础版本（新版本可能尚未开始下载）
+	for (const FDreamPakFileEntry& Base : PatchBases)
+	{
+		FString BasePath = CacheFolder / Base.FileName + PATCH_BASE_EXTENSION;
+		int64 BaseSize = FileManager.FileSize(*BasePath);
+		if (BaseSize <= 0)
+		{
+			continue;
+		}
+
+		TSharedRef<FDreamPakFile>* ExistingFile = PakFiles.Find(Base.FileName);
+		if (ExistingFile == nullptr)
+		{
+			// the version to download isn't known until the remote manifest loads
+			TSharedRef<FDreamPakFile> FileInfo = MakeShared<FDreamPakFile>();
+			FileInfo->Entry.FileName = Base.FileName;
+			FileInfo->Entry.FileSize = BaseSize;
+			ExistingFile = &PakFiles.Add(Base.FileName, FileInfo);
+		}
+		else if ((*ExistingFile)->bIsCached)
+		{
+			continue;
+		}
+
+		DCD_LOG(Log, TEXT("Keeping '%s' (version '%s') as a patch base"), *BasePath, *Base.FileVersion);
+		(*ExistingFile)->PatchBaseVersion = Base.FileVersion;
+		(*ExistingFile)->BaseContentChunks = Base.ContentChunks;
+	}
+
 	// 清理孤立文件
 	for (const FString& Orphan : StrayFiles)
 	{
@@ -272,6 +351,50 @@ void UDreamChunkDownloaderSubsystem::ProcessLocalPakFiles(const TArray<FDreamPak
 			DCD_LOG(Error, TEXT("Unable to delete '%s'"), *FullPathOnDisk);
 		}
 	}
+
+	// 清理没有对应pak的resume状态文件
+	TArray<FString> ResumeStateFiles;
+	FileManager.FindFiles(ResumeStateFiles, *CacheFolder, *(TEXT("*") + RESUME_STATE_EXTENSION));
+	for (const FString& ResumeStateFile : ResumeStateFiles)
+	{
+		FString PakFileName = ResumeStateFile.LeftChop(RESUME_STATE_EXTENSION.Len());
+		if (!PakFiles.Contains(PakFileName))
+		{
+			DCD_LOG(Log, TEXT("Deleting orphaned resume state '%s'"), *ResumeStateFile);
+			FDreamDownloadResumeState::Delete(CacheFolder / PakFileName);
+		}
+	}
+
+	// 清理不在本地manifest中的内容块暂存目录
+	TArray<FString> StagingFolders;
+	FileManager.FindFiles(StagingFolders, *(CacheFolder / (TEXT("*") + CONTENT_CHUNKS_EXTENSION)), false, true);
+	for (const FString& StagingFolder : StagingFolders)
+	{
+		FString PakFileName = StagingFolder.LeftChop(CONTENT_CHUNKS_EXTENSION.Len());
+		if (!LocalManifest.ContainsByPredicate([&PakFileName](const FDreamPakFileEntry& Entry) { return Entry.FileName == PakFileName; }))
+		{
+			DCD_LOG(Log, TEXT("Deleting orphaned content chunks '%s'"), *StagingFolder);
+			FileManager.DeleteDirectory(*(CacheFolder / StagingFolder), false, true);
+		}
+	}
+
+	// 清理上次会话遗留的补丁文件（保留本地manifest仍记录的补丁基础版本）
+	for (const FString& Extension : {PATCH_EXTENSION, PATCH_BASE_EXTENSION})
+	{
+		TArray<FString> PatchFiles;
+		FileManager.FindFiles(PatchFiles, *CacheFolder, *(TEXT("*") + Extension));
+		for (const FString& PatchFile : PatchFiles)
+		{
+			const TSharedRef<FDreamPakFile>* PakFile = PakFiles.Find(PatchFile.LeftChop(Extension.Len()));
+			if (Extension == PATCH_BASE_EXTENSION && PakFile != nullptr && !(*PakFile)->PatchBaseVersion.IsEmpty())
+			{
+				continue;
+			}
+
+			DCD_LOG(Log, TEXT("Deleting stale patch file '%s'"), *PatchFile);
+			FileManager.Delete(*(CacheFolder / PatchFile));
+		}
+	}
 }
 
 void UDreamChunkDownloaderSubsystem::CreateDefaultLocalManifest()
@@ -405,20 +528,49 @@ void UDreamChunkDownloaderSubsystem::Finalize()
 		ManifestRequest.Reset();
 	}
 
+	// keep what we learned about the hosts for the next session
+	SaveHostScores(true);
+
+	// stop adjusting the number of downloads
+	if (ConcurrencyTicker.IsValid())
+	{
+		FTSTicker::GetCoreTicker().RemoveTicker(ConcurrencyTicker);
+		ConcurrencyTicker.Reset();
+	}
+	if (HedgeTicker.IsValid())
+	{
+		FTSTicker::GetCoreTicker().RemoveTicker(HedgeTicker);
+		HedgeTicker.Reset();
+	}
+
+	// stop background cache validation (its results are dropped)
+	if (CacheValidation.IsValid())
+	{
+		CacheValidation->Cancel();
+		CacheValidation->Wait();
+		CacheValidation.Reset();
+	}
+
 	// wait for all mounts to finish
 	WaitForMounts();
 
 	// update the mount tasks (queues up callbacks)
 	ensure(UpdateMountTasks(0.0f) == false);
 
-	// cancel all downloads
+	// cancel all downloads (including the ones still waiting)
 	for (const auto& It : PakFiles)
 	{
-		const TSharedRef<FDreamPakFile>& File = It.Value;
-		if (File->Download.IsValid())
-		{
-			CancelDownload(File, false);
-		}
+		CancelDownload(It.Value, false);
+	}
+
+	// verifications of cancelled downloads are no longer needed
+	AbandonVerifyTasks();
+
+	// finish the completions already queued, later ones run on the HTTP thread
+	if (DownloaderThread.IsValid())
+	{
+		DownloaderThread->Shutdown();
+		DownloaderThread.Reset();
 	}
 
 	// unmount all mounted chunks (best effort)
@@ -684,7 +836,7 @@ float UDreamChunkDownloaderSubsystem::GetPatchProgress() const
 					{
 						if (PakFile->Download.IsValid())
 						{
-							float FileProgress = static_cast<float>(PakFile->Download->GetProgress()) / PakFile->Entry.FileSize;
+							float FileProgress = static_cast<float>(static_cast<double>(PakFile->Download->GetProgress()) / FMath::Max<double>(PakFile->Entry.FileSize, 1.0));
 							TotalProgress += FMath::Clamp(FileProgress * 0.9f, 0.0f, 0.9f); // 最多90%，留10%给挂载
 							break; // 假设每个chunk只有一个pak文件
 						}
@@ -952,6 +1104,7 @@ int32 UDreamChunkDownloaderSubsystem::FlushCache()
 					if (ensure(FileManager.Delete(*FullPathOnDisk)))
 					{
 						DCD_LOG(Log, TEXT("Deleted %s (chunk %d)."), *FullPathOnDisk, Chunk->ChunkId);
+						FDreamDownloadResumeState::Delete(FullPathOnDisk);
 						++FilesDeleted;
 
 						// flag uncached (may have been partial)
@@ -993,10 +1146,10 @@ int UDreamChunkDownloaderSubsystem::ValidateCache()
 		{
 			// we know how to validate certain hash versions
 			bool bFileIsValid = false;
-			if (PakFile->Entry.FileVersion.StartsWith(TEXT("SHA1:")))
+			if (FDreamHashRegistry::Get().IsSupported(PakFile->Entry.FileVersion))
 			{
-				// check the sha1 hash
-				bFileIsValid = FDreamChunkDownloaderUtils::CheckFileSha1Hash(CacheFolder / PakFile->Entry.FileName, PakFile->Entry.FileVersion);
+				// check the hash
+				bFileIsValid = FDreamChunkDownloaderUtils::CheckFileHash(CacheFolder / PakFile->Entry.FileName, PakFile->Entry.FileVersion);
 			}
 			else
 			{
@@ -1019,8 +1172,17 @@ int UDreamChunkDownloaderSubsystem::ValidateCache()
 				DCD_LOG(Warning, TEXT("%s does NOT match hash '%s'."), *PakFile->Entry.FileName, *PakFile->Entry.FileVersion);
 				++InvalidFiles;
 
-				// delete invalid files
+				// repair in place if the manifest says which blocks are corrupt
 				FString FullPathOnDisk = CacheFolder / PakFile->Entry.FileName;
+				TArray<int32> CorruptBlocks;
+				if (PakFile->Entry.HasBlockHashes() &&
+					FDreamChunkDownloaderUtils::FindCorruptBlocks(FullPathOnDisk, PakFile->Entry.BlockSize, PakFile->Entry.BlockHashes, CorruptBlocks, [](int64 BytesRead) { return true; }) &&
+					PrepareBlockRepair(PakFile, CorruptBlocks))
+				{
+					continue;
+				}
+
+				// delete invalid files
 				if (ensure(FileManager.Delete(*FullPathOnDisk)))
 				{
 					DCD_LOG(Log, TEXT("Deleted invalid pak %s (chunk %d)."), *FullPathOnDisk, PakFile->Entry.ChunkId);
@@ -1039,157 +1201,546 @@ int UDreamChunkDownloaderSubsystem::ValidateCache()
 	return InvalidFiles;
 }
 
-void UDreamChunkDownloaderSubsystem::BeginLoadingMode(const FDreamChunkDownloaderTypes::FDreamCallback& OnCallback)
+bool UDreamChunkDownloaderSubsystem::ValidateCacheAsync(const FDreamChunkDownloaderTypes::FDreamValidateProgress& OnProgress, const FDreamChunkDownloaderTypes::FDreamValidateComplete& OnComplete)
 {
-	check(OnCallback); // you can't start loading mode without a valid callback
-
-	// see if we're already in loading mode
-	if (PostLoadCallbacks.Num() > 0)
+	if (CacheValidation.IsValid())
 	{
-		DCD_LOG(Log, TEXT("JoinLoadingMode"));
-
-		// just wait on the existing loading mode to finish
-		PostLoadCallbacks.Add(OnCallback);
-		return;
+		DCD_LOG(Warning, TEXT("Cache validation is already running."));
+		return false;
 	}
 
-	// start loading mode
-	DCD_LOG(Log, TEXT("BeginLoadingMode"));
-#if PLATFORM_ANDROID || PLATFORM_IOS
-	FPlatformApplicationMisc::ControlScreensaver(FPlatformApplicationMisc::Disable);
-#endif
+	// collect the files we know how to validate
+	TArray<FDreamCacheValidation::FFile> Files;
+	int SkippedFiles = 0;
+	for (const auto& It : PakFiles)
+	{
+		const TSharedRef<FDreamPakFile>& PakFile = It.Value;
+		if (PakFile->bIsCached && !PakFile->bIsEmbedded)
+		{
+			if (!FDreamHashRegistry::Get().IsSupported(PakFile->Entry.FileVersion))
+			{
+				// we don't know how to validate this version format
+				DCD_LOG(Warning, TEXT("Unable to validate %s with version '%s'."), *PakFile->Entry.FileName, *PakFile->Entry.FileVersion);
+				++SkippedFiles;
+				continue;
+			}
 
-	// reset stats
-	LoadingModeStats.LastError = FText();
-	LoadingModeStats.BytesDownloaded = 0;
-	LoadingModeStats.FilesDownloaded = 0;
-	LoadingModeStats.ChunksMounted = 0;
-	LoadingModeStats.LoadingStartTime = FDateTime::UtcNow();
-	ComputeLoadingStats(); // recompute before binding callback in case there's nothing queued yet
+			FDreamCacheValidation::FFile& File = Files.AddDefaulted_GetRef();
+			File.FileName = PakFile->Entry.FileName;
+			File.FullPathOnDisk = CacheFolder / PakFile->Entry.FileName;
+			File.FileVersion = PakFile->Entry.FileVersion;
+			if (PakFile->Entry.HasBlockHashes())
+			{
+				File.BlockSize = PakFile->Entry.BlockSize;
+				File.BlockHashes = PakFile->Entry.BlockHashes;
+			}
+		}
+	}
 
-	// set the callback
-	PostLoadCallbacks.Add(OnCallback);
-	LoadingCompleteLatch = 0;
+	DCD_LOG(Display, TEXT("Starting background chunk validation (%d files, %d skipped)."), Files.Num(), SkippedFiles);
+	const UDreamChunkDownloaderSettings* Settings = UDreamChunkDownloaderSettings::Get();
+	const int64 IoBytesPerSecond = (int64)FMath::Max(0, Settings->ValidateCacheIoBudgetMBps) * 1024 * 1024;
+	TSharedRef<FDreamCacheValidation, ESPMode::ThreadSafe> Validation = MakeShared<FDreamCacheValidation, ESPMode::ThreadSafe>(MoveTemp(Files), Settings->ValidateCacheParallelism, IoBytesPerSecond);
+	CacheValidation = Validation;
 
-	// compute again next frame (if nothing's queued by then, we'll fire the callback
-	FTSTicker::GetCoreTicker().AddTicker(FTickerDelegate::CreateLambda([this](float dts)
+	// the validation only holds weak references back to us
+	TWeakObjectPtr<UDreamChunkDownloaderSubsystem> WeakThis(this);
+	TWeakPtr<FDreamCacheValidation, ESPMode::ThreadSafe> WeakValidation = Validation;
+	TSharedRef<int32> FilesValidated = MakeShared<int32>(0);
+	Validation->Start([WeakThis, WeakValidation, FilesValidated, OnProgress](int32 FileIndex, bool bIsValid)
 	{
-		if (!IsValid(this) || this->PostLoadCallbacks.Num() <= 0)
+		TSharedPtr<FDreamCacheValidation, ESPMode::ThreadSafe> Validation = WeakValidation.Pin();
+		if (!WeakThis.IsValid() || !Validation.IsValid() || WeakThis->CacheValidation != Validation)
 		{
-			return false; // stop ticking
+			// finalized in the meantime
+			return;
 		}
-		return this->UpdateLoadingMode();
-	}));
-}
 
-bool UDreamChunkDownloaderSubsystem::StartPatchGame(int InManifestFileDownloadHostIndex)
-{
-	DCD_LOG(Log, TEXT("StartPatchGame requested with host index %d"), InManifestFileDownloadHostIndex);
+		const FDreamCacheValidation::FFile& File = Validation->GetFiles()[FileIndex];
+		if (bIsValid)
+		{
+			DCD_LOG(Log, TEXT("%s matches hash '%s'."), *File.FileName, *File.FileVersion);
+		}
+		else
+		{
+			DCD_LOG(Warning, TEXT("%s does NOT match hash '%s'."), *File.FileName, *File.FileVersion);
+		}
 
-	if (!bIsDownloadManifestUpToDate)
+		++(*FilesValidated);
+		if (OnProgress)
+		{
+			OnProgress(File.FileName, bIsValid, *FilesValidated, Validation->GetFiles().Num());
+		}
+	}, [WeakThis, WeakValidation, SkippedFiles, OnComplete]()
 	{
-		DCD_LOG(Warning, TEXT("Chunk manifest is not up to date, attempting to update..."));
+		TSharedPtr<FDreamCacheValidation, ESPMode::ThreadSafe> Validation = WeakValidation.Pin();
+		if (!WeakThis.IsValid() || !Validation.IsValid() || WeakThis->CacheValidation != Validation)
+		{
+			// finalized in the meantime
+			return;
+		}
+		UDreamChunkDownloaderSubsystem* Self = WeakThis.Get();
+		Self->CacheValidation.Reset();
 
-		UpdateBuild(LastDeploymentName, ContentBuildId, [this, InManifestFileDownloadHostIndex](bool bUpdateSuccess)
+		// apply the results all at once
+		IFileManager& FileManager = IFileManager::Get();
+		int ValidFiles = 0, InvalidFiles = 0;
+		for (int32 FileIndex = 0; FileIndex < Validation->GetFiles().Num(); ++FileIndex)
 		{
-			if (bUpdateSuccess)
+			const FDreamCacheValidation::EResult Result = Validation->GetResult(FileIndex);
+			if (Result == FDreamCacheValidation::EResult::Valid)
 			{
-				DCD_LOG(Log, TEXT("Manifest update completed, retrying patch start"));
-				StartPatchGame(InManifestFileDownloadHostIndex);
+				++ValidFiles;
+				continue;
 			}
-			else
+			if (Result != FDreamCacheValidation::EResult::Invalid)
 			{
-				DCD_LOG(Error, TEXT("Failed to update manifest, cannot start patch"));
-				OnPatchCompletedInternal.Broadcast(false);
+				continue;
 			}
-		});
-		return true; // 异步处理中
-	}
+			++InvalidFiles;
 
-	// 检查所有需要的chunk状态
-	TArray<int32> MountedChunks;
-	TArray<int32> CachedChunks;
-	TArray<int32> DownloadableChunks;
-	TArray<int32> MissingChunks;
+			// the pak may have changed while we were hashing it
+			const FDreamCacheValidation::FFile& File = Validation->GetFiles()[FileIndex];
+			TSharedRef<FDreamPakFile>* PakFilePtr = Self->PakFiles.Find(File.FileName);
+			if (PakFilePtr == nullptr || !(*PakFilePtr)->bIsCached || (*PakFilePtr)->bIsEmbedded || (*PakFilePtr)->Entry.FileVersion != File.FileVersion)
+			{
+				continue;
+			}
+			const TSharedRef<FDreamPakFile>& PakFile = *PakFilePtr;
+			if (PakFile->bIsMounted)
+			{
+				DCD_LOG(Warning, TEXT("Invalid pak %s is mounted and can't be deleted now."), *File.FullPathOnDisk);
+				continue;
+			}
 
-	for (int32 ChunkId : ChunkDownloadList)
-	{
-		EDreamChunkStatus Status = GetChunkStatus(ChunkId);
-		DCD_LOG(Log, TEXT("Chunk %d status: %s"), ChunkId, *UEnum::GetValueAsString(Status));
+			// repair in place if we know which blocks are corrupt
+			if (Self->PrepareBlockRepair(PakFile, Validation->GetCorruptBlocks(FileIndex)))
+			{
+				continue;
+			}
 
-		switch (Status)
-		{
-		case EDreamChunkStatus::Mounted:
-			MountedChunks.Add(ChunkId);
-			break;
+			// delete invalid files
+			if (ensure(FileManager.Delete(*File.FullPathOnDisk)))
+			{
+				DCD_LOG(Log, TEXT("Deleted invalid pak %s (chunk %d)."), *File.FullPathOnDisk, PakFile->Entry.ChunkId);
+				PakFile->bIsCached = false;
+				PakFile->SizeOnDisk = 0;
+				Self->bNeedsManifestSave = true;
+			}
+		}
 
-		case EDreamChunkStatus::Cached:
-			CachedChunks.Add(ChunkId);
-			break;
+		// resave the manifest
+		Self->SaveLocalManifest(false);
 
-		case EDreamChunkStatus::Remote:
-		case EDreamChunkStatus::Downloading:
-		case EDreamChunkStatus::Partial:
-			DownloadableChunks.Add(ChunkId);
-			break;
+		DCD_LOG(Display, TEXT("Background chunk validation %s. %d valid, %d invalid, %d skipped"),
+		        Validation->IsCancelled() ? TEXT("cancelled") : TEXT("complete"), ValidFiles, InvalidFiles, SkippedFiles);
+		if (OnComplete)
+		{
+			OnComplete(InvalidFiles, Validation->IsCancelled());
+		}
+	});
+	return true;
+}
 
-		case EDreamChunkStatus::Unknown:
-		default:
-			MissingChunks.Add(ChunkId);
-			break;
+int32 UDreamChunkDownloaderSubsystem::SelectBuildHost(int TryNumber, int32 ExcludedHostIndex) const
+{
+	check(BuildBaseUrls.Num() > 0);
+	const bool bCanExclude = BuildBaseUrls.Num() > 1 && BuildBaseUrls.IsValidIndex(ExcludedHostIndex);
+	if (!HostScorer.IsValid() || BuildHosts.Num() != BuildBaseUrls.Num())
+	{
+		const int32 HostIndex = TryNumber % BuildBaseUrls.Num();
+		return (bCanExclude && HostIndex == ExcludedHostIndex) ? (HostIndex + 1) % BuildBaseUrls.Num() : HostIndex;
+	}
+
+	// a host that cooled off gets exactly one probe before it rejoins the rotation
+	const double Now = FPlatformTime::Seconds();
+	if (CircuitBreaker.IsValid())
+	{
+		for (int32 HostIndex = 0; HostIndex < BuildHosts.Num(); ++HostIndex)
+		{
+			if ((!bCanExclude || HostIndex != ExcludedHostIndex) && CircuitBreaker->NeedsProbe(BuildHosts[HostIndex], Now))
+			{
+				return HostIndex;
+			}
 		}
 	}
 
-	// 如果有缺失的chunks，无法继续
-	if (MissingChunks.Num() > 0)
+	// other hosts in rotation first, then the excluded one, and if every host is out of rotation
+	// failing on one of them beats not trying at all
+	TArray<int32> CandidateIndices;
+	TArray<FString> CandidateHosts;
+	for (int32 Pass = 0; Pass < 3 && CandidateHosts.Num() == 0; ++Pass)
 	{
-		auto ConvertIntArrayToString = [](const TArray<int32>& IntArray) -> FString
+		for (int32 HostIndex = 0; HostIndex < BuildHosts.Num(); ++HostIndex)
 		{
-			TArray<FString> StringArray;
-			for (int32 Value : IntArray)
+			if ((Pass != 1 && bCanExclude && HostIndex == ExcludedHostIndex) ||
+				(Pass < 2 && CircuitBreaker.IsValid() && !CircuitBreaker->IsAvailable(BuildHosts[HostIndex], Now)))
 			{
-				StringArray.Add(FString::FromInt(Value));
+				continue;
 			}
-			return FString::Join(StringArray, TEXT(", "));
-		};
+			CandidateIndices.Add(HostIndex);
+			CandidateHosts.Add(BuildHosts[HostIndex]);
+		}
+	}
+	return CandidateIndices[HostScorer->SelectHost(CandidateHosts, TryNumber, UDreamChunkDownloaderSettings::Get()->HostExplorationRate)];
+}
 
-		DCD_LOG(Error, TEXT("Some chunks are missing from manifest: %s"), *ConvertIntArrayToString(MissingChunks));
-		return false;
+void UDreamChunkDownloaderSubsystem::OnBuildHostRequestIssued(int32 HostIndex)
+{
+	if (!CircuitBreaker.IsValid() || !BuildHosts.IsValidIndex(HostIndex) || BuildHosts.Num() != BuildBaseUrls.Num())
+	{
+		return;
 	}
 
-	// 如果所有chunks都已经mounted，直接完成
-	if (MountedChunks.Num() == ChunkDownloadList.Num())
+	// only the request that actually goes out uses up the probe
+	const double Now = FPlatformTime::Seconds();
+	if (CircuitBreaker->NeedsProbe(BuildHosts[HostIndex], Now))
 	{
-		DCD_LOG(Log, TEXT("All chunks are already mounted, patch completed"));
-		OnPatchCompletedInternal.Broadcast(true);
-		return true;
+		CircuitBreaker->OnRequestIssued(BuildHosts[HostIndex], Now);
+		UpdateHostCircuits();
 	}
+}
 
-	DCD_LOG(Log, TEXT("Patch status: %d mounted, %d cached, %d need download"),
-	        MountedChunks.Num(), CachedChunks.Num(), DownloadableChunks.Num());
+void UDreamChunkDownloaderSubsystem::ReportHostLatency(int32 HostIndex, double Seconds)
+{
+	if (HostScorer.IsValid() && BuildHosts.IsValidIndex(HostIndex))
+	{
+		HostScorer->AddLatency(BuildHosts[HostIndex], Seconds);
+	}
+}
 
-	// 开始loading mode来跟踪进度
-	BeginLoadingMode([this](bool bLoadingSuccess)
+void UDreamChunkDownloaderSubsystem::ReportHostTransfer(int32 HostIndex, int64 Bytes, double Seconds)
+{
+	if (HostScorer.IsValid() && BuildHosts.IsValidIndex(HostIndex))
 	{
-		HandleLoadingModeCompleted(bLoadingSuccess);
-	});
+		HostScorer->AddTransfer(BuildHosts[HostIndex], Bytes, Seconds);
+	}
+}
 
-	// 需要处理的chunks
-	TArray<int32> ChunksNeedProcessing;
-	ChunksNeedProcessing.Append(CachedChunks);
-	ChunksNeedProcessing.Append(DownloadableChunks);
+void UDreamChunkDownloaderSubsystem::ReportHostResult(int32 HostIndex, int32 HttpStatus)
+{
+	if (HostScorer.IsValid() && BuildHosts.IsValidIndex(HostIndex))
+	{
+		HostScorer->AddResult(BuildHosts[HostIndex], HttpStatus);
+		SaveHostScores(false);
+	}
+	if (CircuitBreaker.IsValid() && BuildHosts.IsValidIndex(HostIndex) &&
+		CircuitBreaker->OnResult(BuildHosts[HostIndex], HttpStatus, FPlatformTime::Seconds()))
+	{
+		UpdateHostCircuits();
+	}
+}
 
-	if (DownloadableChunks.Num() > 0)
+void UDreamChunkDownloaderSubsystem::UpdateHostCircuits()
+{
+	LoadingModeStats.HostCircuits.Empty(BuildHosts.Num());
+	if (!CircuitBreaker.IsValid())
 	{
-		DCD_LOG(Log, TEXT("Starting download for %d chunks"), DownloadableChunks.Num());
+		return;
+	}
+	const double Now = FPlatformTime::Seconds();
+	for (const FString& Host : BuildHosts)
+	{
+		LoadingModeStats.HostCircuits.Add(CircuitBreaker->GetCircuit(Host, Now));
+	}
+}
 
-		DownloadChunks(DownloadableChunks, [this, ChunksNeedProcessing](bool bDownloadSuccess)
-		{
-			if (bDownloadSuccess)
-			{
-				DCD_LOG(Log, TEXT("Download completed, starting mount for all processed chunks"));
-				MountChunks(ChunksNeedProcessing, [this](bool bMountSuccess)
-				{
+void UDreamChunkDownloaderSubsystem::GetHostScores(TArray<FDreamHostScore>& OutScores) const
+{
+	OutScores.Empty();
+	if (HostScorer.IsValid())
+	{
+		HostScorer->GetScores(OutScores);
+	}
+}
+
+void UDreamChunkDownloaderSubsystem::SaveHostScores(bool bForce)
+{
+	// results come in with every request, don't write the file for each of them
+	static const double HOST_SCORE_SAVE_INTERVAL = 30.0;
+	const double Now = FPlatformTime::Seconds();
+	if (!HostScorer.IsValid() || CacheFolder.IsEmpty() || (!bForce && Now - LastHostScoreSaveTime < HOST_SCORE_SAVE_INTERVAL))
+	{
+		return;
+	}
+	LastHostScoreSaveTime = Now;
+	HostScorer->Save(CacheFolder / UDreamChunkDownloaderSettings::Get()->HostScoresFileName);
+}
+
+void UDreamChunkDownloaderSubsystem::BuildContentChunkIndex(TMap<FString, FDreamContentChunkStore::FSource>& OutIndex) const
+{
+	OutIndex.Empty();
+	for (const auto& It : PakFiles)
+	{
+		const TSharedRef<FDreamPakFile>& PakFile = It.Value;
+		if (PakFile->bIsCached && PakFile->Entry.HasContentChunks())
+		{
+			FDreamContentChunkStore::AddSources(PakFile->Entry.ContentChunks, (PakFile->bIsEmbedded ? EmbeddedFolder : CacheFolder) / PakFile->Entry.FileName, OutIndex);
+		}
+
+		// the previous version of a pak usually shares most of its chunks with the new one
+		if (!PakFile->PatchBaseVersion.IsEmpty() && PakFile->BaseContentChunks.Num() > 0)
+		{
+			FDreamContentChunkStore::AddSources(PakFile->BaseContentChunks, CacheFolder / PakFile->Entry.FileName + PATCH_BASE_EXTENSION, OutIndex);
+		}
+	}
+}
+
+bool UDreamChunkDownloaderSubsystem::PrepareBlockRepair(const TSharedRef<FDreamPakFile>& PakFile, const TArray<int32>& CorruptBlocks)
+{
+	if (CorruptBlocks.Num() == 0 || !PakFile->Entry.HasBlockHashes())
+	{
+		return false;
+	}
+
+	// the resume state keeps the pak from being treated as cached until the blocks are refetched
+	FString FullPathOnDisk = CacheFolder / PakFile->Entry.FileName;
+	FDreamDownloadResumeState RepairState;
+	RepairState.ResetForRepair(PakFile->Entry.FileVersion, PakFile->Entry.FileSize, PakFile->Entry.BlockSize, CorruptBlocks);
+	if (!RepairState.Save(FullPathOnDisk))
+	{
+		return false;
+	}
+
+	DCD_LOG(Log, TEXT("Kept invalid pak %s (chunk %d) for repair, %d corrupt blocks (%lld bytes) will be downloaded again."),
+	        *FullPathOnDisk, PakFile->Entry.ChunkId, CorruptBlocks.Num(), PakFile->Entry.FileSize - RepairState.GetReceivedBytes());
+	PakFile->bIsCached = false;
+	bNeedsManifestSave = true;
+	return true;
+}
+
+void UDreamChunkDownloaderSubsystem::CancelValidateCache()
+{
+	if (CacheValidation.IsValid())
+	{
+		DCD_LOG(Log, TEXT("Cancelling background chunk validation."));
+		CacheValidation->Cancel();
+	}
+}
+
+bool UDreamChunkDownloaderSubsystem::IsValidatingCache() const
+{
+	return CacheValidation.IsValid();
+}
+
+bool UDreamChunkDownloaderSubsystem::SetInstallSpeed(EChunkInstallSpeed::Type InInstallSpeed)
+{
+	const UDreamChunkDownloaderSettings* Settings = UDreamChunkDownloaderSettings::Get();
+	int32 KBps = 0;
+	switch (InInstallSpeed)
+	{
+	case EChunkInstallSpeed::Paused:
+		KBps = Settings->PausedInstallSpeedKBps;
+		break;
+	case EChunkInstallSpeed::Slow:
+		KBps = Settings->SlowInstallSpeedKBps;
+		break;
+	case EChunkInstallSpeed::Fast:
+		KBps = Settings->FastInstallSpeedKBps;
+		break;
+	default:
+		return false;
+	}
+
+	InstallSpeed = InInstallSpeed;
+	SetDownloadSpeedLimit((int64)FMath::Max(KBps, 0) * 1024);
+	return true;
+}
+
+void UDreamChunkDownloaderSubsystem::SetDownloadSpeedLimit(int64 BytesPerSecond)
+{
+	if (!DownloadBandwidth.IsValid())
+	{
+		return;
+	}
+
+	// downloads in flight pick the new rate up with their next block
+	DCD_LOG(Log, TEXT("Download bandwidth limit set to %lld bytes/s"), FMath::Max<int64>(BytesPerSecond, 0));
+	DownloadBandwidth->SetRate((double)FMath::Max<int64>(BytesPerSecond, 0));
+}
+
+int64 UDreamChunkDownloaderSubsystem::GetDownloadSpeedLimit() const
+{
+	return DownloadBandwidth.IsValid() ? (int64)DownloadBandwidth->GetRate() : 0;
+}
+
+void UDreamChunkDownloaderSubsystem::AddBytesDownloaded(int64 Bytes)
+{
+	// only the game thread writes, other threads read the counter
+	LoadingModeStats.BytesDownloaded = ProgressCounters->BytesDownloaded.fetch_add(Bytes) + Bytes;
+}
+
+int64 UDreamChunkDownloaderSubsystem::GetReservedDiskSpace() const
+{
+	return DiskSpaceLedger.IsValid() ? DiskSpaceLedger->GetReservedBytes() : 0;
+}
+
+int64 UDreamChunkDownloaderSubsystem::GetAvailableDiskSpace() const
+{
+	return DiskSpaceLedger.IsValid() ? DiskSpaceLedger->GetAvailableBytes() : -1;
+}
+
+void UDreamChunkDownloaderSubsystem::BeginLoadingMode(const FDreamChunkDownloaderTypes::FDreamCallback& OnCallback)
+{
+	check(OnCallback); // you can't start loading mode without a valid callback
+
+	// see if we're already in loading mode
+	if (PostLoadCallbacks.Num() > 0)
+	{
+		DCD_LOG(Log, TEXT("JoinLoadingMode"));
+
+		// just wait on the existing loading mode to finish
+		PostLoadCallbacks.Add(OnCallback);
+		return;
+	}
+
+	// start loading mode
+	DCD_LOG(Log, TEXT("BeginLoadingMode"));
+#if PLATFORM_ANDROID || PLATFORM_IOS
+	FPlatformApplicationMisc::ControlScreensaver(FPlatformApplicationMisc::Disable);
+#endif
+
+	// reset stats
+	LoadingModeStats.LastError = FText();
+	LoadingModeStats.BytesDownloaded = 0;
+	ProgressCounters->BytesDownloaded.store(0);
+	LoadingModeStats.FilesDownloaded = 0;
+	LoadingModeStats.ChunksMounted = 0;
+	LoadingModeStats.FilesVerified = 0;
+	LoadingModeStats.LastVerifySeconds = 0.0f;
+	LoadingModeStats.MaxVerifySeconds = 0.0f;
+	LoadingModeStats.TotalVerifySeconds = 0.0f;
+	LoadingModeStats.TotalVerifyWaitSeconds = 0.0f;
+	LoadingModeStats.LoadingStartTime = FDateTime::UtcNow();
+	if (MemoryBudget.IsValid())
+	{
+		MemoryBudget->ResetPeak();
+	}
+	ComputeLoadingStats(); // recompute before binding callback in case there's nothing queued yet
+
+	// set the callback
+	PostLoadCallbacks.Add(OnCallback);
+	LoadingCompleteLatch = 0;
+
+	// compute again next frame (if nothing's queued by then, we'll fire the callback
+	FTSTicker::GetCoreTicker().AddTicker(FTickerDelegate::CreateLambda([this](float dts)
+	{
+		if (!IsValid(this) || this->PostLoadCallbacks.Num() <= 0)
+		{
+			return false; // stop ticking
+		}
+		return this->UpdateLoadingMode();
+	}));
+}
+
+bool UDreamChunkDownloaderSubsystem::StartPatchGame(int InManifestFileDownloadHostIndex)
+{
+	DCD_LOG(Log, TEXT("StartPatchGame requested with host index %d"), InManifestFileDownloadHostIndex);
+
+	if (!bIsDownloadManifestUpToDate)
+	{
+		DCD_LOG(Warning, TEXT("Chunk manifest is not up to date, attempting to update..."));
+
+		UpdateBuild(LastDeploymentName, ContentBuildId, [this, InManifestFileDownloadHostIndex](bool bUpdateSuccess)
+		{
+			if (bUpdateSuccess)
+			{
+				DCD_LOG(Log, TEXT("Manifest update completed, retrying patch start"));
+				StartPatchGame(InManifestFileDownloadHostIndex);
+			}
+			else
+			{
+				DCD_LOG(Error, TEXT("Failed to update manifest, cannot start patch"));
+				OnPatchCompletedInternal.Broadcast(false);
+			}
+		});
+		return true; // 异步处理中
+	}
+
+	// 检查所有需要的chunk状态
+	TArray<int32> MountedChunks;
+	TArray<int32> CachedChunks;
+	TArray<int32> DownloadableChunks;
+	TArray<int32> MissingChunks;
+
+	for (int32 ChunkId : ChunkDownloadList)
+	{
+		EDreamChunkStatus Status = GetChunkStatus(ChunkId);
+		DCD_LOG(Log, TEXT("Chunk %d status: %s"), ChunkId, *UEnum::GetValueAsString(Status));
+
+		switch (Status)
+		{
+		case EDreamChunkStatus::Mounted:
+			MountedChunks.Add(ChunkId);
+			break;
+
+		case EDreamChunkStatus::Cached:
+			CachedChunks.Add(ChunkId);
+			break;
+
+		case EDreamChunkStatus::Remote:
+		case EDreamChunkStatus::Downloading:
+		case EDreamChunkStatus::Partial:
+			DownloadableChunks.Add(ChunkId);
+			break;
+
+		case EDreamChunkStatus::Unknown:
+		default:
+			MissingChunks.Add(ChunkId);
+			break;
+		}
+	}
+
+	// 如果有缺失的chunks，无法继续
+	if (MissingChunks.Num() > 0)
+	{
+		auto ConvertIntArrayToString = [](const TArray<int32>& IntArray) -> FString
+		{
+			TArray<FString> StringArray;
+			for (int32 Value : IntArray)
+			{
+				StringArray.Add(FString::FromInt(Value));
+			}
+			return FString::Join(StringArray, TEXT(", "));
+		};
+
+		DCD_LOG(Error, TEXT("Some chunks are missing from manifest: %s"), *ConvertIntArrayToString(MissingChunks));
+		return false;
+	}
+
+	// 如果所有chunks都已经mounted，直接完成
+	if (MountedChunks.Num() == ChunkDownloadList.Num())
+	{
+		DCD_LOG(Log, TEXT("All chunks are already mounted, patch completed"));
+		OnPatchCompletedInternal.Broadcast(true);
+		return true;
+	}
+
+	DCD_LOG(Log, TEXT("Patch status: %d mounted, %d cached, %d need download"),
+	        MountedChunks.Num(), CachedChunks.Num(), DownloadableChunks.Num());
+
+	// 开始loading mode来跟踪进度
+	BeginLoadingMode([this](bool bLoadingSuccess)
+	{
+		HandleLoadingModeCompleted(bLoadingSuccess);
+	});
+
+	// 需要处理的chunks
+	TArray<int32> ChunksNeedProcessing;
+	ChunksNeedProcessing.Append(CachedChunks);
+	ChunksNeedProcessing.Append(DownloadableChunks);
+
+	if (DownloadableChunks.Num() > 0)
+	{
+		DCD_LOG(Log, TEXT("Starting download for %d chunks"), DownloadableChunks.Num());
+
+		DownloadChunks(DownloadableChunks, [this, ChunksNeedProcessing](bool bDownloadSuccess)
+		{
+			if (bDownloadSuccess)
+			{
+				DCD_LOG(Log, TEXT("Download completed, starting mount for all processed chunks"));
+				MountChunks(ChunksNeedProcessing, [this](bool bMountSuccess)
+				{
 					HandleMountCompleted(bMountSuccess);
 					HandleDownloadCompleted(bMountSuccess);
 				});
@@ -1436,6 +1987,7 @@ void UDreamChunkDownloaderSubsystem::SetContentBuildId(const FString& Deployment
 
 	// combine CdnBaseUrls with ContentBuildId
 	BuildBaseUrls.Empty();
+	BuildHosts.Empty();
 	for (int32 i = 0, n = CdnBaseUrls.Num(); i < n; ++i)
 	{
 		const FString& BaseUrl = CdnBaseUrls[i];
@@ -1443,6 +1995,7 @@ void UDreamChunkDownloaderSubsystem::SetContentBuildId(const FString& Deployment
 		FString BuildUrl = BaseUrl / ContentBuildId;
 		DCD_LOG(Display, TEXT("ContentBaseUrl[%d] = %s"), i, *BuildUrl);
 		BuildBaseUrls.Add(BuildUrl);
+		BuildHosts.Add(BaseUrl);
 	}
 }
 
@@ -1507,10 +2060,25 @@ void UDreamChunkDownloaderSubsystem::LoadManifest(const TArray<FDreamPakFileEntr
 		for (const FDreamPakFileEntry& FileEntry : It.Value)
 		{
 			// see if there's an existing file for this one
+			FString PatchBaseVersion;
+			TArray<FDreamContentChunk> PatchBaseContentChunks;
 			const TSharedRef<FDreamPakFile>* ExistingFilePtr = OldPakFiles.Find(FileEntry.FileName);
 			if (ExistingFilePtr != nullptr)
 			{
 				const TSharedRef<FDreamPakFile>& ExistingFile = *ExistingFilePtr;
+
+				// the previous version (cached, or already kept as a patch base) may be patched to the new one
+				// or share content chunks with it
+				const FString& PreviousVersion = ExistingFile->bIsCached ? ExistingFile->Entry.FileVersion : ExistingFile->PatchBaseVersion;
+				const TArray<FDreamContentChunk>& PreviousChunks = ExistingFile->bIsCached ? ExistingFile->Entry.ContentChunks : ExistingFile->BaseContentChunks;
+				const bool bHasPatch = FileEntry.FindPatch(PreviousVersion) != nullptr && UDreamChunkDownloaderSettings::Get()->bEnableDeltaPatches;
+				const bool bSharesChunks = FileEntry.HasContentChunks() && PreviousChunks.Num() > 0 && UDreamChunkDownloaderSettings::Get()->bEnableContentChunkStore;
+				if (!ExistingFile->bIsEmbedded && !PreviousVersion.IsEmpty() && (bHasPatch || bSharesChunks))
+				{
+					PatchBaseVersion = PreviousVersion;
+					PatchBaseContentChunks = PreviousChunks;
+				}
+
 				if (ExistingFile->Entry.FileVersion == FileEntry.FileVersion)
 				{
 					// if version matched, size should too
@@ -1530,6 +2098,8 @@ void UDreamChunkDownloaderSubsystem::LoadManifest(const TArray<FDreamPakFileEntr
 			// create a new entry
 			TSharedRef<FDreamPakFile> NewFile = MakeShared<FDreamPakFile>();
 			NewFile->Entry = FileEntry;
+			NewFile->PatchBaseVersion = PatchBaseVersion;
+			NewFile->BaseContentChunks = MoveTemp(PatchBaseContentChunks);
 			Chunk->PakFiles.Add(NewFile);
 			PakFiles.Add(NewFile->Entry.FileName, NewFile);
 
@@ -1593,11 +2163,8 @@ void UDreamChunkDownloaderSubsystem::LoadManifest(const TArray<FDreamPakFileEntr
 		DCD_LOG(Log, TEXT("Removing orphaned pak file %s (was chunk %d)."), *File->Entry.FileName, File->Entry.ChunkId);
 
 		// cancel downloads of pak files that are no longer valid
-		if (File->Download.IsValid())
-		{
-			// treat these cancellations as successful since the pak is no longer needed (we've successfully downloaded nothing)
-			CancelDownload(File, true);
-		}
+		// treat these cancellations as successful since the pak is no longer needed (we've successfully downloaded nothing)
+		CancelDownload(File, true);
 
 		// if a chunk completely disappeared we may need to clean up its mounts this way (otherwise would have been taken care of above)
 		if (File->bIsMounted)
@@ -1605,15 +2172,37 @@ void UDreamChunkDownloaderSubsystem::LoadManifest(const TArray<FDreamPakFileEntr
 			UnmountPakFile(File);
 		}
 
-		// delete any locally cached file
+		// the new version of this pak may be patched from the old one
+		FString FullPathOnDisk = CacheFolder / File->Entry.FileName;
+		const TSharedRef<FDreamPakFile>* NewFilePtr = PakFiles.Find(File->Entry.FileName);
+		const FString NewPatchBaseVersion = NewFilePtr != nullptr ? (*NewFilePtr)->PatchBaseVersion : FString();
+
+		// drop a patch base the new version can't use
+		if (!File->PatchBaseVersion.IsEmpty() && File->PatchBaseVersion != NewPatchBaseVersion)
+		{
+			FileManager.Delete(*(FullPathOnDisk + PATCH_BASE_EXTENSION), false, false, true);
+		}
+
+		// staged content chunks are still useful to a new version of the pak
+		if (NewFilePtr == nullptr && FileManager.DirectoryExists(*(FullPathOnDisk + CONTENT_CHUNKS_EXTENSION)))
+		{
+			FileManager.DeleteDirectory(*(FullPathOnDisk + CONTENT_CHUNKS_EXTENSION), false, true);
+		}
+
+		// delete any locally cached file (or keep it as the base of the new version)
 		if (File->SizeOnDisk > 0 && !File->bIsEmbedded)
 		{
 			bNeedsManifestSave = true;
-			FString FullPathOnDisk = CacheFolder / File->Entry.FileName;
-			if (!ensure(FileManager.Delete(*FullPathOnDisk)))
+			if (File->bIsCached && File->Entry.FileVersion == NewPatchBaseVersion &&
+				FileManager.Move(*(FullPathOnDisk + PATCH_BASE_EXTENSION), *FullPathOnDisk))
+			{
+				DCD_LOG(Log, TEXT("Keeping %s as the base of a delta patch."), *FullPathOnDisk);
+			}
+			else if (!ensure(FileManager.Delete(*FullPathOnDisk)))
 			{
 				DCD_LOG(Error, TEXT("Failed to delete orphaned pak %s."), *FullPathOnDisk);
 			}
+			FDreamDownloadResumeState::Delete(FullPathOnDisk);
 		}
 	}
 
@@ -1667,10 +2256,10 @@ void UDreamChunkDownloaderSubsystem::TryLoadBuildManifest(int TryNumber)
 	}
 
 	// Check retry limits to prevent infinite loops
-	const int32 MAX_MANIFEST_RETRIES = 10;
-	if (TryNumber >= MAX_MANIFEST_RETRIES)
+	const int32 MaxManifestRetries = UDreamChunkDownloaderSettings::Get()->MaxManifestRetries;
+	if (TryNumber > MaxManifestRetries)
 	{
-		DCD_LOG(Error, TEXT("Maximum manifest download retries (%d) exceeded"), MAX_MANIFEST_RETRIES);
+		DCD_LOG(Error, TEXT("Maximum manifest download retries (%d) exceeded"), MaxManifestRetries);
 		LoadingModeStats.LastError = LOCTEXT("ManifestMaxRetriesExceeded", "Maximum manifest download retries exceeded");
 
 		FDreamChunkDownloaderTypes::FDreamCallback Callback = MoveTemp(UpdateBuildCallback);
@@ -1681,15 +2270,27 @@ void UDreamChunkDownloaderSubsystem::TryLoadBuildManifest(int TryNumber)
 	// Fast path the first try - no delay
 	if (TryNumber <= 0)
 	{
+		ManifestPermanentFailureHosts.Empty();
 		TryDownloadBuildManifest(TryNumber);
 		return;
 	}
 
-	// Compute delay before re-attempting download
-	float SecondsToDelay = FMath::Min(TryNumber * 5.0f, 60.0f);
+	// Retries draw from the session budget
+	if (!RetryPolicy->ConsumeRetry())
+	{
+		DCD_LOG(Error, TEXT("Retry budget of the session is spent, giving up on the manifest download"));
+		LoadingModeStats.LastError = LOCTEXT("ManifestRetryBudgetSpent", "Too many failed downloads, check your network connection.");
+
+		FDreamChunkDownloaderTypes::FDreamCallback Callback = MoveTemp(UpdateBuildCallback);
+		ExecuteNextTick(Callback, false);
+		return;
+	}
+
+	// Compute delay before re-attempting download (backoff with jitter, or what the server asked for)
+	float SecondsToDelay = RetryPolicy->GetRetryDelay(TryNumber - 1);
 
 	DCD_LOG(Log, TEXT("Will re-attempt manifest download in %f seconds (attempt %d/%d)"),
-	        SecondsToDelay, TryNumber + 1, MAX_MANIFEST_RETRIES);
+	        SecondsToDelay, TryNumber + 1, MaxManifestRetries + 1);
 
 	FTSTicker::GetCoreTicker().AddTicker(FTickerDelegate::CreateLambda([this, TryNumber](float Unused)
 	{
@@ -1715,13 +2316,28 @@ void UDreamChunkDownloaderSubsystem::TryDownloadBuildManifest(int TryNumber)
 
 	// Download the manifest from CDN
 	FString ManifestFileName = FString::Printf(TEXT("BuildManifest-%s.json"), *PlatformName);
-	FString Url = BuildBaseUrls[TryNumber % BuildBaseUrls.Num()] / ManifestFileName;
-
+	int32 HostIndex = INDEX_NONE;
+	FString Url;
 	if (UDreamChunkDownloaderSettings::Get()->bUseStaticRemoteHost)
 	{
 		Url = UDreamChunkDownloaderSettings::Get()->StaticRemoteHost / ManifestFileName;
 		DCD_LOG(Log, TEXT("Using static remote host: %s"), *Url);
 	}
+	else
+	{
+		// a host that already answered permanently would only say the same again
+		HostIndex = SelectBuildHost(TryNumber);
+		for (int32 Offset = 1; Offset < BuildBaseUrls.Num() && ManifestPermanentFailureHosts.Contains(HostIndex); ++Offset)
+		{
+			HostIndex = SelectBuildHost(TryNumber + Offset, HostIndex);
+		}
+		for (int32 Index = 0; Index < BuildBaseUrls.Num() && ManifestPermanentFailureHosts.Contains(HostIndex); ++Index)
+		{
+			HostIndex = Index;
+		}
+		Url = BuildBaseUrls[HostIndex] / ManifestFileName;
+		OnBuildHostRequestIssued(HostIndex);
+	}
 
 	DCD_LOG(Log, TEXT("Downloading build manifest (attempt #%d) from %s"), TryNumber + 1, *Url);
 
@@ -1740,7 +2356,8 @@ void UDreamChunkDownloaderSubsystem::TryDownloadBuildManifest(int TryNumber)
 	// 使用弱引用避免循环引用
 	TWeakObjectPtr<UDreamChunkDownloaderSubsystem> WeakThis(this);
 
-	ManifestRequest->OnProcessRequestComplete().BindLambda([WeakThis, TryNumber, CachedManifestFullPath](
+	const double RequestStartTime = FPlatformTime::Seconds();
+	ManifestRequest->OnProcessRequestComplete().BindLambda([WeakThis, TryNumber, CachedManifestFullPath, HostIndex, RequestStartTime](
 		FHttpRequestPtr HttpRequest, FHttpResponsePtr HttpResponse, bool bSuccess)
 		{
 			// 检查subsystem是否仍然有效
@@ -1752,6 +2369,18 @@ void UDreamChunkDownloaderSubsystem::TryDownloadBuildManifest(int TryNumber)
 
 			UDreamChunkDownloaderSubsystem* Self = WeakThis.Get();
 
+			// the manifest is small, the whole request is as good as a time to first byte
+			const int32 ResponseStatus = (bSuccess && HttpResponse.IsValid()) ? HttpResponse->GetResponseCode() : 0;
+			if (EHttpResponseCodes::IsOk(ResponseStatus))
+			{
+				Self->ReportHostLatency(HostIndex, FPlatformTime::Seconds() - RequestStartTime);
+			}
+			Self->ReportHostResult(HostIndex, ResponseStatus);
+			if (HttpResponse.IsValid())
+			{
+				Self->RetryPolicy->NoteResponse(ResponseStatus, HttpResponse->GetHeader(TEXT("Retry-After")));
+			}
+
 			// 清理请求引用
 			if (Self->ManifestRequest.IsValid() && Self->ManifestRequest.Get() == HttpRequest.Get())
 			{
@@ -1838,6 +2467,13 @@ void UDreamChunkDownloaderSubsystem::TryDownloadBuildManifest(int TryNumber)
 				DCD_LOG(Log, TEXT("Manifest download successful, attempting to load..."));
 				Self->TryLoadBuildManifest(0); // Reset try count since download succeeded
 			}
+			else if (FDreamRetryPolicy::IsPermanentFailure(ResponseStatus) && Self->AddManifestPermanentFailure(HostIndex))
+			{
+				// every host answered permanently, asking again won't change the answer
+				DCD_LOG(Error, TEXT("Manifest download failed permanently (HTTP %d)"), ResponseStatus);
+				FDreamChunkDownloaderTypes::FDreamCallback Callback = MoveTemp(Self->UpdateBuildCallback);
+				Self->ExecuteNextTick(Callback, false);
+			}
 			else
 			{
 				// Download failed, retry with incremented count
@@ -1865,6 +2501,14 @@ void UDreamChunkDownloaderSubsystem::TryDownloadBuildManifest(int TryNumber)
 	}
 }
 
+bool UDreamChunkDownloaderSubsystem::AddManifestPermanentFailure(int32 HostIndex)
+{
+	// the static remote host is the only host in that mode
+	ManifestPermanentFailureHosts.Add(HostIndex);
+	const int32 NumHosts = UDreamChunkDownloaderSettings::Get()->bUseStaticRemoteHost ? 1 : BuildBaseUrls.Num();
+	return ManifestPermanentFailureHosts.Num() >= NumHosts;
+}
+
 void UDreamChunkDownloaderSubsystem::WaitForMounts()
 {
 	bool bWaiting = false;
@@ -1931,6 +2575,48 @@ void UDreamChunkDownloaderSubsystem::SaveLocalManifest(bool bForce)
 		Writer->WriteValue(FILE_VERSION_FIELD, Entry.FileVersion);
 		Writer->WriteValue(FILE_CHUNK_ID_FIELD, -1); // 本地manifest中设为-1
 		Writer->WriteValue(FILE_RELATIVE_URL_FIELD, TEXT("/"));
+		if (Entry.HasContentChunks())
+		{
+			// 保留内容块列表，下次会话仍可从该pak复用内容块
+			Writer->WriteArrayStart(CONTENT_CHUNKS_FIELD);
+			for (const FDreamContentChunk& Chunk : Entry.ContentChunks)
+			{
+				Writer->WriteObjectStart();
+				Writer->WriteValue(CONTENT_CHUNK_HASH_FIELD, Chunk.Hash);
+				Writer->WriteValue(CONTENT_CHUNK_SIZE_FIELD, Chunk.Size);
+				Writer->WriteObjectEnd();
+			}
+			Writer->WriteArrayEnd();
+		}
+		Writer->WriteObjectEnd();
+	}
+	Writer->WriteArrayEnd();
+
+	// 记录保留为补丁基础的旧版本，下次会话仍可对其打补丁或复用其内容块
+	Writer->WriteArrayStart(PATCH_BASES_FIELD);
+	for (const auto& It : PakFiles)
+	{
+		const TSharedRef<FDreamPakFile>& PakFile = It.Value;
+		if (PakFile->bIsEmbedded || PakFile->PatchBaseVersion.IsEmpty())
+		{
+			continue;
+		}
+
+		Writer->WriteObjectStart();
+		Writer->WriteValue(FILE_NAME_FIELD, PakFile->Entry.FileName);
+		Writer->WriteValue(FILE_VERSION_FIELD, PakFile->PatchBaseVersion);
+		if (PakFile->BaseContentChunks.Num() > 0)
+		{
+			Writer->WriteArrayStart(CONTENT_CHUNKS_FIELD);
+			for (const FDreamContentChunk& Chunk : PakFile->BaseContentChunks)
+			{
+				Writer->WriteObjectStart();
+				Writer->WriteValue(CONTENT_CHUNK_HASH_FIELD, Chunk.Hash);
+				Writer->WriteValue(CONTENT_CHUNK_SIZE_FIELD, Chunk.Size);
+				Writer->WriteObjectEnd();
+			}
+			Writer->WriteArrayEnd();
+		}
 		Writer->WriteObjectEnd();
 	}
 	Writer->WriteArrayEnd();
@@ -2031,6 +2717,11 @@ void UDreamChunkDownloaderSubsystem::ComputeLoadingStats()
 	LoadingModeStats.TotalBytesToDownload = LoadingModeStats.BytesDownloaded;
 	LoadingModeStats.TotalFilesToDownload = LoadingModeStats.FilesDownloaded;
 	LoadingModeStats.TotalChunksToMount = LoadingModeStats.ChunksMounted;
+	if (MemoryBudget.IsValid())
+	{
+		LoadingModeStats.MemoryInUse = MemoryBudget->GetUsedBytes();
+		LoadingModeStats.PeakMemoryInUse = MemoryBudget->GetPeakBytes();
+	}
 
 	// loop over all chunks
 	for (const auto& It : Chunks)
@@ -2057,6 +2748,27 @@ void UDreamChunkDownloaderSubsystem::ComputeLoadingStats()
 			LoadingModeStats.TotalBytesToDownload += PakFile->Entry.FileSize;
 		}
 	}
+	if (PendingDownloads.IsValid())
+	{
+		PendingDownloads->ForEach([this](const TSharedRef<FDreamPakFile>& PakFile)
+		{
+			++LoadingModeStats.TotalFilesToDownload;
+			LoadingModeStats.TotalBytesToDownload += PakFile->Entry.FileSize;
+		});
+	}
+	for (const TSharedRef<FDreamPakFile>& PakFile : HeldDownloads)
+	{
+		++LoadingModeStats.TotalFilesToDownload;
+		LoadingModeStats.TotalBytesToDownload += PakFile->Entry.FileSize;
+	}
+
+	// publish the totals for other threads
+	ProgressCounters->TotalBytesToDownload.store(LoadingModeStats.TotalBytesToDownload);
+	ProgressCounters->FilesDownloaded.store(LoadingModeStats.FilesDownloaded);
+	ProgressCounters->TotalFilesToDownload.store(LoadingModeStats.TotalFilesToDownload);
+
+	// refresh the cool-off timers
+	UpdateHostCircuits();
 }
 
 void UDreamChunkDownloaderSubsystem::UnmountPakFile(const TSharedRef<FDreamPakFile>& PakFile)
@@ -2093,6 +2805,156 @@ void UDreamChunkDownloaderSubsystem::CancelDownload(const TSharedRef<FDreamPakFi
 		PakFile->Download->Cancel(bResult);
 		check(!PakFile->Download.IsValid());
 	}
+	else if ((PendingDownloads.IsValid() && PendingDownloads->Remove(PakFile)) || HeldDownloads.RemoveSingle(PakFile) > 0)
+	{
+		// it never started, just let the callers know
+		for (const auto& Callback : PakFile->PostDownloadCallbacks)
+		{
+			ExecuteNextTick(Callback, bResult);
+		}
+		PakFile->PostDownloadCallbacks.Empty();
+	}
+}
+
+bool UDreamChunkDownloaderSubsystem::PauseDownload(const TSharedRef<FDreamPakFile>& PakFile)
+{
+	if (!PakFile->Download.IsValid() || !PakFile->Download->Pause())
+	{
+		return false;
+	}
+
+	// the pak waits for a slot again (its partial file stays on disk)
+	ensure(DownloadRequests.RemoveSingle(PakFile) > 0);
+	if (PakFile->Download->HasTransfersInFlight())
+	{
+		// the cancelled requests may still be writing the file, see OnPausedDownloadSettled
+		PakFile->PausedDownload = PakFile->Download;
+	}
+	PakFile->Download.Reset();
+	QueueDownload(PakFile);
+	return true;
+}
+
+void UDreamChunkDownloaderSubsystem::OnPausedDownloadSettled(const TSharedRef<FDreamPakFile>& PakFile)
+{
+	if (!PakFile->PausedDownload.IsValid())
+	{
+		return;
+	}
+	DCD_LOG(Verbose, TEXT("Paused download of %s let go of its file"), *PakFile->Entry.FileName);
+	PakFile->PausedDownload.Reset();
+	IssueDownloads();
+}
+
+void UDreamChunkDownloaderSubsystem::QueueDownload(const TSharedRef<FDreamPakFile>& PakFile)
+{
+	if (PausedChunks.Contains(PakFile->Entry.ChunkId))
+	{
+		HeldDownloads.AddUnique(PakFile);
+		return;
+	}
+	PendingDownloads->Push(PakFile, FPlatformTime::Seconds());
+}
+
+void UDreamChunkDownloaderSubsystem::PauseDownloads()
+{
+	if (bDownloadsPaused)
+	{
+		return;
+	}
+	DCD_LOG(Log, TEXT("Pausing downloads (%d in flight, %d waiting)"), DownloadRequests.Num(), GetNumDownloadRequests() - DownloadRequests.Num());
+	bDownloadsPaused = true;
+
+	// pausing takes the pak out of DownloadRequests
+	TArray<TSharedRef<FDreamPakFile>> InFlight = DownloadRequests;
+	for (const TSharedRef<FDreamPakFile>& PakFile : InFlight)
+	{
+		PauseDownload(PakFile);
+	}
+}
+
+void UDreamChunkDownloaderSubsystem::ResumeDownloads()
+{
+	if (!bDownloadsPaused)
+	{
+		return;
+	}
+	DCD_LOG(Log, TEXT("Resuming downloads (%d waiting)"), GetNumDownloadRequests() - DownloadRequests.Num());
+	bDownloadsPaused = false;
+	IssueDownloads();
+}
+
+void UDreamChunkDownloaderSubsystem::PauseChunkDownload(int32 ChunkId)
+{
+	if (PausedChunks.Contains(ChunkId))
+	{
+		return;
+	}
+	DCD_LOG(Log, TEXT("Pausing downloads of chunk %d"), ChunkId);
+	PausedChunks.Add(ChunkId);
+
+	// hold back the paks of the chunk that are waiting or in flight
+	const TSharedRef<FDreamChunk>* Chunk = Chunks.Find(ChunkId);
+	if (Chunk == nullptr)
+	{
+		return;
+	}
+	for (const TSharedRef<FDreamPakFile>& PakFile : (*Chunk)->PakFiles)
+	{
+		if (PendingDownloads->Remove(PakFile))
+		{
+			HeldDownloads.AddUnique(PakFile);
+		}
+		else
+		{
+			PauseDownload(PakFile);
+		}
+	}
+	IssueDownloads();
+}
+
+void UDreamChunkDownloaderSubsystem::ResumeChunkDownload(int32 ChunkId)
+{
+	if (PausedChunks.Remove(ChunkId) == 0)
+	{
+		return;
+	}
+	DCD_LOG(Log, TEXT("Resuming downloads of chunk %d"), ChunkId);
+	for (int32 Index = HeldDownloads.Num() - 1; Index >= 0; --Index)
+	{
+		if (HeldDownloads[Index]->Entry.ChunkId == ChunkId)
+		{
+			PendingDownloads->Push(HeldDownloads[Index], FPlatformTime::Seconds());
+			HeldDownloads.RemoveAt(Index);
+		}
+	}
+	IssueDownloads();
+}
+
+bool UDreamChunkDownloaderSubsystem::PreemptDownload(int32 Priority)
+{
+	// pick the lowest priority download that can stop right now
+	TSharedPtr<FDreamPakFile> Victim;
+	for (const TSharedRef<FDreamPakFile>& PakFile : DownloadRequests)
+	{
+		if (PakFile->Priority < Priority && PakFile->Download.IsValid() && PakFile->Download->CanPause() &&
+			(!Victim.IsValid() || PakFile->Priority < Victim->Priority))
+		{
+			Victim = PakFile;
+		}
+	}
+	if (!Victim.IsValid())
+	{
+		return false;
+	}
+
+	DCD_LOG(Log, TEXT("Preempting download of %s (priority %d) for a request with priority %d"), *Victim->Entry.FileName, Victim->Priority, Priority);
+	return PauseDownload(Victim.ToSharedRef());
+}
+
+int32 UDreamChunkDownloaderSubsystem::GetNumDownloadRequests() const
+{
+	return DownloadRequests.Num() + HeldDownloads.Num() + (PendingDownloads.IsValid() ? PendingDownloads->Num() : 0);
 }
 
 void UDreamChunkDownloaderSubsystem::DownloadPakFileInternal(const TSharedRef<FDreamPakFile>& PakFile, const FDreamChunkDownloaderTypes::FDreamCallback& Callback, int32 Priority)
@@ -2119,12 +2981,16 @@ void UDreamChunkDownloaderSubsystem::DownloadPakFileInternal(const TSharedRef<FD
 		return;
 	}
 
-	// add it to the downloading set
-	DownloadRequests.AddUnique(PakFile);
-	DownloadRequests.StableSort([](const TSharedRef<FDreamPakFile>& A, const TSharedRef<FDreamPakFile>& B)
+	// queue it (or move it up if it's already waiting and the priority went up)
+	QueueDownload(PakFile);
+
+	// an urgent request doesn't wait for background downloads to finish
+	const UDreamChunkDownloaderSettings* Settings = UDreamChunkDownloaderSettings::Get();
+	if (Settings->bEnableDownloadPreemption && PakFile->Priority >= Settings->PreemptionPriorityThreshold && !bDownloadsPaused &&
+		DownloadRequests.Num() >= TargetDownloadsInFlight && PendingDownloads->Contains(*PakFile))
 	{
-		return A->Priority < B->Priority;
-	});
+		PreemptDownload(PakFile->Priority);
+	}
 
 	// start the first N pak files in flight
 	IssueDownloads();
@@ -2344,6 +3210,119 @@ bool UDreamChunkDownloaderSubsystem::UpdateMountTasks(float dts)
 	return bMountsPending; // keep ticking
 }
 
+void UDreamChunkDownloaderSubsystem::QueueVerifyTask(FDreamChunkDownloaderTypes::FDreamVerifyTask* VerifyTask)
+{
+	check(VerifyTask != nullptr);
+	VerifyTask->GetTask().QueueTime = FPlatformTime::Seconds();
+	PendingVerifyTasks.Add(VerifyTask);
+	LoadingModeStats.VerifyQueueDepth = PendingVerifyTasks.Num() + ActiveVerifyTasks.Num();
+
+	// start it right away if there's a free slot
+	StartVerifyTasks();
+
+	// start a per-frame ticker until verifications are finished
+	if (!VerifyTicker.IsValid())
+	{
+		VerifyTicker = FTSTicker::GetCoreTicker().AddTicker(FTickerDelegate::CreateUObject(this, &UDreamChunkDownloaderSubsystem::UpdateVerifyTasks));
+	}
+}
+
+void UDreamChunkDownloaderSubsystem::StartVerifyTasks()
+{
+	const int32 MaxVerifications = FMath::Max(1, UDreamChunkDownloaderSettings::Get()->MaxConcurrentVerifications);
+	while (PendingVerifyTasks.Num() > 0 && ActiveVerifyTasks.Num() < MaxVerifications)
+	{
+		// first come, first served
+		FDreamChunkDownloaderTypes::FDreamVerifyTask* VerifyTask = PendingVerifyTasks[0];
+		PendingVerifyTasks.RemoveAt(0);
+
+		const FDreamPakVerifyWork& VerifyWork = VerifyTask->GetTask();
+		LoadingModeStats.TotalVerifyWaitSeconds += FPlatformTime::Seconds() - VerifyWork.QueueTime;
+		DCD_LOG(Log, TEXT("Verifying %s (%lld bytes)"), *VerifyWork.Entry.FileName, VerifyWork.SizeOnDisk);
+
+		// start as a background task
+		ActiveVerifyTasks.Add(VerifyTask);
+		VerifyTask->StartBackgroundTask();
+	}
+}
+
+void UDreamChunkDownloaderSubsystem::CompleteVerifyTask(FDreamChunkDownloaderTypes::FDreamVerifyTask* VerifyTask)
+{
+	check(VerifyTask != nullptr);
+	check(VerifyTask->IsDone());
+
+	// update verification stats
+	const FDreamPakVerifyWork& VerifyWork = VerifyTask->GetTask();
+	++LoadingModeStats.FilesVerified;
+	LoadingModeStats.LastVerifySeconds = VerifyWork.VerifySeconds;
+	LoadingModeStats.MaxVerifySeconds = FMath::Max<float>(LoadingModeStats.MaxVerifySeconds, VerifyWork.VerifySeconds);
+	LoadingModeStats.TotalVerifySeconds += VerifyWork.VerifySeconds;
+
+	// hand the result back to the download (it may have been cancelled in the meantime)
+	TSharedPtr<FDreamChunkDownload> Download = VerifyWork.Download.Pin();
+	if (Download.IsValid() && !Download->HasCompleted())
+	{
+		Download->OnVerifyComplete(VerifyWork);
+	}
+
+	// finally delete the task
+	delete VerifyTask;
+}
+
+bool UDreamChunkDownloaderSubsystem::UpdateVerifyTasks(float dts)
+{
+	// collect finished tasks first, completing them may queue new verifications
+	TArray<FDreamChunkDownloaderTypes::FDreamVerifyTask*> FinishedTasks;
+	for (int32 i = ActiveVerifyTasks.Num() - 1; i >= 0; --i)
+	{
+		if (ActiveVerifyTasks[i]->IsDone())
+		{
+			FinishedTasks.Add(ActiveVerifyTasks[i]);
+			ActiveVerifyTasks.RemoveAt(i);
+		}
+	}
+
+	// refill the free slots before handing out results
+	StartVerifyTasks();
+	for (FDreamChunkDownloaderTypes::FDreamVerifyTask* VerifyTask : FinishedTasks)
+	{
+		CompleteVerifyTask(VerifyTask);
+	}
+	LoadingModeStats.VerifyQueueDepth = PendingVerifyTasks.Num() + ActiveVerifyTasks.Num();
+
+	const bool bVerificationsPending = (LoadingModeStats.VerifyQueueDepth > 0);
+	if (!bVerificationsPending)
+	{
+		VerifyTicker.Reset();
+	}
+	return bVerificationsPending; // keep ticking
+}
+
+void UDreamChunkDownloaderSubsystem::AbandonVerifyTasks()
+{
+	// tasks that haven't started are simply dropped
+	for (FDreamChunkDownloaderTypes::FDreamVerifyTask* VerifyTask : PendingVerifyTasks)
+	{
+		delete VerifyTask;
+	}
+	PendingVerifyTasks.Empty();
+
+	// running tasks can't be abandoned, wait for them
+	for (FDreamChunkDownloaderTypes::FDreamVerifyTask* VerifyTask : ActiveVerifyTasks)
+	{
+		VerifyTask->EnsureCompletion(true);
+		delete VerifyTask;
+	}
+	ActiveVerifyTasks.Empty();
+	LoadingModeStats.VerifyQueueDepth = 0;
+
+	if (VerifyTicker.IsValid())
+	{
+		FTSTicker::GetCoreTicker().RemoveTicker(VerifyTicker);
+		VerifyTicker.Reset();
+	}
+}
+
 void UDreamChunkDownloaderSubsystem::ExecuteNextTick(const FDreamChunkDownloaderTypes::FDreamCallback& Callback, bool bSuccess)
 {
 	if (Callback)
@@ -2359,21 +3338,58 @@ void UDreamChunkDownloaderSubsystem::ExecuteNextTick(const FDreamChunkDownloader
 void UDreamChunkDownloaderSubsystem::IssueDownloads()
 {
 	int32 StartedDownloads = 0;
+	if (bDownloadsPaused)
+	{
+		return;
+	}
 
-	for (int32 i = 0; i < DownloadRequests.Num() && i < TargetDownloadsInFlight; ++i)
+	// start the highest priority waiting paks until every slot is taken
+	TArray<TPair<TSharedRef<FDreamPakFile>, double>> WaitingForSpace;
+	while (DownloadRequests.Num() < TargetDownloadsInFlight && PendingDownloads.IsValid() && !PendingDownloads->IsEmpty())
 	{
-		TSharedRef<FDreamPakFile> DownloadPakFile = DownloadRequests[i];
+		double QueueTime = 0.0;
+		TSharedRef<FDreamPakFile> DownloadPakFile = PendingDownloads->Pop(&QueueTime).ToSharedRef();
 		if (DownloadPakFile->Download.IsValid())
 		{
 			// already downloading
 			continue;
 		}
+		if (DownloadPakFile->PausedDownload.IsValid())
+		{
+			// a paused download is still closing the file, a new sink would write it at the same time
+			WaitingForSpace.Emplace(DownloadPakFile, QueueTime);
+			continue;
+		}
 
 		// 检查文件是否已经存在且有效
 		if (DownloadPakFile->bIsCached)
 		{
 			DCD_LOG(Log, TEXT("Pak file %s is already cached, skipping download"),
 			        *DownloadPakFile->Entry.FileName);
+			for (const auto& Callback : DownloadPakFile->PostDownloadCallbacks)
+			{
+				ExecuteNextTick(Callback, true);
+			}
+			DownloadPakFile->PostDownloadCallbacks.Empty();
+			continue;
+		}
+
+		// only start what fits in the memory budget next to the downloads in flight (those always get to finish)
+		TWeakObjectPtr<UDreamChunkDownloaderSubsystem> WeakThis(this);
+		TSharedRef<FDreamChunkDownload> Download = MakeShared<FDreamChunkDownload>(WeakThis, DownloadPakFile);
+		if (DownloadRequests.Num() > 0 && !MemoryBudget->CanFit(Download->GetRequiredMemory()))
+		{
+			DCD_LOG(Log, TEXT("Waiting for memory to download %s (%lld of %lld bytes in use)"), *DownloadPakFile->Entry.FileName, MemoryBudget->GetUsedBytes(), MemoryBudget->GetLimit());
+			WaitingForSpace.Emplace(DownloadPakFile, QueueTime);
+			continue;
+		}
+
+		// only start what fits on the disk next to the downloads in flight
+		if (!Download->ReserveDiskSpace() && DiskSpaceLedger->GetReservedBytes() > 0)
+		{
+			// a download in flight may still fail or be cancelled and give its space back
+			DCD_LOG(Log, TEXT("Waiting for disk space to download %s (%lld bytes available)"), *DownloadPakFile->Entry.FileName, DiskSpaceLedger->GetAvailableBytes());
+			WaitingForSpace.Emplace(DownloadPakFile, QueueTime);
 			continue;
 		}
 
@@ -2385,17 +3401,92 @@ void UDreamChunkDownloaderSubsystem::IssueDownloads()
 		);
 		bNeedsManifestSave = true;
 
-		// make a new download
-		TWeakObjectPtr<UDreamChunkDownloaderSubsystem> WeakThis(this);
-		DownloadPakFile->Download = MakeShared<FDreamChunkDownload>(WeakThis, DownloadPakFile);
-		DownloadPakFile->Download->Start();
+		// make a new download (it fails right away if there wasn't enough space)
+		DownloadRequests.Add(DownloadPakFile);
+		DownloadPakFile->Download = Download;
+		Download->Start();
 		StartedDownloads++;
 	}
 
+	// the paks that didn't fit keep their place in the queue
+	for (const TPair<TSharedRef<FDreamPakFile>, double>& Waiting : WaitingForSpace)
+	{
+		PendingDownloads->Push(Waiting.Key, Waiting.Value);
+	}
+
 	if (StartedDownloads > 0)
 	{
 		DCD_LOG(Log, TEXT("Started %d new downloads"), StartedDownloads);
 	}
 }
 
+bool UDreamChunkDownloaderSubsystem::UpdateConcurrency(float dts)
+{
+	if (!ConcurrencyController.IsValid())
+	{
+		ConcurrencyTicker.Reset();
+		return false;
+	}
+
+	// lowering the limit only holds back new downloads, raising it starts waiting ones right away
+	if (ConcurrencyController->Update(FPlatformTime::Seconds(), GetNumDownloadRequests()))
+	{
+		const int32 OldTarget = TargetDownloadsInFlight;
+		TargetDownloadsInFlight = ConcurrencyController->GetLimit();
+		if (TargetDownloadsInFlight > OldTarget)
+		{
+			IssueDownloads();
+		}
+	}
+	return true;
+}
+
+bool UDreamChunkDownloaderSubsystem::UpdateHedging(float dts)
+{
+	// the median covers the last few seconds of every segment in flight
+	static const int32 MAX_SEGMENT_RATE_SAMPLES = 128;
+	static const int32 MIN_SEGMENT_RATE_SAMPLES = 8;
+
+	TArray<float> Rates;
+	for (const TSharedRef<FDreamPakFile>& PakFile : DownloadRequests)
+	{
+		if (PakFile->Download.IsValid())
+		{
+			PakFile->Download->SampleSegmentRates(dts, Rates);
+		}
+	}
+	for (float Rate : Rates)
+	{
+		if (SegmentRateSamples.Num() < MAX_SEGMENT_RATE_SAMPLES)
+		{
+			SegmentRateSamples.Add(Rate);
+		}
+		else
+		{
+			SegmentRateSamples[NextSegmentRateSample] = Rate;
+			NextSegmentRateSample = (NextSegmentRateSample + 1) % MAX_SEGMENT_RATE_SAMPLES;
+		}
+	}
+
+	// a single segment can't be slow compared to itself
+	if (Rates.Num() < 2 || SegmentRateSamples.Num() < MIN_SEGMENT_RATE_SAMPLES)
+	{
+		return true;
+	}
+
+	TArray<float> SortedRates = SegmentRateSamples;
+	SortedRates.Sort();
+	const float MedianRate = SortedRates[SortedRates.Num() / 2];
+
+	const double Now = FPlatformTime::Seconds();
+	for (const TSharedRef<FDreamPakFile>& PakFile : DownloadRequests)
+	{
+		if (PakFile->Download.IsValid())
+		{
+			PakFile->Download->UpdateHedging(Now, MedianRate);
+		}
+	}
+	return true;
+}
+
 #undef LOCTEXT_NAMESPACE
@@ -0,0 +1,87 @@
+﻿// Copyright (C) 2025 Dream Moon, All Rights Reserved.
+
+
+#include "DreamChunkDownloaderTokenBucket.h"
+
+#include "HAL/PlatformProcess.h"
+#include "HAL/PlatformTime.h"
+#include "Misc/ScopeLock.h"
+
+FDreamTokenBucket::FDreamTokenBucket(double InRatePerSecond, double InBurst)
+{
+	SetRate(InRatePerSecond, InBurst);
+}
+
+void FDreamTokenBucket::SetRate(double InRatePerSecond, double InBurst)
+{
+	FScopeLock ScopeLock(&Lock);
+	RatePerSecond = FMath::Max(InRatePerSecond, 0.0);
+	Burst = (InBurst > 0.0) ? InBurst : RatePerSecond;
+	Tokens = FMath::Clamp(Tokens, 0.0, Burst);
+	LastRefillTime = FPlatformTime::Seconds();
+	++RateGeneration;
+}
+
+double FDreamTokenBucket::GetRate() const
+{
+	FScopeLock ScopeLock(&Lock);
+	return RatePerSecond;
+}
+
+bool FDreamTokenBucket::IsLimited() const
+{
+	FScopeLock ScopeLock(&Lock);
+	return RatePerSecond > 0.0;
+}
+
+double FDreamTokenBucket::Reserve(int64 Amount)
+{
+	FScopeLock ScopeLock(&Lock);
+	if (RatePerSecond <= 0.0 || Amount <= 0)
+	{
+		return 0.0;
+	}
+
+	Refill();
+	Tokens -= (double)Amount;
+
+	// in debt, wait until the refill has paid it back
+	return (Tokens < 0.0) ? (-Tokens / RatePerSecond) : 0.0;
+}
+
+void FDreamTokenBucket::Consume(int64 Amount, const std::atomic<bool>* bAbort)
+{
+	const uint32 Generation = RateGeneration.load();
+	double SecondsToWait = Reserve(Amount);
+	while (SecondsToWait > 0.0)
+	{
+		if ((bAbort != nullptr && bAbort->load()) || RateGeneration.load() != Generation)
+		{
+			return;
+		}
+
+		// sleep in short slices so an abort is noticed quickly
+		const double SliceSeconds = FMath::Min(SecondsToWait, 0.1);
+		FPlatformProcess::Sleep((float)SliceSeconds);
+		SecondsToWait -= SliceSeconds;
+	}
+}
+
+double FDreamTokenBucket::GetWaitSeconds() const
+{
+	FScopeLock ScopeLock(&Lock);
+	if (RatePerSecond <= 0.0)
+	{
+		return 0.0;
+	}
+
+	const double CurrentTokens = Tokens + (FPlatformTime::Seconds() - LastRefillTime) * RatePerSecond;
+	return (CurrentTokens < 0.0) ? (-CurrentTokens / RatePerSecond) : 0.0;
+}
+
+void FDreamTokenBucket::Refill()
+{
+	const double Now = FPlatformTime::Seconds();
+	Tokens = FMath::Min(Tokens + (Now - LastRefillTime) * RatePerSecond, Burst);
+	LastRefillTime = Now;
+}
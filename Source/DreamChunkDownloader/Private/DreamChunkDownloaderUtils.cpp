@@ -12,14 +12,42 @@
 #include "Serialization/JsonWriter.h"
 #include "Serialization/JsonReader.h"
 #include "Serialization/JsonSerializer.h"
+#include "Interfaces/IHttpResponse.h"
 
+#include "DreamChunkDownloaderHashRegistry.h"
 #include "DreamChunkDownloaderLog.h"
 #include "DreamChunkDownloaderSubsystem.h"
 
+#if PLATFORM_LINUX || PLATFORM_ANDROID || PLATFORM_MAC || PLATFORM_IOS
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 using namespace FDreamChunkDownloaderStatics;
 
 bool FDreamChunkDownloaderUtils::CheckFileSha1Hash(const FString& FullPathOnDisk, const FString& Sha1HashString)
 {
+	return CheckFileHash(FullPathOnDisk, Sha1HashString);
+}
+
+bool FDreamChunkDownloaderUtils::CheckFileHash(const FString& FullPathOnDisk, const FString& FileVersion)
+{
+	return CheckFileHash(FullPathOnDisk, FileVersion, [](int64 BytesRead) { return true; });
+}
+
+bool FDreamChunkDownloaderUtils::CheckFileHash(const FString& FullPathOnDisk, const FString& FileVersion, TFunctionRef<bool(int64 BytesRead)> OnBlockRead)
+{
+	// create a reader for the algorithm of this version
+	TUniquePtr<IDreamHasher> Hasher = FDreamHashRegistry::Get().CreateHasher(FileVersion);
+	if (!Hasher.IsValid())
+	{
+		DCD_LOG(Error, TEXT("Unknown hash algorithm in version '%s' of %s."), *FileVersion, *FullPathOnDisk);
+		return false;
+	}
+
 	IFileHandle* FilePtr = IPlatformFile::GetPlatformPhysical().OpenRead(*FullPathOnDisk);
 	if (FilePtr == nullptr)
 	{
@@ -27,12 +55,9 @@ bool FDreamChunkDownloaderUtils::CheckFileSha1Hash(const FString& FullPathOnDisk
 		return false;
 	}
 
-	// create a SHA1 reader
-	FSHA1 HashContext;
-
 	// read in 64K chunks to prevent raising the memory high water mark too much
 	{
-		static const int64 FILE_BUFFER_SIZE = 64 * 1024;
+		static const int64 FILE_BUFFER_SIZE = FILE_READ_BUFFER_SIZE;
 		uint8 Buffer[FILE_BUFFER_SIZE];
 		int64 FileSize = FilePtr->Size();
 		for (int64 Pointer = 0; Pointer < FileSize;)
@@ -56,25 +81,200 @@ bool FDreamChunkDownloaderUtils::CheckFileSha1Hash(const FString& FullPathOnDisk
 			Pointer += SizeToRead;
 
 			// update the hash
-			HashContext.Update(Buffer, SizeToRead);
+			Hasher->Update(Buffer, SizeToRead);
+
+			// let the caller throttle or abort
+			if (!OnBlockRead(SizeToRead))
+			{
+				delete FilePtr;
+				return false;
+			}
 		}
 
 		// done with the file
 		delete FilePtr;
 	}
 
-	// close up shop
-	HashContext.Final();
-	uint8 FinalHash[FSHA1::DigestSize];
-	HashContext.GetHash(FinalHash);
-
 	// build the hash string we just computed
-	FString LocalHashStr = TEXT("SHA1:");
-	for (int Idx = 0; Idx < 20; Idx++)
+	return FDreamHashRegistry::FileVersionsMatch(FileVersion, FDreamHashRegistry::MakeFileVersion(FileVersion, *Hasher));
+}
+
+bool FDreamChunkDownloaderUtils::FindCorruptBlocks(const FString& FullPathOnDisk, int64 BlockSize, const TArray<FString>& BlockHashes, TArray<int32>& OutCorruptBlocks, TFunctionRef<bool(int64 BytesRead)> OnBlockRead)
+{
+	OutCorruptBlocks.Empty();
+	if (BlockSize <= 0 || BlockHashes.Num() == 0)
+	{
+		return false;
+	}
+
+	TUniquePtr<IFileHandle> FilePtr(IPlatformFile::GetPlatformPhysical().OpenRead(*FullPathOnDisk));
+	if (!FilePtr.IsValid())
+	{
+		DCD_LOG(Error, TEXT("Unable to open %s for block verify."), *FullPathOnDisk);
+		return false;
+	}
+
+	const int64 FileSize = FilePtr->Size();
+	if (FMath::DivideAndRoundUp<int64>(FileSize, BlockSize) != BlockHashes.Num())
+	{
+		DCD_LOG(Error, TEXT("%s has %lld bytes which doesn't match %d blocks of %lld bytes."), *FullPathOnDisk, FileSize, BlockHashes.Num(), BlockSize);
+		return false;
+	}
+
+	// read in 64K chunks to prevent raising the memory high water mark too much
+	static const int64 FILE_BUFFER_SIZE = FILE_READ_BUFFER_SIZE;
+	TArray<uint8> Buffer;
+	Buffer.SetNumUninitialized(FILE_BUFFER_SIZE);
+	for (int32 BlockIndex = 0; BlockIndex < BlockHashes.Num(); ++BlockIndex)
+	{
+		const FString& BlockHash = BlockHashes[BlockIndex];
+		TUniquePtr<IDreamHasher> Hasher = FDreamHashRegistry::Get().CreateHasher(BlockHash);
+		if (!Hasher.IsValid())
+		{
+			DCD_LOG(Error, TEXT("Unknown hash algorithm in block hash '%s' of %s."), *BlockHash, *FullPathOnDisk);
+			return false;
+		}
+
+		const int64 BlockBegin = (int64)BlockIndex * BlockSize;
+		const int64 BlockEnd = FMath::Min(BlockBegin + BlockSize, FileSize);
+		for (int64 Pointer = BlockBegin; Pointer < BlockEnd;)
+		{
+			const int64 SizeToRead = FMath::Min(BlockEnd - Pointer, FILE_BUFFER_SIZE);
+			if (!FilePtr->Read(Buffer.GetData(), SizeToRead))
+			{
+				DCD_LOG(Error, TEXT("Read error while validating blocks of '%s' at offset %lld."), *FullPathOnDisk, Pointer);
+				return false;
+			}
+			Pointer += SizeToRead;
+			Hasher->Update(Buffer.GetData(), SizeToRead);
+
+			// let the caller throttle or abort
+			if (!OnBlockRead(SizeToRead))
+			{
+				return false;
+			}
+		}
+
+		if (!FDreamHashRegistry::FileVersionsMatch(BlockHash, FDreamHashRegistry::MakeFileVersion(BlockHash, *Hasher)))
+		{
+			OutCorruptBlocks.Add(BlockIndex);
+		}
+	}
+	return true;
+}
+
+bool FDreamChunkDownloaderUtils::ParseBlockHashes(const TSharedPtr<FJsonObject>& JsonObject, int64& OutBlockSize, TArray<FString>& OutBlockHashes)
+{
+	OutBlockSize = 0;
+	OutBlockHashes.Empty();
+	if (!JsonObject.IsValid())
+	{
+		return false;
+	}
+
+	double BlockSizeDouble = 0;
+	const TArray<TSharedPtr<FJsonValue>>* HashArray = nullptr;
+	if (!JsonObject->TryGetNumberField(BLOCK_SIZE_FIELD, BlockSizeDouble) || BlockSizeDouble <= 0 ||
+		!JsonObject->TryGetArrayField(BLOCK_HASHES_FIELD, HashArray) || HashArray == nullptr)
+	{
+		return false;
+	}
+
+	for (const TSharedPtr<FJsonValue>& HashValue : *HashArray)
+	{
+		FString BlockHash;
+		if (!HashValue.IsValid() || !HashValue->TryGetString(BlockHash) || !FDreamHashRegistry::Get().IsSupported(BlockHash))
+		{
+			OutBlockHashes.Empty();
+			return false;
+		}
+		OutBlockHashes.Add(BlockHash);
+	}
+	OutBlockSize = static_cast<int64>(BlockSizeDouble);
+	return OutBlockHashes.Num() > 0;
+}
+
+void FDreamChunkDownloaderUtils::ParsePatches(const TSharedPtr<FJsonObject>& JsonObject, TArray<FDreamPakPatchEntry>& OutPatches)
+{
+	OutPatches.Empty();
+	const TArray<TSharedPtr<FJsonValue>>* PatchArray = nullptr;
+	if (!JsonObject.IsValid() || !JsonObject->TryGetArrayField(PATCHES_FIELD, PatchArray) || PatchArray == nullptr)
+	{
+		return;
+	}
+
+	for (const TSharedPtr<FJsonValue>& PatchValue : *PatchArray)
+	{
+		const TSharedPtr<FJsonObject> PatchObject = PatchValue.IsValid() ? PatchValue->AsObject() : nullptr;
+		FDreamPakPatchEntry Patch;
+		double FileSizeDouble = 0;
+		if (!PatchObject.IsValid() ||
+			!PatchObject->TryGetStringField(PATCH_FROM_VERSION_FIELD, Patch.FromVersion) || Patch.FromVersion.IsEmpty() ||
+			!PatchObject->TryGetStringField(FILE_RELATIVE_URL_FIELD, Patch.RelativeUrl) || Patch.RelativeUrl.IsEmpty() ||
+			!PatchObject->TryGetNumberField(FILE_SIZE_FIELD, FileSizeDouble) || FileSizeDouble <= 0)
+		{
+			DCD_LOG(Warning, TEXT("Ignoring invalid patch entry"));
+			continue;
+		}
+		Patch.FileSize = static_cast<int64>(FileSizeDouble);
+		PatchObject->TryGetStringField(FILE_VERSION_FIELD, Patch.FileVersion);
+		OutPatches.Add(Patch);
+	}
+}
+
+bool FDreamChunkDownloaderUtils::ParseContentChunks(const TSharedPtr<FJsonObject>& JsonObject, TArray<FDreamContentChunk>& OutContentChunks)
+{
+	OutContentChunks.Empty();
+	const TArray<TSharedPtr<FJsonValue>>* ChunkArray = nullptr;
+	if (!JsonObject.IsValid() || !JsonObject->TryGetArrayField(CONTENT_CHUNKS_FIELD, ChunkArray) || ChunkArray == nullptr)
+	{
+		return false;
+	}
+
+	for (const TSharedPtr<FJsonValue>& ChunkValue : *ChunkArray)
 	{
-		LocalHashStr += FString::Printf(TEXT("%02X"), FinalHash[Idx]);
+		const TSharedPtr<FJsonObject> ChunkObject = ChunkValue.IsValid() ? ChunkValue->AsObject() : nullptr;
+		FDreamContentChunk& Chunk = OutContentChunks.AddDefaulted_GetRef();
+		double SizeDouble = 0;
+		if (!ChunkObject.IsValid() ||
+			!ChunkObject->TryGetStringField(CONTENT_CHUNK_HASH_FIELD, Chunk.Hash) || !FDreamHashRegistry::Get().IsSupported(Chunk.Hash) ||
+			!ChunkObject->TryGetNumberField(CONTENT_CHUNK_SIZE_FIELD, SizeDouble) || SizeDouble <= 0 || SizeDouble > MAX_int32)
+		{
+			OutContentChunks.Empty();
+			return false;
+		}
+		Chunk.Size = static_cast<int64>(SizeDouble);
+	}
+	return OutContentChunks.Num() > 0;
+}
+
+void FDreamChunkDownloaderUtils::ParsePatchBases(const TSharedPtr<FJsonObject>& JsonObject, TArray<FDreamPakFileEntry>& OutPatchBases)
+{
+	OutPatchBases.Empty();
+	const TArray<TSharedPtr<FJsonValue>>* BaseArray = nullptr;
+	if (!JsonObject.IsValid() || !JsonObject->TryGetArrayField(PATCH_BASES_FIELD, BaseArray) || BaseArray == nullptr)
+	{
+		return;
+	}
+
+	for (const TSharedPtr<FJsonValue>& BaseValue : *BaseArray)
+	{
+		const TSharedPtr<FJsonObject> BaseObject = BaseValue.IsValid() ? BaseValue->AsObject() : nullptr;
+		FDreamPakFileEntry Base;
+		if (!BaseObject.IsValid() ||
+			!BaseObject->TryGetStringField(FILE_NAME_FIELD, Base.FileName) || Base.FileName.IsEmpty() ||
+			!BaseObject->TryGetStringField(FILE_VERSION_FIELD, Base.FileVersion) || Base.FileVersion.IsEmpty())
+		{
+			DCD_LOG(Warning, TEXT("Ignoring invalid patch base in local manifest"));
+			continue;
+		}
+
+		if (BaseObject->HasField(CONTENT_CHUNKS_FIELD) && !ParseContentChunks(BaseObject, Base.ContentChunks))
+		{
+			DCD_LOG(Warning, TEXT("Ignoring invalid content chunks for the patch base of %s"), *Base.FileName);
+		}
+		OutPatchBases.Add(MoveTemp(Base));
 	}
-	return Sha1HashString == LocalHashStr;
 }
 
 void FDreamChunkDownloaderUtils::DumpLoadedChunks()
@@ -242,6 +442,35 @@ TArray<FDreamPakFileEntry> FDreamChunkDownloaderUtils::ParseManifest(const FStri
 						EntryStruct.RelativeUrl = TEXT("/");
 					}
 
+					if (EntryObject->HasField(BLOCK_HASHES_FIELD) &&
+						(!ParseBlockHashes(EntryObject, EntryStruct.BlockSize, EntryStruct.BlockHashes) || !EntryStruct.HasBlockHashes()))
+					{
+						DCD_LOG(Warning, TEXT("Ignoring invalid block hashes for %s"), *EntryStruct.FileName);
+						EntryStruct.BlockSize = 0;
+						EntryStruct.BlockHashes.Empty();
+					}
+
+					ParsePatches(EntryObject, EntryStruct.Patches);
+
+					double CompressedSizeDouble = 0;
+					if (EntryObject->TryGetStringField(COMPRESSION_FIELD, EntryStruct.Compression) &&
+						(!EntryObject->TryGetStringField(COMPRESSED_RELATIVE_URL_FIELD, EntryStruct.CompressedRelativeUrl) ||
+							!EntryObject->TryGetNumberField(COMPRESSED_SIZE_FIELD, CompressedSizeDouble) || CompressedSizeDouble <= 0))
+					{
+						DCD_LOG(Warning, TEXT("Ignoring invalid compressed variant for %s"), *EntryStruct.FileName);
+						EntryStruct.Compression.Empty();
+						EntryStruct.CompressedRelativeUrl.Empty();
+						CompressedSizeDouble = 0;
+					}
+					EntryStruct.CompressedSize = static_cast<int64>(CompressedSizeDouble);
+
+					if (EntryObject->HasField(CONTENT_CHUNKS_FIELD) &&
+						(!ParseContentChunks(EntryObject, EntryStruct.ContentChunks) || !EntryStruct.HasContentChunks()))
+					{
+						DCD_LOG(Warning, TEXT("Ignoring invalid content chunks for %s"), *EntryStruct.FileName);
+						EntryStruct.ContentChunks.Empty();
+					}
+
 					Entries.Add(EntryStruct);
 				}
 			}
@@ -297,3 +526,94 @@ bool FDreamChunkDownloaderUtils::WriteStringAsUtf8TextFile(const FString& FileTe
 		return false;
 	}
 }
+
+bool FDreamChunkDownloaderUtils::ResizeFile(const FString& FullPathOnDisk, int64 NewSize)
+{
+	TUniquePtr<IFileHandle> FileHandle(IPlatformFile::GetPlatformPhysical().OpenWrite(*FullPathOnDisk, true));
+	if (!FileHandle.IsValid())
+	{
+		DCD_LOG(Error, TEXT("Unable to open %s for resize."), *FullPathOnDisk);
+		return false;
+	}
+
+	if (FileHandle->Size() == NewSize)
+	{
+		return true;
+	}
+
+	// truncate can grow the file on most platforms, otherwise write the last byte
+	if (!FileHandle->Truncate(NewSize) && FileHandle->Size() < NewSize && NewSize > 0)
+	{
+		uint8 Zero = 0;
+		if (!FileHandle->Seek(NewSize - 1) || !FileHandle->Write(&Zero, 1))
+		{
+			DCD_LOG(Error, TEXT("Unable to resize %s to %lld bytes."), *FullPathOnDisk, NewSize);
+			return false;
+		}
+	}
+	return FileHandle->Size() == NewSize;
+}
+
+bool FDreamChunkDownloaderUtils::PreallocateFile(const FString& FullPathOnDisk, int64 FileSize)
+{
+#if PLATFORM_LINUX || PLATFORM_ANDROID || PLATFORM_MAC || PLATFORM_IOS
+	// growing the file with truncate only makes it sparse, the blocks have to be allocated explicitly
+	const FString NativePath = IFileManager::Get().ConvertToAbsolutePathForExternalAppForWrite(*FullPathOnDisk);
+	const int FileDescriptor = open(TCHAR_TO_UTF8(*NativePath), O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+	if (FileDescriptor < 0)
+	{
+		DCD_LOG(Error, TEXT("Unable to open %s for preallocation (%s)."), *FullPathOnDisk, UTF8_TO_TCHAR(strerror(errno)));
+		return false;
+	}
+
+	int Error = 0;
+#if PLATFORM_MAC || PLATFORM_IOS
+	// allocate whatever lies past the current end, contiguous if the volume can manage it
+	struct stat FileStat;
+	if (fstat(FileDescriptor, &FileStat) != 0)
+	{
+		Error = errno;
+	}
+	else if (FileStat.st_size < FileSize)
+	{
+		fstore_t Store = { F_ALLOCATECONTIG | F_ALLOCATEALL, F_PEOFPOSMODE, 0, FileSize - FileStat.st_size, 0 };
+		if (fcntl(FileDescriptor, F_PREALLOCATE, &Store) == -1)
+		{
+			Store.fst_flags = F_ALLOCATEALL;
+			if (fcntl(FileDescriptor, F_PREALLOCATE, &Store) == -1)
+			{
+				Error = errno;
+			}
+		}
+	}
+#else
+	// posix_fallocate reports the error instead of setting errno
+	if (FileSize > 0)
+	{
+		Error = posix_fallocate(FileDescriptor, 0, FileSize);
+	}
+#endif
+
+	// fallocate never shrinks, a longer leftover is cut to size
+	if (Error == 0 && ftruncate(FileDescriptor, FileSize) != 0)
+	{
+		Error = errno;
+	}
+	close(FileDescriptor);
+
+	if (Error != 0)
+	{
+		DCD_LOG(Error, TEXT("Unable to preallocate %lld bytes for %s (%s)."), FileSize, *FullPathOnDisk, UTF8_TO_TCHAR(strerror(Error)));
+		return false;
+	}
+	return true;
+#else
+	// extending the end of file allocates its clusters on the remaining platforms (e.g. NTFS)
+	return ResizeFile(FullPathOnDisk, FileSize);
+#endif
+}
+
+bool FDreamChunkDownloaderUtils::IsHostFailure(int32 HttpStatus)
+{
+	return HttpStatus == 0 || HttpStatus == EHttpResponseCodes::RequestTimeout || HttpStatus == EHttpResponseCodes::TooManyRequests || HttpStatus >= 500;
+}
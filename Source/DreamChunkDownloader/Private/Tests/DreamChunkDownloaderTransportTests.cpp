@@ -0,0 +1,652 @@
+﻿// Copyright (C) 2025 Dream Moon, All Rights Reserved.
+
+
+#include "DreamChunkDownloaderCurlMultiTransport.h"
+#include "DreamChunkDownloaderDownloadTransport.h"
+#include "DreamChunkDownloaderFileSink.h"
+#include "DreamChunkDownloaderTokenBucket.h"
+#include "HAL/FileManager.h"
+#include "HAL/PlatformTime.h"
+#include "HAL/Runnable.h"
+#include "HAL/RunnableThread.h"
+#include "Interfaces/IHttpResponse.h"
+#include "IPAddress.h"
+#include "Misc/AutomationTest.h"
+#include "Misc/FileHelper.h"
+#include "Misc/Paths.h"
+#include "Sockets.h"
+#include "SocketSubsystem.h"
+
+#include <atomic>
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+namespace DreamChunkDownloaderTransportTests
+{
+	/** Size of the test pak (large enough to cancel a throttled copy half way) */
+	static constexpr int32 TEST_FILE_SIZE = 1024 * 1024;
+
+	/** Folder the test files are written to */
+	static FString GetTestFolder()
+	{
+		return FPaths::ConvertRelativePathToFull(FPaths::AutomationTransientDir() / TEXT("DreamChunkDownloader"));
+	}
+
+	/** Bytes no two blocks of the test pak share, so a misplaced block is noticed */
+	static TArray<uint8> MakeTestData()
+	{
+		TArray<uint8> Data;
+		Data.SetNumUninitialized(TEST_FILE_SIZE);
+		for (int32 Index = 0; Index < Data.Num(); ++Index)
+		{
+			Data[Index] = static_cast<uint8>((Index * 31) ^ (Index >> 10));
+		}
+		return Data;
+	}
+
+	/** Result of one transfer, filled in on the game thread */
+	struct FTransferState
+	{
+		bool bIsDone = false;
+		int32 HttpStatus = -1;
+		uint64 BytesReceived = 0;
+		FDreamDownloadCancel Cancel;
+	};
+
+	/**
+	 * Start a transfer
+	 * @param Transport Transport fetching the URL
+	 * @param State Receives the progress and the final status
+	 * @param Url URL of the source
+	 * @param TargetFile Path of the file to write
+	 * @param Options Options of the download
+	 * @param bCancelOnProgress Cancel the transfer as soon as the first bytes arrive (a pause)
+	 */
+	static void StartTransfer(IDreamDownloadTransport& Transport, const TSharedRef<FTransferState>& State, const FString& Url, const FString& TargetFile,
+	                          const FDreamStreamDownloadOptions& Options, bool bCancelOnProgress)
+	{
+		State->Cancel = Transport.Download(Url, TargetFile, Options, [State, bCancelOnProgress](uint64 BytesReceived)
+		{
+			State->BytesReceived = BytesReceived;
+			if (bCancelOnProgress && State->Cancel)
+			{
+				State->Cancel();
+			}
+		}, [State](int32 HttpStatus)
+		{
+			State->HttpStatus = HttpStatus;
+			State->bIsDone = true;
+		});
+	}
+
+	/** Check that a file on disk matches the start of the test data */
+	static bool MatchesTestData(const FString& File, const TArray<uint8>& TestData, int64 ExpectedSize)
+	{
+		TArray<uint8> Data;
+		return FFileHelper::LoadFileToArray(Data, *File) && Data.Num() == ExpectedSize &&
+			FMemory::Memcmp(Data.GetData(), TestData.GetData(), ExpectedSize) == 0;
+	}
+
+#if DCD_WITH_CURL_MULTI
+	/** How long the loopback server blocks before looking at a stop request again */
+	static const FTimespan SERVER_WAIT_TIME = FTimespan::FromMilliseconds(100);
+
+	/**
+	 * Minimal HTTP server on the loopback address, serves the test pak to one connection at a time
+	 */
+	class FLoopbackHttpServer : public FRunnable
+	{
+	public:
+		/** How the server answers a request */
+		enum class EMode : uint8
+		{
+			/** 200 with the whole file, or 206 with the requested range */
+			Serve,
+			/** 200 with the whole file, whatever range was requested */
+			IgnoreRange,
+			/** Sends half of the body, then keeps the connection open without sending more */
+			Stall,
+		};
+
+		FLoopbackHttpServer(const TArray<uint8>& InBody, EMode InMode)
+			: Body(InBody)
+			, Mode(InMode)
+		{
+		}
+
+		virtual ~FLoopbackHttpServer() override
+		{
+			if (Thread != nullptr)
+			{
+				// Kill calls Stop and waits for Run to return
+				Thread->Kill(true);
+				delete Thread;
+			}
+			if (ListenSocket != nullptr)
+			{
+				ListenSocket->Close();
+				ISocketSubsystem::Get(PLATFORM_SOCKETSUBSYSTEM)->DestroySocket(ListenSocket);
+			}
+		}
+
+		/**
+		 * Listen on a free port and start serving
+		 * @return True if the server is running
+		 */
+		bool Start()
+		{
+			ISocketSubsystem* SocketSubsystem = ISocketSubsystem::Get(PLATFORM_SOCKETSUBSYSTEM);
+			TSharedRef<FInternetAddr> Address = SocketSubsystem->CreateInternetAddr(FNetworkProtocolTypes::IPv4);
+			Address->SetLoopbackAddress();
+			Address->SetPort(0);
+
+			ListenSocket = SocketSubsystem->CreateSocket(NAME_Stream, TEXT("DreamLoopbackHttpServer"), FNetworkProtocolTypes::IPv4);
+			if (ListenSocket == nullptr || !ListenSocket->Bind(*Address) || !ListenSocket->Listen(4))
+			{
+				return false;
+			}
+			Port = ListenSocket->GetPortNo();
+			Thread = FRunnableThread::Create(this, TEXT("DreamLoopbackHttpServer"));
+			return Thread != nullptr;
+		}
+
+		/** URL of the test pak */
+		FString GetUrl() const
+		{
+			return FString::Printf(TEXT("http://127.0.0.1:%d/Test.pak"), Port);
+		}
+
+		//~ Begin FRunnable Interface
+		virtual uint32 Run() override
+		{
+			ISocketSubsystem* SocketSubsystem = ISocketSubsystem::Get(PLATFORM_SOCKETSUBSYSTEM);
+			while (!bStopping)
+			{
+				bool bHasPendingConnection = false;
+				if (!ListenSocket->WaitForPendingConnection(bHasPendingConnection, SERVER_WAIT_TIME))
+				{
+					break;
+				}
+				if (!bHasPendingConnection)
+				{
+					continue;
+				}
+				if (FSocket* Connection = ListenSocket->Accept(TEXT("DreamLoopbackHttpConnection")))
+				{
+					ServeConnection(*Connection);
+					Connection->Close();
+					SocketSubsystem->DestroySocket(Connection);
+				}
+			}
+			return 0;
+		}
+
+		virtual void Stop() override
+		{
+			bStopping = true;
+		}
+		//~ End FRunnable Interface
+
+	private:
+		/** Answer the request of one connection */
+		void ServeConnection(FSocket& Connection)
+		{
+			FString Request;
+			if (!ReadRequest(Connection, Request))
+			{
+				return;
+			}
+
+			// the range the client asked for (bytes=A- or bytes=A-B)
+			int64 Begin = 0;
+			int64 Last = Body.Num() - 1;
+			bool bIsRange = false;
+			TArray<FString> Lines;
+			Request.ParseIntoArrayLines(Lines);
+			for (const FString& Line : Lines)
+			{
+				FString Name, Value, First, Second;
+				if (Line.Split(TEXT(":"), &Name, &Value) && Name.TrimEnd().Equals(TEXT("Range"), ESearchCase::IgnoreCase) &&
+					Value.TrimStartAndEnd().Replace(TEXT("bytes="), TEXT("")).Split(TEXT("-"), &First, &Second))
+				{
+					bIsRange = (Mode != EMode::IgnoreRange);
+					if (bIsRange)
+					{
+						Begin = FCString::Atoi64(*First);
+						Last = Second.IsEmpty() ? Last : FMath::Min<int64>(FCString::Atoi64(*Second), Last);
+					}
+				}
+			}
+
+			FString Head = bIsRange
+				? FString::Printf(TEXT("HTTP/1.1 206 Partial Content\r\nContent-Range: bytes %lld-%lld/%d\r\n"), Begin, Last, Body.Num())
+				: FString(TEXT("HTTP/1.1 200 OK\r\n"));
+			Head += FString::Printf(TEXT("Content-Length: %lld\r\nConnection: close\r\n\r\n"), Last - Begin + 1);
+			const FTCHARToUTF8 HeadUtf8(*Head);
+			if (!Send(Connection, reinterpret_cast<const uint8*>(HeadUtf8.Get()), HeadUtf8.Length()))
+			{
+				return;
+			}
+
+			// a stalled server goes quiet half way, until the client gives up
+			const int64 End = (Mode == EMode::Stall) ? Begin + (Last - Begin + 1) / 2 : Last + 1;
+			if (Send(Connection, Body.GetData() + Begin, End - Begin) && Mode == EMode::Stall)
+			{
+				WaitForClose(Connection);
+			}
+		}
+
+		/** Read the request line and headers */
+		bool ReadRequest(FSocket& Connection, FString& OutRequest) const
+		{
+			TArray<uint8> Data;
+			uint8 Buffer[1024];
+			while (!bStopping)
+			{
+				if (!Connection.Wait(ESocketWaitConditions::WaitForRead, SERVER_WAIT_TIME))
+				{
+					continue;
+				}
+				int32 BytesRead = 0;
+				if (!Connection.Recv(Buffer, sizeof(Buffer), BytesRead) || BytesRead <= 0)
+				{
+					return false;
+				}
+				Data.Append(Buffer, BytesRead);
+
+				const FUTF8ToTCHAR Converted(reinterpret_cast<const ANSICHAR*>(Data.GetData()), Data.Num());
+				OutRequest = FString(Converted.Length(), Converted.Get());
+				if (OutRequest.Contains(TEXT("\r\n\r\n")))
+				{
+					return true;
+				}
+			}
+			return false;
+		}
+
+		/** Send a block, waiting while the client doesn't read (a paused transfer) */
+		bool Send(FSocket& Connection, const uint8* Data, int64 Count) const
+		{
+			while (Count > 0 && !bStopping)
+			{
+				if (!Connection.Wait(ESocketWaitConditions::WaitForWrite, SERVER_WAIT_TIME))
+				{
+					continue;
+				}
+				int32 BytesSent = 0;
+				if (!Connection.Send(Data, static_cast<int32>(FMath::Min<int64>(Count, 64 * 1024)), BytesSent))
+				{
+					return false;
+				}
+				Data += BytesSent;
+				Count -= BytesSent;
+			}
+			return Count == 0;
+		}
+
+		/** Keep a connection open until the client closes it */
+		void WaitForClose(FSocket& Connection) const
+		{
+			while (!bStopping)
+			{
+				uint8 Byte = 0;
+				int32 BytesRead = 0;
+				if (Connection.Wait(ESocketWaitConditions::WaitForRead, SERVER_WAIT_TIME) &&
+					(!Connection.Recv(&Byte, 1, BytesRead) || BytesRead <= 0))
+				{
+					return;
+				}
+			}
+		}
+
+		/** Body of the test pak */
+		TArray<uint8> Body;
+
+		/** How requests are answered */
+		EMode Mode;
+
+		/** Socket accepting connections */
+		FSocket* ListenSocket = nullptr;
+
+		/** Thread serving the connections */
+		FRunnableThread* Thread = nullptr;
+
+		/** Port the server listens on */
+		int32 Port = 0;
+
+		/** Set once the thread should exit */
+		std::atomic<bool> bStopping{false};
+	};
+#endif // DCD_WITH_CURL_MULTI
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FDreamFileSinkRangeResponseTest, "DreamChunkDownloader.Transport.FileSinkRangeResponse",
+                                 EAutomationTestFlags::EditorContext | EAutomationTestFlags::ClientContext | EAutomationTestFlags::ProductFilter)
+
+bool FDreamFileSinkRangeResponseTest::RunTest(const FString& Parameters)
+{
+	using namespace DreamChunkDownloaderTransportTests;
+
+	const TArray<uint8> TestData = MakeTestData();
+	const FString TargetFile = GetTestFolder() / TEXT("SinkRange.pak");
+	const int64 Half = TEST_FILE_SIZE / 2;
+
+	// segments write into a preallocated file
+	TArray<uint8> Zeros;
+	Zeros.SetNumZeroed(TEST_FILE_SIZE);
+	TestTrue(TEXT("Preallocate target"), FFileHelper::SaveArrayToFile(Zeros, *TargetFile));
+
+	// a 200 for a range that covers the whole file is the whole file
+	{
+		FDreamChunkDownloadFileSink Sink(TargetFile, 0, FDreamChunkDownloadFileSink::MIN_BUFFER_SIZE, TEST_FILE_SIZE);
+		Sink.SetFileSize(TEST_FILE_SIZE);
+		TestTrue(TEXT("Whole file range accepts 200"), Sink.BeginResponse(EHttpResponseCodes::Ok, FString()));
+		TestTrue(TEXT("Whole file body is written"), Sink.Write(TestData.GetData(), TestData.Num()));
+		TestTrue(TEXT("Whole file response ends"), Sink.EndResponse(EHttpResponseCodes::Ok, FString()));
+		TestTrue(TEXT("Whole file matches"), MatchesTestData(TargetFile, TestData, TEST_FILE_SIZE));
+	}
+
+	// a 200 for part of the file would put the start of the file at the segment offset
+	TestTrue(TEXT("Reset target"), FFileHelper::SaveArrayToFile(Zeros, *TargetFile));
+	{
+		FDreamChunkDownloadFileSink Sink(TargetFile, Half, FDreamChunkDownloadFileSink::MIN_BUFFER_SIZE, TEST_FILE_SIZE);
+		Sink.SetFileSize(TEST_FILE_SIZE);
+		TestFalse(TEXT("Partial range refuses 200"), Sink.BeginResponse(EHttpResponseCodes::Ok, FString()));
+		TestTrue(TEXT("Refused response is reported"), Sink.HasRejectedResponse());
+		TestFalse(TEXT("Refused body aborts the transfer"), Sink.Write(TestData.GetData(), TestData.Num()));
+		TestFalse(TEXT("Refused response doesn't end well"), Sink.EndResponse(EHttpResponseCodes::Ok, FString()));
+	}
+
+	// the same range answered with 206 is written in place
+	{
+		const FString ContentRange = FString::Printf(TEXT("bytes %lld-%d/%d"), Half, TEST_FILE_SIZE - 1, TEST_FILE_SIZE);
+		FDreamChunkDownloadFileSink Sink(TargetFile, Half, FDreamChunkDownloadFileSink::MIN_BUFFER_SIZE, TEST_FILE_SIZE);
+		Sink.SetFileSize(TEST_FILE_SIZE);
+		TestTrue(TEXT("Partial range accepts 206"), Sink.BeginResponse(EHttpResponseCodes::PartialContent, ContentRange));
+		TestTrue(TEXT("Partial body is written"), Sink.Write(TestData.GetData() + Half, TEST_FILE_SIZE - Half));
+		TestTrue(TEXT("Partial response ends"), Sink.EndResponse(EHttpResponseCodes::PartialContent, ContentRange));
+
+		TArray<uint8> Data;
+		TestTrue(TEXT("Load target"), FFileHelper::LoadFileToArray(Data, *TargetFile));
+		TestTrue(TEXT("Segment is in place"), Data.Num() == TEST_FILE_SIZE &&
+			FMemory::Memcmp(Data.GetData() + Half, TestData.GetData() + Half, TEST_FILE_SIZE - Half) == 0);
+		TestTrue(TEXT("Start of the file is untouched"), Data.Num() == TEST_FILE_SIZE && Data[0] == 0 && Data[Half - 1] == 0);
+	}
+
+	IFileManager::Get().Delete(*TargetFile);
+	return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FDreamFileTransportPauseResumeTest, "DreamChunkDownloader.Transport.FileTransportPauseResume",
+                                 EAutomationTestFlags::EditorContext | EAutomationTestFlags::ClientContext | EAutomationTestFlags::ProductFilter)
+
+bool FDreamFileTransportPauseResumeTest::RunTest(const FString& Parameters)
+{
+	using namespace DreamChunkDownloaderTransportTests;
+
+	const TArray<uint8> TestData = MakeTestData();
+	const FString SourceFile = GetTestFolder() / TEXT("Source.pak");
+	const FString TargetFile = GetTestFolder() / TEXT("Target.pak");
+	const FString Url = TEXT("file://") + SourceFile;
+	IFileManager::Get().Delete(*TargetFile);
+	if (!TestTrue(TEXT("Write source"), FFileHelper::SaveArrayToFile(TestData, *SourceFile)))
+	{
+		return false;
+	}
+
+	// the pause is the cancel of the first transfer
+	AddExpectedError(TEXT("HTTP connection issue"), EAutomationExpectedErrorFlags::Contains, 1);
+
+	FDreamStreamDownloadOptions Options;
+	Options.WriteBufferSize = FDreamChunkDownloadFileSink::MIN_BUFFER_SIZE;
+
+	// 1. a fresh copy is answered with 200
+	TSharedRef<FTransferState> Fresh = MakeShared<FTransferState>();
+	FDreamFileDownloadTransport FreshTransport;
+	StartTransfer(FreshTransport, Fresh, Url, TargetFile, Options, false);
+	ADD_LATENT_AUTOMATION_COMMAND(FFunctionLatentCommand([this, Fresh, TargetFile, TestData]()
+	{
+		if (!Fresh->bIsDone)
+		{
+			return false;
+		}
+		TestEqual(TEXT("Fresh copy status"), Fresh->HttpStatus, static_cast<int32>(EHttpResponseCodes::Ok));
+		TestTrue(TEXT("Fresh copy matches"), MatchesTestData(TargetFile, TestData, TEST_FILE_SIZE));
+		IFileManager::Get().Delete(*TargetFile);
+		return true;
+	}));
+
+	// 2. pause a throttled copy once the first bytes arrived, the flushed part is kept
+	TSharedRef<FTransferState> Paused = MakeShared<FTransferState>();
+	ADD_LATENT_AUTOMATION_COMMAND(FFunctionLatentCommand([Paused, Url, TargetFile, Options]()
+	{
+		FDreamStreamDownloadOptions ThrottledOptions = Options;
+		ThrottledOptions.Bandwidth = MakeShared<FDreamTokenBucket, ESPMode::ThreadSafe>(TEST_FILE_SIZE / 4.0, FDreamChunkDownloadFileSink::MIN_BUFFER_SIZE);
+		FDreamFileDownloadTransport Transport;
+		StartTransfer(Transport, Paused, Url, TargetFile, ThrottledOptions, true);
+		return true;
+	}));
+	ADD_LATENT_AUTOMATION_COMMAND(FFunctionLatentCommand([this, Paused, TargetFile, TestData]()
+	{
+		if (!Paused->bIsDone)
+		{
+			return false;
+		}
+		const int64 SizeOnDisk = IFileManager::Get().FileSize(*TargetFile);
+		TestEqual(TEXT("Paused copy reports an interrupted transfer"), Paused->HttpStatus, 0);
+		TestTrue(TEXT("Paused copy kept part of the file"), SizeOnDisk > 0 && SizeOnDisk < TEST_FILE_SIZE);
+		TestTrue(TEXT("Kept part matches"), SizeOnDisk > 0 && MatchesTestData(TargetFile, TestData, SizeOnDisk));
+		return true;
+	}));
+
+	// 3. resuming continues with a range and is answered with 206
+	TSharedRef<FTransferState> Resumed = MakeShared<FTransferState>();
+	ADD_LATENT_AUTOMATION_COMMAND(FFunctionLatentCommand([Resumed, Url, TargetFile, Options]()
+	{
+		FDreamFileDownloadTransport Transport;
+		StartTransfer(Transport, Resumed, Url, TargetFile, Options, false);
+		return true;
+	}));
+	ADD_LATENT_AUTOMATION_COMMAND(FFunctionLatentCommand([this, Resumed, SourceFile, TargetFile, TestData]()
+	{
+		if (!Resumed->bIsDone)
+		{
+			return false;
+		}
+		TestEqual(TEXT("Resumed copy status"), Resumed->HttpStatus, static_cast<int32>(EHttpResponseCodes::PartialContent));
+		TestTrue(TEXT("Resumed copy matches"), MatchesTestData(TargetFile, TestData, TEST_FILE_SIZE));
+		IFileManager::Get().Delete(*SourceFile);
+		IFileManager::Get().Delete(*TargetFile);
+		return true;
+	}));
+
+	return true;
+}
+
+#if DCD_WITH_CURL_MULTI
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FDreamCurlTransportBandwidthTest, "DreamChunkDownloader.Transport.CurlTransportBandwidth",
+                                 EAutomationTestFlags::EditorContext | EAutomationTestFlags::ClientContext | EAutomationTestFlags::ProductFilter)
+
+bool FDreamCurlTransportBandwidthTest::RunTest(const FString& Parameters)
+{
+	using namespace DreamChunkDownloaderTransportTests;
+
+	const TArray<uint8> TestData = MakeTestData();
+	const FString TargetFile = GetTestFolder() / TEXT("CurlThrottled.pak");
+	IFileManager::Get().Delete(*TargetFile);
+
+	TSharedRef<FLoopbackHttpServer> Server = MakeShared<FLoopbackHttpServer>(TestData, FLoopbackHttpServer::EMode::Serve);
+	if (!TestTrue(TEXT("Start loopback server"), Server->Start()))
+	{
+		return false;
+	}
+
+	// a quarter of the file per second, every block past the burst pauses the connection until its share is back
+	const double Rate = TEST_FILE_SIZE / 4.0;
+	FDreamStreamDownloadOptions Options;
+	Options.WriteBufferSize = FDreamChunkDownloadFileSink::MIN_BUFFER_SIZE;
+	Options.Bandwidth = MakeShared<FDreamTokenBucket, ESPMode::ThreadSafe>(Rate, FDreamChunkDownloadFileSink::MIN_BUFFER_SIZE);
+
+	TSharedRef<FDreamCurlMultiDownloadTransport, ESPMode::ThreadSafe> Transport = MakeShared<FDreamCurlMultiDownloadTransport, ESPMode::ThreadSafe>();
+	TSharedRef<FTransferState> Throttled = MakeShared<FTransferState>();
+	const double StartTime = FPlatformTime::Seconds();
+	StartTransfer(*Transport, Throttled, Server->GetUrl(), TargetFile, Options, false);
+	ADD_LATENT_AUTOMATION_COMMAND(FFunctionLatentCommand([this, Server, Transport, Throttled, TargetFile, TestData, StartTime, Rate]()
+	{
+		if (!Throttled->bIsDone)
+		{
+			return false;
+		}
+
+		// the paused connection was resumed every time, but never before the limit allowed it
+		const double Elapsed = FPlatformTime::Seconds() - StartTime;
+		TestEqual(TEXT("Throttled transfer status"), Throttled->HttpStatus, static_cast<int32>(EHttpResponseCodes::Ok));
+		TestTrue(TEXT("Throttled transfer matches"), MatchesTestData(TargetFile, TestData, TEST_FILE_SIZE));
+		TestTrue(TEXT("Throttled transfer kept to the limit"), Elapsed >= 0.5 * TEST_FILE_SIZE / Rate);
+
+		Transport->Shutdown();
+		IFileManager::Get().Delete(*TargetFile);
+		return true;
+	}));
+
+	return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FDreamCurlTransportStalledCancelTest, "DreamChunkDownloader.Transport.CurlTransportStalledCancel",
+                                 EAutomationTestFlags::EditorContext | EAutomationTestFlags::ClientContext | EAutomationTestFlags::ProductFilter)
+
+bool FDreamCurlTransportStalledCancelTest::RunTest(const FString& Parameters)
+{
+	using namespace DreamChunkDownloaderTransportTests;
+
+	const TArray<uint8> TestData = MakeTestData();
+	const FString TargetFile = GetTestFolder() / TEXT("CurlStalled.pak");
+	IFileManager::Get().Delete(*TargetFile);
+
+	TSharedRef<FLoopbackHttpServer> Server = MakeShared<FLoopbackHttpServer>(TestData, FLoopbackHttpServer::EMode::Stall);
+	if (!TestTrue(TEXT("Start loopback server"), Server->Start()))
+	{
+		return false;
+	}
+
+	// the cancel ends the transfer as an interrupted one
+	AddExpectedError(TEXT("HTTP connection issue"), EAutomationExpectedErrorFlags::Contains, 1);
+
+	FDreamStreamDownloadOptions Options;
+	Options.WriteBufferSize = FDreamChunkDownloadFileSink::MIN_BUFFER_SIZE;
+
+	TSharedRef<FDreamCurlMultiDownloadTransport, ESPMode::ThreadSafe> Transport = MakeShared<FDreamCurlMultiDownloadTransport, ESPMode::ThreadSafe>();
+	TSharedRef<FTransferState> Stalled = MakeShared<FTransferState>();
+	StartTransfer(*Transport, Stalled, Server->GetUrl(), TargetFile, Options, false);
+
+	// 1. wait for the half the server sends, then give the connection time to go quiet
+	TSharedRef<double> QuietSince = MakeShared<double>(0.0);
+	ADD_LATENT_AUTOMATION_COMMAND(FFunctionLatentCommand([Stalled, QuietSince]()
+	{
+		if (Stalled->bIsDone)
+		{
+			return true;
+		}
+		if (Stalled->BytesReceived < TEST_FILE_SIZE / 2)
+		{
+			return false;
+		}
+		if (*QuietSince == 0.0)
+		{
+			*QuietSince = FPlatformTime::Seconds();
+		}
+		return FPlatformTime::Seconds() - *QuietSince >= 0.5;
+	}));
+
+	// 2. cancel while no data is coming in (OnWrite never runs, the thread has to drop it)
+	TSharedRef<double> CancelTime = MakeShared<double>(0.0);
+	ADD_LATENT_AUTOMATION_COMMAND(FFunctionLatentCommand([this, Stalled, CancelTime]()
+	{
+		TestFalse(TEXT("Stalled transfer is still running"), Stalled->bIsDone);
+		*CancelTime = FPlatformTime::Seconds();
+		Stalled->Cancel();
+		return true;
+	}));
+
+	// 3. the transfer ends long before the low speed timeout, with the received half kept
+	ADD_LATENT_AUTOMATION_COMMAND(FFunctionLatentCommand([this, Server, Transport, Stalled, CancelTime, TargetFile, TestData]()
+	{
+		if (!Stalled->bIsDone)
+		{
+			return false;
+		}
+		const int64 SizeOnDisk = IFileManager::Get().FileSize(*TargetFile);
+		TestEqual(TEXT("Cancelled transfer reports an interrupted transfer"), Stalled->HttpStatus, 0);
+		TestTrue(TEXT("Cancelled transfer ends promptly"), FPlatformTime::Seconds() - *CancelTime < 5.0);
+		TestTrue(TEXT("Cancelled transfer kept the received part"), SizeOnDisk > 0 && SizeOnDisk <= TEST_FILE_SIZE / 2);
+		TestTrue(TEXT("Kept part matches"), SizeOnDisk > 0 && MatchesTestData(TargetFile, TestData, SizeOnDisk));
+
+		Transport->Shutdown();
+		IFileManager::Get().Delete(*TargetFile);
+		return true;
+	}));
+
+	return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FDreamCurlTransportRefusedResponseTest, "DreamChunkDownloader.Transport.CurlTransportRefusedResponse",
+                                 EAutomationTestFlags::EditorContext | EAutomationTestFlags::ClientContext | EAutomationTestFlags::ProductFilter)
+
+bool FDreamCurlTransportRefusedResponseTest::RunTest(const FString& Parameters)
+{
+	using namespace DreamChunkDownloaderTransportTests;
+
+	const TArray<uint8> TestData = MakeTestData();
+	const FString TargetFile = GetTestFolder() / TEXT("CurlRefused.pak");
+	const int64 Half = TEST_FILE_SIZE / 2;
+
+	// segments write into a preallocated file
+	TArray<uint8> Zeros;
+	Zeros.SetNumZeroed(TEST_FILE_SIZE);
+	if (!TestTrue(TEXT("Preallocate target"), FFileHelper::SaveArrayToFile(Zeros, *TargetFile)))
+	{
+		return false;
+	}
+
+	// a server that ignores the range answers the segment with the start of the file
+	TSharedRef<FLoopbackHttpServer> Server = MakeShared<FLoopbackHttpServer>(TestData, FLoopbackHttpServer::EMode::IgnoreRange);
+	if (!TestTrue(TEXT("Start loopback server"), Server->Start()))
+	{
+		return false;
+	}
+	AddExpectedError(TEXT("Unexpected response body"), EAutomationExpectedErrorFlags::Contains, 1);
+
+	FDreamStreamDownloadOptions Options;
+	Options.WriteBufferSize = FDreamChunkDownloadFileSink::MIN_BUFFER_SIZE;
+	Options.RangeBegin = Half;
+	Options.RangeEnd = TEST_FILE_SIZE - 1;
+	Options.FileSize = TEST_FILE_SIZE;
+
+	TSharedRef<FDreamCurlMultiDownloadTransport, ESPMode::ThreadSafe> Transport = MakeShared<FDreamCurlMultiDownloadTransport, ESPMode::ThreadSafe>();
+	TSharedRef<FTransferState> Refused = MakeShared<FTransferState>();
+	StartTransfer(*Transport, Refused, Server->GetUrl(), TargetFile, Options, false);
+	ADD_LATENT_AUTOMATION_COMMAND(FFunctionLatentCommand([this, Server, Transport, Refused, TargetFile, Zeros]()
+	{
+		if (!Refused->bIsDone)
+		{
+			return false;
+		}
+
+		// the refused body is reported as an unusable range and nothing of it reaches the file
+		TArray<uint8> Data;
+		TestEqual(TEXT("Refused response status"), Refused->HttpStatus, static_cast<int32>(EHttpResponseCodes::RequestedRangeNotSatisfiable));
+		TestTrue(TEXT("Load target"), FFileHelper::LoadFileToArray(Data, *TargetFile));
+		TestTrue(TEXT("Refused body isn't written"), Data.Num() == Zeros.Num() && FMemory::Memcmp(Data.GetData(), Zeros.GetData(), Zeros.Num()) == 0);
+
+		Transport->Shutdown();
+		IFileManager::Get().Delete(*TargetFile);
+		return true;
+	}));
+
+	return true;
+}
+
+#endif // DCD_WITH_CURL_MULTI
+
+#endif // WITH_DEV_AUTOMATION_TESTS
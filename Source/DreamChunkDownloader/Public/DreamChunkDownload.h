@@ -4,6 +4,10 @@
 
 #include "DreamChunkDownloaderSubsystem.h"
 #include "DreamChunkDownloaderPlatformStreamDownload.h"
+#include "DreamChunkDownloaderResumeState.h"
+#include "DreamChunkDownloaderIncrementalHash.h"
+
+class FDreamPakVerifyWork;
 
 /**
  * Chunk Download Manager
@@ -11,9 +15,15 @@
  * This class handles the downloading of individual pak files (chunks) from CDN.
  * It manages the entire download lifecycle including:
  * - Download initiation and progress tracking
+ * - Segmented (parallel range) downloads of large paks
+ * - Hedged requests for segments that stall (a second request races the slow one)
  * - Retry logic with exponential backoff
- * - File validation and integrity checking
- * - Device space verification
+ * - File validation and integrity checking (hashed incrementally while downloading, verified off the game thread)
+ * - Block level repair of corrupt files (only corrupt blocks are downloaded again)
+ * - Delta patching from the previous version of the pak
+ * - Assembly from content chunks (only chunks not already on disk are downloaded)
+ * - Compressed variants that are decompressed while streaming to disk
+ * - Disk space reservation (shared ledger of all downloads in flight) and preallocation
  * - Completion and error handling
  * 
  * Each instance manages a single pak file download and maintains state
@@ -44,10 +54,26 @@ public:
 	 * Get the current download progress in bytes
 	 * @return Number of bytes received so far
 	 */
-	inline int32 GetProgress() const { return LastBytesReceived; }
+	inline int64 GetProgress() const { return LastBytesReceived; }
+
+	/**
+	 * Reserve the disk space the download still needs in the ledger of the subsystem
+	 * Called before the download starts (Start reserves it itself otherwise) and before every retry.
+	 * A reservation that can't be renewed is given up, so the ledger only holds what the other downloads reserved.
+	 * @return True if the space is reserved
+	 */
+	bool ReserveDiskSpace();
+
+	/**
+	 * Get the memory the download needs from the memory budget to make progress
+	 * Streamed requests make do with the smallest write buffer, a body that isn't streamed is held in memory whole.
+	 * @return Number of bytes
+	 */
+	int64 GetRequiredMemory() const;
 
 	/**
 	 * Start the download process
+	 * Fails the download if the disk space can't be reserved.
 	 */
 	void Start();
 
@@ -57,6 +83,46 @@ public:
 	 */
 	void Cancel(bool bResult);
 
+	/**
+	 * Check if the download can be paused right now
+	 * @return True while the download is transferring data or waiting for its next request (not verifying, patching or assembling)
+	 */
+	inline bool CanPause() const { return (bIsTransferring || bIsWaiting) && !bHasCompleted; }
+
+	/**
+	 * Stop the download without completing it, keeping the partial file so it can be resumed later
+	 * The download is finished afterwards (no callbacks fire), the owner requeues the pak with a new download.
+	 * @return False if the download can't be paused right now
+	 */
+	bool Pause();
+
+	/**
+	 * Check if requests of a paused download are still finishing
+	 * Their sinks may still write the file, the pak must not be downloaded again until they are done.
+	 * @return True while a completion callback of this download hasn't run yet
+	 */
+	inline bool HasTransfersInFlight() const { return TransfersInFlight > 0; }
+
+	/**
+	 * Handle the result of the background verification of the downloaded file
+	 * @param VerifyWork The finished verification (URL, attempt number and results)
+	 */
+	void OnVerifyComplete(const FDreamPakVerifyWork& VerifyWork);
+
+	/**
+	 * Measure the transfer rate of every segment in flight
+	 * @param DeltaSeconds Time since the last sample
+	 * @param OutRates Receives the rate of each segment in flight (bytes per second)
+	 */
+	void SampleSegmentRates(float DeltaSeconds, TArray<float>& OutRates);
+
+	/**
+	 * Hedge segments that stayed well below the typical transfer rate for too long
+	 * @param Now Current time in seconds (FPlatformTime::Seconds)
+	 * @param MedianRate Median transfer rate of the session (bytes per second)
+	 */
+	void UpdateHedging(double Now, float MedianRate);
+
 public:
 	/** Reference to the chunk downloader subsystem that owns this download */
 	const TWeakObjectPtr<UDreamChunkDownloaderSubsystem> Downloader;
@@ -74,16 +140,60 @@ protected:
 	void UpdateFileSize();
 
 	/**
-	 * Validate the downloaded file's integrity
-	 * @return True if the file is valid
+	 * Queue the downloaded file for verification on a background thread
+	 * @param Url The URL the file was downloaded from
+	 * @param TryNumber The attempt number that downloaded the file
+	 * @param bBlocksOnly Only locate corrupt blocks (the file already failed verification)
 	 */
-	bool ValidateFile() const;
+	void StartVerification(const FString& Url, int TryNumber, bool bBlocksOnly = false);
 
 	/**
-	 * Check if there is sufficient device space for the download
-	 * @return True if there is enough space
+	 * Download the block hash file published next to the pak on the CDN
+	 * @param Url The URL the pak was downloaded from
+	 * @param TryNumber The attempt number that downloaded the file
 	 */
-	bool HasDeviceSpaceRequired() const;
+	void FetchBlockHashes(const FString& Url, int TryNumber);
+
+	/**
+	 * Handle the response of the block hash file request
+	 * @param Url The URL the pak was downloaded from
+	 * @param TryNumber The attempt number that downloaded the file
+	 * @param JsonData Content of the block hash file (empty if the request failed)
+	 */
+	void OnBlockHashesReceived(const FString& Url, int TryNumber, const FString& JsonData);
+
+	/**
+	 * Refetch only the corrupt blocks of the file
+	 * @param CorruptBlocks Indices of the corrupt blocks
+	 * @param TryNumber The attempt number that downloaded the file
+	 * @return False if the file can't be repaired (it has to be downloaded again)
+	 */
+	bool StartRepair(const TArray<int32>& CorruptBlocks, int TryNumber);
+
+	/**
+	 * Delete the file and everything known about it, then schedule a full download
+	 * @param TryNumber The attempt number that failed
+	 */
+	void DiscardAndRetry(int TryNumber);
+
+	/**
+	 * Schedule the next download attempt (after checking for device space and the retry budget)
+	 * @param TryNumber The attempt number that failed
+	 * @param HttpStatus Status of the failed request (0 if it didn't fail on an HTTP error)
+	 */
+	void ScheduleRetry(int TryNumber, int32 HttpStatus = 0);
+
+	/**
+	 * Get the disk space the download is still going to add to the cache
+	 * A preallocated pak already holds its space, a patch is downloaded next to the base it applies to.
+	 * @return Number of bytes
+	 */
+	int64 GetRequiredDiskSpace() const;
+
+	/**
+	 * Drop the disk space reservation of the download
+	 */
+	void ReleaseDiskSpace();
 
 	/**
 	 * Start the actual download process with retry logic
@@ -91,14 +201,235 @@ protected:
 	 */
 	void StartDownload(int TryNumber);
 
+	/**
+	 * Make sure the running hash covers the part of the file already on disk
+	 * If the prefix has to be hashed first, this is done on a worker thread and the download is restarted afterwards.
+	 * @param TryNumber The current attempt number (passed on to the restarted download)
+	 * @param ValidLength Number of valid bytes at the start of the file
+	 * @return True if the download can be issued right away
+	 */
+	bool PrepareIncrementalHash(int TryNumber, int64 ValidLength);
+
+	/**
+	 * Check if this pak should be fetched as several parallel byte ranges
+	 * @return True if a segmented download should be used
+	 */
+	bool ShouldUseSegments() const;
+
+	/**
+	 * Check if this pak is large enough to be split into several parallel byte ranges
+	 * @return True if the segment table should have more than one segment
+	 */
+	bool ShouldSplitIntoSegments() const;
+
+	/**
+	 * Check if this pak should be preallocated (it is then fetched as a single in-place range)
+	 * @return True if the plain pak is downloaded and preallocation is enabled
+	 */
+	bool ShouldPreallocate() const;
+
+	/**
+	 * Start (or continue) a segmented download by issuing a range request for every incomplete segment
+	 * @param TryNumber The current attempt number (for retry logic)
+	 */
+	void StartSegmentedDownload(int TryNumber);
+
+	/**
+	 * Issue the range request of a segment of the current attempt, starting where the segment got to
+	 * @param SegmentIndex Index of the segment in the resume state
+	 * @param HostIndex Index of the build base URL to download the segment from
+	 */
+	void StartSegmentRequest(int32 SegmentIndex, int32 HostIndex);
+
+	/**
+	 * Get the most bytes a single segment request may fetch
+	 * Under a bandwidth limit segments are fetched in slices, so the limit also holds for transports
+	 * that can't hold back the data of a running request (they only put the bandwidth in debt).
+	 * @return Size of a slice in bytes (0 = no limit, the whole segment is requested at once)
+	 */
+	int64 GetBandwidthSliceSize() const;
+
+	/**
+	 * Call a function of this download once the bandwidth debt left by earlier requests is paid back
+	 * @param Function Called on the game thread after the wait, unless the download ended meanwhile
+	 * @return True if the function was deferred, false if there is no debt (the caller goes ahead right away)
+	 */
+	bool DeferForBandwidth(TFunction<void()>&& Function);
+
+	/**
+	 * Handle progress updates for one segment
+	 * @param SegmentIndex Index of the segment in the resume state
+	 * @param BytesReceived Number of bytes received by the segment request so far
+	 */
+	void OnSegmentProgress(int32 SegmentIndex, uint64 BytesReceived, bool bHedge);
+
+	/**
+	 * Handle completion of one segment request
+	 * @param SegmentIndex Index of the segment in the resume state
+	 * @param HostIndex Index of the build base URL the segment was downloaded from
+	 * @param Url The URL the segment was downloaded from
+	 * @param TryNumber The attempt number the segment belongs to
+	 * @param HttpStatus The HTTP status code of the response
+	 * @param bHedge Whether the response belongs to the hedged request of the segment
+	 */
+	void OnSegmentComplete(int32 SegmentIndex, int32 HostIndex, const FString& Url, int TryNumber, int32 HttpStatus, bool bHedge);
+
+	/**
+	 * Race a slow segment request with a second request for its remaining bytes from another host
+	 * @param SegmentIndex Index of the segment in the resume state
+	 */
+	void StartHedge(int32 SegmentIndex);
+
+	/**
+	 * Cancel every segment request of the current attempt
+	 */
+	void CancelSegmentRequests();
+
+	/**
+	 * Add the bytes the requests of a segment flushed to disk to its received bytes
+	 * @param Segment The segment to update (from ResumeState or a copy of it)
+	 * @param SegmentIndex Index of the segment in the resume state
+	 */
+	void CreditFlushedBytes(FDreamDownloadSegment& Segment, int32 SegmentIndex) const;
+
+	/**
+	 * Save the segment table including what the requests in flight flushed so far
+	 * The table in memory is left alone, the ranges of the requests in flight are based on it.
+	 */
+	void SaveSegmentProgress() const;
+
+	/**
+	 * Drop the segment table and the partial file (used when segments can't be used or the file is bad)
+	 */
+	void ResetSegments();
+
+	/**
+	 * Check if the compressed variant of the pak should be downloaded instead of the plain file
+	 * @return True if the manifest lists a variant we can decode and it didn't fail us before
+	 */
+	bool ShouldUseCompressedVariant() const;
+
+	/**
+	 * Check if the pak can be built from the previous version and a delta patch
+	 * @return True if the manifest has a usable patch and the previous version is on disk
+	 */
+	bool ShouldUsePatch() const;
+
+	/**
+	 * Hand the download back to the subsystem if a pause was requested while it couldn't stop
+	 * Verifying, repairing, patching and hashing run to the end; the pause takes effect before the next request.
+	 * @return True if the download was paused (it must not issue anything else)
+	 */
+	bool PauseIfRequested();
+
+	/**
+	 * Stop the download between requests and put the pak back into the queue of the subsystem
+	 * @return True if the pak was requeued (the download is finished and must not issue anything else)
+	 */
+	bool ReturnToQueue();
+
+	/**
+	 * Count a request as in flight until its completion callback has run
+	 * @param Callback Completion callback of the request
+	 * @return Callback to hand to the transport
+	 */
+	FDreamDownloadComplete TrackTransfer(FDreamDownloadComplete&& Callback);
+
+	/**
+	 * Download the delta patch
+	 * @param TryNumber The attempt number (used to pick the CDN)
+	 */
+	void StartPatchDownload(int TryNumber);
+
+	/**
+	 * Handle completion of the delta patch download
+	 * @param Url The URL the patch was downloaded from
+	 * @param TryNumber The attempt number that completed
+	 * @param HttpStatus The HTTP status code of the response
+	 */
+	void OnPatchDownloadComplete(const FString& Url, int TryNumber, int32 HttpStatus);
+
+	/**
+	 * Apply the downloaded patch on a background thread
+	 * @param Url The URL the patch was downloaded from
+	 * @param TryNumber The attempt number that downloaded the patch
+	 */
+	void ApplyPatch(const FString& Url, int TryNumber);
+
+	/**
+	 * Handle the result of applying the patch
+	 * @param Url The URL the patch was downloaded from
+	 * @param TryNumber The attempt number that downloaded the patch
+	 * @param bApplied Whether the patched file was written completely
+	 */
+	void OnPatchApplied(const FString& Url, int TryNumber, bool bApplied);
+
+	/**
+	 * Delete the patch and the previous version of the pak (after patching or when falling back to a full download)
+	 */
+	void DiscardPatch();
+
+	/**
+	 * Check if the pak should be assembled from content chunks
+	 * @return True if the manifest lists content chunks for the pak and they didn't fail us before
+	 */
+	bool ShouldUseContentChunks() const;
+
+	/**
+	 * Look up which content chunks are already on disk and download the rest
+	 * @param TryNumber The attempt number (used to pick the CDN)
+	 */
+	void StartContentChunkDownload(int TryNumber);
+
+	/**
+	 * Start chunk downloads until the concurrency limit is reached
+	 */
+	void IssueContentChunkDownloads();
+
+	/**
+	 * Handle completion of a content chunk download
+	 * @param QueueIndex Index of the chunk in ContentChunkQueue
+	 * @param TryNumber The attempt number the request belongs to
+	 * @param HttpStatus The HTTP status code of the response
+	 */
+	void OnContentChunkComplete(int32 QueueIndex, int TryNumber, int32 HttpStatus);
+
+	/**
+	 * Write the pak out of its chunks on a background thread
+	 * @param TryNumber The attempt number that fetched the chunks
+	 */
+	void AssembleContentChunks(int TryNumber);
+
+	/**
+	 * Handle the result of assembling the pak
+	 * @param TryNumber The attempt number that fetched the chunks
+	 * @param BadChunks Index of every chunk that couldn't be read or didn't match its hash
+	 * @param bAssembled Whether the whole pak was written
+	 */
+	void OnContentChunksAssembled(int TryNumber, const TArray<int32>& BadChunks, bool bAssembled);
+
+	/**
+	 * Delete the staged content chunks of the pak
+	 */
+	void DiscardContentChunks();
+
 	/**
 	 * Handle download progress updates
 	 * @param BytesReceived Number of bytes received in this update
 	 */
-	void OnDownloadProgress(int32 BytesReceived);
+	void OnDownloadProgress(int64 BytesReceived);
+
+	/**
+	 * Report the outcome of a request to the adaptive concurrency controller and the host scorer
+	 * Called once per HTTP request where it completes (a download made of several requests reports each of them).
+	 * @param HostIndex Index of the build base URL the request went to
+	 * @param HttpStatus The HTTP status code of the response
+	 */
+	void ReportRequestResult(int32 HostIndex, int32 HttpStatus);
 
 	/**
 	 * Handle download completion
+	 * The requests of the attempt have already been reported with ReportRequestResult.
 	 * @param Url The URL that was downloaded from
 	 * @param TryNumber The attempt number that completed
 	 * @param HttpStatus The HTTP status code of the response
@@ -122,9 +453,187 @@ private:
 	/** Whether the download has completed (successfully or unsuccessfully) */
 	bool bHasCompleted = false;
 
+	/** Whether requests of the current attempt are transferring data (the download can be paused) */
+	bool bIsTransferring = false;
+
+	/** Whether the download waits on a ticker for its next request, a retry or the bandwidth (the download can be paused) */
+	bool bIsWaiting = false;
+
+	/** Whether the download was paused */
+	bool bIsPaused = false;
+
+	/** Number of requests whose completion callback hasn't run yet */
+	int32 TransfersInFlight = 0;
+
 	/** Time when the download started */
 	FDateTime BeginTime;
 
 	/** Last reported number of bytes received */
-	int32 LastBytesReceived = 0;
+	int64 LastBytesReceived = 0;
+
+	/** Whether the current attempt hasn't received its first byte yet (time to first byte is measured from BeginTime) */
+	bool bAwaitingFirstByte = false;
+
+	/** Index of the build base URL the current attempt downloads from (the first host for segments) */
+	int32 AttemptHostIndex = INDEX_NONE;
+
+	/** Disk space reserved for the current attempt (the reservation shrinks as the attempt receives data) */
+	int64 ReservedDiskSpace = 0;
+
+	/** Whether the disk space of the current attempt is reserved */
+	bool bDiskSpaceReserved = false;
+
+	/** Running hash of a single stream (or single segment) download (null if the file version isn't a supported hash) */
+	TSharedPtr<FDreamIncrementalFileHash, ESPMode::ThreadSafe> IncrementalHash;
+
+	/** Segment table of a segmented or preallocated download (empty for single stream downloads) */
+	FDreamDownloadResumeState ResumeState;
+
+	/** Request(s) fetching one segment of the current attempt */
+	struct FSegmentTransfer
+	{
+		/** Cancels the original request */
+		FDreamDownloadCancel Cancel;
+
+		/** Cancels the hedged request */
+		FDreamDownloadCancel HedgeCancel;
+
+		/** Index of the build base URL the original request goes to */
+		int32 HostIndex = INDEX_NONE;
+
+		/** Index of the build base URL the hedged request goes to */
+		int32 HedgeHostIndex = INDEX_NONE;
+
+		/** Time the original request was issued (FPlatformTime::Seconds) */
+		double StartTime = 0.0;
+
+		/** Time the hedged request was issued (FPlatformTime::Seconds) */
+		double HedgeStartTime = 0.0;
+
+		/** Bytes received by the original request */
+		uint64 BytesReceived = 0;
+
+		/** Bytes received by the earlier slices of the segment in this attempt */
+		uint64 CompletedBytes = 0;
+
+		/** Offset one past the last byte requested by the original request */
+		int64 RequestEnd = 0;
+
+		/** Bytes of the original range the hedged request skips (they are on disk already) */
+		uint64 HedgeSkippedBytes = 0;
+
+		/** Bytes received by the hedged request */
+		uint64 HedgeBytesReceived = 0;
+
+		/** First byte fetched by the hedged request */
+		int64 HedgeBegin = 0;
+
+		/** End of the data the original request flushed to disk */
+		TSharedPtr<std::atomic<int64>, ESPMode::ThreadSafe> FlushedEnd;
+
+		/** End of the data the hedged request flushed to disk */
+		TSharedPtr<std::atomic<int64>, ESPMode::ThreadSafe> HedgeFlushedEnd;
+
+		/** Whether the original request hasn't reported back */
+		bool bInFlight = false;
+
+		/** Whether the hedged request hasn't reported back */
+		bool bHedgeInFlight = false;
+
+		/** Whether the segment was hedged in this attempt (only once) */
+		bool bHedged = false;
+
+		/** Progress of the segment at the last rate sample */
+		uint64 SampledBytes = 0;
+
+		/** Transfer rate measured at the last sample (bytes per second) */
+		float Rate = 0.0f;
+
+		/** Time the segment first fell below the hedging threshold (0 = it's keeping up) */
+		double SlowSince = 0.0;
+
+		/**
+		 * Get the progress of the segment
+		 * @return Bytes of the original range that are on disk, by whichever request got further
+		 */
+		inline uint64 GetBytesReceived() const { return CompletedBytes + FMath::Max(BytesReceived, HedgeSkippedBytes + HedgeBytesReceived); }
+
+		/**
+		 * Whether a request of the segment is still running
+		 * @return True if the original or the hedged request hasn't reported back
+		 */
+		inline bool IsInFlight() const { return bInFlight || bHedgeInFlight; }
+	};
+
+	/** Request state of each segment of the current attempt */
+	TArray<FSegmentTransfer> SegmentTransfers;
+
+	/** Progress of the current attempt when the segment table was last saved */
+	uint64 SegmentBytesAtLastSave = 0;
+
+	/** Number of segment requests of the current attempt that haven't reported back */
+	int32 SegmentsInFlight = 0;
+
+	/** Attempt number the in-flight segment requests belong to */
+	int SegmentTryNumber = -1;
+
+	/** HTTP status of the last failed segment of the current attempt */
+	int32 SegmentFailureStatus = 0;
+
+	/** Whether the host refused range requests (segmented downloads are disabled for this pak) */
+	bool bSegmentsUnsupported = false;
+
+	/** Size of the blocks covered by BlockHashes (from the manifest or the CDN block hash file) */
+	int64 BlockSize = 0;
+
+	/** Hash of every block of the file (empty if unknown) */
+	TArray<FString> BlockHashes;
+
+	/** Whether the block hash file was already requested from the CDN */
+	bool bBlockHashesRequested = false;
+
+	/** Number of block repairs attempted for this download */
+	int32 RepairAttempts = 0;
+
+	/** Number of attempts that failed with an error a retry can't fix */
+	int32 PermanentFailures = 0;
+
+	/** Location of every content chunk of the pak for the current attempt (same order as the entry) */
+	TArray<FDreamContentChunkStore::FSource> ContentChunkSources;
+
+	/** Content chunks the current attempt has to download */
+	TArray<FDreamContentChunk> ContentChunkQueue;
+
+	/** Index of the next chunk in ContentChunkQueue to request */
+	int32 NextContentChunk = 0;
+
+	/** Cancel callbacks of the chunk requests in flight (by queue index) */
+	TMap<int32, FDreamDownloadCancel> ContentChunkCancels;
+
+	/** Attempt number the in-flight chunk requests belong to */
+	int ContentChunkTryNumber = -1;
+
+	/** Base URL of the chunk store for the current attempt */
+	FString ContentChunkBaseUrl;
+
+	/** Bytes of content chunks downloaded by the current attempt */
+	int64 ContentChunkBytesReceived = 0;
+
+	/** HTTP status of the last failed chunk request of the current attempt (0 if none failed) */
+	int32 ContentChunkFailureStatus = 0;
+
+	/** Whether a chunk request of the current attempt failed */
+	bool bContentChunkFailed = false;
+
+	/** Whether the next chunk requests wait for the bandwidth debt to be paid back */
+	bool bContentChunkIssuePending = false;
+
+	/** Chunk hashes whose local copy turned out to be unreadable or corrupt (always downloaded) */
+	TSet<FString> ExcludedContentChunks;
+
+	/** Number of times assembling the pak failed */
+	int32 ContentChunkAssemblyFailures = 0;
+
+	/** Whether the compressed variant was missing or undecodable (the plain file is downloaded instead) */
+	bool bCompressedVariantFailed = false;
 };
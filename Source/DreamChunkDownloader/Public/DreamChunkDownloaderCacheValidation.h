@@ -0,0 +1,154 @@
+﻿// Copyright (C) 2025 Dream Moon, All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Async/Future.h"
+#include "DreamChunkDownloaderTokenBucket.h"
+
+#include <atomic>
+
+/**
+ * Background Cache Validation
+ * 
+ * Hashes a list of cached pak files on several worker threads at once. Workers pull the
+ * next file from a shared index, so large and small paks balance out across threads.
+ * Reads are paced by an optional I/O budget shared by all workers, so validating a full
+ * install doesn't starve the game of disk bandwidth.
+ * 
+ * Results are reported on the game thread, one callback per file and a final callback
+ * once every worker has stopped. The validation itself never touches the pak records;
+ * applying the results (deleting or repairing invalid files) is left to the caller.
+ * Files with block hashes also report which blocks are corrupt.
+ */
+class DREAMCHUNKDOWNLOADER_API FDreamCacheValidation : public TSharedFromThis<FDreamCacheValidation, ESPMode::ThreadSafe>
+{
+public:
+	/** A cached pak file to validate */
+	struct FFile
+	{
+		/** Name of the pak file */
+		FString FileName;
+
+		/** Full path of the pak file on disk */
+		FString FullPathOnDisk;
+
+		/** Expected file version (hash) */
+		FString FileVersion;
+
+		/** Size of the blocks covered by BlockHashes (0 if the file has no block hashes) */
+		int64 BlockSize = 0;
+
+		/** Hash of every block of the file */
+		TArray<FString> BlockHashes;
+	};
+
+	/** Validation result of a single file */
+	enum class EResult : uint8
+	{
+		/** Not checked (validation was cancelled first) */
+		Pending,
+
+		/** The file matches its version */
+		Valid,
+
+		/** The file doesn't match its version */
+		Invalid,
+	};
+
+	/** Called on the game thread after each file */
+	typedef TFunction<void(int32 FileIndex, bool bIsValid)> FOnFileValidated;
+
+	/** Called on the game thread once all workers have stopped */
+	typedef TFunction<void()> FOnFinished;
+
+	/**
+	 * Constructor
+	 * @param InFiles Files to validate
+	 * @param InParallelism Maximum number of files hashed at the same time
+	 * @param InIoBytesPerSecond Read budget shared by all workers (0 = unlimited)
+	 */
+	FDreamCacheValidation(TArray<FFile>&& InFiles, int32 InParallelism, int64 InIoBytesPerSecond);
+
+	/**
+	 * Start the workers
+	 * @param InOnFileValidated Called on the game thread after each file
+	 * @param InOnFinished Called on the game thread once all workers have stopped
+	 */
+	void Start(FOnFileValidated InOnFileValidated, FOnFinished InOnFinished);
+
+	/**
+	 * Ask the workers to stop (files not checked yet stay pending)
+	 */
+	void Cancel();
+
+	/**
+	 * Block until all workers have stopped
+	 */
+	void Wait();
+
+	/**
+	 * Whether the validation was cancelled
+	 * @return True if Cancel was called
+	 */
+	bool IsCancelled() const;
+
+	/**
+	 * Get the files being validated
+	 * @return List of files
+	 */
+	const TArray<FFile>& GetFiles() const { return Files; }
+
+	/**
+	 * Get the result of a file (only reliable on the game thread after its callback)
+	 * @param FileIndex Index of the file
+	 * @return Result of the file
+	 */
+	EResult GetResult(int32 FileIndex) const { return Results[FileIndex]; }
+
+	/**
+	 * Get the corrupt blocks of an invalid file (only reliable on the game thread after its callback)
+	 * @param FileIndex Index of the file
+	 * @return Sorted indices of the corrupt blocks (empty if unknown)
+	 */
+	const TArray<int32>& GetCorruptBlocks(int32 FileIndex) const { return CorruptBlocks[FileIndex]; }
+
+private:
+	/**
+	 * Validate files until the list is exhausted or the validation is cancelled
+	 */
+	void WorkerLoop();
+
+	/** Files to validate */
+	const TArray<FFile> Files;
+
+	/** Result of each file (each entry is written by a single worker) */
+	TArray<EResult> Results;
+
+	/** Corrupt blocks of each invalid file (each entry is written by a single worker) */
+	TArray<TArray<int32>> CorruptBlocks;
+
+	/** Maximum number of workers */
+	const int32 Parallelism;
+
+	/** Read budget shared by all workers */
+	FDreamTokenBucket IoBudget;
+
+	/** Index of the next file to hand out */
+	std::atomic<int32> NextFileIndex{0};
+
+	/** Number of workers still running */
+	std::atomic<int32> WorkersRunning{0};
+
+	/** Whether the validation was cancelled */
+	std::atomic<bool> bCancelled{false};
+
+	/** Worker futures (used to wait for the workers) */
+	TArray<TFuture<void>> Workers;
+
+	/** Called on the game thread after each file */
+	FOnFileValidated OnFileValidated;
+
+	/** Called on the game thread once all workers have stopped */
+	FOnFinished OnFinished;
+};
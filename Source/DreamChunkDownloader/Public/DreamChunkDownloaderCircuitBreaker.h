@@ -0,0 +1,95 @@
+﻿// Copyright (C) 2025 Dream Moon, All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "DreamChunkDownloaderTypes.h"
+
+/**
+ * Circuit Breaker
+ *
+ * Takes failing CDN hosts (by base URL) out of rotation. A host that fails a number of
+ * requests in a row opens its circuit and gets no requests for a cool-off window. After
+ * that a single probe request is let through (half open): success closes the circuit,
+ * failure opens it again for another window. A probe that never reports back is
+ * replaced after one more window.
+ *
+ * Only connection failures, timeouts, throttling and server errors count as failures.
+ * Only used on the game thread.
+ */
+class DREAMCHUNKDOWNLOADER_API FDreamCircuitBreaker
+{
+public:
+	/**
+	 * Constructor
+	 * @param InFailureThreshold Number of failures in a row that open the circuit
+	 * @param InCooldownSeconds Time an open host gets no requests
+	 */
+	FDreamCircuitBreaker(int32 InFailureThreshold, double InCooldownSeconds);
+
+	/**
+	 * Check if a host may receive a request
+	 * @param Host CDN base URL of the host
+	 * @param Now Current time in seconds (FPlatformTime::Seconds)
+	 * @return True if the circuit is closed or the host is due for its probe
+	 */
+	bool IsAvailable(const FString& Host, double Now) const;
+
+	/**
+	 * Check if a host is waiting for its probe request
+	 * @param Host CDN base URL of the host
+	 * @param Now Current time in seconds
+	 * @return True if the cool-off ended and no probe is in flight
+	 */
+	bool NeedsProbe(const FString& Host, double Now) const;
+
+	/**
+	 * Record that a request goes to a host (turns a due probe into a half open circuit)
+	 * @param Host CDN base URL of the host
+	 * @param Now Current time in seconds
+	 */
+	void OnRequestIssued(const FString& Host, double Now);
+
+	/**
+	 * Record the outcome of a request
+	 * @param Host CDN base URL of the host
+	 * @param HttpStatus HTTP status of the response (0 = connection failure)
+	 * @param Now Current time in seconds
+	 * @return True if the state of the circuit changed
+	 */
+	bool OnResult(const FString& Host, int32 HttpStatus, double Now);
+
+	/**
+	 * Get the state of a host
+	 * @param Host CDN base URL of the host
+	 * @param Now Current time in seconds
+	 * @return Circuit of the host (closed if never seen)
+	 */
+	FDreamHostCircuit GetCircuit(const FString& Host, double Now) const;
+
+private:
+	/** State of one host */
+	struct FState
+	{
+		/** Current state */
+		EDreamCircuitState State = EDreamCircuitState::Closed;
+
+		/** Number of failed requests in a row */
+		int32 ConsecutiveFailures = 0;
+
+		/** Time the circuit opened */
+		double OpenedTime = 0.0;
+
+		/** Time the probe request was issued (half open only) */
+		double ProbeTime = 0.0;
+	};
+
+	/** Number of failures in a row that open the circuit */
+	const int32 FailureThreshold;
+
+	/** Time an open host gets no requests */
+	const double CooldownSeconds;
+
+	/** State by CDN base URL */
+	TMap<FString, FState> States;
+};
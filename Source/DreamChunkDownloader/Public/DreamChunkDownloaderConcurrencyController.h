@@ -0,0 +1,110 @@
+﻿// Copyright (C) 2025 Dream Moon, All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+/**
+ * Concurrency Controller
+ *
+ * Picks the number of pak downloads kept in flight (additive increase, multiplicative decrease).
+ * Downloads report the bytes they receive, the time to first byte of each request and whether
+ * requests succeeded. Once per window the controller looks at the aggregate:
+ * - a high rate of failed requests halves the limit
+ * - a time to first byte well above the best seen so far (queues building up) lowers it by a quarter
+ * - otherwise, while there are more downloads waiting than the limit allows and the throughput
+ *   still grows, the limit goes up by one
+ *
+ * The limit always stays within the configured bounds. Lowering it never cancels downloads,
+ * it only holds back new ones. Only used on the game thread.
+ */
+class DREAMCHUNKDOWNLOADER_API FDreamConcurrencyController
+{
+public:
+	/**
+	 * Constructor
+	 * @param InMinLimit Lowest number of downloads in flight
+	 * @param InMaxLimit Highest number of downloads in flight
+	 * @param InInitialLimit Limit to start with (clamped to the bounds)
+	 * @param InWindowSeconds Length of the measurement window
+	 */
+	FDreamConcurrencyController(int32 InMinLimit, int32 InMaxLimit, int32 InInitialLimit, double InWindowSeconds);
+
+	/**
+	 * Get the current number of downloads allowed in flight
+	 * @return The limit
+	 */
+	inline int32 GetLimit() const { return Limit; }
+
+	/**
+	 * Record bytes received by any download
+	 * @param Bytes Number of new bytes
+	 */
+	void AddBytes(int64 Bytes);
+
+	/**
+	 * Record the time a request took to deliver its first byte
+	 * @param Seconds Time from issuing the request to the first byte
+	 */
+	void AddFirstByteTime(double Seconds);
+
+	/**
+	 * Record the outcome of a request
+	 * @param HttpStatus HTTP status of the response (0 = connection failure)
+	 */
+	void AddRequestResult(int32 HttpStatus);
+
+	/**
+	 * Close the measurement window if it elapsed and adjust the limit
+	 * @param Now Current time in seconds (FPlatformTime::Seconds)
+	 * @param NumWaitingDownloads Number of downloads requested (running or waiting for a slot)
+	 * @return True if the limit changed
+	 */
+	bool Update(double Now, int32 NumWaitingDownloads);
+
+private:
+	/**
+	 * Start a new measurement window
+	 * @param Now Current time in seconds
+	 */
+	void ResetWindow(double Now);
+
+	/** Lowest number of downloads in flight */
+	const int32 MinLimit;
+
+	/** Highest number of downloads in flight */
+	const int32 MaxLimit;
+
+	/** Length of the measurement window */
+	const double WindowSeconds;
+
+	/** Current number of downloads allowed in flight */
+	int32 Limit;
+
+	/** Start of the current window (0 until the first update) */
+	double WindowStart = 0.0;
+
+	/** Bytes received in the current window */
+	int64 WindowBytes = 0;
+
+	/** Requests that succeeded in the current window */
+	int32 WindowSuccesses = 0;
+
+	/** Requests that failed because of congestion in the current window */
+	int32 WindowFailures = 0;
+
+	/** Sum of the times to first byte measured in the current window */
+	double WindowFirstByteSeconds = 0.0;
+
+	/** Number of times to first byte measured in the current window */
+	int32 WindowFirstByteCount = 0;
+
+	/** Whether more downloads were waiting than the limit allowed during the window */
+	bool bWindowSaturated = false;
+
+	/** Throughput of the last window with traffic (bytes per second) */
+	double LastThroughput = 0.0;
+
+	/** Lowest time to first byte seen (slowly drifts up so a changed network is picked up) */
+	double BaselineFirstByteSeconds = 0.0;
+};
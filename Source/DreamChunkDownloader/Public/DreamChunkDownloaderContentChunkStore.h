@@ -0,0 +1,60 @@
+﻿// Copyright (C) 2025 Dream Moon, All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+class FDreamIncrementalFileHash;
+struct FDreamContentChunk;
+
+/**
+ * Content Chunk Store
+ *
+ * Assembles a pak from content defined chunks. A manifest that describes a pak as a list
+ * of chunk hashes lets the client copy every chunk it already holds (from any cached or
+ * embedded pak, or the previous version of the pak) and download only the rest, so data
+ * shared between paks and between builds is transferred once.
+ *
+ * The local index maps a chunk hash to a location inside a pak on disk. Downloaded chunks
+ * are staged as individual files in a folder next to the pak (<pak>.chunks) until the
+ * pak is assembled, so an interrupted download keeps the chunks it already fetched.
+ */
+class DREAMCHUNKDOWNLOADER_API FDreamContentChunkStore
+{
+public:
+	/** Where a chunk can be read from */
+	struct FSource
+	{
+		/** Path of the file holding the chunk */
+		FString Path;
+
+		/** Offset of the chunk in the file */
+		int64 Offset = 0;
+	};
+
+	/**
+	 * Get the name of a chunk on the CDN and in the staging folder
+	 * @param ChunkHash Hash of the chunk (e.g. "XXH3:0123...")
+	 * @return File name of the chunk (e.g. "XXH3-0123...")
+	 */
+	static FString GetChunkFileName(const FString& ChunkHash);
+
+	/**
+	 * Add the chunks of a file on disk to an index
+	 * @param Chunks Chunks of the file in file order
+	 * @param Path Path of the file
+	 * @param OutIndex Index of chunk hash to location (existing entries are kept)
+	 */
+	static void AddSources(const TArray<FDreamContentChunk>& Chunks, const FString& Path, TMap<FString, FSource>& OutIndex);
+
+	/**
+	 * Write a pak out of its chunks, checking the hash of every chunk before it is written
+	 * @param Chunks Chunks of the pak in file order
+	 * @param Sources Location of each chunk (same order as Chunks)
+	 * @param OutputPath Path of the pak (overwritten)
+	 * @param OutputHash Running hash fed with the output as it is written (optional)
+	 * @param OutBadChunks Receives the index of every chunk that couldn't be read or didn't match its hash
+	 * @return True if the whole pak was written
+	 */
+	static bool Assemble(const TArray<FDreamContentChunk>& Chunks, const TArray<FSource>& Sources, const FString& OutputPath, FDreamIncrementalFileHash* OutputHash, TArray<int32>& OutBadChunks);
+};
@@ -0,0 +1,102 @@
+﻿// Copyright (C) 2025 Dream Moon, All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "DreamChunkDownloaderDownloadTransport.h"
+
+#if DCD_WITH_CURL_MULTI
+
+#include "Containers/Queue.h"
+#include "HAL/CriticalSection.h"
+#include "HAL/Runnable.h"
+
+#include <atomic>
+
+class FRunnableThread;
+
+/**
+ * libcurl Multi Transport
+ * 
+ * Fetches http(s) URLs with a libcurl multi handle driven by its own thread, bypassing the
+ * engine HTTP module. Body data goes from the receive buffer of libcurl straight into the
+ * file sink, without the intermediate copies and delegate hops of the HTTP module.
+ * 
+ * Completion work (flushing, checking and rolling back the file) runs on the transport
+ * thread, only progress and the final status are handed to the game thread.
+ * 
+ * A bandwidth limit is applied by pausing the connections that are over their share
+ * (CURL_WRITEFUNC_PAUSE), so the thread never sleeps while other transfers are waiting.
+ * 
+ * Only handles URLs while bUseCurlMultiTransport is enabled. Linux only.
+ */
+class DREAMCHUNKDOWNLOADER_API FDreamCurlMultiDownloadTransport : public IDreamDownloadTransport, public FRunnable
+{
+public:
+	/**
+	 * Destructor, stops the thread
+	 */
+	virtual ~FDreamCurlMultiDownloadTransport() override;
+
+	//~ Begin IDreamDownloadTransport Interface
+	virtual bool CanHandle(const FString& Url) const override;
+	virtual FDreamDownloadCancel Download(const FString& Url, const FString& TargetFile, const FDreamStreamDownloadOptions& Options,
+	                                      const FDreamDownloadProgress& Progress, const FDreamDownloadComplete& Callback) override;
+	virtual void Shutdown() override;
+	//~ End IDreamDownloadTransport Interface
+
+	//~ Begin FRunnable Interface
+	virtual uint32 Run() override;
+	virtual void Stop() override;
+	//~ End FRunnable Interface
+
+private:
+	/** State of one transfer (defined in the cpp to keep libcurl out of the header) */
+	struct FTransfer;
+
+	/**
+	 * Start the thread and the multi handle on first use
+	 * @return True if the transport is running
+	 */
+	bool EnsureStarted();
+
+	/**
+	 * Create the easy handle of a transfer and add it to the multi handle (transport thread)
+	 * @param Transfer The transfer to start
+	 * @return True if the transfer was started
+	 */
+	bool StartTransfer(const TSharedPtr<FTransfer, ESPMode::ThreadSafe>& Transfer);
+
+	/**
+	 * Finish a transfer and report its result (transport thread)
+	 * @param Transfer The transfer that ended
+	 * @param CurlResult libcurl result code of the transfer
+	 */
+	void FinishTransfer(const TSharedPtr<FTransfer, ESPMode::ThreadSafe>& Transfer, int32 CurlResult);
+
+	/**
+	 * Unpause the transfers whose bandwidth wait is over (transport thread)
+	 * @return Longest time the thread may sleep before the next paused transfer is due (milliseconds)
+	 */
+	int32 ResumePausedTransfers();
+
+	/** Guards starting and stopping */
+	FCriticalSection StartLock;
+
+	/** The libcurl multi handle (CURLM) */
+	void* MultiHandle = nullptr;
+
+	/** The thread driving the multi handle */
+	FRunnableThread* Thread = nullptr;
+
+	/** Transfers waiting to be added to the multi handle */
+	TQueue<TSharedPtr<FTransfer, ESPMode::ThreadSafe>, EQueueMode::Mpsc> NewTransfers;
+
+	/** Transfers in the multi handle (transport thread only) */
+	TArray<TSharedPtr<FTransfer, ESPMode::ThreadSafe>> ActiveTransfers;
+
+	/** Set once the thread should exit */
+	std::atomic<bool> bStopping{false};
+};
+
+#endif // DCD_WITH_CURL_MULTI
@@ -0,0 +1,38 @@
+﻿// Copyright (C) 2025 Dream Moon, All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+class FDreamIncrementalFileHash;
+
+/**
+ * Delta Patch
+ *
+ * Rebuilds a new version of a pak from the previous version and a small patch, so a build
+ * update only downloads the bytes that actually changed. The patch is a list of copy
+ * operations (ranges of the old pak that are unchanged) and insert operations (new bytes
+ * carried in the patch). The output is written front to back, so it can be hashed while
+ * it is written.
+ *
+ * Patch format (little endian):
+ *   "DCDPATCH" magic, uint32 format version (1), int64 size of the output file
+ *   followed by operations, each starting with a uint8 opcode:
+ *     0 = end of patch
+ *     1 = copy:   int64 offset in the base file, int64 length
+ *     2 = insert: int64 length, followed by that many bytes
+ */
+class DREAMCHUNKDOWNLOADER_API FDreamDeltaPatch
+{
+public:
+	/**
+	 * Apply a patch to a base file
+	 * @param BasePath Path of the previous version of the pak
+	 * @param PatchPath Path of the downloaded patch
+	 * @param OutputPath Path of the new version of the pak (overwritten)
+	 * @param OutputSize Expected size of the new version
+	 * @param OutputHash Running hash fed with the output as it is written (optional)
+	 * @return True if the patch was well formed and the output has the expected size
+	 */
+	static bool Apply(const FString& BasePath, const FString& PatchPath, const FString& OutputPath, int64 OutputSize, FDreamIncrementalFileHash* OutputHash);
+};
@@ -0,0 +1,93 @@
+﻿// Copyright (C) 2025 Dream Moon, All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+/**
+ * Disk Space Ledger
+ *
+ * Keeps track of the disk space the downloads in flight are still going to use. A download
+ * reserves the bytes it will add to the cache before it starts, and only starts if the free
+ * space of the volume minus everything already reserved covers them, so several downloads
+ * that each fit on their own can't overrun the disk together.
+ *
+ * A reservation shrinks as the download writes to disk (the free space shrinks by the same
+ * amount) and drops to zero once a preallocated pak holds its space. It is released when the
+ * download completes, fails, is cancelled or is paused.
+ *
+ * If the platform can't report the free space, every reservation succeeds. Only used on the
+ * game thread.
+ */
+class DREAMCHUNKDOWNLOADER_API FDreamDiskSpaceLedger
+{
+public:
+	/**
+	 * Constructor
+	 * @param InFolder Folder on the volume the downloads are written to
+	 */
+	explicit FDreamDiskSpaceLedger(const FString& InFolder);
+
+	/**
+	 * Reserve the space a download still needs (replaces an earlier reservation of the same pak)
+	 * @param FileName Pak the space is reserved for
+	 * @param Bytes Number of bytes the download is going to add to the disk
+	 * @return True if the space was reserved, false if it doesn't fit next to the other reservations
+	 */
+	bool Reserve(const FString& FileName, int64 Bytes);
+
+	/**
+	 * Lower a reservation as the download writes to disk (never raises it)
+	 * @param FileName Pak the space is reserved for
+	 * @param RemainingBytes Number of bytes the download is still going to add
+	 */
+	void Reduce(const FString& FileName, int64 RemainingBytes);
+
+	/**
+	 * Drop the reservation of a pak
+	 * @param FileName Pak the space was reserved for
+	 */
+	void Release(const FString& FileName);
+
+	/**
+	 * Get the space reserved by all downloads
+	 * @return Number of bytes reserved
+	 */
+	inline int64 GetReservedBytes() const { return ReservedBytes; }
+
+	/**
+	 * Get the space reserved for one pak
+	 * @param FileName The pak
+	 * @return Number of bytes reserved (0 if the pak holds no reservation)
+	 */
+	int64 GetReservedBytes(const FString& FileName) const;
+
+	/**
+	 * Get the space a new download could still reserve
+	 * @return Free bytes on the volume minus the reserved bytes, or -1 if the free space is unknown
+	 */
+	int64 GetAvailableBytes() const;
+
+	/**
+	 * Get the reservation of every download
+	 * @return Map of pak file name to reserved bytes
+	 */
+	inline const TMap<FString, int64>& GetReservations() const { return Reservations; }
+
+private:
+	/**
+	 * Query the free space of the volume
+	 * @param OutFreeBytes Receives the number of free bytes
+	 * @return True if the platform reported the free space
+	 */
+	bool GetFreeBytes(int64& OutFreeBytes) const;
+
+	/** Folder on the volume the downloads are written to */
+	const FString Folder;
+
+	/** Bytes reserved by each pak */
+	TMap<FString, int64> Reservations;
+
+	/** Sum of all reservations */
+	int64 ReservedBytes = 0;
+};
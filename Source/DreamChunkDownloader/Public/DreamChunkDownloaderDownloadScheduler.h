@@ -0,0 +1,151 @@
+﻿// Copyright (C) 2025 Dream Moon, All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "DreamChunkDownloaderTypes.h"
+
+/**
+ * Download Scheduler
+ *
+ * Priority queue of the pak files waiting for a download slot (an indexed binary heap,
+ * so adding, reprioritizing and removing a pak are O(log n)). The pak with the highest
+ * priority is issued first, paks of equal priority in the order they were requested.
+ *
+ * Waiting paks age: every second in the queue adds AgingPerSecond to their priority, so
+ * a steady stream of high priority requests can't starve older low priority ones. All
+ * paks age at the same rate, so the order only depends on the priority minus the aging
+ * credit at the time the pak was queued and never has to be recomputed.
+ *
+ * Only used on the game thread.
+ */
+class DREAMCHUNKDOWNLOADER_API FDreamDownloadScheduler
+{
+public:
+	/**
+	 * Constructor
+	 * @param InAgingPerSecond Priority a pak gains for every second it waits
+	 */
+	explicit FDreamDownloadScheduler(double InAgingPerSecond);
+
+	/**
+	 * Queue a pak, or move it to its new place if it is already queued
+	 * @param PakFile The pak to download (ordered by its Priority)
+	 * @param Now Current time in seconds (FPlatformTime::Seconds)
+	 * @return True if the pak was added, false if it was already queued
+	 */
+	bool Push(const TSharedRef<FDreamPakFile>& PakFile, double Now);
+
+	/**
+	 * Remove a pak from the queue
+	 * @param PakFile The pak to remove
+	 * @return True if the pak was queued
+	 */
+	bool Remove(const TSharedRef<FDreamPakFile>& PakFile);
+
+	/**
+	 * Take the pak that should be downloaded next
+	 * @param OutQueueTime Receives the time the pak was queued (optional, pushing it back with this time keeps its aging credit)
+	 * @return The pak, or null if the queue is empty
+	 */
+	TSharedPtr<FDreamPakFile> Pop(double* OutQueueTime = nullptr);
+
+	/**
+	 * Check if a pak is queued
+	 * @param PakFile The pak to look for
+	 * @return True if the pak is waiting in the queue
+	 */
+	bool Contains(const FDreamPakFile& PakFile) const;
+
+	/**
+	 * Get the number of queued paks
+	 * @return Number of paks waiting
+	 */
+	inline int32 Num() const { return Heap.Num(); }
+
+	/**
+	 * Whether no pak is waiting
+	 * @return True if the queue is empty
+	 */
+	inline bool IsEmpty() const { return Heap.Num() == 0; }
+
+	/**
+	 * Drop every queued pak
+	 */
+	void Empty();
+
+	/**
+	 * Visit every queued pak (in no particular order)
+	 * @param Func Called with each pak
+	 */
+	template <typename FuncType>
+	void ForEach(FuncType Func) const
+	{
+		for (const FEntry& Entry : Heap)
+		{
+			Func(Entry.PakFile);
+		}
+	}
+
+private:
+	/** A queued pak */
+	struct FEntry
+	{
+		/** The pak to download */
+		TSharedRef<FDreamPakFile> PakFile;
+
+		/** Time the pak was queued */
+		double QueueTime;
+
+		/** Priority minus the aging credit at QueueTime (higher goes first) */
+		double Key;
+
+		/** Request order, breaks ties between equal keys */
+		uint64 Sequence;
+	};
+
+	/**
+	 * Whether an entry has to be downloaded before another one
+	 * @param A First entry
+	 * @param B Second entry
+	 * @return True if A goes first
+	 */
+	static bool GoesBefore(const FEntry& A, const FEntry& B);
+
+	/**
+	 * Move an entry towards the root until the heap is ordered
+	 * @param Index Index of the entry
+	 */
+	void SiftUp(int32 Index);
+
+	/**
+	 * Move an entry towards the leaves until the heap is ordered
+	 * @param Index Index of the entry
+	 */
+	void SiftDown(int32 Index);
+
+	/**
+	 * Swap two entries and keep the index map in step
+	 * @param A Index of the first entry
+	 * @param B Index of the second entry
+	 */
+	void SwapEntries(int32 A, int32 B);
+
+	/**
+	 * Remove the entry at an index
+	 * @param Index Index of the entry
+	 */
+	void RemoveAt(int32 Index);
+
+	/** Priority a pak gains for every second it waits */
+	const double AgingPerSecond;
+
+	/** Binary heap of the queued paks */
+	TArray<FEntry> Heap;
+
+	/** Position of each queued pak in the heap */
+	TMap<const FDreamPakFile*, int32> HeapIndices;
+
+	/** Sequence number of the next request */
+	uint64 NextSequence = 0;
+};
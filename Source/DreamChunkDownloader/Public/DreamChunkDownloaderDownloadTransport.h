@@ -0,0 +1,276 @@
+﻿// Copyright (C) 2025 Dream Moon, All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "DreamChunkDownloaderPlatformStreamDownload.h"
+#include "Misc/ScopeRWLock.h"
+
+#include <atomic>
+
+class FDreamChunkDownloadFileSink;
+
+/**
+ * Transfer Range
+ * 
+ * Part of a file a transfer has to fetch, worked out from the download options and the
+ * file already on disk. Shared by all transports so they resume the same way.
+ */
+struct DREAMCHUNKDOWNLOADER_API FDreamTransferRange
+{
+	/** Offset of the target file the body is written at (the valid size on disk for plain resumes) */
+	int64 ResumeOffset = 0;
+
+	/** Last byte (inclusive) of an explicit range, or -1 for the rest of the file */
+	int64 RangeEnd = -1;
+
+	/** Size of the whole source file, or -1 if unknown */
+	int64 FileSize = -1;
+
+	/** Whether an explicit range is written in place (segmented downloads) */
+	bool bIsExplicitRange = false;
+
+	/** Whether the body is a compressed variant that is always fetched whole */
+	bool bIsCompressed = false;
+
+	/**
+	 * Work out the range of a transfer
+	 * @param TargetFile Path of the file being downloaded
+	 * @param Options Options of the download
+	 * @return The range to fetch
+	 */
+	static FDreamTransferRange Make(const FString& TargetFile, const FDreamStreamDownloadOptions& Options);
+
+	/**
+	 * Get the first byte of the source to fetch
+	 * @return Offset in the source file (0 for compressed variants)
+	 */
+	int64 GetRequestBegin() const;
+
+	/**
+	 * Get the value of the Range header to send
+	 * @return Header value (e.g. "bytes=100-"), or empty to fetch the whole file
+	 */
+	FString GetRangeHeader() const;
+
+	/**
+	 * Get the range end the file sink writes up to
+	 * @return Offset one past the explicit range, or -1 to append
+	 */
+	int64 GetSinkRangeEnd() const;
+};
+
+/**
+ * Game Thread Progress
+ * 
+ * Hands the progress of a transfer running on another thread to the game thread. Only the
+ * latest value is delivered, at most once per game tick, and nothing is delivered once the
+ * transfer completed.
+ */
+class DREAMCHUNKDOWNLOADER_API FDreamGameThreadProgress : public TSharedFromThis<FDreamGameThreadProgress, ESPMode::ThreadSafe>
+{
+public:
+	/**
+	 * Constructor
+	 * @param InProgress Progress callback to invoke on the game thread
+	 */
+	explicit FDreamGameThreadProgress(const FDreamDownloadProgress& InProgress);
+
+	/**
+	 * Report progress (any thread)
+	 * @param BytesReceived Number of body bytes received so far
+	 */
+	void Report(uint64 BytesReceived);
+
+	/**
+	 * Stop reporting (updates still on their way to the game thread are dropped)
+	 */
+	void Complete();
+
+private:
+	/** Progress callback */
+	FDreamDownloadProgress Progress;
+
+	/** Latest value reported */
+	std::atomic<uint64> BytesReceived{0};
+
+	/** Whether an update is queued on the game thread */
+	std::atomic<bool> bPending{false};
+
+	/** Whether the transfer completed */
+	std::atomic<bool> bCompleted{false};
+};
+
+/**
+ * Download Transport
+ * 
+ * Moves the bytes of a single pak (or a range of it) from a source into a file. Transports
+ * cover the range request, progress, the streaming file sink and cancellation, so the
+ * downloader doesn't care where the data comes from. Progress and completion are always
+ * reported on the game thread, with HTTP status codes (a transport without HTTP maps its
+ * results onto them: 200, 206, 404, 416, 0 for an interrupted transfer).
+ * 
+ * The helpers below implement the parts every transport shares, so they resume, roll back
+ * and report errors the same way.
+ */
+class DREAMCHUNKDOWNLOADER_API IDreamDownloadTransport
+{
+public:
+	virtual ~IDreamDownloadTransport() = default;
+
+	/**
+	 * Check if the transport can fetch a URL
+	 * @param Url URL of the source
+	 * @return True if Download can be used for the URL
+	 */
+	virtual bool CanHandle(const FString& Url) const = 0;
+
+	/**
+	 * Start a transfer (game thread)
+	 * @param Url URL of the source
+	 * @param TargetFile Path of the file to write
+	 * @param Options Options of the download
+	 * @param Progress Receives the number of body bytes received (game thread)
+	 * @param Callback Receives the final status (game thread), called exactly once
+	 * @return Cancels the transfer (the callback still fires)
+	 */
+	virtual FDreamDownloadCancel Download(const FString& Url, const FString& TargetFile, const FDreamStreamDownloadOptions& Options,
+	                                      const FDreamDownloadProgress& Progress, const FDreamDownloadComplete& Callback) = 0;
+
+	/**
+	 * Stop any worker threads (module shutdown)
+	 */
+	virtual void Shutdown()
+	{
+	}
+
+protected:
+	/**
+	 * Create the file sink for a transfer
+	 * @param TargetFile Path of the file to write
+	 * @param Options Options of the download
+	 * @param Range Range of the transfer
+	 * @return The sink, or null if the body compression can't be decoded
+	 */
+	static TSharedPtr<FDreamChunkDownloadFileSink, ESPMode::ThreadSafe> CreateFileSink(const FString& TargetFile, const FDreamStreamDownloadOptions& Options, const FDreamTransferRange& Range);
+
+	/**
+	 * Finish the response written to a sink: flush, check the body and clean up after errors
+	 * @param Sink Sink the body was written to
+	 * @param Url URL of the source (for logging)
+	 * @param TargetFile Path of the file written
+	 * @param Range Range of the transfer
+	 * @param bGotResponse False if the transfer was interrupted before it completed
+	 * @param HttpStatus Status of the response
+	 * @param ContentRange Value of the Content-Range header
+	 * @return Status to report (bodies that don't fit the range are reported as 416)
+	 */
+	static int32 FinishResponse(FDreamChunkDownloadFileSink& Sink, const FString& Url, const FString& TargetFile, const FDreamTransferRange& Range,
+	                            bool bGotResponse, int32 HttpStatus, const FString& ContentRange);
+
+	/**
+	 * Invoke a completion callback on the game thread
+	 * @param Callback Callback to invoke (may be unbound)
+	 * @param HttpStatus Status to report
+	 */
+	static void CompleteOnGameThread(const FDreamDownloadComplete& Callback, int32 HttpStatus);
+};
+
+/**
+ * HTTP Transport
+ * 
+ * Fetches http(s) URLs with the engine HTTP module. Streams the body to disk through a file
+ * sink, or buffers it in memory when streaming is disabled.
+ */
+class DREAMCHUNKDOWNLOADER_API FDreamHttpDownloadTransport : public IDreamDownloadTransport
+{
+public:
+	//~ Begin IDreamDownloadTransport Interface
+	virtual bool CanHandle(const FString& Url) const override;
+	virtual FDreamDownloadCancel Download(const FString& Url, const FString& TargetFile, const FDreamStreamDownloadOptions& Options,
+	                                      const FDreamDownloadProgress& Progress, const FDreamDownloadComplete& Callback) override;
+	//~ End IDreamDownloadTransport Interface
+};
+
+/**
+ * Local File Transport
+ * 
+ * Copies file:// URLs (or absolute paths) from a local directory, for loopback testing and
+ * sideloading paks from removable media. Ranges, resumes and compressed variants work like
+ * over HTTP; the copy runs on the thread pool.
+ */
+class DREAMCHUNKDOWNLOADER_API FDreamFileDownloadTransport : public IDreamDownloadTransport
+{
+public:
+	/**
+	 * Get the local path of a URL
+	 * @param Url A file:// URL or an absolute path
+	 * @return Path on disk
+	 */
+	static FString GetLocalPath(const FString& Url);
+
+	//~ Begin IDreamDownloadTransport Interface
+	virtual bool CanHandle(const FString& Url) const override;
+	virtual FDreamDownloadCancel Download(const FString& Url, const FString& TargetFile, const FDreamStreamDownloadOptions& Options,
+	                                      const FDreamDownloadProgress& Progress, const FDreamDownloadComplete& Callback) override;
+	//~ End IDreamDownloadTransport Interface
+};
+
+/**
+ * Download Transport Registry
+ * 
+ * Picks the transport for a URL. Transports are asked in reverse registration order, so a
+ * transport registered by the project takes precedence over the built-in ones.
+ * 
+ * Built-in transports:
+ * - http: engine HTTP module (http and https)
+ * - file: local files (file:// and absolute paths)
+ * - curl: libcurl multi (http and https, Linux only, see bUseCurlMultiTransport)
+ */
+class DREAMCHUNKDOWNLOADER_API FDreamDownloadTransportRegistry
+{
+public:
+	/**
+	 * Get the registry
+	 * @return The singleton registry
+	 */
+	static FDreamDownloadTransportRegistry& Get();
+
+	/**
+	 * Register (or replace) a transport
+	 * @param Name Name of the transport (case insensitive)
+	 * @param Transport The transport
+	 */
+	void Register(const FString& Name, const TSharedRef<IDreamDownloadTransport, ESPMode::ThreadSafe>& Transport);
+
+	/**
+	 * Find the transport for a URL
+	 * @param Url URL of the source
+	 * @return The transport, or null if none can handle the URL
+	 */
+	TSharedPtr<IDreamDownloadTransport, ESPMode::ThreadSafe> FindTransport(const FString& Url) const;
+
+	/**
+	 * Shut down every transport (module shutdown)
+	 */
+	void Shutdown();
+
+private:
+	/**
+	 * Constructor - registers the built-in transports
+	 */
+	FDreamDownloadTransportRegistry();
+
+	/** A registered transport */
+	struct FEntry
+	{
+		FString Name;
+		TSharedRef<IDreamDownloadTransport, ESPMode::ThreadSafe> Transport;
+	};
+
+	/** Guards the transport list */
+	mutable FRWLock Lock;
+
+	/** Transports in registration order */
+	TArray<FEntry> Transports;
+};
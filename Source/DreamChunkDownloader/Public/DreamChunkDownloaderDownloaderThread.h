@@ -0,0 +1,78 @@
+﻿// Copyright (C) 2025 Dream Moon, All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Containers/Queue.h"
+#include "HAL/Runnable.h"
+
+#include <atomic>
+
+class FEvent;
+class FRunnableThread;
+
+/**
+ * Downloader Thread
+ * 
+ * Worker thread with a message queue that finishes HTTP transfers independently of the
+ * game tick. Requests complete on the HTTP thread and post their completion work (flushing
+ * and closing the target file, checking the body, rolling back bad data) here, so a long
+ * frame never delays the disk I/O of a finished transfer. Only the user facing callbacks
+ * are marshalled to the game thread afterwards.
+ * 
+ * Only the file work of a finished transfer runs here. Scheduling (IssueDownloads), retry
+ * backoff, hedging and concurrency updates and verification dispatch still run on the game
+ * ticker, so how quickly the next request goes out still depends on the game tick.
+ * 
+ * Messages can be posted from any thread and run in the order they were posted. Once the
+ * thread is stopping, Post refuses new messages and the caller runs the work itself.
+ */
+class DREAMCHUNKDOWNLOADER_API FDreamDownloaderThread : public FRunnable
+{
+public:
+	/**
+	 * Constructor, starts the thread
+	 */
+	FDreamDownloaderThread();
+
+	/**
+	 * Destructor, stops the thread
+	 */
+	virtual ~FDreamDownloaderThread() override;
+
+	/**
+	 * Queue a message for the thread
+	 * @param Message Work to run on the thread
+	 * @return False if the thread is not running (the message was not queued)
+	 */
+	bool Post(TFunction<void()>&& Message);
+
+	/**
+	 * Stop the thread after running the messages already queued
+	 * Blocks until the thread has exited.
+	 */
+	void Shutdown();
+
+	//~ Begin FRunnable Interface
+	virtual uint32 Run() override;
+	virtual void Stop() override;
+	//~ End FRunnable Interface
+
+private:
+	/**
+	 * Run every queued message
+	 */
+	void ProcessMessages();
+
+	/** Messages waiting to run (any thread produces, the downloader thread consumes) */
+	TQueue<TFunction<void()>, EQueueMode::Mpsc> Messages;
+
+	/** Wakes the thread when a message is posted */
+	FEvent* WakeEvent = nullptr;
+
+	/** The thread running the message loop */
+	FRunnableThread* Thread = nullptr;
+
+	/** Set once the thread should exit */
+	std::atomic<bool> bStopping{false};
+};
@@ -0,0 +1,270 @@
+﻿// Copyright (C) 2025 Dream Moon, All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "HAL/CriticalSection.h"
+#include "DreamChunkDownloaderMemoryBudget.h"
+
+#include <atomic>
+
+class IFileHandle;
+class FDreamIncrementalFileHash;
+class IDreamStreamDecoder;
+
+/**
+ * Streaming File Sink
+ *
+ * Receives response body data for a single pak download and writes it to the
+ * target file in bounded blocks as it arrives. The sink owns a fixed-size write
+ * buffer, so the memory used by a download no longer depends on the size of the pak.
+ *
+ * Body data is usually delivered on the HTTP thread while the completion is handled
+ * on the game thread, so all public functions are guarded by a critical section.
+ *
+ * Everything flushed to disk is kept when the request is interrupted, which allows
+ * the next attempt to resume from the real partial file with a Range request.
+ *
+ * A sink created with a range end writes one segment of a preallocated file in place
+ * instead of appending, which is used by segmented downloads.
+ *
+ * An optional incremental hash is fed every block as it reaches the disk, and an optional
+ * counter is told how far the data on disk reaches, so the owner of a preallocated file can
+ * record the valid length while the response is still running.
+ *
+ * With a decoder the response body is a compressed variant of the file that is always
+ * sent from the start. It is decompressed as it arrives; the decompressed bytes already
+ * on disk are skipped, so the resume offset always refers to the decompressed file.
+ *
+ * The memory of the write buffer and the decoder can be held as a reservation of the
+ * download memory budget, which is given back as soon as the response ends.
+ */
+class DREAMCHUNKDOWNLOADER_API FDreamChunkDownloadFileSink
+{
+public:
+	/** Smallest write buffer (the buffer shrinks down to this when the memory budget runs short) */
+	static constexpr int32 MIN_BUFFER_SIZE = 16 * 1024;
+
+	/**
+	 * Constructor
+	 * @param InTargetFile Path of the file to write
+	 * @param InResumeOffset Number of valid bytes already on disk (the requested range starts here)
+	 * @param InBufferSize Size of the write buffer in bytes
+	 * @param InRangeEnd Offset one past the last byte of an in-place segment, or -1 to append to the file
+	 */
+	FDreamChunkDownloadFileSink(const FString& InTargetFile, int64 InResumeOffset, int32 InBufferSize, int64 InRangeEnd = -1);
+
+	/**
+	 * Destructor - flushes and closes the file if it is still open
+	 */
+	~FDreamChunkDownloadFileSink();
+
+	/**
+	 * Set the running hash that is updated with every block written to disk
+	 * @param InHash The hash to update (may be null)
+	 */
+	void SetIncrementalHash(const TSharedPtr<FDreamIncrementalFileHash, ESPMode::ThreadSafe>& InHash);
+
+	/**
+	 * Set the counter that receives the end of the data known to be valid on disk
+	 * It starts at the resume offset and only moves once the response is known to be usable.
+	 * @param InFlushedEnd The counter to update (may be null)
+	 */
+	void SetFlushedEnd(const TSharedPtr<std::atomic<int64>, ESPMode::ThreadSafe>& InFlushedEnd);
+
+	/**
+	 * Set the size of the whole file
+	 * An in-place range that covers the whole file also accepts a 200 response (the server ignored the Range header).
+	 * @param InFileSize Size of the file in bytes (-1 = unknown)
+	 */
+	void SetFileSize(int64 InFileSize);
+
+	/**
+	 * Decompress the response body before it is written
+	 * @param InDecoder Decoder for the compression of the body
+	 */
+	void SetDecoder(TUniquePtr<IDreamStreamDecoder>&& InDecoder);
+
+	/**
+	 * Hold the memory budget reservation that covers the write buffer and the decoder
+	 * It is given back when the response ends or the sink is closed.
+	 * @param InMemory Reservation taken for this sink
+	 */
+	void SetMemoryReservation(FDreamMemoryReservation&& InMemory);
+
+	/**
+	 * Inspect the response headers before the first body block is written
+	 * A 206 response continues at the resume offset, a 200 response restarts the file
+	 * from the beginning (the server ignored the Range header) and anything else is refused.
+	 * An in-place range only accepts a 200 response if the range is the whole file, and a 206 response
+	 * only if its Content-Range ends where the range ends (and names the file size, if known).
+	 * @param HttpStatus Status code of the response (0 if not known yet)
+	 * @param ContentRange Value of the Content-Range header
+	 * @return True if body data will be written to disk
+	 */
+	bool BeginResponse(int32 HttpStatus, const FString& ContentRange);
+
+	/**
+	 * Whether BeginResponse has already been called
+	 * @return True once the response headers have been inspected
+	 */
+	bool HasBegunResponse() const;
+
+	/**
+	 * Receive a block of body data
+	 * @param Data Pointer to the received bytes
+	 * @param Length Number of bytes received
+	 * @return False if the data could not be written or the response was refused (the request should be aborted)
+	 */
+	bool Write(const uint8* Data, int64 Length);
+
+	/**
+	 * Finish the response: flush, close and make sure what was written matches the final status
+	 * Data written before the status was known is rolled back if the response turns out to be unusable.
+	 * @param HttpStatus Final status code of the response
+	 * @param ContentRange Value of the Content-Range header
+	 * @return True if the response body was written completely and is usable
+	 */
+	bool EndResponse(int32 HttpStatus, const FString& ContentRange);
+
+	/**
+	 * Flush any buffered data and close the file
+	 * @return True if every accepted byte reached the disk
+	 */
+	bool Close();
+
+	/**
+	 * Roll the file back to the resume offset (drops everything written by this response)
+	 */
+	void Discard();
+
+	/**
+	 * Get the number of body bytes written by this response
+	 * @return Bytes written since the resume offset
+	 */
+	int64 GetBytesWritten() const;
+
+	/**
+	 * Get the number of valid bytes at the start of the file
+	 * @return Length of the valid prefix on disk (including buffered data)
+	 */
+	int64 GetValidLength() const;
+
+	/**
+	 * Whether a write error occurred
+	 * @return True if the sink failed to open or write the target file
+	 */
+	bool HasError() const;
+
+	/**
+	 * Whether the response was refused (its body is not written)
+	 * @return True if the status or the Content-Range of the response doesn't fit the requested range
+	 */
+	bool HasRejectedResponse() const;
+
+private:
+	/**
+	 * Work out where a response body has to be written
+	 * @param HttpStatus Status code of the response
+	 * @param ContentRange Value of the Content-Range header
+	 * @param OutWriteOffset Receives the file offset the body starts at
+	 * @return True if the response body can be used
+	 */
+	bool GetResponseWriteOffset(int32 HttpStatus, const FString& ContentRange, int64& OutWriteOffset) const;
+
+	/**
+	 * Read a Content-Range header
+	 * @param ContentRange Value of the header ("bytes <first>-<last>/<total>")
+	 * @param OutBegin Receives the first byte of the range
+	 * @param OutEnd Receives the last byte (inclusive) of the range
+	 * @param OutTotal Receives the size of the whole file (-1 if the server sent "*")
+	 * @return True if the header is well formed
+	 */
+	static bool ParseContentRange(const FString& ContentRange, int64& OutBegin, int64& OutEnd, int64& OutTotal);
+
+	/**
+	 * Roll the file back to the resume offset (lock must be held)
+	 */
+	void DiscardLocked();
+
+	/**
+	 * Buffer decompressed (or plain) body data and write full blocks to disk (lock must be held)
+	 * @param Data Pointer to the bytes
+	 * @param Length Number of bytes
+	 * @return False if the data could not be written
+	 */
+	bool WriteLocked(const uint8* Data, int64 Length);
+
+	/**
+	 * Open the target file positioned at the given offset
+	 * @param Offset Offset to start writing at (the file is truncated there)
+	 * @return True if the file was opened
+	 */
+	bool OpenAt(int64 Offset);
+
+	/**
+	 * Write the buffered data to disk
+	 * @return True if the buffer was written
+	 */
+	bool FlushBuffer();
+
+	/** Guards all state (body data arrives on the HTTP thread) */
+	mutable FCriticalSection Lock;
+
+	/** Path of the file being written */
+	const FString TargetFile;
+
+	/** Offset the response body starts at */
+	int64 ResumeOffset = 0;
+
+	/** Offset one past the last byte of an in-place segment (-1 when appending) */
+	const int64 RangeEnd;
+
+	/** Size of the whole file (-1 if unknown) */
+	int64 FileSize = -1;
+
+	/** Offset the current response started writing at */
+	int64 WriteOffset = 0;
+
+	/** Number of bytes flushed to disk by this response */
+	int64 FlushedBytes = 0;
+
+	/** Maximum number of bytes held in memory before writing */
+	const int32 BufferSize;
+
+	/** Bounded write buffer */
+	TArray<uint8> Buffer;
+
+	/** Running hash of the file (optional) */
+	TSharedPtr<FDreamIncrementalFileHash, ESPMode::ThreadSafe> IncrementalHash;
+
+	/** Receives the end of the valid data on disk (optional) */
+	TSharedPtr<std::atomic<int64>, ESPMode::ThreadSafe> FlushedEnd;
+
+	/** Decompresses the body (null for plain responses) */
+	TUniquePtr<IDreamStreamDecoder> Decoder;
+
+	/** Memory budget reservation of the write buffer and the decoder */
+	FDreamMemoryReservation Memory;
+
+	/** Number of decompressed bytes still to skip (already on disk) */
+	int64 DecodedBytesToSkip = 0;
+
+	/** Open handle to the target file */
+	TUniquePtr<IFileHandle> FileHandle;
+
+	/** Whether the response headers have been inspected */
+	bool bHasBegunResponse = false;
+
+	/** Whether the status code was known when the first body block arrived */
+	bool bStatusKnownAtBegin = false;
+
+	/** Whether body data should be dropped (error responses) */
+	bool bDiscardBody = false;
+
+	/** Whether BeginResponse refused the response */
+	bool bRejectedResponse = false;
+
+	/** Whether a write error occurred */
+	bool bHasError = false;
+};
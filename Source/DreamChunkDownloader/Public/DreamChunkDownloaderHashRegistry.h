@@ -0,0 +1,116 @@
+﻿// Copyright (C) 2025 Dream Moon, All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Misc/ScopeRWLock.h"
+
+/**
+ * Incremental Hasher
+ * 
+ * One running hash computation. Created by the hash registry for a specific algorithm.
+ */
+class DREAMCHUNKDOWNLOADER_API IDreamHasher
+{
+public:
+	virtual ~IDreamHasher() = default;
+
+	/**
+	 * Add data to the hash
+	 * @param Data Pointer to the data
+	 * @param Length Number of bytes
+	 */
+	virtual void Update(const uint8* Data, int64 Length) = 0;
+
+	/**
+	 * Get the hash of everything added so far (the hasher can keep going afterwards)
+	 * @return Digest as upper case hex string (without prefix)
+	 */
+	virtual FString Finalize() const = 0;
+};
+
+/**
+ * Hash Registry
+ * 
+ * Maps the prefix of a pak file version (e.g. "SHA1:", "XXH3:", "BLAKE3:", "SHA256:") to the
+ * algorithm used to validate it, so a deployment can pick the hash cost in its manifest.
+ * Everything that validates pak files (download verification, cache validation and the
+ * incremental download hash) goes through this registry.
+ * 
+ * Built-in algorithms:
+ * - SHA1: legacy default
+ * - XXH3: 64 bit XXH3 (engine xxHash, vectorized where the CPU supports it)
+ * - XXH128: 128 bit XXH3 (engine xxHash, vectorized where the CPU supports it)
+ * - BLAKE3: 256 bit BLAKE3 (engine BLAKE3, vectorized where the CPU supports it)
+ * - SHA256: portable implementation
+ * 
+ * Projects can register additional algorithms at startup.
+ */
+class DREAMCHUNKDOWNLOADER_API FDreamHashRegistry
+{
+public:
+	/** Creates a new hasher for an algorithm */
+	typedef TFunction<TUniquePtr<IDreamHasher>()> FHasherFactory;
+
+	/**
+	 * Get the registry
+	 * @return The singleton registry
+	 */
+	static FDreamHashRegistry& Get();
+
+	/**
+	 * Register (or replace) an algorithm
+	 * @param Prefix Algorithm name used in file versions, without the colon (e.g. "XXH3")
+	 * @param Factory Creates hashers for the algorithm
+	 */
+	void Register(const FString& Prefix, FHasherFactory Factory);
+
+	/**
+	 * Check if a file version names a registered hash algorithm
+	 * @param FileVersion File version from the manifest
+	 * @return True if the file can be validated
+	 */
+	bool IsSupported(const FString& FileVersion) const;
+
+	/**
+	 * Create a hasher for the algorithm of a file version
+	 * @param FileVersion File version from the manifest
+	 * @return New hasher, or null if the algorithm isn't registered
+	 */
+	TUniquePtr<IDreamHasher> CreateHasher(const FString& FileVersion) const;
+
+	/**
+	 * Get the algorithm prefix of a file version
+	 * @param FileVersion File version from the manifest
+	 * @return Text before the first colon (empty if there is none)
+	 */
+	static FString GetPrefix(const FString& FileVersion);
+
+	/**
+	 * Build a file version string from a hasher
+	 * @param FileVersion File version the hasher was created for (provides the prefix)
+	 * @param Hasher Hasher to finalize
+	 * @return Hash in file version format (e.g. "XXH3:0123...")
+	 */
+	static FString MakeFileVersion(const FString& FileVersion, const IDreamHasher& Hasher);
+
+	/**
+	 * Compare two file versions (the hex digest is case insensitive)
+	 * @param A First file version
+	 * @param B Second file version
+	 * @return True if both describe the same hash
+	 */
+	static bool FileVersionsMatch(const FString& A, const FString& B);
+
+private:
+	/**
+	 * Constructor - registers the built-in algorithms
+	 */
+	FDreamHashRegistry();
+
+	/** Guards the factory map */
+	mutable FRWLock Lock;
+
+	/** Hasher factories by upper case prefix */
+	TMap<FString, FHasherFactory> Factories;
+};
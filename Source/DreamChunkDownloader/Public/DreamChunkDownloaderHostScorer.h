@@ -0,0 +1,90 @@
+﻿// Copyright (C) 2025 Dream Moon, All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "DreamChunkDownloaderTypes.h"
+
+/**
+ * Host Scorer
+ *
+ * Keeps exponential moving averages of the time to first byte, throughput and failure rate
+ * of each CDN host (by base URL) and ranks hosts by the expected time to fetch a megabyte.
+ * First attempts go to the best host, except for a small share that explores a random one
+ * (hosts that were never measured first). Retries walk down the ranking.
+ *
+ * The averages are saved to a small json file so they survive between sessions.
+ * Only used on the game thread.
+ */
+class DREAMCHUNKDOWNLOADER_API FDreamHostScorer
+{
+public:
+	/**
+	 * Pick the host for an attempt
+	 * @param Hosts CDN base URLs to choose from
+	 * @param TryNumber The attempt number (0 = first attempt)
+	 * @param ExplorationRate Share of first attempts that go to a random host (0 to 1)
+	 * @return Index into Hosts
+	 */
+	int32 SelectHost(const TArray<FString>& Hosts, int32 TryNumber, float ExplorationRate) const;
+
+	/**
+	 * Record the time a request to a host took to deliver its first byte
+	 * @param Host CDN base URL of the host
+	 * @param Seconds Time to first byte
+	 */
+	void AddLatency(const FString& Host, double Seconds);
+
+	/**
+	 * Record a finished transfer from a host
+	 * @param Host CDN base URL of the host
+	 * @param Bytes Number of bytes received
+	 * @param Seconds Duration of the transfer
+	 */
+	void AddTransfer(const FString& Host, int64 Bytes, double Seconds);
+
+	/**
+	 * Record the outcome of a request to a host
+	 * @param Host CDN base URL of the host
+	 * @param HttpStatus HTTP status of the response (0 = connection failure)
+	 */
+	void AddResult(const FString& Host, int32 HttpStatus);
+
+	/**
+	 * Get the scores of all measured hosts
+	 * @param OutScores Receives one entry per host, best first
+	 */
+	void GetScores(TArray<FDreamHostScore>& OutScores) const;
+
+	/**
+	 * Load the scores saved by an earlier session
+	 * @param Path Path of the host score file
+	 * @return True if the file was read
+	 */
+	bool Load(const FString& Path);
+
+	/**
+	 * Save the scores
+	 * @param Path Path of the host score file
+	 * @return True if the file was written
+	 */
+	bool Save(const FString& Path) const;
+
+private:
+	/**
+	 * Get the expected seconds to fetch a megabyte from a host
+	 * @param Host Measured host
+	 * @return Score (lower is better)
+	 */
+	static float ComputeScore(const FDreamHostScore& Host);
+
+	/**
+	 * Find or add the averages of a host
+	 * @param Host CDN base URL of the host
+	 * @return The averages
+	 */
+	FDreamHostScore& FindOrAdd(const FString& Host);
+
+	/** Averages by CDN base URL */
+	TMap<FString, FDreamHostScore> Hosts;
+};
@@ -0,0 +1,111 @@
+﻿// Copyright (C) 2025 Dream Moon, All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "HAL/CriticalSection.h"
+
+class IDreamHasher;
+
+/**
+ * Incremental File Hash
+ *
+ * Running hash of a pak file that is updated with every block written to disk during
+ * the download, so validating the finished file is a digest compare instead of a second
+ * pass over the whole file. The algorithm comes from the hash registry (by file version prefix).
+ *
+ * The hash only ever covers a contiguous prefix of the file. Blocks arriving out of order
+ * invalidate it, in which case validation falls back to reading the file. When a download
+ * resumes, the existing prefix is hashed once with CatchUp before new data is appended.
+ *
+ * Blocks are written on the HTTP thread, so all functions are guarded by a critical section.
+ */
+class DREAMCHUNKDOWNLOADER_API FDreamIncrementalFileHash
+{
+public:
+	/**
+	 * Constructor
+	 * @param InExpectedHash The file version the finished file has to match (e.g. "SHA1:...")
+	 */
+	explicit FDreamIncrementalFileHash(const FString& InExpectedHash);
+
+	/**
+	 * Destructor
+	 */
+	~FDreamIncrementalFileHash();
+
+	/**
+	 * Check if a file version can be validated incrementally
+	 * @param FileVersion The file version from the manifest
+	 * @return True if the version is a hash this class understands
+	 */
+	static bool IsSupported(const FString& FileVersion);
+
+	/**
+	 * Start over from the beginning of the file
+	 */
+	void Reset();
+
+	/**
+	 * Mark the hash as unusable (data was written out of order or rolled back)
+	 */
+	void Invalidate();
+
+	/**
+	 * Add a block written to the file
+	 * A block at offset 0 restarts the hash, a block that doesn't continue the hashed prefix invalidates it.
+	 * @param Offset Offset of the block in the file
+	 * @param Data Pointer to the block
+	 * @param Length Size of the block in bytes
+	 */
+	void Update(int64 Offset, const uint8* Data, int64 Length);
+
+	/**
+	 * Hash the part of the file on disk that is not covered yet
+	 * @param FullPathOnDisk Path of the file
+	 * @param Length Number of bytes at the start of the file that should be covered
+	 * @return True if the hash covers Length bytes afterwards
+	 */
+	bool CatchUp(const FString& FullPathOnDisk, int64 Length);
+
+	/**
+	 * Get the number of bytes covered by the hash
+	 * @return Length of the hashed prefix
+	 */
+	int64 GetHashedBytes() const;
+
+	/**
+	 * Whether the hash still describes a prefix of the file
+	 * @return False if the hash was invalidated
+	 */
+	bool IsValid() const;
+
+	/**
+	 * Check the hash against the expected file version
+	 * @param FileSize Size the hashed prefix must have (the whole file)
+	 * @return True if the hash is valid, covers FileSize bytes and matches the expected version
+	 */
+	bool Matches(int64 FileSize) const;
+
+	/**
+	 * Get the hash of the prefix in file version format
+	 * @return Hash string (e.g. "SHA1:0123...")
+	 */
+	FString GetHashString() const;
+
+private:
+	/** Guards all state (blocks arrive on the HTTP thread) */
+	mutable FCriticalSection Lock;
+
+	/** The file version the finished file has to match */
+	const FString ExpectedHash;
+
+	/** Running hash state */
+	TUniquePtr<IDreamHasher> Hasher;
+
+	/** Number of bytes covered by the hash */
+	int64 HashedBytes = 0;
+
+	/** Whether the hash still describes a prefix of the file */
+	bool bIsValid = true;
+};
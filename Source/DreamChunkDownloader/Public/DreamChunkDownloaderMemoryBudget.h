@@ -0,0 +1,145 @@
+﻿// Copyright (C) 2025 Dream Moon, All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "HAL/CriticalSection.h"
+
+/**
+ * Memory Budget
+ * 
+ * Bounds the memory held by the downloads in flight. Write buffers, decompression windows,
+ * response bodies that are held in memory and verification buffers all draw from the same
+ * budget, so the total doesn't grow with the number of downloads or the size of the paks.
+ * 
+ * A caller asks for the amount it would like and the least it can work with. It gets as much
+ * as fits, but never less than the minimum, so work that already started can always finish;
+ * the subsystem holds back new downloads instead while the budget is exhausted.
+ * 
+ * A budget with a limit of zero is unlimited and only measures the current and peak usage.
+ * Buffers are taken and given back on the HTTP and worker threads, so all functions are
+ * guarded by a critical section.
+ */
+class DREAMCHUNKDOWNLOADER_API FDreamMemoryBudget
+{
+public:
+	/**
+	 * Constructor
+	 * @param InLimit Maximum number of bytes in use (0 = unlimited)
+	 */
+	explicit FDreamMemoryBudget(int64 InLimit = 0);
+
+	/**
+	 * Change the limit of the budget (memory already in use is kept)
+	 * @param InLimit Maximum number of bytes in use (0 = unlimited)
+	 */
+	void SetLimit(int64 InLimit);
+
+	/**
+	 * Get the limit of the budget
+	 * @return Maximum number of bytes in use (0 = unlimited)
+	 */
+	int64 GetLimit() const;
+
+	/**
+	 * Check if an amount of memory fits in the budget right now
+	 * @param Bytes Number of bytes
+	 * @return True if the budget is unlimited or has room for Bytes
+	 */
+	bool CanFit(int64 Bytes) const;
+
+	/**
+	 * Take memory from the budget
+	 * @param Bytes Number of bytes the caller would like
+	 * @param MinBytes Number of bytes the caller can't do without (granted even over the limit)
+	 * @return Number of bytes granted, between MinBytes and Bytes
+	 */
+	int64 Acquire(int64 Bytes, int64 MinBytes);
+
+	/**
+	 * Give memory back to the budget
+	 * @param Bytes Number of bytes granted by Acquire
+	 */
+	void Release(int64 Bytes);
+
+	/**
+	 * Get the memory in use
+	 * @return Number of bytes currently granted
+	 */
+	int64 GetUsedBytes() const;
+
+	/**
+	 * Get the highest memory use since the budget was created or the peak was reset
+	 * @return Number of bytes
+	 */
+	int64 GetPeakBytes() const;
+
+	/**
+	 * Start measuring the peak from the current use
+	 */
+	void ResetPeak();
+
+private:
+	/** Guards all state */
+	mutable FCriticalSection Lock;
+
+	/** Maximum number of bytes in use (0 = unlimited) */
+	int64 Limit = 0;
+
+	/** Number of bytes currently granted */
+	int64 UsedBytes = 0;
+
+	/** Highest number of bytes granted at once */
+	int64 PeakBytes = 0;
+};
+
+/**
+ * Memory Reservation
+ * 
+ * Memory taken from a budget that is given back when the reservation is reset or destroyed.
+ * Can be moved but not copied.
+ */
+class DREAMCHUNKDOWNLOADER_API FDreamMemoryReservation
+{
+public:
+	/**
+	 * Constructor - an empty reservation
+	 */
+	FDreamMemoryReservation() = default;
+
+	/**
+	 * Constructor - takes memory from a budget
+	 * @param InBudget Budget to take the memory from (may be null, nothing is reserved then)
+	 * @param InBytes Number of bytes the caller would like
+	 * @param MinBytes Number of bytes the caller can't do without (-1 = all of InBytes)
+	 */
+	FDreamMemoryReservation(const TSharedPtr<FDreamMemoryBudget, ESPMode::ThreadSafe>& InBudget, int64 InBytes, int64 MinBytes = -1);
+
+	/**
+	 * Destructor - gives the memory back
+	 */
+	~FDreamMemoryReservation();
+
+	FDreamMemoryReservation(FDreamMemoryReservation&& Other);
+	FDreamMemoryReservation& operator=(FDreamMemoryReservation&& Other);
+	FDreamMemoryReservation(const FDreamMemoryReservation&) = delete;
+	FDreamMemoryReservation& operator=(const FDreamMemoryReservation&) = delete;
+
+	/**
+	 * Give the memory back to the budget
+	 */
+	void Reset();
+
+	/**
+	 * Get the size of the reservation
+	 * @return Number of bytes granted (0 without a budget)
+	 */
+	inline int64 GetBytes() const { return Bytes; }
+
+private:
+	/** Budget the memory was taken from */
+	TSharedPtr<FDreamMemoryBudget, ESPMode::ThreadSafe> Budget;
+
+	/** Number of bytes granted */
+	int64 Bytes = 0;
+};
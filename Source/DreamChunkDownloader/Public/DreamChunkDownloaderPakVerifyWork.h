@@ -0,0 +1,138 @@
+﻿// Copyright (C) 2025 Dream Moon, All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "DreamChunkDownloaderTypes.h"
+
+class FDreamIncrementalFileHash;
+class FDreamMemoryBudget;
+
+/**
+ * Asynchronous Pak File Verification Task
+ * 
+ * This class represents an asynchronous task that validates a downloaded pak file in a
+ * background thread. Reading and hashing a large pak can take seconds, so it must not
+ * happen inside the HTTP completion callback on the game thread.
+ * 
+ * The task checks the size of the file and its hash. If the download already hashed the
+ * data while it arrived, only the digest is compared; otherwise the whole file is read.
+ * When the file is corrupt and block hashes are known, the corrupt blocks are located so
+ * the download can refetch only those byte ranges.
+ * 
+ * Tasks are queued and started by the subsystem, which limits how many run at once.
+ * After completion, the result is handed back to the download on the main thread.
+ */
+class FDreamPakVerifyWork : public FNonAbandonableTask
+{
+public:
+	/** Allow the async task template to access private members */
+	friend class FAsyncTask<FDreamPakVerifyWork>;
+
+	/**
+	 * Main work function that performs the verification
+	 * This function is executed on a background thread
+	 */
+	void DoWork();
+
+	/**
+	 * Get the statistics ID for this task type
+	 * Used by the engine's profiling system to track performance
+	 * @return Statistics ID for this task type
+	 */
+	FORCEINLINE TStatId GetStatId() const
+	{
+		RETURN_QUICK_DECLARE_CYCLE_STAT(FPakVerifyWork, STATGROUP_ThreadPoolAsyncTasks);
+	}
+
+public: // inputs
+
+	/** 
+	 * Download that requested the verification 
+	 * Only accessed on the main thread
+	 */
+	TWeakPtr<FDreamChunkDownload> Download;
+
+	/** 
+	 * URL the file was downloaded from 
+	 * Passed back to the download for logging and retries
+	 */
+	FString Url;
+
+	/** 
+	 * Attempt number of the download 
+	 * Passed back to the download for retries
+	 */
+	int TryNumber = 0;
+
+	/** 
+	 * Full path of the file to verify 
+	 */
+	FString TargetFile;
+
+	/** 
+	 * Manifest entry of the pak file (expected size and version) 
+	 */
+	FDreamPakFileEntry Entry;
+
+	/** 
+	 * Size of the file on disk when the task was queued 
+	 */
+	int64 SizeOnDisk = 0;
+
+	/** 
+	 * Running hash of the download (optional) 
+	 * If it covers the whole file, the file doesn't have to be read again
+	 */
+	TSharedPtr<FDreamIncrementalFileHash, ESPMode::ThreadSafe> IncrementalHash;
+
+	/** 
+	 * Memory budget the read buffer is charged to while the file is read (optional) 
+	 */
+	TSharedPtr<FDreamMemoryBudget, ESPMode::ThreadSafe> MemoryBudget;
+
+	/** 
+	 * Size of the blocks covered by BlockHashes (0 if unknown) 
+	 */
+	int64 BlockSize = 0;
+
+	/** 
+	 * Hash of every block of the file (optional) 
+	 * Used to locate corrupt blocks when the file doesn't match its version
+	 */
+	TArray<FString> BlockHashes;
+
+	/** 
+	 * Skip the whole-file check and only locate corrupt blocks 
+	 * Used when block hashes become available after the file already failed verification
+	 */
+	bool bBlocksOnly = false;
+
+	/** 
+	 * Time the task was queued 
+	 * Used to report how long files wait for a free verification slot
+	 */
+	double QueueTime = 0.0;
+
+public: // results
+
+	/** 
+	 * Whether the file passed verification 
+	 */
+	bool bIsValid = false;
+
+	/** 
+	 * Whether the blocks of the file were checked (CorruptBlocks is meaningful) 
+	 */
+	bool bBlocksChecked = false;
+
+	/** 
+	 * Indices of the blocks that don't match their block hashes 
+	 */
+	TArray<int32> CorruptBlocks;
+
+	/** 
+	 * Time spent verifying the file in seconds (excluding time in the queue) 
+	 */
+	double VerifySeconds = 0.0;
+};
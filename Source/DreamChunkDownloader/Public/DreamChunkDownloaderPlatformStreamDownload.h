@@ -3,9 +3,16 @@
 
 #pragma once
 
-#include "HAL/Platform.h"
+#include "CoreMinimal.h"
+#include "Templates/SharedPointer.h"
 
-class FString;
+#include <atomic>
+
+class FDreamDownloaderThread;
+class FDreamIncrementalFileHash;
+class FDreamMemoryBudget;
+class FDreamRetryPolicy;
+class FDreamTokenBucket;
 
 template <typename FuncType> class TFunction;
 
@@ -13,4 +20,88 @@ typedef TFunction<void(int32 HttpStatus)> FDreamDownloadComplete;
 typedef TFunction<void(uint64 BytesReceived)> FDreamDownloadProgress;
 typedef TFunction<void(void)> FDreamDownloadCancel;
 
-extern FDreamDownloadCancel PlatformStreamDownload(const FString& Url, const FString& TargetFile, const FDreamDownloadProgress& Progress, const FDreamDownloadComplete& Callback);
+/**
+ * Options for a single platform stream download
+ */
+struct FDreamStreamDownloadOptions
+{
+	/** Write the response body to disk as it arrives instead of buffering the whole file in memory */
+	bool bStreamToDisk = true;
+
+	/** Size of the per-download write buffer used when streaming (bytes) */
+	int32 WriteBufferSize = 256 * 1024;
+
+	/**
+	 * First byte of an explicit range to fetch, or -1 to resume from the size of the file on disk
+	 * Explicit ranges are written in place into an already preallocated file (always streamed).
+	 */
+	int64 RangeBegin = -1;
+
+	/** Last byte (inclusive) of the explicit range */
+	int64 RangeEnd = -1;
+
+	/**
+	 * Size of the whole source file, or -1 if unknown
+	 * A server that ignores a range covering the whole file answers 200 with the file, which is accepted when this is known.
+	 */
+	int64 FileSize = -1;
+
+	/**
+	 * Running hash of the file, updated with every block written (optional)
+	 * Has to cover the bytes already on disk before the download starts.
+	 */
+	TSharedPtr<FDreamIncrementalFileHash, ESPMode::ThreadSafe> IncrementalHash;
+
+	/**
+	 * Receives the end of the data known to be valid on disk, updated as blocks are flushed (optional)
+	 * Lets the owner of a preallocated file record how much of a range arrived before the transfer ends.
+	 */
+	TSharedPtr<std::atomic<int64>, ESPMode::ThreadSafe> FlushedEnd;
+
+	/**
+	 * Compression of the response body (e.g. "gzip"), or empty for the plain file
+	 * Compressed bodies are requested whole and decompressed into the target file (always streamed),
+	 * skipping the decompressed bytes already on disk.
+	 */
+	FString Compression;
+
+	/**
+	 * Bandwidth limit shared with other downloads (optional)
+	 * Transports pace the body without blocking the thread that delivers it; the HTTP module can't hold back
+	 * data, so its received blocks only put the bandwidth in debt and the owner paces the next requests instead.
+	 */
+	TSharedPtr<FDreamTokenBucket, ESPMode::ThreadSafe> Bandwidth;
+
+	/**
+	 * Thread that finishes the transfer (optional, HTTP module transport only)
+	 * When set, the request completes on the HTTP thread and the file work runs on this thread instead of the game thread.
+	 * Progress and the completion callback are still delivered on the game thread.
+	 */
+	TSharedPtr<FDreamDownloaderThread, ESPMode::ThreadSafe> CompletionThread;
+
+	/** Retry policy told about Retry-After headers of the response (optional) */
+	TSharedPtr<FDreamRetryPolicy, ESPMode::ThreadSafe> RetryPolicy;
+
+	/**
+	 * Memory budget the write buffer, the decoder and bodies held in memory draw from (optional)
+	 * The write buffer shrinks towards its minimum size when the budget runs short.
+	 */
+	TSharedPtr<FDreamMemoryBudget, ESPMode::ThreadSafe> MemoryBudget;
+
+	/**
+	 * Expected size of the response body, or -1 if unknown
+	 * A body that isn't streamed is held in memory whole, this much is charged to the memory budget until it is saved.
+	 */
+	int64 ExpectedBodySize = -1;
+};
+
+/**
+ * Download a file (or a range of it) with the transport registered for its URL
+ * @param Url URL of the source (see FDreamDownloadTransportRegistry)
+ * @param TargetFile Path of the file to write
+ * @param Options Options of the download
+ * @param Progress Receives the number of body bytes received (game thread)
+ * @param Callback Receives the final HTTP status (game thread)
+ * @return Cancels the download
+ */
+extern FDreamDownloadCancel PlatformStreamDownload(const FString& Url, const FString& TargetFile, const FDreamStreamDownloadOptions& Options, const FDreamDownloadProgress& Progress, const FDreamDownloadComplete& Callback);
@@ -0,0 +1,125 @@
+﻿// Copyright (C) 2025 Dream Moon, All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+/**
+ * Download Segment
+ *
+ * A contiguous byte range of a pak file that is fetched by its own range request.
+ */
+struct FDreamDownloadSegment
+{
+	/** First byte of the segment */
+	int64 Begin = 0;
+
+	/** Offset one past the last byte of the segment */
+	int64 End = 0;
+
+	/** Number of bytes at the start of the segment that are already on disk */
+	int64 Received = 0;
+
+	/**
+	 * Get the size of the segment
+	 * @return Number of bytes covered by the segment
+	 */
+	inline int64 GetLength() const { return End - Begin; }
+
+	/**
+	 * Check if every byte of the segment is on disk
+	 * @return True if the segment is complete
+	 */
+	inline bool IsComplete() const { return Received >= GetLength(); }
+};
+
+/**
+ * Download Resume State
+ *
+ * Segment table of a pak that is being downloaded in several byte ranges at once, or
+ * as a single range into a preallocated file. The pak is preallocated to its final size,
+ * so the size on disk no longer says how much of it is valid. The table is saved next to
+ * the pak (<pak>.resume) as the segments progress so a retry, or the next session, only
+ * refetches what is missing.
+ *
+ * A corrupt pak with block hashes is repaired the same way: only the segments covering
+ * the corrupt blocks are marked missing.
+ * 
+ * A pak with a resume state file is never treated as cached.
+ */
+struct DREAMCHUNKDOWNLOADER_API FDreamDownloadResumeState
+{
+	/** Version of the pak the segments belong to */
+	FString FileVersion;
+
+	/** Final size of the pak */
+	int64 FileSize = 0;
+
+	/** Byte ranges of the pak */
+	TArray<FDreamDownloadSegment> Segments;
+
+	/**
+	 * Get the path of the resume state file for a pak
+	 * @param TargetFile Path of the pak file
+	 * @return Path of the resume state file
+	 */
+	static FString GetPath(const FString& TargetFile);
+
+	/**
+	 * Check if a pak has a resume state file
+	 * @param TargetFile Path of the pak file
+	 * @return True if the resume state file exists
+	 */
+	static bool Exists(const FString& TargetFile);
+
+	/**
+	 * Delete the resume state file of a pak (if any)
+	 * @param TargetFile Path of the pak file
+	 */
+	static void Delete(const FString& TargetFile);
+
+	/**
+	 * Split a pak into evenly sized segments
+	 * @param InFileVersion Version of the pak
+	 * @param InFileSize Final size of the pak
+	 * @param NumSegments Number of segments to create
+	 * @param ValidPrefix Number of bytes at the start of the file that are already valid
+	 */
+	void Reset(const FString& InFileVersion, int64 InFileSize, int32 NumSegments, int64 ValidPrefix);
+
+	/**
+	 * Build a segment table that refetches only the corrupt blocks of an otherwise complete pak
+	 * Adjacent corrupt blocks are merged into a single segment.
+	 * @param InFileVersion Version of the pak
+	 * @param InFileSize Final size of the pak
+	 * @param BlockSize Size of each block
+	 * @param CorruptBlocks Sorted indices of the blocks that have to be fetched again
+	 */
+	void ResetForRepair(const FString& InFileVersion, int64 InFileSize, int64 BlockSize, const TArray<int32>& CorruptBlocks);
+
+	/**
+	 * Load the resume state of a pak
+	 * @param TargetFile Path of the pak file
+	 * @return True if a valid resume state was loaded
+	 */
+	bool Load(const FString& TargetFile);
+
+	/**
+	 * Save the resume state of a pak
+	 * @param TargetFile Path of the pak file
+	 * @return True if the resume state file was written
+	 */
+	bool Save(const FString& TargetFile) const;
+
+	/**
+	 * Get the number of bytes already on disk
+	 * @return Sum of the received bytes of all segments
+	 */
+	int64 GetReceivedBytes() const;
+
+	/**
+	 * Check if every segment is complete
+	 * @return True if the whole pak is on disk
+	 */
+	bool IsComplete() const;
+};
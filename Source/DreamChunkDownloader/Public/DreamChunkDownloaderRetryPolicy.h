@@ -0,0 +1,92 @@
+﻿// Copyright (C) 2025 Dream Moon, All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "HAL/CriticalSection.h"
+
+/**
+ * Retry Policy
+ *
+ * Decides when a failed pak or manifest download is tried again. Delays grow exponentially
+ * with full jitter (a random delay between zero and the exponential cap), so clients that
+ * failed together during a CDN outage don't come back in lockstep. A Retry-After header on
+ * a 429 or 503 response sets a floor for every retry until it has passed.
+ *
+ * Errors that a retry can't fix (most 4xx responses) are reported as permanent. Every retry
+ * of the session draws from a shared budget; once it is spent, downloads fail instead of
+ * retrying.
+ *
+ * Retry-After is noted on whichever thread completes the request, so all functions are
+ * guarded by a critical section.
+ */
+class DREAMCHUNKDOWNLOADER_API FDreamRetryPolicy
+{
+public:
+	/**
+	 * Constructor
+	 * @param InBaseDelaySeconds Cap of the delay before the first retry
+	 * @param InMaxDelaySeconds Cap of the delay before any retry
+	 * @param InSessionBudget Number of retries allowed in the session (0 = unlimited)
+	 */
+	FDreamRetryPolicy(float InBaseDelaySeconds, float InMaxDelaySeconds, int32 InSessionBudget);
+
+	/**
+	 * Check if a failure can't be fixed by trying the same request again
+	 * @param HttpStatus Status of the failed request (0 = connection failure)
+	 * @return True for client errors other than timeouts, throttling and unusable ranges
+	 */
+	static bool IsPermanentFailure(int32 HttpStatus);
+
+	/**
+	 * Parse a Retry-After header
+	 * @param HeaderValue Either a number of seconds or an HTTP date
+	 * @return Seconds to wait, or 0 if the header is missing or malformed
+	 */
+	static float ParseRetryAfter(const FString& HeaderValue);
+
+	/**
+	 * Take a response into account (Retry-After on 429 and 503)
+	 * @param HttpStatus Status of the response
+	 * @param RetryAfterHeader Value of its Retry-After header (may be empty)
+	 */
+	void NoteResponse(int32 HttpStatus, const FString& RetryAfterHeader);
+
+	/**
+	 * Take a retry from the session budget
+	 * @return False if the budget is spent (the caller should give up)
+	 */
+	bool ConsumeRetry();
+
+	/**
+	 * Get the delay before a retry
+	 * @param RetryIndex Number of retries of this download before this one
+	 * @return Seconds to wait, never less than what a pending Retry-After asks for
+	 */
+	float GetRetryDelay(int32 RetryIndex);
+
+	/**
+	 * Get the number of retries taken from the budget so far
+	 * @return Retries used this session
+	 */
+	int32 GetRetriesUsed() const;
+
+private:
+	/** Guards all state */
+	mutable FCriticalSection Lock;
+
+	/** Cap of the delay before the first retry */
+	float BaseDelaySeconds = 0.0f;
+
+	/** Cap of the delay before any retry */
+	float MaxDelaySeconds = 0.0f;
+
+	/** Number of retries allowed in the session (0 = unlimited) */
+	int32 SessionBudget = 0;
+
+	/** Retries used so far */
+	int32 RetriesUsed = 0;
+
+	/** No retry starts before this time (FPlatformTime::Seconds), set by Retry-After */
+	double RetryNotBefore = 0.0;
+};
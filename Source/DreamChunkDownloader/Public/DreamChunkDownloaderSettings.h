@@ -21,6 +21,8 @@ enum class EDreamChunkDownloaderCacheLocation : uint8;
  * - CDN configuration
  * - Cache storage locations
  * - Download concurrency limits
+ * - Download streaming behaviour
+ * - Cache validation throughput
  * - Manifest file names
  * 
  * Settings are stored in the DreamChunkDownloader config file and can be modified
@@ -111,10 +113,48 @@ public:
 	 * 
 	 * Minimum value is 1. Higher values may improve download speed but
 	 * increase network and system resource usage.
+	 * 
+	 * With adaptive concurrency this is only the starting point.
 	 */
 	UPROPERTY(Config, EditAnywhere, BlueprintReadWrite, Category = "Settings")
 	int MaxConcurrentDownloads = 5;
 
+	/**
+	 * Whether to adjust the number of concurrent downloads to the network
+	 * 
+	 * The aggregate throughput, time to first byte and failure rate of downloads are measured
+	 * every AdaptiveConcurrencyWindowSeconds. The number of downloads in flight grows by one
+	 * while that keeps improving the throughput and is cut back on failures or rising latency,
+	 * always staying between MinConcurrentDownloads and MaxAdaptiveConcurrentDownloads.
+	 */
+	UPROPERTY(Config, EditAnywhere, BlueprintReadWrite, Category = "Settings")
+	bool bEnableAdaptiveConcurrency = true;
+
+	/**
+	 * Lowest number of concurrent downloads adaptive concurrency may go down to
+	 * 
+	 * Default: 1
+	 */
+	UPROPERTY(Config, EditAnywhere, BlueprintReadWrite, Category = "Settings", Meta = (EditCondition = "bEnableAdaptiveConcurrency", ClampMin = 1, UIMin = 1))
+	int32 MinConcurrentDownloads = 1;
+
+	/**
+	 * Highest number of concurrent downloads adaptive concurrency may go up to
+	 * 
+	 * Default: 16
+	 */
+	UPROPERTY(Config, EditAnywhere, BlueprintReadWrite, Category = "Settings", Meta = (EditCondition = "bEnableAdaptiveConcurrency", ClampMin = 1, UIMin = 1))
+	int32 MaxAdaptiveConcurrentDownloads = 16;
+
+	/**
+	 * Length of an adaptive concurrency measurement window in seconds
+	 * 
+	 * Shorter windows react faster but are noisier.
+	 * Default: 2
+	 */
+	UPROPERTY(Config, EditAnywhere, BlueprintReadWrite, Category = "Settings", Meta = (EditCondition = "bEnableAdaptiveConcurrency", ClampMin = 0.5, UIMin = 0.5))
+	float AdaptiveConcurrencyWindowSeconds = 2.0f;
+
 	/**
 	 * Deployment-specific CDN configurations
 	 * 
@@ -130,6 +170,384 @@ public:
 	UPROPERTY(Config, EditAnywhere, BlueprintReadWrite, Category = "Settings")
 	TArray<FDreamChunkDownloaderDeploymentSet> DeploymentSets;
 
+	/**
+	 * Whether to stream downloaded pak data straight to disk
+	 * 
+	 * When enabled, response data is written to the target file in bounded blocks
+	 * as it arrives instead of being held in memory until the download completes.
+	 * This keeps memory flat for large paks and leaves a real partial file behind
+	 * when a download is interrupted, which the next attempt resumes with a range request.
+	 * 
+	 * Disable only for HTTP backends that do not support response body streaming.
+	 */
+	UPROPERTY(Config, EditAnywhere, BlueprintReadWrite, Category = "Download")
+	bool bStreamDownloadsToDisk = true;
+
+	/**
+	 * Size of the per-download write buffer in kilobytes
+	 * 
+	 * Received data is collected in this buffer and written to disk whenever it fills up.
+	 * Peak memory per download is roughly this size regardless of the pak size.
+	 * 
+	 * Default: 256 KB
+	 */
+	UPROPERTY(Config, EditAnywhere, BlueprintReadWrite, Category = "Download", Meta = (EditCondition = "bStreamDownloadsToDisk", ClampMin = 16, UIMin = 16))
+	int32 StreamWriteBufferSizeKB = 256;
+
+	/**
+	 * Memory budget of the downloads in flight in megabytes
+	 * 
+	 * Write buffers, decompression windows, verification buffers and response bodies held
+	 * in memory all draw from this budget. When it runs short, write buffers shrink towards
+	 * 16 KB and new downloads are held back until the ones in flight give memory back.
+	 * Work that already started always gets the minimum it needs to finish.
+	 * 
+	 * Current and peak usage are reported in the loading stats. 0 means unlimited.
+	 * 
+	 * Default: 0 (unlimited)
+	 */
+	UPROPERTY(Config, EditAnywhere, BlueprintReadWrite, Category = "Download", Meta = (ClampMin = 0, UIMin = 0))
+	int32 DownloadMemoryBudgetMB = 0;
+
+	/**
+	 * Whether finished transfers are completed on a dedicated downloader thread
+	 * 
+	 * When enabled, pak requests complete on the HTTP thread and the file work that follows
+	 * (flushing and closing the pak, checking the response body, rolling back bad data) runs
+	 * on the downloader thread, so a long frame or a hitch doesn't hold up finished transfers.
+	 * Progress and completion are still reported on the game thread.
+	 * Scheduling, retries, hedging and verification dispatch stay on the game ticker, so a long
+	 * frame still delays the next request of a pak (only the file work of finished transfers moves).
+	 * 
+	 * Requires an HTTP backend that supports completing requests on the HTTP thread.
+	 */
+	UPROPERTY(Config, EditAnywhere, BlueprintReadWrite, Category = "Download")
+	bool bUseDownloaderThread = false;
+
+	/**
+	 * Whether http(s) paks are fetched with libcurl directly instead of the engine HTTP module (Linux only)
+	 * 
+	 * A libcurl multi handle on its own thread writes received data straight into the pak
+	 * file, skipping the copies and delegate hops of the HTTP module. Useful for dedicated
+	 * servers and Linux clients that download a lot of content. Manifests and block hashes
+	 * still go through the HTTP module.
+	 */
+	UPROPERTY(Config, EditAnywhere, BlueprintReadWrite, Category = "Download")
+	bool bUseCurlMultiTransport = false;
+
+	/**
+	 * Whether pak files are preallocated to their full size before the download starts
+	 * 
+	 * The space of the whole pak is reserved up front (fallocate or the platform equivalent),
+	 * so a full device fails the download right away with a clear error instead of after most
+	 * of the pak was transferred, and large paks aren't fragmented by growing a little at a time.
+	 * How much of the file is valid is recorded next to the pak, like for segmented downloads.
+	 * 
+	 * Compressed variants, delta patches and content chunks produce the pak in one pass
+	 * and are not preallocated. Hosts that don't support range requests fall back to
+	 * appending to the file.
+	 */
+	UPROPERTY(Config, EditAnywhere, BlueprintReadWrite, Category = "Download")
+	bool bPreallocatePakFiles = true;
+
+	/**
+	 * Whether to download large paks as several byte ranges in parallel
+	 * 
+	 * On high-latency links a single connection cannot use the available bandwidth.
+	 * When enabled, paks above SegmentedDownloadMinSizeMB are preallocated on disk and
+	 * split into SegmentsPerDownload ranges that are fetched concurrently. Completed
+	 * segments are recorded next to the pak, so a retry only refetches failed segments.
+	 * 
+	 * Requires CDN hosts that support HTTP range requests. Downloads fall back to a
+	 * single stream automatically if a host does not.
+	 */
+	UPROPERTY(Config, EditAnywhere, BlueprintReadWrite, Category = "Download")
+	bool bEnableSegmentedDownloads = false;
+
+	/**
+	 * Minimum pak size in megabytes for a segmented download
+	 * 
+	 * Smaller paks are downloaded with a single request.
+	 */
+	UPROPERTY(Config, EditAnywhere, BlueprintReadWrite, Category = "Download", Meta = (EditCondition = "bEnableSegmentedDownloads", ClampMin = 1, UIMin = 1))
+	int32 SegmentedDownloadMinSizeMB = 64;
+
+	/**
+	 * Number of byte ranges a large pak is split into
+	 */
+	UPROPERTY(Config, EditAnywhere, BlueprintReadWrite, Category = "Download", Meta = (EditCondition = "bEnableSegmentedDownloads", ClampMin = 2, ClampMax = 16, UIMin = 2, UIMax = 16))
+	int32 SegmentsPerDownload = 4;
+
+	/**
+	 * Whether segments of the same pak are spread over all CDN hosts of the deployment
+	 * 
+	 * When disabled, every segment of an attempt is fetched from the same host.
+	 */
+	UPROPERTY(Config, EditAnywhere, BlueprintReadWrite, Category = "Download", Meta = (EditCondition = "bEnableSegmentedDownloads"))
+	bool bSpreadSegmentsAcrossHosts = true;
+
+	/**
+	 * Priority a waiting download gains for every minute it waits
+	 * 
+	 * Downloads are issued highest priority first. Aging keeps a steady stream of high
+	 * priority requests from starving older low priority ones. 0 disables aging.
+	 * 
+	 * Default: 1.0
+	 */
+	UPROPERTY(Config, EditAnywhere, BlueprintReadWrite, Category = "Download", Meta = (ClampMin = 0, UIMin = 0, UIMax = 60))
+	float DownloadPriorityAgingPerMinute = 1.0f;
+
+	/**
+	 * Whether urgent downloads may pause lower priority downloads in flight
+	 * 
+	 * When a download with at least PreemptionPriorityThreshold priority is requested and
+	 * every download slot is taken, the lowest priority download in flight is paused and
+	 * its slot goes to the urgent one. The paused download keeps its partial file and goes
+	 * back into the queue, so it resumes with a range request later.
+	 */
+	UPROPERTY(Config, EditAnywhere, BlueprintReadWrite, Category = "Download")
+	bool bEnableDownloadPreemption = true;
+
+	/**
+	 * Lowest priority that may preempt downloads in flight
+	 * 
+	 * Mount requests download missing paks at the highest possible priority.
+	 * 
+	 * Default: 2147483647 (only mount requests)
+	 */
+	UPROPERTY(Config, EditAnywhere, BlueprintReadWrite, Category = "Download", Meta = (EditCondition = "bEnableDownloadPreemption"))
+	int32 PreemptionPriorityThreshold = MAX_int32;
+
+	/**
+	 * Whether stalling segments are raced with a second request from another host
+	 * 
+	 * A segment whose transfer rate stays below HedgeSlowRateFraction of the median rate
+	 * of the session for HedgeSlowWindowSeconds gets a second range request for its
+	 * remaining bytes. Whichever request finishes first completes the segment and the
+	 * other one is cancelled. Each segment is hedged at most once per attempt.
+	 * 
+	 * Only applies to segmented downloads.
+	 */
+	UPROPERTY(Config, EditAnywhere, BlueprintReadWrite, Category = "Download", Meta = (EditCondition = "bEnableSegmentedDownloads"))
+	bool bEnableHedgedRequests = true;
+
+	/**
+	 * Share of the median transfer rate below which a segment counts as stalling
+	 * 
+	 * Default: 0.2
+	 */
+	UPROPERTY(Config, EditAnywhere, BlueprintReadWrite, Category = "Download", Meta = (EditCondition = "bEnableSegmentedDownloads && bEnableHedgedRequests", ClampMin = 0.01, ClampMax = 1, UIMin = 0.01, UIMax = 1))
+	float HedgeSlowRateFraction = 0.2f;
+
+	/**
+	 * Time in seconds a segment has to stall before it is hedged
+	 * 
+	 * Default: 5.0
+	 */
+	UPROPERTY(Config, EditAnywhere, BlueprintReadWrite, Category = "Download", Meta = (EditCondition = "bEnableSegmentedDownloads && bEnableHedgedRequests", ClampMin = 0.5, UIMin = 0.5, UIMax = 60))
+	float HedgeSlowWindowSeconds = 5.0f;
+
+	/**
+	 * Share of first attempts that go to a random CDN host instead of the best scoring one
+	 * 
+	 * Hosts are scored by their measured latency, throughput and failure rate. Exploring
+	 * keeps the scores of the other hosts fresh so a recovered host is picked up again.
+	 * Retries always move on to the next best host.
+	 * 
+	 * Default: 0.1
+	 */
+	UPROPERTY(Config, EditAnywhere, BlueprintReadWrite, Category = "Download", Meta = (ClampMin = 0, ClampMax = 1, UIMin = 0, UIMax = 1))
+	float HostExplorationRate = 0.1f;
+
+	/**
+	 * Number of failed requests in a row that take a CDN host out of rotation
+	 * 
+	 * Connection failures, timeouts, throttling and server errors count as failures. The
+	 * host gets no requests until the cool-off ends, then a single probe decides whether it
+	 * comes back. If every host is out of rotation, requests go to all of them anyway.
+	 * 0 disables the circuit breaker.
+	 * 
+	 * Default: 3
+	 */
+	UPROPERTY(Config, EditAnywhere, BlueprintReadWrite, Category = "Download", Meta = (ClampMin = 0, UIMin = 0, UIMax = 20))
+	int32 CircuitBreakerFailureThreshold = 3;
+
+	/**
+	 * Time in seconds a failing CDN host stays out of rotation before it is probed again
+	 * 
+	 * Default: 30.0
+	 */
+	UPROPERTY(Config, EditAnywhere, BlueprintReadWrite, Category = "Download", Meta = (ClampMin = 1, UIMin = 1, UIMax = 600))
+	float CircuitBreakerCooldownSeconds = 30.0f;
+
+	/**
+	 * Cap of the delay before the first retry of a failed pak or manifest download in seconds
+	 * 
+	 * Each retry waits a random time between zero and a cap that doubles with every retry
+	 * of the same download (full jitter), up to RetryMaxDelaySeconds. A Retry-After header
+	 * on a 429 or 503 response is honoured as a minimum delay.
+	 * 
+	 * Default: 2.0
+	 */
+	UPROPERTY(Config, EditAnywhere, BlueprintReadWrite, Category = "Download", Meta = (ClampMin = 0, UIMin = 0, UIMax = 30))
+	float RetryBaseDelaySeconds = 2.0f;
+
+	/**
+	 * Longest delay before a retry in seconds (Retry-After can ask for more)
+	 * 
+	 * Default: 60.0
+	 */
+	UPROPERTY(Config, EditAnywhere, BlueprintReadWrite, Category = "Download", Meta = (ClampMin = 1, UIMin = 1, UIMax = 600))
+	float RetryMaxDelaySeconds = 60.0f;
+
+	/**
+	 * Number of retries allowed over the whole session, shared by all pak and manifest downloads
+	 * 
+	 * Once spent, failed downloads report an error instead of retrying. 0 means unlimited.
+	 * 
+	 * Default: 500
+	 */
+	UPROPERTY(Config, EditAnywhere, BlueprintReadWrite, Category = "Download", Meta = (ClampMin = 0, UIMin = 0))
+	int32 SessionRetryBudget = 500;
+
+	/**
+	 * Number of times the build manifest download is retried before UpdateBuild fails
+	 * Counts retries after the first attempt, so the manifest is requested up to MaxManifestRetries + 1 times.
+	 * 
+	 * Default: 10
+	 */
+	UPROPERTY(Config, EditAnywhere, BlueprintReadWrite, Category = "Download", Meta = (ClampMin = 0, UIMin = 0, UIMax = 50))
+	int32 MaxManifestRetries = 10;
+
+	/**
+	 * Maximum number of downloaded paks verified at the same time
+	 * 
+	 * Downloaded paks are verified on background threads before they are marked as cached.
+	 * Additional paks wait in a queue so verification never saturates the disk or the thread pool.
+	 * 
+	 * Default: 2
+	 */
+	UPROPERTY(Config, EditAnywhere, BlueprintReadWrite, Category = "Download", Meta = (ClampMin = 1, UIMin = 1))
+	int32 MaxConcurrentVerifications = 2;
+
+	/**
+	 * Whether to look for block hash files on the CDN when a download fails verification
+	 * 
+	 * Paks whose manifest entry has no block hashes can publish them next to the pak
+	 * (<pak url>.blocks.json). When a downloaded pak is corrupt, the file is fetched and
+	 * only the corrupt blocks are downloaded again instead of the whole pak.
+	 * A missing block hash file simply falls back to a full download.
+	 */
+	UPROPERTY(Config, EditAnywhere, BlueprintReadWrite, Category = "Download")
+	bool bFetchBlockHashFiles = false;
+
+	/**
+	 * Whether to update paks with delta patches advertised by the manifest
+	 * 
+	 * When a new manifest changes the version of a cached pak and lists a patch from the
+	 * cached version, the old pak is kept and only the patch is downloaded and applied.
+	 * Paks fall back to a full download if the patch isn't smaller than the pak, the old
+	 * version is gone, or the patch fails to download, apply or verify.
+	 * Default: true
+	 */
+	UPROPERTY(Config, EditAnywhere, BlueprintReadWrite, Category = "Download")
+	bool bEnableDeltaPatches = true;
+
+	/**
+	 * Whether to assemble paks from content chunks when the manifest lists them
+	 * 
+	 * Chunks already held by any cached or embedded pak (or the previous version of the pak)
+	 * are copied locally, only the missing ones are downloaded from the CDN.
+	 * Default: true
+	 */
+	UPROPERTY(Config, EditAnywhere, BlueprintReadWrite, Category = "Download")
+	bool bEnableContentChunkStore = true;
+
+	/**
+	 * Whether to download compressed variants of paks when the manifest lists them
+	 * 
+	 * The variant is decompressed into the pak while it downloads. An interrupted download
+	 * keeps the decompressed prefix; the retry fetches the variant again and skips the part
+	 * already on disk. Variants with a compression that has no registered decoder are ignored.
+	 * Default: true
+	 */
+	UPROPERTY(Config, EditAnywhere, BlueprintReadWrite, Category = "Download")
+	bool bEnableCompressedDownloads = true;
+
+	/**
+	 * Folder of the content chunk store on the CDN (relative to the build base URL)
+	 * 
+	 * Chunks are fetched from <base url>/<folder>/<chunk hash>, with the ':' of the hash replaced by '-'.
+	 * Default: chunks
+	 */
+	UPROPERTY(Config, EditAnywhere, BlueprintReadWrite, Category = "Download")
+	FString ContentChunkRelativeUrl = TEXT("chunks");
+
+	/**
+	 * Maximum number of content chunk requests in flight per pak
+	 * 
+	 * Chunks are small, so several are fetched at once to keep the connection busy.
+	 * Default: 8
+	 */
+	UPROPERTY(Config, EditAnywhere, BlueprintReadWrite, Category = "Download", Meta = (ClampMin = 1, UIMin = 1))
+	int32 MaxConcurrentContentChunkDownloads = 8;
+
+	/**
+	 * Download bandwidth in kilobytes per second for the Fast install speed
+	 * 
+	 * The limit is shared by every download in flight and can be switched at runtime with
+	 * SetInstallSpeed (or the platform chunk install interface) without cancelling downloads.
+	 * 0 means unlimited.
+	 * 
+	 * Default: 0 (unlimited)
+	 */
+	UPROPERTY(Config, EditAnywhere, BlueprintReadWrite, Category = "Bandwidth", Meta = (ClampMin = 0, UIMin = 0))
+	int32 FastInstallSpeedKBps = 0;
+
+	/**
+	 * Download bandwidth in kilobytes per second for the Slow install speed
+	 * 
+	 * Meant for background patching while the game needs the connection (e.g. during a match).
+	 * 0 means unlimited.
+	 * 
+	 * Default: 256
+	 */
+	UPROPERTY(Config, EditAnywhere, BlueprintReadWrite, Category = "Bandwidth", Meta = (ClampMin = 0, UIMin = 0))
+	int32 SlowInstallSpeedKBps = 256;
+
+	/**
+	 * Download bandwidth in kilobytes per second for the Paused install speed
+	 * 
+	 * Downloads stay connected and only trickle, so they pick up full speed again as soon
+	 * as the install speed is raised. Keep it above zero, 0 would mean unlimited.
+	 * 
+	 * Default: 4
+	 */
+	UPROPERTY(Config, EditAnywhere, BlueprintReadWrite, Category = "Bandwidth", Meta = (ClampMin = 0, UIMin = 0))
+	int32 PausedInstallSpeedKBps = 4;
+
+	/**
+	 * Number of cached paks hashed at the same time by ValidateCacheAsync
+	 * 
+	 * Each pak is hashed on its own worker thread. Higher values finish faster on
+	 * fast storage but compete with the game for CPU and disk.
+	 * 
+	 * Default: 4
+	 */
+	UPROPERTY(Config, EditAnywhere, BlueprintReadWrite, Category = "Validation", Meta = (ClampMin = 1, ClampMax = 32, UIMin = 1, UIMax = 32))
+	int32 ValidateCacheParallelism = 4;
+
+	/**
+	 * Read budget of ValidateCacheAsync in megabytes per second
+	 * 
+	 * Shared by all validation workers so a full cache check doesn't saturate the disk
+	 * while the game is streaming content. 0 means unlimited.
+	 * 
+	 * Default: 0 (unlimited)
+	 */
+	UPROPERTY(Config, EditAnywhere, BlueprintReadWrite, Category = "Validation", Meta = (ClampMin = 0, UIMin = 0))
+	int32 ValidateCacheIoBudgetMBps = 0;
+
 	/**
 	 * Name of the embedded manifest file
 	 * 
@@ -164,6 +582,17 @@ public:
 	UPROPERTY(Config, EditAnywhere, BlueprintReadWrite, Category = "File")
 	FString CachedBuildManifestFileName = "CachedBuildManifest.json";
 
+	/**
+	 * Name of the host score file
+	 * 
+	 * This file keeps the measured latency, throughput and failure rate of each CDN host
+	 * between sessions, so the first download of a session already goes to the best host.
+	 * 
+	 * Default: "HostScores.json"
+	 */
+	UPROPERTY(Config, EditAnywhere, BlueprintReadWrite, Category = "File")
+	FString HostScoresFileName = "HostScores.json";
+
 public:
 	/**
 	 * Get the singleton instance of the settings
@@ -0,0 +1,98 @@
+﻿// Copyright (C) 2025 Dream Moon, All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Misc/ScopeRWLock.h"
+
+/**
+ * Stream Decoder
+ * 
+ * Decompresses one response body as it arrives. Created by the decoder registry for a
+ * specific compression format.
+ */
+class DREAMCHUNKDOWNLOADER_API IDreamStreamDecoder
+{
+public:
+	virtual ~IDreamStreamDecoder() = default;
+
+	/**
+	 * Decode the next block of compressed data
+	 * @param Data Pointer to the compressed bytes
+	 * @param Length Number of compressed bytes
+	 * @param OnOutput Receives the decompressed bytes (returns false to abort)
+	 * @return False if the data is corrupt or OnOutput aborted
+	 */
+	virtual bool Decode(const uint8* Data, int64 Length, TFunctionRef<bool(const uint8* Output, int64 OutputLength)> OnOutput) = 0;
+
+	/**
+	 * Whether the end of the compressed stream was reached
+	 * @return True if the stream is complete
+	 */
+	virtual bool IsFinished() const = 0;
+
+	/**
+	 * Get the memory the decoder holds on to (output buffer and decompression window)
+	 * Charged to the download memory budget for as long as the decoder is in use.
+	 * @return Number of bytes
+	 */
+	virtual int64 GetMemorySize() const { return 0; }
+};
+
+/**
+ * Stream Decoder Registry
+ * 
+ * Maps the compression name used in manifests (e.g. "gzip") to a streaming decoder, so
+ * compressed variants of paks can be decompressed into the target file while they download.
+ * 
+ * Built-in formats:
+ * - gzip: engine zlib (zlib streams are accepted as well)
+ * 
+ * The engine doesn't ship a zstd decoder; projects that link one can register "zstd" at
+ * startup. Variants with an unregistered compression are ignored (the plain pak is downloaded).
+ */
+class DREAMCHUNKDOWNLOADER_API FDreamStreamDecoderRegistry
+{
+public:
+	/** Creates a new decoder for a format */
+	typedef TFunction<TUniquePtr<IDreamStreamDecoder>()> FDecoderFactory;
+
+	/**
+	 * Get the registry
+	 * @return The singleton registry
+	 */
+	static FDreamStreamDecoderRegistry& Get();
+
+	/**
+	 * Register (or replace) a compression format
+	 * @param Compression Name of the format used in manifests (case insensitive)
+	 * @param Factory Creates decoders for the format
+	 */
+	void Register(const FString& Compression, FDecoderFactory Factory);
+
+	/**
+	 * Check if a compression format can be decoded
+	 * @param Compression Name of the format
+	 * @return True if a decoder is registered
+	 */
+	bool IsSupported(const FString& Compression) const;
+
+	/**
+	 * Create a decoder
+	 * @param Compression Name of the format
+	 * @return New decoder, or null if the format isn't registered
+	 */
+	TUniquePtr<IDreamStreamDecoder> CreateDecoder(const FString& Compression) const;
+
+private:
+	/**
+	 * Constructor - registers the built-in formats
+	 */
+	FDreamStreamDecoderRegistry();
+
+	/** Guards the factory map */
+	mutable FRWLock Lock;
+
+	/** Decoder factories by lower case name */
+	TMap<FString, FDecoderFactory> Factories;
+};
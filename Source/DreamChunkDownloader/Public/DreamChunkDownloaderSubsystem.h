@@ -4,12 +4,24 @@
 
 #include "CoreMinimal.h"
 #include "DreamChunkDownloaderTypes.h"
+#include "DreamChunkDownloaderContentChunkStore.h"
 #include "Subsystems/GameInstanceSubsystem.h"
 #include "Containers/Ticker.h"
+#include "GenericPlatform/GenericPlatformChunkInstall.h"
 #include "DreamChunkDownloaderSubsystem.generated.h"
 
 class FDreamChunkDownloaderPlatformWrapper;
 class FDreamChunkDownload;
+class FDreamCacheValidation;
+class FDreamTokenBucket;
+class FDreamConcurrencyController;
+class FDreamHostScorer;
+class FDreamCircuitBreaker;
+class FDreamDownloadScheduler;
+class FDreamDownloaderThread;
+class FDreamRetryPolicy;
+class FDreamDiskSpaceLedger;
+class FDreamMemoryBudget;
 class IHttpRequest;
 class IFileManager;
 class FJsonObject;
@@ -34,9 +46,13 @@ DECLARE_DYNAMIC_DELEGATE_OneParam(FDreamChunkDownloaderCallbackEvent, bool, bSuc
  * This subsystem handles downloading, caching, and mounting of game content chunks (pak files).
  * It manages the entire lifecycle of chunked content including:
  * - Downloading chunks from CDN
+ * - Scheduling downloads by priority (urgent requests preempt background downloads)
  * - Caching downloaded content to disk
+ * - Verifying downloaded content on background threads
  * - Mounting/unmounting pak files
  * - Tracking chunk status and progress
+ * - Limiting the download bandwidth shared by all downloads
+ * - Picking CDN hosts by their measured performance (failing hosts are taken out of rotation)
  * - Handling manifest updates
  * 
  * The system is designed to work with chunked content distribution where game content
@@ -78,9 +94,10 @@ public:
 	/**
 	 * Process local pak files found on disk
 	 * @param LocalManifest The manifest entries to process
+	 * @param PatchBases Previous pak versions the local manifest kept as <pak>.base
 	 * @param FileManager File manager instance for file operations
 	 */
-	void ProcessLocalPakFiles(const TArray<FDreamPakFileEntry>& LocalManifest, IFileManager& FileManager);
+	void ProcessLocalPakFiles(const TArray<FDreamPakFileEntry>& LocalManifest, const TArray<FDreamPakFileEntry>& PatchBases, IFileManager& FileManager);
 
 	/**
 	 * Setup the content build ID from either remote manifest or settings
@@ -175,6 +192,99 @@ public:
 	 */
 	int ValidateCache();
 
+	/**
+	 * Validate integrity of cached files on worker threads
+	 * Files are hashed in parallel (see ValidateCacheParallelism and ValidateCacheIoBudgetMBps).
+	 * Invalid files are deleted and the local manifest is saved once, when validation ends.
+	 * @param OnProgress Called on the game thread after each file
+	 * @param OnComplete Called on the game thread with the number of invalid files once validation ends
+	 * @return False if a validation is already running (no callbacks will fire)
+	 */
+	bool ValidateCacheAsync(const FDreamChunkDownloaderTypes::FDreamValidateProgress& OnProgress, const FDreamChunkDownloaderTypes::FDreamValidateComplete& OnComplete);
+
+	/**
+	 * Cancel a running ValidateCacheAsync
+	 * Files found invalid so far are still deleted, and the completion callback still fires.
+	 */
+	void CancelValidateCache();
+
+	/**
+	 * Whether a ValidateCacheAsync is running
+	 * @return True if cached files are being validated
+	 */
+	bool IsValidatingCache() const;
+
+	/**
+	 * Switch the download bandwidth to the profile of an install speed
+	 * Downloads in flight keep running at the new rate (see FastInstallSpeedKBps and friends).
+	 * @param InInstallSpeed The desired installation speed
+	 * @return True if the speed was applied
+	 */
+	bool SetInstallSpeed(EChunkInstallSpeed::Type InInstallSpeed);
+
+	/**
+	 * Get the install speed whose bandwidth profile was applied last
+	 * @return The current installation speed
+	 */
+	EChunkInstallSpeed::Type GetInstallSpeed() const
+	{
+		return InstallSpeed;
+	}
+
+	/**
+	 * Get the adaptive concurrency controller downloads report to
+	 * @return The controller (null if adaptive concurrency is disabled)
+	 */
+	TSharedPtr<FDreamConcurrencyController> GetConcurrencyController() const
+	{
+		return ConcurrencyController;
+	}
+
+	/**
+	 * Get the bandwidth limit shared by all downloads
+	 * @return Token bucket in bytes per second
+	 */
+	TSharedPtr<FDreamTokenBucket, ESPMode::ThreadSafe> GetDownloadBandwidth() const
+	{
+		return DownloadBandwidth;
+	}
+
+	/**
+	 * Get the thread that completes finished transfers
+	 * @return The downloader thread, or null if transfers complete on the game thread
+	 */
+	TSharedPtr<FDreamDownloaderThread, ESPMode::ThreadSafe> GetDownloaderThread() const
+	{
+		return DownloaderThread;
+	}
+
+	/**
+	 * Get the retry policy shared by pak and manifest downloads
+	 * @return Retry policy
+	 */
+	TSharedPtr<FDreamRetryPolicy, ESPMode::ThreadSafe> GetRetryPolicy() const
+	{
+		return RetryPolicy;
+	}
+
+	/**
+	 * Get the disk space reservations of the downloads in flight
+	 * @return Disk space ledger of the cache folder
+	 */
+	TSharedPtr<FDreamDiskSpaceLedger> GetDiskSpaceLedger() const
+	{
+		return DiskSpaceLedger;
+	}
+
+	/**
+	 * Get the memory budget shared by the buffers of all downloads and verifications
+	 * @return Memory budget
+	 */
+	TSharedPtr<FDreamMemoryBudget, ESPMode::ThreadSafe> GetMemoryBudget() const
+	{
+		return MemoryBudget;
+	}
+
 	/**
 	 * Begin loading mode to track download/mount progress
 	 * @param OnCallback Callback to execute when loading completes
@@ -244,12 +354,87 @@ public:
 
 	/**
 	 * Get the number of active download requests
-	 * @return Number of download requests
+	 * @return Number of download requests (in flight and waiting)
 	 */
 	UFUNCTION(BlueprintPure, Category = "DreamChunkDownloader")
-	int32 GetNumDownloadRequests() const
+	int32 GetNumDownloadRequests() const;
+
+	/**
+	 * Limit the download bandwidth shared by all downloads (replaces the install speed profile until the next SetInstallSpeed)
+	 * @param BytesPerSecond Maximum bytes per second (0 = unlimited)
+	 */
+	UFUNCTION(BlueprintCallable, Category = "DreamChunkDownloader")
+	void SetDownloadSpeedLimit(int64 BytesPerSecond);
+
+	/**
+	 * Get the download bandwidth limit shared by all downloads
+	 * @return Maximum bytes per second (0 = unlimited)
+	 */
+	UFUNCTION(BlueprintPure, Category = "DreamChunkDownloader")
+	int64 GetDownloadSpeedLimit() const;
+
+	/**
+	 * Get the disk space the downloads in flight are still going to use
+	 * @return Number of bytes reserved
+	 */
+	UFUNCTION(BlueprintPure, Category = "DreamChunkDownloader")
+	int64 GetReservedDiskSpace() const;
+
+	/**
+	 * Get the disk space left for new downloads (free space of the cache volume minus the reserved space)
+	 * @return Number of bytes, or -1 if the platform can't report the free space
+	 */
+	UFUNCTION(BlueprintPure, Category = "DreamChunkDownloader")
+	int64 GetAvailableDiskSpace() const;
+
+	/**
+	 * Suspend all downloads (e.g. during a loading screen or a match)
+	 * Requests in flight stop and keep what reached the disk, the queue and its priorities are kept.
+	 * No callbacks fire until the downloads are resumed and finish. Downloads that are already
+	 * verifying, patching or assembling finish normally. Mount requests wait as well.
+	 */
+	UFUNCTION(BlueprintCallable, Category = "DreamChunkDownloader")
+	void PauseDownloads();
+
+	/**
+	 * Continue the downloads suspended by PauseDownloads (partial files resume with range requests)
+	 */
+	UFUNCTION(BlueprintCallable, Category = "DreamChunkDownloader")
+	void ResumeDownloads();
+
+	/**
+	 * Check if all downloads are suspended
+	 * @return True between PauseDownloads and ResumeDownloads
+	 */
+	UFUNCTION(BlueprintPure, Category = "DreamChunkDownloader")
+	bool AreDownloadsPaused() const
 	{
-		return DownloadRequests.Num();
+		return bDownloadsPaused;
+	}
+
+	/**
+	 * Suspend the downloads of a single chunk (other chunks keep downloading)
+	 * @param ChunkId The chunk to pause (also applies to downloads requested later)
+	 */
+	UFUNCTION(BlueprintCallable, Category = "DreamChunkDownloader")
+	void PauseChunkDownload(int32 ChunkId);
+
+	/**
+	 * Continue the downloads of a chunk suspended by PauseChunkDownload
+	 * @param ChunkId The chunk to resume
+	 */
+	UFUNCTION(BlueprintCallable, Category = "DreamChunkDownloader")
+	void ResumeChunkDownload(int32 ChunkId);
+
+	/**
+	 * Check if the downloads of a chunk are suspended
+	 * @param ChunkId The chunk to check
+	 * @return True between PauseChunkDownload and ResumeChunkDownload
+	 */
+	UFUNCTION(BlueprintPure, Category = "DreamChunkDownloader")
+	bool IsChunkDownloadPaused(int32 ChunkId) const
+	{
+		return PausedChunks.Contains(ChunkId);
 	}
 
 	/**
@@ -279,6 +464,63 @@ public:
 		return BuildBaseUrls;
 	}
 
+	/**
+	 * Let a pak whose download was paused be downloaded again once the paused requests have finished
+	 * @param PakFile The pak that was paused
+	 */
+	void OnPausedDownloadSettled(const TSharedRef<FDreamPakFile>& PakFile);
+
+	/**
+	 * Pick the CDN host for an attempt (best scoring host first, occasionally exploring the others)
+	 * Hosts taken out of rotation by the circuit breaker are skipped, a host due for its probe goes first.
+	 * Picking a host doesn't use up its probe, see OnBuildHostRequestIssued.
+	 * @param TryNumber The attempt number (retries walk down the ranking)
+	 * @param ExcludedHostIndex Host to avoid if another one is in rotation (e.g. the host a hedge races against)
+	 * @return Index into the build base URLs
+	 */
+	int32 SelectBuildHost(int TryNumber, int32 ExcludedHostIndex = INDEX_NONE) const;
+
+	/**
+	 * Record that a request is sent to a host (a host due for its probe goes half open)
+	 * @param HostIndex Index into the build base URLs
+	 */
+	void OnBuildHostRequestIssued(int32 HostIndex);
+
+	/**
+	 * Record the time a request to a host took to deliver its first byte
+	 * @param HostIndex Index into the build base URLs
+	 * @param Seconds Time to first byte
+	 */
+	void ReportHostLatency(int32 HostIndex, double Seconds);
+
+	/**
+	 * Record a finished transfer from a host
+	 * @param HostIndex Index into the build base URLs
+	 * @param Bytes Number of bytes received
+	 * @param Seconds Duration of the transfer
+	 */
+	void ReportHostTransfer(int32 HostIndex, int64 Bytes, double Seconds);
+
+	/**
+	 * Record the outcome of a request to a host
+	 * @param HostIndex Index into the build base URLs
+	 * @param HttpStatus HTTP status of the response (0 = connection failure)
+	 */
+	void ReportHostResult(int32 HostIndex, int32 HttpStatus);
+
+	/**
+	 * Get the measured scores of the CDN hosts (for diagnostics)
+	 * @param OutScores Receives one entry per measured host, best first
+	 */
+	UFUNCTION(BlueprintPure, Category = "DreamChunkDownloader")
+	void GetHostScores(TArray<FDreamHostScore>& OutScores) const;
+
+	/**
+	 * Index every content chunk held on disk (cached and embedded paks, previous versions kept as patch bases)
+	 * @param OutIndex Receives the location of each chunk by hash
+	 */
+	void BuildContentChunkIndex(TMap<FString, FDreamContentChunkStore::FSource>& OutIndex) const;
+
 	/**
 	 * Get loading statistics
 	 * @return Reference to loading stats structure
@@ -289,6 +531,22 @@ public:
 		return LoadingModeStats;
 	}
 
+	/**
+	 * Get the download progress counters that any thread can sample without locks
+	 * Get them on the game thread and keep the reference, reading it is safe from any thread.
+	 * @return Progress counters mirroring the loading stats
+	 */
+	TSharedRef<const FDreamDownloadProgressCounters, ESPMode::ThreadSafe> GetProgressCounters() const
+	{
+		return ProgressCounters;
+	}
+
+	/**
+	 * Add to the number of bytes downloaded (loading stats and progress counters)
+	 * @param Bytes Number of bytes to add (negative when received bytes are counted again later)
+	 */
+	void AddBytesDownloaded(int64 Bytes);
+
 	/**
 	 * Get the current content build ID
 	 * @return Current build ID
@@ -358,7 +616,7 @@ public:
 	}
 
 	/**
-	 * Get reference to download requests array
+	 * Get reference to the downloads in flight
 	 * @return Reference to download requests array
 	 */
 	TArray<TSharedRef<FDreamPakFile>>& GetDownloadRequests()
@@ -370,6 +628,9 @@ protected:
 	/** Loading statistics and progress tracking */
 	FDreamChunkDownloaderStats LoadingModeStats;
 
+	/** Lock-free copy of the download progress for other threads */
+	TSharedRef<FDreamDownloadProgressCounters, ESPMode::ThreadSafe> ProgressCounters = MakeShared<FDreamDownloadProgressCounters, ESPMode::ThreadSafe>();
+
 	/** Callbacks to execute after loading completes */
 	TArray<FDreamChunkDownloaderTypes::FDreamCallback> PostLoadCallbacks;
 
@@ -397,6 +658,27 @@ protected:
 	/** Base URLs for content downloads */
 	TArray<FString> BuildBaseUrls;
 
+	/** CDN base URL (without the build ID) of each build base URL, the hosts are scored by it */
+	TArray<FString> BuildHosts;
+
+	/** Measured performance of the CDN hosts */
+	TSharedPtr<FDreamHostScorer> HostScorer;
+
+	/** Time the host scores were last saved */
+	double LastHostScoreSaveTime = 0.0;
+
+	/** Takes failing CDN hosts out of rotation (null if disabled) */
+	TSharedPtr<FDreamCircuitBreaker> CircuitBreaker;
+
+	/** Delays and budget of the retries of failed downloads */
+	TSharedPtr<FDreamRetryPolicy, ESPMode::ThreadSafe> RetryPolicy;
+
+	/** Disk space reserved by the downloads in flight */
+	TSharedPtr<FDreamDiskSpaceLedger> DiskSpaceLedger;
+
+	/** Memory held by the buffers of the downloads and verifications in flight */
+	TSharedPtr<FDreamMemoryBudget, ESPMode::ThreadSafe> MemoryBudget;
+
 	/** Map of chunk ID to chunk record */
 	TMap<int32, TSharedRef<FDreamChunk>> Chunks;
 
@@ -412,15 +694,66 @@ protected:
 	/** Handle for the per-frame mount ticker in the main thread */
 	FTSTicker::FDelegateHandle MountTicker;
 
+	/** Handle for the per-frame verification ticker in the main thread */
+	FTSTicker::FDelegateHandle VerifyTicker;
+
+	/** Verification tasks waiting for a free slot */
+	TArray<FDreamChunkDownloaderTypes::FDreamVerifyTask*> PendingVerifyTasks;
+
+	/** Verification tasks running in the background */
+	TArray<FDreamChunkDownloaderTypes::FDreamVerifyTask*> ActiveVerifyTasks;
+
+	/** Running background cache validation (if any) */
+	TSharedPtr<FDreamCacheValidation, ESPMode::ThreadSafe> CacheValidation;
+
 	/** Manifest download request */
 	TSharedPtr<IHttpRequest, ESPMode::ThreadSafe> ManifestRequest;
 
+	/** Hosts that answered the current manifest update with an error a retry can't fix (INDEX_NONE = static remote host) */
+	TSet<int32> ManifestPermanentFailureHosts;
+
 	/** Maximum number of downloads to allow concurrently */
 	int32 TargetDownloadsInFlight = 1;
 
-	/** List of pak files that have been requested */
+	/** Adjusts TargetDownloadsInFlight to the network (null if adaptive concurrency is disabled) */
+	TSharedPtr<FDreamConcurrencyController> ConcurrencyController;
+
+	/** Handle for the adaptive concurrency ticker in the main thread */
+	FTSTicker::FDelegateHandle ConcurrencyTicker;
+
+	/** Handle for the hedging ticker in the main thread */
+	FTSTicker::FDelegateHandle HedgeTicker;
+
+	/** Recent transfer rates of the segments in flight (ring buffer, bytes per second) */
+	TArray<float> SegmentRateSamples;
+
+	/** Next slot of SegmentRateSamples to overwrite */
+	int32 NextSegmentRateSample = 0;
+
+	/** Bandwidth limit shared by all downloads (bytes per second) */
+	TSharedPtr<FDreamTokenBucket, ESPMode::ThreadSafe> DownloadBandwidth;
+
+	/** Thread that completes finished transfers (only with bUseDownloaderThread) */
+	TSharedPtr<FDreamDownloaderThread, ESPMode::ThreadSafe> DownloaderThread;
+
+	/** Install speed whose bandwidth profile was applied last */
+	EChunkInstallSpeed::Type InstallSpeed = EChunkInstallSpeed::Fast;
+
+	/** Pak files being downloaded */
 	TArray<TSharedRef<FDreamPakFile>> DownloadRequests;
 
+	/** Pak files waiting for a download slot, highest priority first */
+	TSharedPtr<FDreamDownloadScheduler> PendingDownloads;
+
+	/** Pak files of paused chunks, they go back into PendingDownloads when their chunk resumes */
+	TArray<TSharedRef<FDreamPakFile>> HeldDownloads;
+
+	/** Chunks whose downloads are paused */
+	TSet<int32> PausedChunks;
+
+	/** Whether all downloads are paused */
+	bool bDownloadsPaused = false;
+
 private:
 	/**
 	 * Set the content build ID and update base URLs
@@ -447,6 +780,13 @@ private:
 	 */
 	void TryDownloadBuildManifest(int TryNumber);
 
+	/**
+	 * Record a manifest request a retry can't fix
+	 * @param HostIndex Host that answered (INDEX_NONE = static remote host)
+	 * @return True once every host answered that way
+	 */
+	bool AddManifestPermanentFailure(int32 HostIndex);
+
 	/**
 	 * Wait for all mount operations to complete
 	 */
@@ -469,6 +809,11 @@ private:
 	 */
 	void ComputeLoadingStats();
 
+	/**
+	 * Copy the circuit breaker state of the CDN hosts into the loading stats
+	 */
+	void UpdateHostCircuits();
+
 	/**
 	 * Unmount a pak file
 	 * @param PakFile Pak file to unmount
@@ -476,12 +821,32 @@ private:
 	void UnmountPakFile(const TSharedRef<FDreamPakFile>& PakFile);
 
 	/**
-	 * Cancel a download operation
+	 * Cancel a download operation (or drop it from the queue if it hasn't started)
 	 * @param PakFile Pak file whose download to cancel
 	 * @param bResult Result to report for the cancelled download
 	 */
 	void CancelDownload(const TSharedRef<FDreamPakFile>& PakFile, bool bResult);
 
+	/**
+	 * Pause a download in flight and put the pak back into the queue
+	 * @param PakFile Pak file whose download to pause
+	 * @return True if the download was paused
+	 */
+	bool PauseDownload(const TSharedRef<FDreamPakFile>& PakFile);
+
+	/**
+	 * Queue a pak for download (held back instead if its chunk is paused)
+	 * @param PakFile Pak file to queue
+	 */
+	void QueueDownload(const TSharedRef<FDreamPakFile>& PakFile);
+
+	/**
+	 * Free a download slot for an urgent request by pausing the lowest priority download in flight
+	 * @param Priority Priority of the urgent request (only lower priority downloads are paused)
+	 * @return True if a download was paused
+	 */
+	bool PreemptDownload(int32 Priority);
+
 	/**
 	 * Internal function to download a pak file
 	 * @param PakFile Pak file to download
@@ -518,6 +883,44 @@ private:
 	 */
 	bool UpdateMountTasks(float dts);
 
+	/**
+	 * Queue a downloaded pak file for verification (takes ownership of the task)
+	 * @param VerifyTask Configured verification task
+	 */
+	void QueueVerifyTask(FDreamChunkDownloaderTypes::FDreamVerifyTask* VerifyTask);
+
+	/**
+	 * Start queued verification tasks while there are free slots
+	 */
+	void StartVerifyTasks();
+
+	/**
+	 * Complete a verification task and hand the result back to its download
+	 * @param VerifyTask Finished verification task (deleted by this function)
+	 */
+	void CompleteVerifyTask(FDreamChunkDownloaderTypes::FDreamVerifyTask* VerifyTask);
+
+	/**
+	 * Update verification tasks each frame
+	 * @param dts Delta time since last update
+	 * @return True if verifications are still pending
+	 */
+	bool UpdateVerifyTasks(float dts);
+
+	/**
+	 * Wait for running verifications to finish and drop the queued ones (used during shutdown)
+	 */
+	void AbandonVerifyTasks();
+
+	/**
+	 * Keep a corrupt cached pak and mark only its corrupt blocks for download
+	 * The pak is no longer cached; the next download of its chunk refetches the corrupt ranges.
+	 * @param PakFile The corrupt pak
+	 * @param CorruptBlocks Sorted indices of the corrupt blocks
+	 * @return False if the pak can't be repaired (it has to be deleted)
+	 */
+	bool PrepareBlockRepair(const TSharedRef<FDreamPakFile>& PakFile, const TArray<int32>& CorruptBlocks);
+
 	/**
 	 * Execute a callback on the next tick
 	 * @param Callback Callback to execute
@@ -529,4 +932,24 @@ private:
 	 * Issue pending downloads
 	 */
 	void IssueDownloads();
+
+	/**
+	 * Let the concurrency controller adjust the number of downloads in flight
+	 * @param dts Delta time in seconds
+	 * @return True to keep ticking
+	 */
+	bool UpdateConcurrency(float dts);
+
+	/**
+	 * Sample the transfer rate of the segments in flight and hedge the ones that stall
+	 * @param dts Delta time in seconds
+	 * @return True to keep ticking
+	 */
+	bool UpdateHedging(float dts);
+
+	/**
+	 * Save the host scores
+	 * @param bForce Save even if they were saved recently
+	 */
+	void SaveHostScores(bool bForce);
 };
@@ -0,0 +1,99 @@
+﻿// Copyright (C) 2025 Dream Moon, All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "HAL/CriticalSection.h"
+
+#include <atomic>
+
+/**
+ * Token Bucket
+ * 
+ * Rate limiter shared by any number of threads. Tokens (bytes) refill at a fixed rate
+ * up to a burst size. Reserving more tokens than available puts the bucket in debt,
+ * and the caller is told how long to wait before using the reserved amount, so large
+ * reservations are never starved by small ones.
+ * 
+ * A bucket with a rate of zero is unlimited. The rate can be changed at any time; a change
+ * forgives the current debt and ends pending waits, so the new rate applies right away.
+ */
+class DREAMCHUNKDOWNLOADER_API FDreamTokenBucket
+{
+public:
+	/**
+	 * Constructor
+	 * @param InRatePerSecond Refill rate in tokens per second (0 = unlimited)
+	 * @param InBurst Maximum number of tokens that can be saved up (0 = one second worth)
+	 */
+	explicit FDreamTokenBucket(double InRatePerSecond = 0.0, double InBurst = 0.0);
+
+	/**
+	 * Change the rate of the bucket
+	 * @param InRatePerSecond Refill rate in tokens per second (0 = unlimited)
+	 * @param InBurst Maximum number of tokens that can be saved up (0 = one second worth)
+	 */
+	void SetRate(double InRatePerSecond, double InBurst = 0.0);
+
+	/**
+	 * Get the refill rate of the bucket
+	 * @return Tokens per second (0 = unlimited)
+	 */
+	double GetRate() const;
+
+	/**
+	 * Whether the bucket limits anything
+	 * @return True if a rate is set
+	 */
+	bool IsLimited() const;
+
+	/**
+	 * Take tokens from the bucket
+	 * @param Amount Number of tokens to take
+	 * @return Seconds the caller should wait before using the tokens (0 = right away)
+	 */
+	double Reserve(int64 Amount);
+
+	/**
+	 * Take tokens from the bucket and sleep until they may be used (worker threads only)
+	 * @param Amount Number of tokens to take
+	 * @param bAbort Optional flag that ends the wait early when set
+	 */
+	void Consume(int64 Amount, const std::atomic<bool>* bAbort = nullptr);
+
+	/**
+	 * Get how long the current debt takes to be paid back, without taking any tokens
+	 * @return Seconds until tokens are available again (0 = not in debt)
+	 */
+	double GetWaitSeconds() const;
+
+	/**
+	 * Get the number of rate changes so far (callers pacing themselves stop waiting when it changes)
+	 * @return Rate generation
+	 */
+	uint32 GetRateGeneration() const { return RateGeneration.load(); }
+
+private:
+	/**
+	 * Add the tokens accumulated since the last refill (lock must be held)
+	 */
+	void Refill();
+
+	/** Guards all state */
+	mutable FCriticalSection Lock;
+
+	/** Refill rate in tokens per second */
+	double RatePerSecond = 0.0;
+
+	/** Maximum number of tokens */
+	double Burst = 0.0;
+
+	/** Current number of tokens (negative while in debt) */
+	double Tokens = 0.0;
+
+	/** Time of the last refill */
+	double LastRefillTime = 0.0;
+
+	/** Incremented by every rate change (pending waits end when it changes) */
+	std::atomic<uint32> RateGeneration{0};
+};
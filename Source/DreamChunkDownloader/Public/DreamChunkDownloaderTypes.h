@@ -4,15 +4,20 @@
 
 #include "CoreMinimal.h"
 #include "Async/AsyncWork.h"
+
+#include <atomic>
+
 #include "DreamChunkDownloaderTypes.generated.h"
 
 class FDreamChunkDownload;
 class FDreamPakMountWork;
+class FDreamPakVerifyWork;
 
 struct FDreamPakFile;
 struct FDreamChunkDownloaderStats;
 struct FDreamChunk;
 struct FDreamPakFileEntry;
+struct FDreamContentChunk;
 
 /**
  * Type Definitions for Dream Chunk Downloader
@@ -25,6 +30,9 @@ namespace FDreamChunkDownloaderTypes
 	/** Type alias for the async mount task */
 	typedef FAsyncTask<FDreamPakMountWork> FDreamMountTask;
 
+	/** Type alias for the async verification task */
+	typedef FAsyncTask<FDreamPakVerifyWork> FDreamVerifyTask;
+
 	/** Callback function type for async operations */
 	typedef TFunction<void(bool bSuccess)> FDreamCallback;
 
@@ -35,6 +43,16 @@ namespace FDreamChunkDownloaderTypes
 		uint64 SizeBytes,
 		const FTimespan& DownloadTime,
 		int32 HttpStatus)> FDreamDownloadAnalytics;
+
+	/** Callback function type for cache validation progress (called once per validated file) */
+	typedef TFunction<void(
+		const FString& FileName,
+		bool bIsValid,
+		int32 FilesValidated,
+		int32 TotalFiles)> FDreamValidateProgress;
+
+	/** Callback function type for cache validation completion */
+	typedef TFunction<void(int32 InvalidFiles, bool bWasCancelled)> FDreamValidateComplete;
 }
 
 /**
@@ -74,6 +92,84 @@ namespace FDreamChunkDownloaderStatics
 
 	/** Field name for client build ID in manifest files */
 	static const FString CLIENT_BUILD_ID = "client-build-id";
+
+	/** Extension of the resume state file stored next to a partially downloaded pak */
+	static const FString RESUME_STATE_EXTENSION = TEXT(".resume");
+
+	/** Field name for the segment list in resume state files */
+	static const FString SEGMENTS_FIELD = TEXT("segments");
+
+	/** Field name for the first byte of a segment in resume state files */
+	static const FString SEGMENT_BEGIN_FIELD = TEXT("begin");
+
+	/** Field name for the end (exclusive) of a segment in resume state files */
+	static const FString SEGMENT_END_FIELD = TEXT("end");
+
+	/** Field name for the number of bytes received for a segment in resume state files */
+	static const FString SEGMENT_RECEIVED_FIELD = TEXT("received");
+
+	/** Field name for the host list in the host score file */
+	static const FString HOSTS_FIELD = TEXT("hosts");
+
+	/** Field name for the CDN base URL of a host in the host score file */
+	static const FString HOST_URL_FIELD = TEXT("url");
+
+	/** Field name for the average time to first byte of a host in the host score file */
+	static const FString HOST_LATENCY_FIELD = TEXT("latency");
+
+	/** Field name for the average throughput of a host in the host score file */
+	static const FString HOST_THROUGHPUT_FIELD = TEXT("throughput");
+
+	/** Field name for the average failure rate of a host in the host score file */
+	static const FString HOST_FAILURE_RATE_FIELD = TEXT("failure-rate");
+
+	/** Field name for the number of measurements of a host in the host score file */
+	static const FString HOST_SAMPLES_FIELD = TEXT("samples");
+
+	/** Field name for the block size of per-block hashes in pak file entries and block hash files */
+	static const FString BLOCK_SIZE_FIELD = TEXT("block-size");
+
+	/** Field name for the list of per-block hashes in pak file entries and block hash files */
+	static const FString BLOCK_HASHES_FIELD = TEXT("block-hashes");
+
+	/** Extension of the block hash file published next to a pak on the CDN */
+	static const FString BLOCK_HASHES_EXTENSION = TEXT(".blocks.json");
+
+	/** Field name for the list of delta patches in pak file entries */
+	static const FString PATCHES_FIELD = TEXT("patches");
+
+	/** Field name for the version a delta patch applies to */
+	static const FString PATCH_FROM_VERSION_FIELD = TEXT("from-version");
+
+	/** Extension of a downloaded delta patch stored next to the pak */
+	static const FString PATCH_EXTENSION = TEXT(".patch");
+
+	/** Extension of the previous version of a pak kept as the base of a delta patch */
+	static const FString PATCH_BASE_EXTENSION = TEXT(".base");
+
+	/** Field name for the previous pak versions kept as patch bases in the local manifest */
+	static const FString PATCH_BASES_FIELD = TEXT("patch-bases");
+
+	/** Field name for the list of content chunks in pak file entries */
+	static const FString CONTENT_CHUNKS_FIELD = TEXT("content-chunks");
+
+	/** Field name for the hash of a content chunk */
+	static const FString CONTENT_CHUNK_HASH_FIELD = TEXT("hash");
+
+	/** Field name for the size of a content chunk */
+	static const FString CONTENT_CHUNK_SIZE_FIELD = TEXT("size");
+
+	/** Extension of the folder next to a pak holding its downloaded content chunks until it is assembled */
+	static const FString CONTENT_CHUNKS_EXTENSION = TEXT(".chunks");
+
+	/** Field name for the compression of the compressed variant in pak file entries (e.g. "gzip") */
+	static const FString COMPRESSION_FIELD = TEXT("compression");
+
+	/** Field name for the relative URL of the compressed variant in pak file entries */
+	static const FString COMPRESSED_RELATIVE_URL_FIELD = TEXT("compressed-relative-url");
+
+	/** Field name for the size of the compressed variant in pak file entries */
+	static const FString COMPRESSED_SIZE_FIELD = TEXT("compressed-size");
 }
 
 /**
@@ -119,6 +215,24 @@ enum class EDreamChunkDownloaderCacheLocation : uint8
 	Game UMETA(DisplayName = "Game"),
 };
 
+/**
+ * Circuit Breaker State
+ * 
+ * Whether a CDN host currently receives requests.
+ */
+UENUM(BlueprintType)
+enum class EDreamCircuitState : uint8
+{
+	/** Host is healthy and in rotation */
+	Closed UMETA(DisplayName = "Closed"),
+
+	/** Host failed repeatedly and is out of rotation until its cool-off ends */
+	Open UMETA(DisplayName = "Open"),
+
+	/** Cool-off ended, a single probe request decides whether the host returns */
+	HalfOpen UMETA(DisplayName = "Half Open"),
+};
+
 /**
  * Deployment Set Configuration
  * 
@@ -140,6 +254,33 @@ public:
 	TArray<FString> Hosts;
 };
 
+/**
+ * Host Circuit
+ * 
+ * Circuit breaker state of one CDN host.
+ */
+USTRUCT(BlueprintType)
+struct FDreamHostCircuit
+{
+	GENERATED_BODY()
+
+	/** CDN base URL of the host (from the deployment set) */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "DreamChunkDownloader")
+	FString Url;
+
+	/** Whether the host receives requests */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "DreamChunkDownloader")
+	EDreamCircuitState State = EDreamCircuitState::Closed;
+
+	/** Number of failed requests in a row */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "DreamChunkDownloader")
+	int32 ConsecutiveFailures = 0;
+
+	/** Seconds until an open host may be probed again (0 if not open) */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "DreamChunkDownloader")
+	float CooldownRemainingSeconds = 0.0f;
+};
+
 /**
  * Chunk Downloader Statistics
  * 
@@ -176,6 +317,38 @@ public:
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "DreamChunkDownloader")
 	int TotalChunksToMount = 0;
 
+	/** Number of downloaded pak files waiting for or undergoing verification */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "DreamChunkDownloader")
+	int VerifyQueueDepth = 0;
+
+	/** Number of pak files that have been verified */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "DreamChunkDownloader")
+	int FilesVerified = 0;
+
+	/** Time spent verifying the last pak file (seconds) */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "DreamChunkDownloader")
+	float LastVerifySeconds = 0.0f;
+
+	/** Longest time spent verifying a single pak file (seconds) */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "DreamChunkDownloader")
+	float MaxVerifySeconds = 0.0f;
+
+	/** Total time spent verifying pak files (seconds) */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "DreamChunkDownloader")
+	float TotalVerifySeconds = 0.0f;
+
+	/** Total time pak files waited for a free verification slot (seconds) */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "DreamChunkDownloader")
+	float TotalVerifyWaitSeconds = 0.0f;
+
+	/** Memory held by the download, decompression and verification buffers (bytes) */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "DreamChunkDownloader")
+	int64 MemoryInUse = 0;
+
+	/** Highest memory held by the download, decompression and verification buffers since loading began (bytes) */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "DreamChunkDownloader")
+	int64 PeakMemoryInUse = 0;
+
 	/** UTC time when loading began (for rate calculations) */
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "DreamChunkDownloader")
 	FDateTime LoadingStartTime = FDateTime::MinValue();
@@ -183,6 +356,116 @@ public:
 	/** Last error that occurred during operations */
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "DreamChunkDownloader")
 	FText LastError;
+
+	/** Circuit breaker state of each CDN host of the deployment */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "DreamChunkDownloader")
+	TArray<FDreamHostCircuit> HostCircuits;
+};
+
+/**
+ * Download Progress Counters
+ * 
+ * Lock-free copy of the download progress in the loading stats that any thread can sample
+ * (UI, telemetry) without touching the subsystem or its downloads. Written on the game thread:
+ * the bytes as downloads report progress, the rest whenever the loading stats are recomputed.
+ * Readers keep a reference to the counters, so they stay valid after the subsystem is gone.
+ */
+struct FDreamDownloadProgressCounters
+{
+	/** Number of bytes that have been downloaded */
+	std::atomic<int64> BytesDownloaded{0};
+
+	/** Total number of bytes that need to be downloaded */
+	std::atomic<int64> TotalBytesToDownload{0};
+
+	/** Number of pak files that have been downloaded */
+	std::atomic<int32> FilesDownloaded{0};
+
+	/** Total number of pak files that need to be downloaded */
+	std::atomic<int32> TotalFilesToDownload{0};
+};
+
+/**
+ * Host Score
+ * 
+ * Moving averages measured for one CDN host, used to pick the host of new downloads.
+ */
+USTRUCT(BlueprintType)
+struct FDreamHostScore
+{
+	GENERATED_BODY()
+
+	/** CDN base URL of the host (from the deployment set) */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "DreamChunkDownloader")
+	FString Url;
+
+	/** Average time to first byte in seconds */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "DreamChunkDownloader")
+	float LatencySeconds = 0.0f;
+
+	/** Average throughput of a single request in bytes per second */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "DreamChunkDownloader")
+	float BytesPerSecond = 0.0f;
+
+	/** Average share of failed requests (0 to 1) */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "DreamChunkDownloader")
+	float FailureRate = 0.0f;
+
+	/** Number of measurements the averages are based on */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "DreamChunkDownloader")
+	int32 Samples = 0;
+
+	/** Expected seconds to fetch a megabyte from the host (lower is better, 0 while unmeasured) */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "DreamChunkDownloader")
+	float Score = 0.0f;
+};
+
+/**
+ * Content Chunk
+ * 
+ * A content defined piece of a pak (cut where a rolling hash of the data matches, so
+ * identical data produces identical chunks across paks and builds).
+ */
+USTRUCT(BlueprintType)
+struct FDreamContentChunk
+{
+	GENERATED_BODY()
+
+	/** Hash of the chunk in file version format (identifies the chunk on the CDN and in the local index) */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "DreamChunkDownloader")
+	FString Hash;
+
+	/** Size of the chunk in bytes */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "DreamChunkDownloader")
+	int64 Size = 0;
+};
+
+/**
+ * Pak Patch Entry
+ * 
+ * A delta patch advertised by the manifest that turns an older version of a pak
+ * into the version of its entry.
+ */
+USTRUCT(BlueprintType)
+struct FDreamPakPatchEntry
+{
+	GENERATED_BODY()
+
+	/** Version of the pak the patch applies to */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "DreamChunkDownloader")
+	FString FromVersion;
+
+	/** URL of the patch (relative to CDN root, includes build-specific folder) */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "DreamChunkDownloader")
+	FString RelativeUrl;
+
+	/** Size of the patch in bytes */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "DreamChunkDownloader")
+	int64 FileSize = 0;
+
+	/** Version of the patch file itself (a hash if it uses a registered prefix, optional) */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "DreamChunkDownloader")
+	FString FileVersion;
 };
 
 /**
@@ -206,7 +489,8 @@ struct FDreamPakFileEntry
 
 	/** 
 	 * Unique ID representing a particular version of this pak file
-	 * When used for validation (if it begins with "SHA1:"), it's treated as a SHA1 hash
+	 * When used for validation (if it begins with a registered hash prefix such as "SHA1:", "XXH3:",
+	 * "BLAKE3:" or "SHA256:"), it's treated as a hash of the file (see FDreamHashRegistry)
 	 * Otherwise, it's considered just a unique ID
 	 */
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "DreamChunkDownloader")
@@ -219,6 +503,89 @@ struct FDreamPakFileEntry
 	/** URL for this pak file (relative to CDN root, includes build-specific folder) */
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "DreamChunkDownloader")
 	FString RelativeUrl;
+
+	/** Size of the blocks covered by BlockHashes (0 if the manifest has no block hashes for this pak) */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "DreamChunkDownloader")
+	int64 BlockSize = 0;
+
+	/**
+	 * Hash of every BlockSize bytes of the file, in file version format (optional)
+	 * Lets a corrupt file be repaired by refetching only the blocks that don't match
+	 */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "DreamChunkDownloader")
+	TArray<FString> BlockHashes;
+
+	/**
+	 * Check if the entry has usable block hashes
+	 * @return True if there is one hash for every block of the file
+	 */
+	inline bool HasBlockHashes() const
+	{
+		return BlockSize > 0 && BlockHashes.Num() == FMath::DivideAndRoundUp<int64>(FileSize, BlockSize);
+	}
+
+	/**
+	 * The pak as an ordered list of content chunks (optional)
+	 * Lets the pak be assembled from chunks already on disk, downloading only the missing ones
+	 */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "DreamChunkDownloader")
+	TArray<FDreamContentChunk> ContentChunks;
+
+	/**
+	 * Check if the entry has a usable content chunk list
+	 * @return True if the chunks add up to the whole file
+	 */
+	inline bool HasContentChunks() const
+	{
+		int64 ChunkBytes = 0;
+		for (const FDreamContentChunk& Chunk : ContentChunks)
+		{
+			ChunkBytes += Chunk.Size;
+		}
+		return ContentChunks.Num() > 0 && ChunkBytes == FileSize;
+	}
+
+	/** Compression of the compressed variant of the pak on the CDN (e.g. "gzip", empty if there is none) */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "DreamChunkDownloader")
+	FString Compression;
+
+	/** URL of the compressed variant (relative to CDN root, includes build-specific folder) */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "DreamChunkDownloader")
+	FString CompressedRelativeUrl;
+
+	/** Size of the compressed variant in bytes */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "DreamChunkDownloader")
+	int64 CompressedSize = 0;
+
+	/**
+	 * Check if the manifest lists a compressed variant worth downloading
+	 * @return True if the variant has a URL and is smaller than the pak
+	 */
+	inline bool HasCompressedVariant() const
+	{
+		return !Compression.IsEmpty() && !CompressedRelativeUrl.IsEmpty() && CompressedSize > 0 && CompressedSize < FileSize;
+	}
+
+	/** Delta patches from older versions of this pak (optional) */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "DreamChunkDownloader")
+	TArray<FDreamPakPatchEntry> Patches;
+
+	/**
+	 * Find a patch that is worth downloading instead of the whole file
+	 * @param FromVersion Version of the pak we already have
+	 * @return The patch, or null if there is none for this version or it isn't smaller than the file
+	 */
+	inline const FDreamPakPatchEntry* FindPatch(const FString& FromVersion) const
+	{
+		for (const FDreamPakPatchEntry& Patch : Patches)
+		{
+			if (Patch.FromVersion == FromVersion && Patch.FileSize > 0 && Patch.FileSize < FileSize)
+			{
+				return &Patch;
+			}
+		}
+		return nullptr;
+	}
 };
 
 /**
@@ -256,9 +623,23 @@ struct FDreamPakFile
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "DreamChunkDownloader")
 	int32 Priority = 0;
 
+	/**
+	 * Version of the previous pak kept on disk (<pak>.base) as the base of a delta patch
+	 * Empty if the pak has to be downloaded in full.
+	 */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "DreamChunkDownloader")
+	FString PatchBaseVersion;
+
+	/** Content chunks of the previous pak kept as <pak>.base (lets the new version reuse them) */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "DreamChunkDownloader")
+	TArray<FDreamContentChunk> BaseContentChunks;
+
 	/** Active download operation for this file */
 	TSharedPtr<FDreamChunkDownload> Download;
 
+	/** Paused download whose requests are still finishing (the file is busy until they are done) */
+	TSharedPtr<FDreamChunkDownload> PausedDownload;
+
 	/** Callbacks to execute after download completes */
 	TArray<FDreamChunkDownloaderTypes::FDreamCallback> PostDownloadCallbacks;
 };
@@ -7,6 +7,8 @@
 class FJsonObject;
 class FJsonValue;
 struct FDreamPakFileEntry;
+struct FDreamPakPatchEntry;
+struct FDreamContentChunk;
 enum class EDreamChunkStatus : uint8;
 
 /**
@@ -21,6 +23,9 @@ enum class EDreamChunkStatus : uint8;
 struct DREAMCHUNKDOWNLOADER_API FDreamChunkDownloaderUtils
 {
 public:
+	/** Size of the buffer files are read with when they are hashed (keeps the memory high water mark low) */
+	static constexpr int64 FILE_READ_BUFFER_SIZE = 64 * 1024;
+
 	/**
 	 * Check if a file matches the specified SHA1 hash
 	 * 
@@ -33,6 +38,81 @@ public:
 	 */
 	static bool CheckFileSha1Hash(const FString& FullPathOnDisk, const FString& Sha1HashString);
 
+	/**
+	 * Check if a file matches the specified file version hash
+	 * 
+	 * Validates the integrity of a file with the algorithm named by the prefix of the
+	 * file version (see FDreamHashRegistry, e.g. "SHA1:", "XXH3:", "BLAKE3:", "SHA256:").
+	 * 
+	 * @param FullPathOnDisk Full path to the file to check
+	 * @param FileVersion Expected file version (algorithm prefix and hex digest)
+	 * @return True if the file's hash matches the expected hash
+	 */
+	static bool CheckFileHash(const FString& FullPathOnDisk, const FString& FileVersion);
+
+	/**
+	 * Check if a file matches the specified file version hash, reporting every block read
+	 * 
+	 * Same as CheckFileHash, but calls OnBlockRead after each block so the caller can
+	 * throttle the reads or stop early (used by background cache validation).
+	 * 
+	 * @param FullPathOnDisk Full path to the file to check
+	 * @param FileVersion Expected file version (algorithm prefix and hex digest)
+	 * @param OnBlockRead Called with the size of each block read, returning false aborts the check
+	 * @return True if the file's hash matches the expected hash (false if aborted)
+	 */
+	static bool CheckFileHash(const FString& FullPathOnDisk, const FString& FileVersion, TFunctionRef<bool(int64 BytesRead)> OnBlockRead);
+
+	/**
+	 * Find the blocks of a file that don't match their block hashes
+	 * 
+	 * Hashes the file block by block (see FDreamPakFileEntry::BlockHashes) so a corrupt
+	 * file can be repaired by refetching only the listed blocks.
+	 * 
+	 * @param FullPathOnDisk Full path to the file to check
+	 * @param BlockSize Size of each block (the last block may be shorter)
+	 * @param BlockHashes Expected hash of every block, in file version format
+	 * @param OutCorruptBlocks Receives the indices of the blocks that don't match
+	 * @param OnBlockRead Called with the size of each read, returning false aborts the check
+	 * @return False if the file couldn't be read completely or doesn't have the expected number of blocks
+	 */
+	static bool FindCorruptBlocks(const FString& FullPathOnDisk, int64 BlockSize, const TArray<FString>& BlockHashes, TArray<int32>& OutCorruptBlocks, TFunctionRef<bool(int64 BytesRead)> OnBlockRead);
+
+	/**
+	 * Read per-block hashes from a JSON object (pak file entry or block hash file)
+	 * 
+	 * @param JsonObject Object holding the block-size and block-hashes fields
+	 * @param OutBlockSize Receives the block size
+	 * @param OutBlockHashes Receives the block hashes
+	 * @return True if both fields were present and valid
+	 */
+	static bool ParseBlockHashes(const TSharedPtr<FJsonObject>& JsonObject, int64& OutBlockSize, TArray<FString>& OutBlockHashes);
+
+	/**
+	 * Read the delta patches of a pak file entry
+	 * 
+	 * @param JsonObject The pak file entry
+	 * @param OutPatches Receives the valid patches (invalid ones are skipped with a warning)
+	 */
+	static void ParsePatches(const TSharedPtr<FJsonObject>& JsonObject, TArray<FDreamPakPatchEntry>& OutPatches);
+
+	/**
+	 * Read the content chunk list of a pak file entry
+	 * 
+	 * @param JsonObject The pak file entry
+	 * @param OutContentChunks Receives the chunks in file order
+	 * @return True if every chunk has a supported hash and a size (false leaves the list empty)
+	 */
+	static bool ParseContentChunks(const TSharedPtr<FJsonObject>& JsonObject, TArray<FDreamContentChunk>& OutContentChunks);
+
+	/**
+	 * Read the patch bases recorded in a local manifest
+	 * 
+	 * @param JsonObject The local manifest
+	 * @param OutPatchBases Receives the name, version and content chunks of each pak kept as <pak>.base
+	 */
+	static void ParsePatchBases(const TSharedPtr<FJsonObject>& JsonObject, TArray<FDreamPakFileEntry>& OutPatchBases);
+
 	/**
 	 * Dump information about all loaded chunks to the log
 	 * 
@@ -107,4 +187,38 @@ public:
 	 * @return True if the file was successfully written
 	 */
 	static bool WriteStringAsUtf8TextFile(const FString& FileText, const FString& FilePath);
+
+	/**
+	 * Resize a file on disk
+	 * 
+	 * Creates the file if it doesn't exist and grows or shrinks it to the requested size.
+	 * Used to allocate the full size of a pak up front so segments can be written in place.
+	 * 
+	 * @param FullPathOnDisk Full path to the file to resize
+	 * @param NewSize The size the file should have
+	 * @return True if the file has the requested size
+	 */
+	static bool ResizeFile(const FString& FullPathOnDisk, int64 NewSize);
+
+	/**
+	 * Reserve the disk space of a file
+	 * 
+	 * Creates the file if it doesn't exist and sets it to the requested size with every
+	 * block allocated (fallocate or the platform equivalent), so running out of space
+	 * fails here instead of part way through a download and the file is laid out in one piece.
+	 * Platforms without an allocation call fall back to ResizeFile.
+	 * 
+	 * @param FullPathOnDisk Full path to the file to preallocate
+	 * @param FileSize The size the file should have
+	 * @return True if the space is reserved and the file has the requested size
+	 */
+	static bool PreallocateFile(const FString& FullPathOnDisk, int64 FileSize);
+
+	/**
+	 * Check if a failed request points at the host or the link (rather than a missing file)
+	 * 
+	 * @param HttpStatus HTTP status of the response (0 = connection failure)
+	 * @return True for connection failures, timeouts, throttling and server errors
+	 */
+	static bool IsHostFailure(int32 HttpStatus);
 };